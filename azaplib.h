@@ -2,13 +2,17 @@
 #define __AZAPLIB__H
 
 #include "zaptypes.h"
+#include "session.h"
 
 typedef struct
 {
     int frequency;
     fe_modulation_t modulation;
 
-    // Video PID.
+    // Video PID. When both it and apid are 0 and sid isn't, every stream of
+    // the service is found from its PMT (see zap_session_add_service()). 
+    // With a sid of 0 too, only the multiplex is tuned (or a radio service's
+    // PIDs are added afterwards).
     int vpid;
     
     // Audio PID.
@@ -18,8 +22,21 @@ typedef struct
     int sid;
 } t_atsc_tune_info;
 
+extern int azap_tune(t_zap_session *session, t_atsc_tune_info tune_info, 
+                     int dvr, int rec_psi, StatusReceiver statusReceiver);
+
+extern int azap_tune_start(t_zap_session *session, 
+                           t_atsc_tune_info tune_info, int dvr, 
+                           int rec_psi, StatusReceiver statusReceiver);
+
 extern int azap_tune_silent(t_tuner_descriptor tuner, 
                             t_atsc_tune_info tune_info, int dvr, int rec_psi, 
                             StatusReceiver statusReceiver);
 
+extern int azap_tune_silent_ex(t_tuner_descriptor tuner, 
+                               t_atsc_tune_info tune_info, int dvr, 
+                               int rec_psi, StatusReceiver statusReceiver, 
+                               const t_tune_options *options, 
+                               t_tune_stats *stats);
+
 #endif
@@ -0,0 +1,90 @@
+// Pluggable device I/O (see backend.h).
+
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <poll.h>
+
+#include "backend.h"
+
+static int system_open(void *context, const char *path, int flags)
+{
+    return open(path, flags);
+}
+
+static int system_close(void *context, int fd)
+{
+    return close(fd);
+}
+
+static int system_ioctl(void *context, int fd, unsigned long request, 
+                        void *arg)
+{
+    return ioctl(fd, request, arg);
+}
+
+static ssize_t system_read(void *context, int fd, void *buf, size_t count)
+{
+    return read(fd, buf, count);
+}
+
+static int system_poll(void *context, struct pollfd *fds, nfds_t nfds, 
+                       int timeout)
+{
+    return poll(fds, nfds, timeout);
+}
+
+const t_zap_backend zap_system_backend = {
+    NULL, system_open, system_close, system_ioctl, system_read, system_poll,
+    1
+};
+
+static t_zap_backend backend = {
+    NULL, system_open, system_close, system_ioctl, system_read, system_poll,
+    1
+};
+
+void zap_set_backend(const t_zap_backend *new_backend)
+{
+    backend = (new_backend != NULL) ? *new_backend : zap_system_backend;
+}
+
+int zap_backend_pollable(void)
+{
+    return backend.pollable;
+}
+
+int zap_open(const char *path, int flags)
+{
+    return backend.open(backend.context, path, flags);
+}
+
+int zap_close(int fd)
+{
+    return backend.close(backend.context, fd);
+}
+
+int zap_ioctl(int fd, unsigned long request, ...)
+{
+    va_list args;
+    void *arg;
+
+    va_start(args, request);
+    arg = va_arg(args, void *);
+    va_end(args);
+
+    return backend.ioctl(backend.context, fd, request, arg);
+}
+
+ssize_t zap_read(int fd, void *buf, size_t count)
+{
+    return backend.read(backend.context, fd, buf, count);
+}
+
+int zap_poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+    return backend.poll(backend.context, fds, nfds, timeout);
+}
+
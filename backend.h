@@ -0,0 +1,48 @@
+#ifndef __BACKEND__H
+#define __BACKEND__H
+
+#include <sys/types.h>
+#include <poll.h>
+
+// The device I/O of the library. Each call takes the backend's context, and 
+// otherwise behaves like the system call of the same name (returning -1 and
+// setting errno on failure). ioctl's argument is passed as a pointer, as 
+// the system call's is. pollable is set when the descriptors the backend 
+// opens can be waited on by the kernel (epoll, or another process's poll()).
+// Otherwise event loops call back every ZAP_BACKEND_TICK_MS instead.
+typedef struct
+{
+    void *context;
+
+    int (*open)(void *context, const char *path, int flags);
+    int (*close)(void *context, int fd);
+    int (*ioctl)(void *context, int fd, unsigned long request, void *arg);
+    ssize_t (*read)(void *context, int fd, void *buf, size_t count);
+    int (*poll)(void *context, struct pollfd *fds, nfds_t nfds, 
+                int timeout);
+    int pollable;
+} t_zap_backend;
+
+#define ZAP_BACKEND_TICK_MS 1
+
+// The system calls themselves (the default backend). Backends can pass the
+// descriptors they don't handle on to these.
+extern const t_zap_backend zap_system_backend;
+
+// Send the device I/O of every session in the process through a backend, 
+// or back to the system calls (NULL). Change it only while no session is 
+// open.
+void zap_set_backend(const t_zap_backend *backend);
+
+// Whether the current backend's descriptors can be waited on by the kernel.
+int zap_backend_pollable(void);
+
+// The backend's calls, as used throughout the library.
+int zap_open(const char *path, int flags);
+int zap_close(int fd);
+int zap_ioctl(int fd, unsigned long request, ...);
+ssize_t zap_read(int fd, void *buf, size_t count);
+int zap_poll(struct pollfd *fds, nfds_t nfds, int timeout);
+
+#endif
+
@@ -0,0 +1,394 @@
+// The capabilities of the frontends in the system (see caps.h).
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+
+#include <linux/dvb/frontend.h>
+
+#include "zaptypes.h"
+#include "backend.h"
+#include "caps.h"
+
+#define CAPS_SLOTS (CAPS_MAX_ADAPTERS * CAPS_MAX_FRONTENDS)
+#define CAPS_WORDS ((CAPS_SLOTS + 63) / 64)
+
+typedef struct
+{
+    // Frontends by slot (adapter * CAPS_MAX_FRONTENDS + frontend).
+    t_frontend_caps slots[CAPS_SLOTS];
+    int found[CAPS_SLOTS];
+
+    // The slots found, in order.
+    int order[CAPS_SLOTS];
+    int count;
+
+    // Bit n is set for slot n: the frontends supporting each delivery
+    // system, and those that are claimed.
+    uint64_t supported[CAPS_MAX_DELSYS][CAPS_WORDS];
+    uint64_t taken[CAPS_WORDS];
+} t_caps_table;
+
+// The table is read and claimed from under lock. discover_lock keeps
+// discoveries apart, so that the probing (and the next table) can be done
+// without holding up the tunes reading it.
+static t_caps_table table;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static t_caps_table next;
+static pthread_mutex_t discover_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// What a pre-DVBv5 driver's frontend type stands for.
+static void infer_delsys(t_frontend_caps *caps)
+{
+    int s2 = (caps->info.caps & FE_CAN_2G_MODULATION) != 0;
+
+    caps->delsys_count = 0;
+
+    switch (caps->info.type)
+    {
+    case FE_QPSK:
+        caps->delsys[caps->delsys_count++] = SYS_DVBS;
+        if (s2)
+            caps->delsys[caps->delsys_count++] = SYS_DVBS2;
+        break;
+
+    case FE_QAM:
+        caps->delsys[caps->delsys_count++] = SYS_DVBC_ANNEX_A;
+        break;
+
+    case FE_OFDM:
+        caps->delsys[caps->delsys_count++] = SYS_DVBT;
+        if (s2)
+            caps->delsys[caps->delsys_count++] = SYS_DVBT2;
+        break;
+
+    case FE_ATSC:
+        caps->delsys[caps->delsys_count++] = SYS_ATSC;
+        if (caps->info.caps & (FE_CAN_QAM_64 | FE_CAN_QAM_256 |
+                               FE_CAN_QAM_AUTO))
+            caps->delsys[caps->delsys_count++] = SYS_DVBC_ANNEX_B;
+        break;
+    }
+}
+
+static int probe_frontend(int fd, t_frontend_caps *caps)
+{
+    struct dtv_property prop;
+    struct dtv_properties props;
+    unsigned int i;
+
+    if (zap_ioctl(fd, FE_GET_INFO, &caps->info) < 0)
+        return -1;
+
+    memset(&prop, 0, sizeof(prop));
+    prop.cmd = DTV_ENUM_DELSYS;
+
+    props.num = 1;
+    props.props = &prop;
+
+    caps->delsys_count = 0;
+
+    if (zap_ioctl(fd, FE_GET_PROPERTY, &props) == 0)
+    {
+        for (i = 0; i < prop.u.buffer.len && i < CAPS_MAX_DELSYS; i++)
+            caps->delsys[caps->delsys_count++] = prop.u.buffer.data[i];
+    }
+
+    if (caps->delsys_count == 0)
+        infer_delsys(caps);
+
+    caps->delsys_mask = 0;
+    for (i = 0; i < caps->delsys_count; i++)
+        if (caps->delsys[i] < 32)
+            caps->delsys_mask |= (uint32_t)1 << caps->delsys[i];
+
+    return 0;
+}
+
+// Devices that are there but busy (a dvr being read) are counted too.
+static unsigned int count_devices(unsigned int adapter, const char *name)
+{
+    char path[80];
+    unsigned int count;
+    int fd;
+
+    for (count = 0; count < CAPS_MAX_DEVICES; count++)
+    {
+        snprintf(path, sizeof(path), "/dev/dvb/adapter%u/%s%u", adapter,
+                 name, count);
+
+        if ((fd = zap_open(path, O_RDONLY | O_NONBLOCK)) < 0)
+        {
+            if (errno == EBUSY)
+                continue;
+
+            break;
+        }
+
+        zap_close(fd);
+    }
+
+    return count;
+}
+
+// One adapter's frontends, as probed by its own thread.
+typedef struct
+{
+    unsigned int adapter;
+    t_frontend_caps caps[CAPS_MAX_FRONTENDS];
+    int found[CAPS_MAX_FRONTENDS];
+} t_adapter_probe;
+
+static void *probe_adapter(void *arg)
+{
+    t_adapter_probe *probe = arg;
+    t_frontend_caps *caps;
+    unsigned int frontend, demuxes = 0, dvrs = 0;
+    char path[80];
+    int fd;
+
+    for (frontend = 0; frontend < CAPS_MAX_FRONTENDS; frontend++)
+    {
+        // Frontends opened read-only aren't powered up.
+        snprintf(path, sizeof(path), "/dev/dvb/adapter%u/frontend%u",
+                 probe->adapter, frontend);
+
+        if ((fd = zap_open(path, O_RDONLY | O_NONBLOCK)) < 0)
+            break;
+
+        caps = &probe->caps[frontend];
+
+        if (probe_frontend(fd, caps) == 0)
+        {
+            if (frontend == 0)
+            {
+                demuxes = count_devices(probe->adapter, "demux");
+                dvrs = count_devices(probe->adapter, "dvr");
+            }
+
+            caps->adapter = probe->adapter;
+            caps->frontend = frontend;
+            caps->demux_count = demuxes;
+            caps->dvr_count = dvrs;
+
+            probe->found[frontend] = 1;
+        }
+
+        zap_close(fd);
+    }
+
+    return NULL;
+}
+
+int caps_discover(void)
+{
+    static t_adapter_probe probes[CAPS_MAX_ADAPTERS];
+    pthread_t threads[CAPS_MAX_ADAPTERS];
+    int started[CAPS_MAX_ADAPTERS];
+    uint64_t present[CAPS_WORDS];
+    t_frontend_caps *caps;
+    unsigned int adapter, frontend, slot, word, i;
+    int count;
+
+    pthread_mutex_lock(&discover_lock);
+
+    memset(probes, 0, sizeof(probes));
+
+    for (adapter = 0; adapter < CAPS_MAX_ADAPTERS; adapter++)
+    {
+        probes[adapter].adapter = adapter;
+
+        // Opening a frontend can take a while (firmware being loaded), so
+        // the adapters are probed at once, or one after the other if there
+        // are no threads to be had.
+        started[adapter] = (pthread_create(&threads[adapter], NULL,
+                                           probe_adapter,
+                                           &probes[adapter]) == 0);
+
+        if (started[adapter] == 0)
+            probe_adapter(&probes[adapter]);
+    }
+
+    for (adapter = 0; adapter < CAPS_MAX_ADAPTERS; adapter++)
+        if (started[adapter])
+            pthread_join(threads[adapter], NULL);
+
+    memset(&next, 0, sizeof(next));
+    memset(present, 0, sizeof(present));
+
+    for (adapter = 0; adapter < CAPS_MAX_ADAPTERS; adapter++)
+    {
+        for (frontend = 0; frontend < CAPS_MAX_FRONTENDS; frontend++)
+        {
+            if (probes[adapter].found[frontend] == 0)
+                continue;
+
+            caps = &probes[adapter].caps[frontend];
+            slot = adapter * CAPS_MAX_FRONTENDS + frontend;
+
+            next.slots[slot] = *caps;
+            next.found[slot] = 1;
+            next.order[next.count++] = slot;
+            present[slot / 64] |= (uint64_t)1 << (slot % 64);
+
+            for (i = 0; i < caps->delsys_count; i++)
+                if (caps->delsys[i] < CAPS_MAX_DELSYS)
+                    next.supported[caps->delsys[i]][slot / 64] |=
+                        (uint64_t)1 << (slot % 64);
+        }
+    }
+
+    // The frontends claimed (even while probing) stay claimed while they're
+    // still there.
+    pthread_mutex_lock(&lock);
+
+    for (word = 0; word < CAPS_WORDS; word++)
+        next.taken[word] = table.taken[word] & present[word];
+
+    table = next;
+    count = table.count;
+
+    pthread_mutex_unlock(&lock);
+    pthread_mutex_unlock(&discover_lock);
+
+    return count;
+}
+
+void caps_clear(void)
+{
+    uint64_t taken[CAPS_WORDS];
+
+    // Frontends claimed stay claimed until they're released.
+    pthread_mutex_lock(&lock);
+
+    memcpy(taken, table.taken, sizeof(taken));
+    memset(&table, 0, sizeof(table));
+    memcpy(table.taken, taken, sizeof(taken));
+
+    pthread_mutex_unlock(&lock);
+}
+
+int caps_count(void)
+{
+    int count;
+
+    pthread_mutex_lock(&lock);
+    count = table.count;
+    pthread_mutex_unlock(&lock);
+
+    return count;
+}
+
+int caps_get(int index, t_frontend_caps *caps)
+{
+    int retval = -1;
+
+    pthread_mutex_lock(&lock);
+
+    if (index >= 0 && index < table.count)
+    {
+        *caps = table.slots[table.order[index]];
+        retval = 0;
+    }
+
+    pthread_mutex_unlock(&lock);
+    return retval;
+}
+
+int caps_find(unsigned int adapter, unsigned int frontend,
+              t_frontend_caps *caps)
+{
+    unsigned int slot = adapter * CAPS_MAX_FRONTENDS + frontend;
+    int retval = -1;
+
+    if (adapter >= CAPS_MAX_ADAPTERS || frontend >= CAPS_MAX_FRONTENDS)
+        return -1;
+
+    pthread_mutex_lock(&lock);
+
+    if (table.found[slot])
+    {
+        *caps = table.slots[slot];
+        retval = 0;
+    }
+
+    pthread_mutex_unlock(&lock);
+    return retval;
+}
+
+int caps_supports(const t_frontend_caps *caps, unsigned int delsys,
+                  uint32_t frequency)
+{
+    if (delsys >= 32 || (caps->delsys_mask & ((uint32_t)1 << delsys)) == 0)
+        return 0;
+
+    // Drivers that don't give a range give 0 for both.
+    if (frequency != 0 && caps->info.frequency_max != 0 &&
+        (frequency < caps->info.frequency_min ||
+         frequency > caps->info.frequency_max))
+        return 0;
+
+    return 1;
+}
+
+int caps_claim(unsigned int delsys, uint32_t frequency,
+               t_tuner_descriptor *tuner)
+{
+    const t_frontend_caps *caps;
+    uint64_t candidates;
+    unsigned int word, slot;
+
+    if (delsys >= CAPS_MAX_DELSYS)
+        return -1;
+
+    pthread_mutex_lock(&lock);
+
+    // The free frontends supporting the delivery system are the bits left
+    // when those taken are masked off; only the frequency is checked one by
+    // one.
+    for (word = 0; word < CAPS_WORDS; word++)
+    {
+        candidates = table.supported[delsys][word] & ~table.taken[word];
+
+        while (candidates != 0)
+        {
+            slot = word * 64 + __builtin_ctzll(candidates);
+            candidates &= candidates - 1;
+
+            caps = &table.slots[slot];
+
+            if (caps_supports(caps, delsys, frequency) == 0)
+                continue;
+
+            table.taken[word] |= (uint64_t)1 << (slot % 64);
+
+            tuner->adapter = caps->adapter;
+            tuner->frontend = caps->frontend;
+            tuner->demux = (caps->frontend < caps->demux_count) ?
+                           caps->frontend : 0;
+
+            pthread_mutex_unlock(&lock);
+            return 0;
+        }
+    }
+
+    pthread_mutex_unlock(&lock);
+    return -1;
+}
+
+void caps_release(unsigned int adapter, unsigned int frontend)
+{
+    unsigned int slot = adapter * CAPS_MAX_FRONTENDS + frontend;
+
+    if (adapter >= CAPS_MAX_ADAPTERS || frontend >= CAPS_MAX_FRONTENDS)
+        return;
+
+    pthread_mutex_lock(&lock);
+    table.taken[slot / 64] &= ~((uint64_t)1 << (slot % 64));
+    pthread_mutex_unlock(&lock);
+}
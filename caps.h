@@ -0,0 +1,78 @@
+#ifndef __CAPS__H
+#define __CAPS__H
+
+#include <stdint.h>
+
+#include <linux/dvb/frontend.h>
+
+#include "zaptypes.h"
+
+// Adapters (frontends, demuxes and dvrs within each) caps_discover() looks
+// for.
+#define CAPS_MAX_ADAPTERS 32
+#define CAPS_MAX_FRONTENDS 4
+#define CAPS_MAX_DEVICES 8
+
+// Delivery systems (enum fe_delivery_system) kept per frontend.
+#define CAPS_MAX_DELSYS 32
+
+// What a frontend can do, as found by caps_discover().
+typedef struct
+{
+    unsigned int adapter;
+    unsigned int frontend;
+
+    // What FE_GET_INFO said. Frequencies are in kHz for satellite frontends,
+    // and in Hz otherwise.
+    struct dvb_frontend_info info;
+
+    // The delivery systems it supports, as DTV_ENUM_DELSYS gives them, or as
+    // inferred from info.type and info.caps for drivers that predate DVBv5.
+    // delsys_mask has bit n set for delivery system n.
+    uint8_t delsys[CAPS_MAX_DELSYS];
+    unsigned int delsys_count;
+    uint32_t delsys_mask;
+
+    // The devices on its adapter.
+    unsigned int demux_count;
+    unsigned int dvr_count;
+} t_frontend_caps;
+
+// Look for every frontend on adapters 0 to CAPS_MAX_ADAPTERS - 1 through the
+// current backend (each adapter from its own thread), and keep what they can
+// do. The frontends are only opened read-only, so they aren't powered up.
+// Tunes then take the frontend's FE_GET_INFO from here rather than asking.
+// Call it again when the adapters change; the frontends still there keep
+// their claims. Returns the number of frontends found, or -1.
+int caps_discover(void);
+
+// Forget what was found (but not what's claimed).
+void caps_clear(void);
+
+// The frontends found, in the order of their adapters and frontends. A
+// frontend's caps are copied, since they may be rediscovered meanwhile;
+// -1 if there's no such frontend.
+int caps_count(void);
+int caps_get(int index, t_frontend_caps *caps);
+
+// A frontend by its numbers (copied as for caps_get()), -1 if it wasn't
+// found.
+int caps_find(unsigned int adapter, unsigned int frontend,
+              t_frontend_caps *caps);
+
+// Whether a frontend supports a delivery system, and a frequency (in its
+// units; 0 isn't checked).
+int caps_supports(const t_frontend_caps *caps, unsigned int delsys,
+                  uint32_t frequency);
+
+// Take a frontend that supports the delivery system and frequency and isn't
+// taken already, filling in a descriptor for it (with the demux of the same
+// number, or the first). Returns -1 if there's none. Safe to use from any
+// thread.
+int caps_claim(unsigned int delsys, uint32_t frequency,
+               t_tuner_descriptor *tuner);
+
+// Give a claimed frontend back.
+void caps_release(unsigned int adapter, unsigned int frontend);
+
+#endif
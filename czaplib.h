@@ -2,6 +2,7 @@
 #define __CZAPLIB__H
 
 #include "zaptypes.h"
+#include "session.h"
 
 typedef struct
 {
@@ -15,9 +16,22 @@ typedef struct
     int forward_err_corr;
 } t_dvbc_tune_info;
 
+extern int czap_tune(t_zap_session *session, t_dvbc_tune_info tune_info, 
+                     int dvr, int rec_psi, StatusReceiver statusReceiver);
+
+extern int czap_tune_start(t_zap_session *session, 
+                           t_dvbc_tune_info tune_info, int dvr, 
+                           int rec_psi, StatusReceiver statusReceiver);
+
 extern int czap_tune_silent(t_tuner_descriptor tuner, 
                             t_dvbc_tune_info tune_info, int dvr, int rec_psi, 
                             StatusReceiver statusReceiver);
 
+extern int czap_tune_silent_ex(t_tuner_descriptor tuner, 
+                               t_dvbc_tune_info tune_info, int dvr, 
+                               int rec_psi, StatusReceiver statusReceiver, 
+                               const t_tune_options *options, 
+                               t_tune_stats *stats);
+
 #endif
 
@@ -0,0 +1,392 @@
+// Transport stream capture from the dvr device (see dvr.h).
+
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+
+#include <linux/dvb/dmx.h>
+
+#include "util.h"
+#include "backend.h"
+#include "dvr.h"
+
+#define TS_SYNC_BYTE 0x47
+
+// Unmap the streaming buffers and hand them back to the kernel.
+static void unmap_buffers(t_dvr_reader *reader)
+{
+    unsigned int i;
+
+    for (i = 0; i < DVR_MAX_BUFFERS; i++)
+    {
+        if (reader->buffers[i] != NULL)
+        {
+            munmap(reader->buffers[i], reader->buffer_lengths[i]);
+            reader->buffers[i] = NULL;
+        }
+    }
+
+#ifdef DMX_REQBUFS
+    struct dmx_requestbuffers request;
+
+    memset(&request, 0, sizeof(request));
+    zap_ioctl(reader->fd, DMX_REQBUFS, &request);
+#endif
+}
+
+// Set up streaming I/O. Fails (harmlessly) on drivers, kernels or headers
+// without it.
+static int map_buffers(t_dvr_reader *reader)
+{
+#ifdef DMX_REQBUFS
+    struct dmx_requestbuffers request;
+    struct dmx_buffer buffer;
+    unsigned int i;
+    void *mem;
+
+    memset(&request, 0, sizeof(request));
+    request.count = reader->buffer_count;
+    request.size = reader->buffer_size;
+
+    if (zap_ioctl(reader->fd, DMX_REQBUFS, &request) == -1 || request.count == 0)
+        return -1;
+
+    if (request.count < reader->buffer_count)
+        reader->buffer_count = request.count;
+
+    for (i = 0; i < reader->buffer_count; i++)
+    {
+        memset(&buffer, 0, sizeof(buffer));
+        buffer.index = i;
+
+        if (zap_ioctl(reader->fd, DMX_QUERYBUF, &buffer) == -1)
+            goto fail;
+
+        mem = mmap(NULL, buffer.length, PROT_READ, MAP_SHARED, reader->fd,
+                   buffer.offset);
+
+        if (mem == MAP_FAILED)
+            goto fail;
+
+        reader->buffers[i] = mem;
+        reader->buffer_lengths[i] = buffer.length;
+    }
+
+    // Streaming starts with the first buffer queued.
+    for (i = 0; i < reader->buffer_count; i++)
+    {
+        memset(&buffer, 0, sizeof(buffer));
+        buffer.index = i;
+
+        if (zap_ioctl(reader->fd, DMX_QBUF, &buffer) == -1)
+            goto fail;
+    }
+
+    reader->mapped = 1;
+    return 0;
+
+fail:
+    unmap_buffers(reader);
+
+    return -1;
+#else
+    return -1;
+#endif
+}
+
+int dvr_reader_open(t_dvr_reader *reader, int fd, unsigned int buffer_size,
+                    unsigned int buffer_count)
+{
+    memset(reader, 0, sizeof(t_dvr_reader));
+
+    if (buffer_size == 0)
+        buffer_size = DVR_DEFAULT_BUFFER_SIZE;
+
+    if (buffer_count == 0)
+        buffer_count = DVR_DEFAULT_BUFFER_COUNT;
+
+    if (buffer_count > DVR_MAX_BUFFERS)
+        buffer_count = DVR_MAX_BUFFERS;
+
+    // Whole packets per buffer keep every batch aligned.
+    buffer_size -= buffer_size % TS_PACKET_SIZE;
+    if (buffer_size == 0)
+        return -1;
+
+    reader->fd = fd;
+    reader->last_overflow_us = -1;
+    reader->buffer_stats.buffer_size = DVR_KERNEL_BUFFER_SIZE;
+    reader->buffer_size = buffer_size;
+    reader->buffer_count = buffer_count;
+
+    if (map_buffers(reader) == 0)
+        return 0;
+
+    // Fall back to read(), with the same total amount of buffering.
+
+    reader->buffer_size = buffer_size * buffer_count;
+    reader->buffer_count = 1;
+
+    if ((reader->buffers[0] = malloc(reader->buffer_size)) == NULL)
+        return -1;
+
+    return 0;
+}
+
+// Resize the kernel's buffer. A demux filter refuses (EBUSY) while running.
+static int resize(t_dvr_reader *reader, unsigned int size)
+{
+    int retval;
+
+    if (reader->is_filter && zap_ioctl(reader->fd, DMX_STOP) == -1)
+        return -1;
+
+    retval = zap_ioctl(reader->fd, DMX_SET_BUFFER_SIZE, size);
+
+    if (reader->is_filter && zap_ioctl(reader->fd, DMX_START) == -1)
+        return -1;
+
+    if (retval == -1)
+        return -1;
+
+    reader->buffer_stats.buffer_size = size;
+
+    return 0;
+}
+
+int dvr_reader_set_buffer(t_dvr_reader *reader, unsigned int size,
+                          unsigned int max_size)
+{
+    if (max_size > 0 && size > max_size)
+        size = max_size;
+
+    reader->buffer_stats.max_buffer_size = max_size;
+
+    if (size == 0 || size == reader->buffer_stats.buffer_size)
+        return 0;
+
+    return resize(reader, size);
+}
+
+// The kernel flushed its buffer. Grow it if this keeps happening.
+static void overflowed(t_dvr_reader *reader)
+{
+    t_buffer_stats *stats = &reader->buffer_stats;
+    int64_t now = monotonic_us();
+    unsigned int size;
+
+    stats->overflows++;
+    stats->bytes_dropped += stats->buffer_size;
+
+    if (reader->last_overflow_us >= 0 &&
+        now - reader->last_overflow_us < DVR_OVERFLOW_WINDOW_US &&
+        stats->buffer_size < stats->max_buffer_size)
+    {
+        size = stats->buffer_size * 2;
+        if (size > stats->max_buffer_size || size < stats->buffer_size)
+            size = stats->max_buffer_size;
+
+        if (resize(reader, size) == 0)
+        {
+            stats->resizes++;
+
+            // Start counting again at the new size.
+            now = -1;
+        }
+    }
+
+    reader->last_overflow_us = now;
+}
+
+static int process_mapped(t_dvr_reader *reader, PacketReceiver receiver,
+                          void *context)
+{
+#ifdef DMX_REQBUFS
+    struct dmx_buffer buffer;
+    unsigned int index, count;
+    int retval = 1;
+
+    memset(&buffer, 0, sizeof(buffer));
+
+    if (zap_ioctl(reader->fd, DMX_DQBUF, &buffer) == -1)
+    {
+        if (errno == EOVERFLOW)
+        {
+            overflowed(reader);
+            return 1;
+        }
+
+        return (errno == EAGAIN || errno == EINTR) ? 1 : -1;
+    }
+
+    // Packets were lost (or mangled) before this buffer, which isn't 
+    // necessarily the kernel's doing.
+    if (buffer.flags & (DMX_BUFFER_FLAG_DISCONTINUITY_DETECTED |
+                        DMX_BUFFER_PKT_COUNTER_MISMATCH))
+        reader->buffer_stats.discontinuities++;
+
+    index = buffer.index;
+    count = buffer.bytesused / TS_PACKET_SIZE;
+
+    if (count > 0)
+    {
+        reader->packets += count;
+        reader->bytes += (uint64_t)count * TS_PACKET_SIZE;
+
+        retval = receiver(reader->buffers[index], count, context);
+    }
+
+    memset(&buffer, 0, sizeof(buffer));
+    buffer.index = index;
+
+    if (zap_ioctl(reader->fd, DMX_QBUF, &buffer) == -1)
+        return -1;
+
+    return retval;
+#else
+    return -1;
+#endif
+}
+
+static int process_read(t_dvr_reader *reader, PacketReceiver receiver,
+                        void *context)
+{
+    unsigned char *buf = reader->buffers[0];
+    unsigned int fill, start = 0, count, used;
+    ssize_t n;
+    int retval = 1;
+
+    n = zap_read(reader->fd, buf + reader->carry,
+             reader->buffer_size - reader->carry);
+
+    if (n < 0)
+    {
+        if (errno == EOVERFLOW)
+        {
+            overflowed(reader);
+            return 1;
+        }
+
+        if (errno == EAGAIN || errno == EINTR)
+            return 1;
+
+        return -1;
+    }
+
+    if (n == 0)
+        return 0;
+
+    fill = reader->carry + n;
+
+    // Skip to a packet boundary (only needed after an overflow).
+    while (start < fill && buf[start] != TS_SYNC_BYTE)
+        start++;
+
+    count = (fill - start) / TS_PACKET_SIZE;
+    used = start + count * TS_PACKET_SIZE;
+
+    if (count > 0)
+    {
+        reader->packets += count;
+        reader->bytes += (uint64_t)count * TS_PACKET_SIZE;
+
+        retval = receiver(buf + start, count, context);
+    }
+
+    // Keep a trailing partial packet for the next read.
+    reader->carry = fill - used;
+    memmove(buf, buf + used, reader->carry);
+
+    return retval;
+}
+
+int dvr_reader_process(t_dvr_reader *reader, PacketReceiver receiver,
+                       void *context)
+{
+    if (reader->mapped)
+        return process_mapped(reader, receiver, context);
+
+    return process_read(reader, receiver, context);
+}
+
+int dvr_reader_run(t_dvr_reader *reader, int cancel_fd,
+                   PacketReceiver receiver, void *context)
+{
+    struct pollfd pfd[2];
+    int retval;
+
+    pfd[0].fd = reader->fd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = cancel_fd;
+    pfd[1].events = POLLIN;
+
+    while (1)
+    {
+        pfd[0].revents = pfd[1].revents = 0;
+
+        if (zap_poll(pfd, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            return -1;
+        }
+
+        if (pfd[1].revents != 0)
+            return 0;
+
+        if (pfd[0].revents == 0)
+            continue;
+
+        if ((retval = dvr_reader_process(reader, receiver, context)) <= 0)
+            return retval;
+    }
+}
+
+int dvr_reader_export(t_dvr_reader *reader, unsigned int index)
+{
+#ifdef DMX_EXPBUF
+    struct dmx_exportbuffer exp;
+
+    if (reader->mapped == 0 || index >= reader->buffer_count)
+        return -1;
+
+    memset(&exp, 0, sizeof(exp));
+    exp.index = index;
+    exp.flags = O_CLOEXEC;
+
+    if (zap_ioctl(reader->fd, DMX_EXPBUF, &exp) == -1)
+        return -1;
+
+    return exp.fd;
+#else
+    return -1;
+#endif
+}
+
+void dvr_reader_close(t_dvr_reader *reader)
+{
+    if (reader->mapped)
+    {
+        unmap_buffers(reader);
+        reader->mapped = 0;
+    }
+    else if (reader->buffers[0] != NULL)
+    {
+        free(reader->buffers[0]);
+        reader->buffers[0] = NULL;
+    }
+
+    if (reader->owns_fd && reader->fd >= 0)
+        zap_close(reader->fd);
+
+    reader->fd = -1;
+}
+
@@ -0,0 +1,105 @@
+#ifndef __DVR__H
+#define __DVR__H
+
+#include <stdint.h>
+
+#define TS_PACKET_SIZE 188
+
+#define DVR_MAX_BUFFERS 32
+
+// Defaults for dvr_reader_open(): 16 buffers of 1024 packets (3 MiB).
+#define DVR_DEFAULT_BUFFER_SIZE (TS_PACKET_SIZE * 1024)
+#define DVR_DEFAULT_BUFFER_COUNT 16
+
+// The kernel's default dvr buffer.
+#define DVR_KERNEL_BUFFER_SIZE (10 * TS_PACKET_SIZE * 1024)
+
+// Overflows within this many microseconds of each other grow the kernel's
+// buffer (see dvr_reader_set_buffer()).
+#define DVR_OVERFLOW_WINDOW_US 10000000
+
+// What the kernel's buffer behind a reader has been through. The kernel
+// flushes the whole buffer when it overflows (the next read() or DMX_DQBUF 
+// fails with EOVERFLOW), so bytes_dropped counts a full buffer per overflow.
+// Mapped buffers flagged as following a discontinuity (which continuity
+// counter errors from a weak signal also cause) are only counted.
+typedef struct
+{
+    unsigned int buffer_size;
+    unsigned int max_buffer_size;
+
+    uint32_t overflows;
+    uint64_t bytes_dropped;
+    uint32_t resizes;
+    uint32_t discontinuities;
+} t_buffer_stats;
+
+// Receives count whole TS packets. The memory belongs to the reader (and is
+// the kernel's buffer when memory-mapped), so it's only valid until the
+// receiver returns. Returning 0 stops dvr_reader_run().
+typedef int (*PacketReceiver)(const unsigned char *packets, unsigned int count,
+                              void *context);
+
+// Reads a transport stream from a dvr (or ZAP_OUT_TSDEMUX demux) descriptor.
+// Uses the kernel's memory-mapped streaming I/O (DMX_REQBUFS/DMX_QBUF/
+// DMX_DQBUF) when the driver supports it, so packets are handed over without
+// being copied. Otherwise, falls back to large read()s into a preallocated
+// buffer.
+typedef struct
+{
+    int fd;
+    int owns_fd;
+
+    // Nonzero when using streaming I/O.
+    int mapped;
+
+    unsigned int buffer_size;
+    unsigned int buffer_count;
+
+    // The mapped kernel buffers, or (for read()) buffers[0] alone.
+    unsigned char *buffers[DVR_MAX_BUFFERS];
+    unsigned int buffer_lengths[DVR_MAX_BUFFERS];
+
+    // read(): bytes of a partial packet held at the start of buffers[0].
+    unsigned int carry;
+
+    uint64_t packets;
+    uint64_t bytes;
+
+    // The kernel's buffer. A running demux filter (rather than the dvr 
+    // device) has to be stopped to be resized.
+    t_buffer_stats buffer_stats;
+    int is_filter;
+    int64_t last_overflow_us;
+} t_dvr_reader;
+
+// Prepare to read from fd. buffer_size is rounded down to whole packets.
+// Zero sizes select the defaults. The descriptor should be non-blocking.
+int dvr_reader_open(t_dvr_reader *reader, int fd, unsigned int buffer_size,
+                    unsigned int buffer_count);
+
+// Resize the kernel's buffer behind the reader (0 keeps the current size),
+// and let it double, up to max_size, each time it overflows twice within
+// DVR_OVERFLOW_WINDOW_US. A max_size of 0 never grows it.
+int dvr_reader_set_buffer(t_dvr_reader *reader, unsigned int size,
+                          unsigned int max_size);
+
+// Hand whatever packets are ready (one batch) to the receiver without
+// blocking. Returns the receiver's result (1 when nothing was ready), or -1
+// on error.
+int dvr_reader_process(t_dvr_reader *reader, PacketReceiver receiver,
+                       void *context);
+
+// Hand batches to the receiver until it returns 0 or cancel_fd (may be -1)
+// becomes readable.
+int dvr_reader_run(t_dvr_reader *reader, int cancel_fd,
+                   PacketReceiver receiver, void *context);
+
+// Export a mapped buffer as a DMABUF descriptor (DMX_EXPBUF), so that it can
+// be passed to another device or process. Returns -1 when not mapped.
+int dvr_reader_export(t_dvr_reader *reader, unsigned int index);
+
+void dvr_reader_close(t_dvr_reader *reader);
+
+#endif
+
@@ -0,0 +1,669 @@
+// Frontend status monitoring shared by the ?zap implementations.
+
+#include <sys/ioctl.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+
+#include <linux/dvb/frontend.h>
+
+#include "util.h"
+#include "backend.h"
+#include "zaptypes.h"
+#include "session.h"
+#include "frontend.h"
+#include "trace.h"
+#include "status.h"
+#include "unicable.h"
+
+static fe_status_t read_status(int fe_fd)
+{
+    fe_status_t status;
+
+    if (zap_ioctl(fe_fd, FE_READ_STATUS, &status) == -1)
+        return 0;
+
+    return status;
+}
+
+void fe_props_add(t_fe_props *props, uint32_t cmd, uint32_t data)
+{
+    if (props->count >= FE_MAX_PROPS)
+        return;
+
+    memset(&props->props[props->count], 0, sizeof(struct dtv_property));
+    props->props[props->count].cmd = cmd;
+    props->props[props->count].u.data = data;
+    props->count++;
+}
+
+static uint32_t bandwidth_hz(fe_bandwidth_t bandwidth)
+{
+    switch (bandwidth)
+    {
+    case BANDWIDTH_8_MHZ:      return 8000000;
+    case BANDWIDTH_7_MHZ:      return 7000000;
+    case BANDWIDTH_6_MHZ:      return 6000000;
+    case BANDWIDTH_5_MHZ:      return 5000000;
+    case BANDWIDTH_10_MHZ:     return 10000000;
+    case BANDWIDTH_1_712_MHZ:  return 1712000;
+    default:                   return 0;
+    }
+}
+
+void fe_props_from_params(t_fe_props *props, fe_type_t fe_type, 
+                          const struct dvb_frontend_parameters *params)
+{
+    props->count = 0;
+
+    switch (fe_type)
+    {
+    case FE_QPSK:
+        fe_props_add(props, DTV_DELIVERY_SYSTEM, SYS_DVBS);
+        fe_props_add(props, DTV_FREQUENCY, params->frequency);
+        fe_props_add(props, DTV_INVERSION, params->inversion);
+        fe_props_add(props, DTV_SYMBOL_RATE, params->u.qpsk.symbol_rate);
+        fe_props_add(props, DTV_INNER_FEC, params->u.qpsk.fec_inner);
+        break;
+
+    case FE_QAM:
+        fe_props_add(props, DTV_DELIVERY_SYSTEM, SYS_DVBC_ANNEX_A);
+        fe_props_add(props, DTV_FREQUENCY, params->frequency);
+        fe_props_add(props, DTV_INVERSION, params->inversion);
+        fe_props_add(props, DTV_SYMBOL_RATE, params->u.qam.symbol_rate);
+        fe_props_add(props, DTV_MODULATION, params->u.qam.modulation);
+        fe_props_add(props, DTV_INNER_FEC, params->u.qam.fec_inner);
+        break;
+
+    case FE_OFDM:
+        fe_props_add(props, DTV_DELIVERY_SYSTEM, SYS_DVBT);
+        fe_props_add(props, DTV_FREQUENCY, params->frequency);
+        fe_props_add(props, DTV_INVERSION, params->inversion);
+        fe_props_add(props, DTV_BANDWIDTH_HZ, 
+                     bandwidth_hz(params->u.ofdm.bandwidth));
+        fe_props_add(props, DTV_CODE_RATE_HP, params->u.ofdm.code_rate_HP);
+        fe_props_add(props, DTV_CODE_RATE_LP, params->u.ofdm.code_rate_LP);
+        fe_props_add(props, DTV_MODULATION, params->u.ofdm.constellation);
+        fe_props_add(props, DTV_TRANSMISSION_MODE, 
+                     params->u.ofdm.transmission_mode);
+        fe_props_add(props, DTV_GUARD_INTERVAL, 
+                     params->u.ofdm.guard_interval);
+        fe_props_add(props, DTV_HIERARCHY, 
+                     params->u.ofdm.hierarchy_information);
+        break;
+
+    case FE_ATSC:
+        // QAM on an ATSC frontend is US cable (annex B).
+        fe_props_add(props, DTV_DELIVERY_SYSTEM, 
+                     (params->u.vsb.modulation == VSB_8 || 
+                      params->u.vsb.modulation == VSB_16) ? SYS_ATSC : 
+                                                            SYS_DVBC_ANNEX_B);
+        fe_props_add(props, DTV_FREQUENCY, params->frequency);
+        fe_props_add(props, DTV_INVERSION, params->inversion);
+        fe_props_add(props, DTV_MODULATION, params->u.vsb.modulation);
+        break;
+    }
+}
+
+static const struct dtv_property *find_prop(const t_fe_props *props, 
+                                            uint32_t cmd)
+{
+    unsigned int i;
+
+    for (i = 0; i < props->count; i++)
+        if (props->props[i].cmd == cmd)
+            return &props->props[i];
+
+    return NULL;
+}
+
+static int apply_frontend(t_zap_session *session, const t_fe_props *props,
+                          const struct dvb_frontend_parameters *params)
+{
+    struct dtv_property batch[FE_MAX_PROPS + 1];
+    struct dtv_properties cmdseq;
+    const struct dtv_property *applied, *system, *new_system;
+    unsigned int i, n = 0;
+    int full;
+
+    if (session->fe_legacy == 0)
+    {
+        // The driver's cache of properties is only trusted for the same 
+        // delivery system (changing it may reset the rest).
+        system = find_prop(&session->fe_applied, DTV_DELIVERY_SYSTEM);
+        new_system = find_prop(props, DTV_DELIVERY_SYSTEM);
+        full = (system == NULL || new_system == NULL || 
+                new_system->u.data != system->u.data);
+
+        for (i = 0; i < props->count; i++)
+        {
+            applied = full ? NULL : find_prop(&session->fe_applied, 
+                                              props->props[i].cmd);
+
+            if (applied == NULL || applied->u.data != props->props[i].u.data)
+                batch[n++] = props->props[i];
+        }
+
+        memset(&batch[n], 0, sizeof(struct dtv_property));
+        batch[n++].cmd = DTV_TUNE;
+
+        cmdseq.num = n;
+        cmdseq.props = batch;
+
+        if (zap_ioctl(session->frontend_fd, FE_SET_PROPERTY, &cmdseq) == 0)
+        {
+            session->fe_applied = *props;
+            return 0;
+        }
+
+        // What the driver was left with is unknown.
+        session->fe_applied.count = 0;
+
+        if (errno != ENOTTY && errno != EOPNOTSUPP)
+            return -1;
+
+        session->fe_legacy = 1;
+    }
+
+    // Only tunes that the legacy parameters can express.
+    if (params == NULL)
+        return -1;
+
+    return zap_ioctl(session->frontend_fd, FE_SET_FRONTEND, params) < 0 ? -1 : 0;
+}
+
+int set_frontend(t_zap_session *session, const t_fe_props *props,
+                 const struct dvb_frontend_parameters *params)
+{
+    int64_t start_us = monotonic_us();
+
+    if (apply_frontend(session, props, params) < 0)
+        return -1;
+
+    zap_session_step(session, TUNE_STAGE_FRONTEND, -1, start_us);
+    ZAP_TRACE(TRACE_FRONTEND_SET, session->tuner.adapter, 
+              session->fe_legacy ? -1 : props->count, 
+              monotonic_us() - start_us);
+    return 0;
+}
+
+// The statistics read for each sample, in the order of t_frontend_stats.
+static const uint32_t stat_cmds[] = {
+    DTV_STAT_SIGNAL_STRENGTH,
+    DTV_STAT_CNR,
+    DTV_STAT_PRE_ERROR_BIT_COUNT,
+    DTV_STAT_PRE_TOTAL_BIT_COUNT,
+    DTV_STAT_POST_ERROR_BIT_COUNT,
+    DTV_STAT_POST_TOTAL_BIT_COUNT,
+    DTV_STAT_ERROR_BLOCK_COUNT,
+    DTV_STAT_TOTAL_BLOCK_COUNT
+};
+
+#define STAT_COUNT (sizeof(stat_cmds) / sizeof(stat_cmds[0]))
+
+// The global (first) layer of a measure, and its scale.
+static int64_t stat_value(const struct dtv_property *prop, int *scale)
+{
+    const struct dtv_stats *stat = &prop->u.st.stat[0];
+
+    if (prop->u.st.len == 0 || stat->scale == FE_SCALE_NOT_AVAILABLE)
+    {
+        *scale = FE_SCALE_NOT_AVAILABLE;
+        return 0;
+    }
+
+    *scale = stat->scale;
+
+    return (stat->scale == FE_SCALE_DECIBEL) ? stat->svalue : 
+                                               (int64_t)stat->uvalue;
+}
+
+static int64_t stat_counter(const struct dtv_property *prop)
+{
+    int scale;
+    int64_t value = stat_value(prop, &scale);
+
+    return (scale == FE_SCALE_COUNTER) ? value : -1;
+}
+
+static int read_stats_v5(int fe_fd, t_frontend_stats *stats)
+{
+    struct dtv_property props[STAT_COUNT];
+    struct dtv_properties cmdseq;
+    unsigned int i;
+
+    memset(props, 0, sizeof(props));
+    for (i = 0; i < STAT_COUNT; i++)
+        props[i].cmd = stat_cmds[i];
+
+    cmdseq.num = STAT_COUNT;
+    cmdseq.props = props;
+
+    if (zap_ioctl(fe_fd, FE_GET_PROPERTY, &cmdseq) == -1)
+        return -1;
+
+    stats->signal = stat_value(&props[0], &stats->signal_scale);
+    stats->cnr = stat_value(&props[1], &stats->cnr_scale);
+    stats->pre_error_bits = stat_counter(&props[2]);
+    stats->pre_total_bits = stat_counter(&props[3]);
+    stats->post_error_bits = stat_counter(&props[4]);
+    stats->post_total_bits = stat_counter(&props[5]);
+    stats->error_blocks = stat_counter(&props[6]);
+    stats->total_blocks = stat_counter(&props[7]);
+
+    return 0;
+}
+
+static void read_stats_legacy(int fe_fd, t_frontend_stats *stats)
+{
+    uint16_t signal_strength, snr;
+    uint32_t uncorrected_blocks;
+
+    stats->legacy = 1;
+
+    /* some frontends might not support all these ioctls */
+    if (zap_ioctl(fe_fd, FE_READ_SIGNAL_STRENGTH, &signal_strength) == 0)
+    {
+        stats->signal_scale = FE_SCALE_RELATIVE;
+        stats->signal = signal_strength;
+    }
+
+    if (zap_ioctl(fe_fd, FE_READ_SNR, &snr) == 0)
+    {
+        stats->cnr_scale = FE_SCALE_RELATIVE;
+        stats->cnr = snr;
+    }
+
+    if (zap_ioctl(fe_fd, FE_READ_UNCORRECTED_BLOCKS, &uncorrected_blocks) == 0)
+        stats->error_blocks = uncorrected_blocks;
+}
+
+void read_frontend_stats(int fe_fd, int *legacy, t_frontend_stats *stats)
+{
+    memset(stats, 0, sizeof(t_frontend_stats));
+    stats->pre_error_bits = stats->pre_total_bits = -1;
+    stats->post_error_bits = stats->post_total_bits = -1;
+    stats->error_blocks = stats->total_blocks = -1;
+
+    stats->status = read_status(fe_fd);
+    stats->is_locked = (stats->status & FE_HAS_LOCK) > 0;
+
+    if (*legacy == 0 && read_stats_v5(fe_fd, stats) < 0)
+        *legacy = 1;
+
+    // Drivers converted to DVBv5 without statistics report nothing at all.
+    if (*legacy || (stats->signal_scale == FE_SCALE_NOT_AVAILABLE &&
+                    stats->cnr_scale == FE_SCALE_NOT_AVAILABLE &&
+                    stats->error_blocks < 0))
+        read_stats_legacy(fe_fd, stats);
+}
+
+// Discard queued frontend events and return the current status. The queue
+// may overflow (EOVERFLOW), so the events themselves aren't relied upon.
+static fe_status_t drain_events(int fe_fd)
+{
+    struct dvb_frontend_event event;
+
+    while (zap_ioctl(fe_fd, FE_GET_EVENT, &event) == 0 || errno == EOVERFLOW)
+        ;
+
+    return read_status(fe_fd);
+}
+
+void monitor_begin(t_zap_session *session, int64_t tune_start_us,
+                   StatusReceiver statusReceiver)
+{
+    t_fe_monitor *monitor = &session->monitor;
+
+    monitor->running = 1;
+    monitor->receiver = statusReceiver;
+    monitor->tune_start_us = tune_start_us;
+    monitor->sampling = 1;
+    monitor->was_locked = 0;
+    monitor->legacy = 0;
+    monitor->delivered = 0;
+    monitor->interval_us = DEFAULT_STATUS_INTERVAL_US;
+    monitor->next_sample_us = monotonic_us();
+
+    if (session->options.status_interval_us > 0)
+        monitor->interval_us = session->options.status_interval_us;
+
+    session->stats.lock_latency_us = -1;
+}
+
+int monitor_pollfds(t_zap_session *session, struct pollfd *pfd, 
+                    int64_t *wake_us)
+{
+    t_fe_monitor *monitor = &session->monitor;
+    int lock_wait = (session->options.sample_only == 0);
+
+    // Wake when the next sample is due, the session is cancelled or (in 
+    // lock-wait mode) the driver reports a status change. A change in lock
+    // is then reported immediately rather than on the next interval. PSI 
+    // taken from the cache is checked meanwhile, and the PSI of a pipelined 
+    // tune read (until its deadline).
+
+    *wake_us = monitor->sampling ? monitor->next_sample_us 
+                                 : session->psi_deadline_us;
+    if (zap_session_psi_waiting(session) && 
+        session->psi_deadline_us < *wake_us)
+        *wake_us = session->psi_deadline_us;
+
+    if (session->sec_resend.resend_us != 0 && 
+        session->sec_resend.resend_us < *wake_us)
+        *wake_us = session->sec_resend.resend_us;
+
+    pfd[0].fd = session->cancel_fd;
+    pfd[0].events = POLLIN;
+    pfd[0].revents = 0;
+
+    pfd[1].fd = (lock_wait && monitor->sampling) ? session->frontend_fd : -1;
+    pfd[1].events = POLLIN | POLLPRI;
+    pfd[1].revents = 0;
+
+    pfd[2].fd = session->pat_fd;
+    pfd[2].events = POLLIN;
+    pfd[2].revents = 0;
+
+    pfd[3].fd = session->pmt_fd;
+    pfd[3].events = POLLIN;
+    pfd[3].revents = 0;
+
+    return MONITOR_FDS;
+}
+
+// A sample for the StatusReceiver, as kept in a status ring. Measures the 
+// driver doesn't have are -2.
+static void legacy_stats(fe_status_t status, uint16_t signal_strength, 
+                         uint16_t snr, uint32_t ber, 
+                         uint32_t uncorrected_blocks, t_frontend_stats *stats)
+{
+    memset(stats, 0, sizeof(t_frontend_stats));
+
+    stats->status = status;
+    stats->is_locked = (status & FE_HAS_LOCK) > 0;
+    stats->legacy = 1;
+
+    stats->signal_scale = (signal_strength == (uint16_t)-2) ? 
+                          FE_SCALE_NOT_AVAILABLE : FE_SCALE_RELATIVE;
+    stats->signal = signal_strength;
+
+    stats->cnr_scale = (snr == (uint16_t)-2) ? 
+                       FE_SCALE_NOT_AVAILABLE : FE_SCALE_RELATIVE;
+    stats->cnr = snr;
+
+    stats->pre_error_bits = stats->pre_total_bits = -1;
+    stats->post_error_bits = (ber == (uint32_t)-2) ? -1 : ber;
+    stats->post_total_bits = -1;
+    stats->error_blocks = (uncorrected_blocks == (uint32_t)-2) ? 
+                          -1 : uncorrected_blocks;
+    stats->total_blocks = -1;
+}
+
+static int64_t distance(int64_t a, int64_t b)
+{
+    return (a > b) ? a - b : b - a;
+}
+
+// Whether a sample goes to the receiver (see t_tune_options.status_mode), 
+// remembering those that do.
+static int deliver(t_zap_session *session, const t_frontend_stats *stats)
+{
+    t_fe_monitor *monitor = &session->monitor;
+    const t_tune_options *options = &session->options;
+
+    if (options->status_mode == STATUS_ON_CHANGE && monitor->delivered &&
+        stats->is_locked == monitor->delivered_locked &&
+        (options->status_snr_delta == 0 || 
+         distance(stats->cnr, monitor->delivered_cnr) < 
+            options->status_snr_delta) &&
+        (options->status_ber_delta == 0 || 
+         distance(stats->post_error_bits, monitor->delivered_ber) < 
+            options->status_ber_delta))
+        return 0;
+
+    monitor->delivered = 1;
+    monitor->delivered_locked = stats->is_locked;
+    monitor->delivered_cnr = stats->cnr;
+    monitor->delivered_ber = stats->post_error_bits;
+
+    return 1;
+}
+
+// Take a status sample and hand it to the receiver, the ring and the board.
+static void sample(t_zap_session *session, int64_t now_us)
+{
+    t_fe_monitor *monitor = &session->monitor;
+    t_tune_stats *stats = &session->stats;
+    int fe_fd = session->frontend_fd;
+    fe_status_t status;
+    uint16_t snr, signal_strength;
+    uint32_t ber, uncorrected_blocks;
+    t_status_record record;
+    int is_locked, retval = 1;
+
+    if (session->options.status_receiver_ex != NULL)
+        read_frontend_stats(fe_fd, &monitor->legacy, &record.stats);
+    else
+    {
+        status = read_status(fe_fd);
+
+        /* some frontends might not support all these ioctls */
+        if (zap_ioctl(fe_fd, FE_READ_SIGNAL_STRENGTH, 
+                  &signal_strength) == -1)
+            signal_strength = -2;
+        if (zap_ioctl(fe_fd, FE_READ_SNR, &snr) == -1)
+            snr = -2;
+        if (zap_ioctl(fe_fd, FE_READ_BER, &ber) == -1)
+            ber = -2;
+        if (zap_ioctl(fe_fd, FE_READ_UNCORRECTED_BLOCKS,
+                  &uncorrected_blocks) == -1)
+            uncorrected_blocks = -2;
+
+        legacy_stats(status, signal_strength, snr, ber, uncorrected_blocks,
+                     &record.stats);
+    }
+
+    status = record.stats.status;
+    is_locked = record.stats.is_locked;
+
+    monitor->was_locked = is_locked;
+
+    if (is_locked)
+        session->sec_resend.resend_us = 0;
+
+    if (status & FE_HAS_SIGNAL)
+        zap_session_mark(session, TUNE_STAGE_SIGNAL);
+
+    if (is_locked && stats->lock_latency_us < 0)
+    {
+        stats->lock_latency_us = monotonic_us() - monitor->tune_start_us;
+        zap_session_mark(session, TUNE_STAGE_LOCK);
+    }
+
+    record.time_us = now_us;
+    record.adapter = session->tuner.adapter;
+    record.frontend = session->tuner.frontend;
+
+    if (session->options.status_ring != NULL)
+        status_ring_push(session->options.status_ring, &record);
+
+    if (session->options.status_board != NULL)
+        status_board_publish(session->options.status_board, &record);
+
+    if (deliver(session, &record.stats))
+    {
+        if (session->options.status_receiver_ex != NULL)
+            retval = session->options.status_receiver_ex(
+                        &record.stats, session->options.status_context);
+        else
+            retval = monitor->receiver(status, signal_strength, snr, ber,
+                                       uncorrected_blocks, is_locked);
+    }
+
+    // The receiver is done, but a pipelined tune may still be finding its
+    // PSI.
+    if (retval == 0)
+        monitor->sampling = 0;
+
+    monitor->next_sample_us = now_us + monitor->interval_us;
+}
+
+// When to give up on a single cable router's command: the lock wait, and a
+// random delay growing with each attempt, so that tuners whose commands 
+// collided don't send them again at the same time.
+static int64_t resend_deadline(t_sec_resend *resend)
+{
+    return monotonic_us() + UNICABLE_LOCK_WAIT_MS * 1000LL + 
+           (rand_r(&resend->seed) % 
+            (UNICABLE_BACKOFF_MS * resend->attempts)) * 1000LL;
+}
+
+void monitor_resend_begin(t_zap_session *session)
+{
+    t_sec_resend *resend = &session->sec_resend;
+
+    resend->resends = UNICABLE_RETRIES - 1;
+    resend->attempts = 1;
+    resend->seed = (unsigned int)monotonic_us();
+    resend->resend_us = resend_deadline(resend);
+}
+
+// Send the router's command and the tune again if there's still no lock, 
+// in case the command collided with another tuner's on the cable.
+static void resend_sec(t_zap_session *session)
+{
+    t_sec_resend *resend = &session->sec_resend;
+    int64_t start_us = monotonic_us();
+
+    resend->resend_us = 0;
+
+    if ((read_status(session->frontend_fd) & FE_HAS_LOCK) || 
+        resend->resends <= 0)
+        return;
+
+    resend->resends--;
+    resend->attempts++;
+
+    if (unicable_send(session->frontend_fd, &resend->cmd) < 0)
+        return;
+
+    session->stats.sec_us += monotonic_us() - start_us;
+    zap_session_step(session, TUNE_STAGE_SEC, -1, start_us);
+
+    if (set_frontend(session, &resend->props, 
+                     resend->has_params ? &resend->params : NULL) < 0)
+        return;
+
+    resend->resend_us = resend_deadline(resend);
+}
+
+int monitor_resend_wait(t_zap_session *session)
+{
+    t_sec_resend *resend = &session->sec_resend;
+    struct pollfd pfd;
+
+    while (resend->resend_us != 0)
+    {
+        if (read_status(session->frontend_fd) & FE_HAS_LOCK)
+        {
+            resend->resend_us = 0;
+            return 1;
+        }
+
+        // A cancelled tune is left to the monitor to end.
+        pfd.fd = session->cancel_fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        if (zap_poll(&pfd, 1, 10) > 0 ||
+            (session->break_tune != NULL && *session->break_tune != 0))
+            return 1;
+
+        if (monotonic_us() >= resend->resend_us)
+            resend_sec(session);
+    }
+
+    return (read_status(session->frontend_fd) & FE_HAS_LOCK) != 0;
+}
+
+int monitor_process(t_zap_session *session, const struct pollfd *pfd)
+{
+    t_fe_monitor *monitor = &session->monitor;
+    fe_status_t status;
+    int64_t now_us = monotonic_us();
+
+    if (monitor->running == 0)
+        return 0;
+
+    if ((session->break_tune != NULL && *session->break_tune != 0) ||
+        (pfd != NULL && pfd[0].revents != 0))
+    {
+        monitor->running = 0;
+        return 0;
+    }
+
+    if ((pfd != NULL && (pfd[2].revents != 0 || pfd[3].revents != 0)) ||
+        (zap_session_psi_waiting(session) && 
+         now_us >= session->psi_deadline_us))
+        zap_session_revalidate_psi(session);
+
+    if (pfd != NULL && pfd[1].revents != 0)
+    {
+        status = drain_events(session->frontend_fd);
+        if (status & FE_HAS_SIGNAL)
+            zap_session_mark(session, TUNE_STAGE_SIGNAL);
+
+        if (((status & FE_HAS_LOCK) > 0) != monitor->was_locked)
+            monitor->next_sample_us = now_us;
+    }
+
+    if (monitor->sampling && now_us >= monitor->next_sample_us)
+        sample(session, now_us);
+
+    if (session->sec_resend.resend_us != 0 && 
+        now_us >= session->sec_resend.resend_us)
+        resend_sec(session);
+
+    if (monitor->sampling == 0 && zap_session_psi_waiting(session) == 0)
+        monitor->running = 0;
+
+    return monitor->running;
+}
+
+int check_frontend(t_zap_session *session, int64_t tune_start_us,
+                   StatusReceiver statusReceiver)
+{
+    struct pollfd pfd[MONITOR_FDS];
+    const struct pollfd *ready = NULL;
+    int64_t now_us, wake_us;
+    int count;
+
+    monitor_begin(session, tune_start_us, statusReceiver);
+
+    while (monitor_process(session, ready))
+    {
+        count = monitor_pollfds(session, pfd, &wake_us);
+        now_us = monotonic_us();
+        ready = NULL;
+
+        if (zap_poll(pfd, count, 
+                 wake_us > now_us ? (wake_us - now_us + 999) / 1000 : 0) < 0)
+        {
+            // A signal (SIGALRM for the legacy calls) gets the break flag
+            // rechecked.
+            if (errno == EINTR)
+                continue;
+
+            session->monitor.running = 0;
+            return -1;
+        }
+
+        ready = pfd;
+    }
+
+    return 0;
+}
+
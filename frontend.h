@@ -0,0 +1,60 @@
+#ifndef __FRONTEND__H
+#define __FRONTEND__H
+
+#include <poll.h>
+
+#include "zaptypes.h"
+#include "session.h"
+
+#define DEFAULT_STATUS_INTERVAL_US 1000000
+
+// Append a property to a tune (ignored once FE_MAX_PROPS are there).
+void fe_props_add(t_fe_props *props, uint32_t cmd, uint32_t data);
+
+// The properties for a tune given as legacy parameters.
+void fe_props_from_params(t_fe_props *props, fe_type_t fe_type, 
+                          const struct dvb_frontend_parameters *params);
+
+// Tune the session's frontend with FE_SET_PROPERTY: only the properties that
+// differ from the last tune through the same descriptor are sent, followed 
+// by DTV_TUNE, all in one call. Drivers without DVBv5 support are tuned with
+// FE_SET_FRONTEND and params instead (NULL if the tune can't be expressed 
+// that way, e.g. DVB-S2). Timed as the tune's TUNE_STAGE_FRONTEND step. 
+// Returns -1 on failure.
+int set_frontend(t_zap_session *session, const t_fe_props *props,
+                 const struct dvb_frontend_parameters *params);
+
+// Read a status sample: the DVBv5 statistics in one FE_GET_PROPERTY or, if
+// the driver doesn't have them (or *legacy is set), the legacy FE_READ_* 
+// ioctls. *legacy is set once the driver is found not to support DVBv5 
+// statistics, so that later samples needn't try again.
+void read_frontend_stats(int fe_fd, int *legacy, t_frontend_stats *stats);
+
+// Report frontend status to the receiver until it returns 0 or the session
+// is cancelled. The frontend must have been opened with O_NONBLOCK.
+// tune_start_us is the monotonic_us() time at which the tune was requested.
+// options.status_receiver_ex, when set, is used instead of statusReceiver.
+int check_frontend(t_zap_session *session, int64_t tune_start_us,
+                   StatusReceiver statusReceiver);
+
+// check_frontend() in steps, for an event loop: start monitoring, then 
+// repeatedly wait on the MONITOR_FDS descriptors given by monitor_pollfds() 
+// (until wake_us at the latest) and pass what poll() returned to 
+// monitor_process() (or NULL, to only do what's due). monitor_process() 
+// returns 0 once monitoring is over.
+void monitor_begin(t_zap_session *session, int64_t tune_start_us,
+                   StatusReceiver statusReceiver);
+int monitor_pollfds(t_zap_session *session, struct pollfd *pfd, 
+                    int64_t *wake_us);
+int monitor_process(t_zap_session *session, const struct pollfd *pfd);
+
+// Have the monitor send session->sec_resend (a single cable router's command
+// and the tune after it, just sent) again while the tune doesn't lock, 
+// UNICABLE_RETRIES times in all. Blocking tunes, which read tables before 
+// they're monitored, wait with monitor_resend_wait() instead: it returns 0 
+// if the last attempt didn't lock either.
+void monitor_resend_begin(t_zap_session *session);
+int monitor_resend_wait(t_zap_session *session);
+
+#endif
+
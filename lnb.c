@@ -52,6 +52,34 @@ lnb_enum(int curno)
 	return &lnbs[curno];
 }
 
+/* A universal LNB behind a single cable router: the user band frequencies
+ * follow the type.
+ */
+static int
+scr_decode(char *cp, int scr, struct lnb_types_st *lnbp)
+{
+char *np;
+unsigned long ub;
+
+	*lnbp = lnbs[0];
+	lnbp->scr = scr;
+	for (;;) {
+		while (*cp && (isspace(*cp) || *cp == ','))
+			cp++;
+		if (*cp == '\0')
+			break;
+		if (!isdigit(*cp) || lnbp->user_band_count >= 
+		    (scr == LNB_SCR_UNICABLE ? 8 : LNB_MAX_USER_BANDS))
+			return -1;
+		ub = strtoul(cp, &np, 0);
+		if (ub == 0)
+			return -1;
+		lnbp->user_bands[lnbp->user_band_count++] = ub;
+		cp = np;
+	}
+	return lnbp->user_band_count > 0 ? 1 : -1;
+}
+
 /* Decode an lnb type, for example given on a command line
  * If alpha and standard type, e.g. "Universal" then match that
  * otherwise low[,high[,switch]]
@@ -68,6 +96,10 @@ char *cp, *np;
 	while(*cp && isspace(*cp))
 		cp++;
 	if (isalpha(*cp)) {
+		if (!strncasecmp(cp, "UNICABLE", 8))
+			return scr_decode(cp + 8, LNB_SCR_UNICABLE, lnbp);
+		if (!strncasecmp(cp, "JESS", 4))
+			return scr_decode(cp + 4, LNB_SCR_JESS, lnbp);
 		for (i = 0; i < (int)(sizeof(lnbs) / sizeof(lnbs[0])); i++) {
 			if (!strcasecmp(lnbs[i].name, cp)) {
 				*lnbp = lnbs[i];
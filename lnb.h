@@ -1,9 +1,28 @@
+#ifndef __LNB__H
+#define __LNB__H
+
+/* single cable routers (the scr field): none, Unicable (EN 50494) or JESS 
+ * (EN 50607)
+ */
+#define LNB_SCR_NONE 0
+#define LNB_SCR_UNICABLE 1
+#define LNB_SCR_JESS 2
+
+#define LNB_MAX_USER_BANDS 32
+
 struct lnb_types_st {
 	char	*name;
 	char	**desc;
 	unsigned long	low_val;
 	unsigned long	high_val;	/* zero indicates no hiband */
 	unsigned long	switch_val;	/* zero indicates no hiband */
+
+	/* behind a single cable router: its type, and the frequencies (MHz) 
+	 * of its user bands, in order
+	 */
+	int		scr;
+	unsigned int	user_band_count;
+	unsigned int	user_bands[LNB_MAX_USER_BANDS];
 };
 
 /* Enumerate through standard types of LNB's until NULL returned.
@@ -16,7 +35,12 @@ lnb_enum(int curno);
 /* Decode an lnb type, for example given on a command line
  * If alpha and standard type, e.g. "Universal" then match that
  * otherwise low[,high[,switch]]
+ * A universal LNB behind a single cable router is given as 
+ * "UNICABLE,ub0[,ub1...]" or "JESS,ub0[,ub1...]", with the user band 
+ * frequencies in MHz.
  */
 
 int
 lnb_decode(char *str, struct lnb_types_st *lnbp);
+
+#endif
@@ -0,0 +1,214 @@
+// PID sets on a demux (see pidfilter.h).
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <linux/dvb/frontend.h>
+#include <linux/dvb/dmx.h>
+
+#include "util.h"
+#include "backend.h"
+#include "zaptypes.h"
+#include "pidfilter.h"
+
+void pid_filter_init(t_pid_filter *filter, const char *demux_dev, int output)
+{
+    int i;
+
+    memset(filter, 0, sizeof(t_pid_filter));
+
+    snprintf(filter->demux_dev, sizeof(filter->demux_dev), "%s", demux_dev);
+    filter->output = output;
+    filter->fd = -1;
+    filter->buffer_size = PID_FILTER_TSDEMUX_BUFFER_SIZE;
+
+    for (i = 0; i < PID_FILTER_MAX_PIDS; i++)
+        filter->fds[i] = -1;
+}
+
+static int find(const t_pid_filter *filter, int pid)
+{
+    int i;
+
+    for (i = 0; i < filter->count; i++)
+        if (filter->pids[i] == pid)
+            return i;
+
+    return -1;
+}
+
+int pid_filter_contains(const t_pid_filter *filter, int pid)
+{
+    return find(filter, pid) >= 0;
+}
+
+// Program the shared filter with its first PID. A descriptor still open 
+// from earlier PIDs is stopped and reused.
+static int start_tsdemux(t_pid_filter *filter, int pid)
+{
+    struct dmx_pes_filter_params pesfilter;
+
+    if (filter->fd >= 0)
+        zap_ioctl(filter->fd, DMX_STOP);
+    else if ((filter->fd = zap_open(filter->demux_dev, O_RDWR | O_NONBLOCK)) < 0)
+        return -1;
+
+    // The kernel keeps its default (8 KiB) if this fails, so carry on.
+    if (zap_ioctl(filter->fd, DMX_SET_BUFFER_SIZE, filter->buffer_size) == -1)
+        filter->buffer_size = 8192;
+
+    memset(&pesfilter, 0, sizeof(pesfilter));
+    pesfilter.pid = pid;
+    pesfilter.input = DMX_IN_FRONTEND;
+    pesfilter.output = DMX_OUT_TSDEMUX_TAP;
+    pesfilter.pes_type = DMX_PES_OTHER;
+    pesfilter.flags = DMX_IMMEDIATE_START;
+
+    if (zap_ioctl(filter->fd, DMX_SET_PES_FILTER, &pesfilter) == -1)
+    {
+        zap_close(filter->fd);
+        filter->fd = -1;
+
+        return -1;
+    }
+
+    return 0;
+}
+
+int pid_filter_add(t_pid_filter *filter, int pid, int pes_type)
+{
+    uint16_t pid16 = pid;
+    int fd;
+
+    /* ignore this pid to allow radio services */
+    if (pid < 0 ||
+        pid >= 0x1fff ||
+        (pid == 0 && pes_type != DMX_PES_OTHER))
+        return 0;
+
+    if (find(filter, pid) >= 0)
+        return 0;
+
+    if (filter->count >= PID_FILTER_MAX_PIDS)
+        return -1;
+
+    if (filter->output == ZAP_OUT_TSDEMUX)
+    {
+        if (filter->count == 0)
+        {
+            if (start_tsdemux(filter, pid) < 0)
+                return -1;
+        }
+        else if (zap_ioctl(filter->fd, DMX_ADD_PID, &pid16) == -1)
+            return -1;
+    }
+    else
+    {
+        if (filter->spare_count > 0)
+            fd = filter->spares[--filter->spare_count];
+        else if ((fd = zap_open(filter->demux_dev, O_RDWR)) < 0)
+            return -1;
+
+        if (set_pesfilter_buffer(fd, pid, pes_type, filter->output, 0) < 0)
+        {
+            zap_close(fd);
+            return -1;
+        }
+
+        filter->fds[filter->count] = fd;
+    }
+
+    filter->pids[filter->count] = pid;
+    filter->count++;
+
+    return 0;
+}
+
+// Stop a per-PID descriptor and keep it for reuse.
+static void release_fd(t_pid_filter *filter, int fd)
+{
+    if (filter->spare_count < PID_FILTER_MAX_PIDS &&
+        zap_ioctl(fd, DMX_STOP) == 0)
+        filter->spares[filter->spare_count++] = fd;
+    else
+        zap_close(fd);
+}
+
+int pid_filter_remove(t_pid_filter *filter, int pid)
+{
+    uint16_t pid16 = pid;
+    int i = find(filter, pid);
+
+    if (i < 0)
+        return 0;
+
+    if (filter->output == ZAP_OUT_TSDEMUX)
+    {
+        if (zap_ioctl(filter->fd, DMX_REMOVE_PID, &pid16) == -1)
+            return -1;
+    }
+    else
+        release_fd(filter, filter->fds[i]);
+
+    filter->count--;
+    filter->pids[i] = filter->pids[filter->count];
+    filter->fds[i] = filter->fds[filter->count];
+    filter->fds[filter->count] = -1;
+
+    return 0;
+}
+
+void pid_filter_clear(t_pid_filter *filter)
+{
+    int i;
+
+    for (i = 0; i < filter->count; i++)
+    {
+        if (filter->fds[i] >= 0)
+        {
+            release_fd(filter, filter->fds[i]);
+            filter->fds[i] = -1;
+        }
+    }
+
+    // The next PID added reprograms the shared filter.
+    if (filter->fd >= 0)
+        zap_ioctl(filter->fd, DMX_STOP);
+
+    filter->count = 0;
+}
+
+void pid_filter_close(t_pid_filter *filter)
+{
+    int i;
+
+    for (i = 0; i < filter->spare_count; i++)
+        zap_close(filter->spares[i]);
+
+    filter->spare_count = 0;
+
+    for (i = 0; i < filter->count; i++)
+    {
+        if (filter->fds[i] >= 0)
+        {
+            zap_close(filter->fds[i]);
+            filter->fds[i] = -1;
+        }
+    }
+
+    if (filter->fd >= 0)
+    {
+        zap_close(filter->fd);
+        filter->fd = -1;
+    }
+
+    filter->count = 0;
+}
+
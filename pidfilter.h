@@ -0,0 +1,59 @@
+#ifndef __PIDFILTER__H
+#define __PIDFILTER__H
+
+#include <stdint.h>
+
+#define PID_FILTER_MAX_PIDS 32
+
+// The default buffer of a ZAP_OUT_TSDEMUX filter, which carries the whole PID
+// set (the same as the kernel's default dvr buffer).
+#define PID_FILTER_TSDEMUX_BUFFER_SIZE (10 * 188 * 1024)
+
+// A set of PIDs passed by the demux. With ZAP_OUT_TSDEMUX one kernel filter
+// carries every PID (DMX_ADD_PID/DMX_REMOVE_PID). The kernel only allows a
+// single PID per filter for the decoder and dvr outputs, so those get one
+// demux descriptor per PID.
+typedef struct
+{
+    char demux_dev[80];
+    int output;
+
+    int count;
+    uint16_t pids[PID_FILTER_MAX_PIDS];
+
+    // Per-PID descriptors (decoder and dvr outputs), -1 when unused.
+    int fds[PID_FILTER_MAX_PIDS];
+
+    // The shared descriptor (ZAP_OUT_TSDEMUX), -1 when not open.
+    int fd;
+
+    // Per-PID descriptors no longer in use, stopped and kept for the next 
+    // PIDs added (so that a retune needn't reopen the demux).
+    int spare_count;
+    int spares[PID_FILTER_MAX_PIDS];
+
+    // The shared filter's buffer. The per-PID filters have none to size: 
+    // the decoder takes their packets, or they go to the dvr device's buffer.
+    unsigned int buffer_size;
+} t_pid_filter;
+
+// Prepare an empty set. Nothing is opened until the first PID is added.
+void pid_filter_init(t_pid_filter *filter, const char *demux_dev, int output);
+
+// Add a PID (a no-op for PIDs that set_pesfilter() would ignore, or ones
+// already present). pes_type only matters for the decoder output.
+int pid_filter_add(t_pid_filter *filter, int pid, int pes_type);
+
+int pid_filter_remove(t_pid_filter *filter, int pid);
+
+int pid_filter_contains(const t_pid_filter *filter, int pid);
+
+// Drop every PID but keep the descriptors, stopped, for the next PIDs 
+// added.
+void pid_filter_clear(t_pid_filter *filter);
+
+// Drop every PID and close all descriptors.
+void pid_filter_close(t_pid_filter *filter);
+
+#endif
+
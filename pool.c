@@ -0,0 +1,778 @@
+// Tuners shared by the subscribers to their multiplexes (see pool.h).
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include <linux/dvb/frontend.h>
+#include <linux/dvb/dmx.h>
+
+#include "util.h"
+#include "zaptypes.h"
+#include "backend.h"
+#include "session.h"
+#include "frontend.h"
+#include "caps.h"
+#include "pool.h"
+
+static int no_status(fe_status_t status, uint16_t signal, uint16_t snr,
+                     uint32_t ber, uint32_t uncorrected_blocks, int is_locked)
+{
+    return 0;
+}
+
+// A tune is monitored until the lock, or its deadline.
+static int lock_status(const t_frontend_stats *stats, void *context)
+{
+    t_pool_tuner *tuner = context;
+
+    if (stats->is_locked)
+    {
+        tuner->locked = 1;
+        return 0;
+    }
+
+    return monotonic_us() < tuner->lock_deadline_us;
+}
+
+// Once locked, a tuner is sampled until it's released, and failed if it
+// loses the lock.
+static int held_status(const t_frontend_stats *stats, void *context)
+{
+    t_pool_tuner *tuner = context;
+    t_tuner_pool *pool = tuner->pool;
+
+    if (stats->is_locked)
+        return 1;
+
+    pthread_mutex_lock(&pool->lock);
+
+    if (tuner->state == POOL_TUNER_LOCKED)
+    {
+        tuner->state = POOL_TUNER_FAILED;
+        pthread_cond_broadcast(&pool->changed);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    return 1;
+}
+
+// Give a tuner's frontend and session back. Called with the pool locked.
+static void close_tuner(t_tuner_pool *pool, t_pool_tuner *tuner)
+{
+    caps_release(tuner->session.tuner.adapter, tuner->session.tuner.frontend);
+    zap_session_destroy(&tuner->session);
+
+    tuner->state = POOL_TUNER_FREE;
+    tuner->pid_count = 0;
+    tuner->monitoring = 0;
+
+    pthread_cond_broadcast(&pool->changed);
+}
+
+// Monitor a locked tuner until its session is cancelled (see release()),
+// then close it.
+static void *monitor_tuner(void *context)
+{
+    t_pool_tuner *tuner = context;
+    t_tuner_pool *pool = tuner->pool;
+    t_zap_session *session = &tuner->session;
+    struct pollfd pfd[MONITOR_FDS];
+    const struct pollfd *ready = NULL;
+    int64_t lock_latency_us = session->stats.lock_latency_us;
+    int64_t now_us, wake_us;
+    int count;
+
+    // The tune's lock latency stands.
+    monitor_begin(session, session->tune_start_us, no_status);
+    session->stats.lock_latency_us = lock_latency_us;
+
+    while (monitor_process(session, ready))
+    {
+        count = monitor_pollfds(session, pfd, &wake_us);
+        now_us = monotonic_us();
+        ready = NULL;
+
+        if (zap_poll(pfd, count,
+                 wake_us > now_us ? (wake_us - now_us + 999) / 1000 : 0) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            break;
+        }
+
+        ready = pfd;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+
+    // A monitor that failed leaves the tuner failed, to release().
+    if (tuner->state == POOL_TUNER_CLOSING)
+        close_tuner(pool, tuner);
+    else
+    {
+        tuner->monitoring = 0;
+
+        if (tuner->state == POOL_TUNER_LOCKED)
+            tuner->state = POOL_TUNER_FAILED;
+
+        pthread_cond_broadcast(&pool->changed);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+// Count a subscription's use of a PID, passing it if it's new to the tuner.
+static int add_ref(t_pool_tuner *tuner, int pid, int pes_type)
+{
+    int i;
+
+    for (i = 0; i < tuner->pid_count; i++)
+    {
+        if (tuner->pids[i].pid == pid)
+        {
+            tuner->pids[i].refs++;
+            return 0;
+        }
+    }
+
+    if (tuner->pid_count == PID_FILTER_MAX_PIDS ||
+        zap_session_add_pid(&tuner->session, pid, pes_type) < 0)
+        return -1;
+
+    tuner->pids[tuner->pid_count].pid = pid;
+    tuner->pids[tuner->pid_count].refs = 1;
+    tuner->pid_count++;
+
+    return 0;
+}
+
+static void drop_ref(t_pool_tuner *tuner, int pid)
+{
+    int i;
+
+    for (i = 0; i < tuner->pid_count; i++)
+    {
+        if (tuner->pids[i].pid != pid)
+            continue;
+
+        if (--tuner->pids[i].refs == 0)
+        {
+            zap_session_remove_pid(&tuner->session, pid);
+            tuner->pids[i] = tuner->pids[--tuner->pid_count];
+        }
+
+        return;
+    }
+}
+
+// A PID the PSI of the first subscription's service moved (see
+// t_zap_session.psi_pid_hook), counted as that subscription's so that
+// PIDs other subscriptions need stay passed.
+static int psi_pid(int pid, int pes_type, int add, void *context)
+{
+    t_pool_tuner *tuner = context;
+    t_tuner_pool *pool = tuner->pool;
+    t_pool_subscription *subscription;
+    int i, retval = 0;
+
+    pthread_mutex_lock(&pool->lock);
+
+    if (tuner->psi_subscription < 0)
+    {
+        pthread_mutex_unlock(&pool->lock);
+        return 0;
+    }
+
+    subscription = &pool->subscriptions[tuner->psi_subscription];
+
+    for (i = 0; i < subscription->pid_count; i++)
+        if (subscription->pids[i] == pid)
+            break;
+
+    if (add && i == subscription->pid_count)
+    {
+        if (subscription->pid_count == SERVICE_MAX_PIDS ||
+            add_ref(tuner, pid, pes_type) < 0)
+            retval = -1;
+        else
+            subscription->pids[subscription->pid_count++] = pid;
+    }
+    else if (add == 0 && i < subscription->pid_count)
+    {
+        subscription->pids[i] = subscription->pids[--subscription->pid_count];
+        drop_ref(tuner, pid);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    return retval;
+}
+
+// Start monitoring a tuner that has locked. Called with the pool locked.
+static int start_monitor(t_pool_tuner *tuner)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+    int retval;
+
+    tuner->session.options.status_receiver_ex = held_status;
+    tuner->session.options.sample_only = 1;
+    tuner->session.psi_pid_hook = psi_pid;
+    tuner->session.psi_pid_context = tuner;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    tuner->monitoring = 1;
+    retval = pthread_create(&thread, &attr, monitor_tuner, tuner);
+
+    pthread_attr_destroy(&attr);
+
+    if (retval != 0)
+    {
+        tuner->monitoring = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int same_string(const char *a, const char *b)
+{
+    if (a == NULL || b == NULL)
+        return a == b;
+
+    return strcmp(a, b) == 0;
+}
+
+static const t_dvbs_tune_info *dvbs_info(const t_pool_service *service)
+{
+    return service->s2 ? &service->u.dvbs2.dvbs : &service->u.dvbs;
+}
+
+// Whether two services are on the same multiplex: everything but their
+// PIDs and service IDs is the same.
+static int same_mux(const t_pool_service *a, const t_pool_service *b)
+{
+    if (a->type != b->type)
+        return 0;
+
+    switch (a->type)
+    {
+    case FE_ATSC:
+        return a->u.atsc.frequency == b->u.atsc.frequency &&
+               a->u.atsc.modulation == b->u.atsc.modulation;
+
+    case FE_QAM:
+        return a->u.dvbc.frequency == b->u.dvbc.frequency &&
+               a->u.dvbc.inversion == b->u.dvbc.inversion &&
+               a->u.dvbc.sym_per_sec == b->u.dvbc.sym_per_sec &&
+               a->u.dvbc.modulation == b->u.dvbc.modulation &&
+               a->u.dvbc.forward_err_corr == b->u.dvbc.forward_err_corr;
+
+    case FE_OFDM:
+        return a->u.dvbt.frequency == b->u.dvbt.frequency &&
+               a->u.dvbt.modulation == b->u.dvbt.modulation &&
+               a->u.dvbt.inversion == b->u.dvbt.inversion &&
+               a->u.dvbt.bandwidth == b->u.dvbt.bandwidth &&
+               a->u.dvbt.forward_err_corr_hp ==
+                   b->u.dvbt.forward_err_corr_hp &&
+               a->u.dvbt.forward_err_corr_lp ==
+                   b->u.dvbt.forward_err_corr_lp &&
+               a->u.dvbt.transmission_mode == b->u.dvbt.transmission_mode &&
+               a->u.dvbt.guard_interval == b->u.dvbt.guard_interval &&
+               a->u.dvbt.heirarchy_information ==
+                   b->u.dvbt.heirarchy_information;
+
+    case FE_QPSK:
+        if (a->s2 != b->s2 || !same_string(a->lnb_raw, b->lnb_raw))
+            return 0;
+
+        if (a->s2 &&
+            (a->u.dvbs2.modulation != b->u.dvbs2.modulation ||
+             a->u.dvbs2.fec != b->u.dvbs2.fec ||
+             a->u.dvbs2.rolloff != b->u.dvbs2.rolloff ||
+             a->u.dvbs2.pilot != b->u.dvbs2.pilot ||
+             a->u.dvbs2.multistream != b->u.dvbs2.multistream ||
+             a->u.dvbs2.stream_id != b->u.dvbs2.stream_id))
+            return 0;
+
+        return dvbs_info(a)->frequency == dvbs_info(b)->frequency &&
+               dvbs_info(a)->pol == dvbs_info(b)->pol &&
+               dvbs_info(a)->sat_no == dvbs_info(b)->sat_no &&
+               dvbs_info(a)->sr == dvbs_info(b)->sr;
+    }
+
+    return 0;
+}
+
+static void service_ids(const t_pool_service *service, int *vpid, int *apid,
+                        int *sid)
+{
+    switch (service->type)
+    {
+    case FE_ATSC:
+        *vpid = service->u.atsc.vpid;
+        *apid = service->u.atsc.apid;
+        *sid = service->u.atsc.sid;
+        break;
+
+    case FE_QAM:
+        *vpid = service->u.dvbc.vpid;
+        *apid = service->u.dvbc.apid;
+        *sid = service->u.dvbc.sid;
+        break;
+
+    case FE_OFDM:
+        *vpid = service->u.dvbt.vpid;
+        *apid = service->u.dvbt.apid;
+        *sid = service->u.dvbt.sid;
+        break;
+
+    default:
+        *vpid = dvbs_info(service)->vpid;
+        *apid = dvbs_info(service)->apid;
+        *sid = dvbs_info(service)->sid;
+        break;
+    }
+}
+
+// The delivery system (and frequency, in the frontend's units, 0 if it
+// can't be told) a tuner needs for the multiplex. DVB-S frontends are given
+// an intermediate frequency that depends on the LNB.
+static unsigned int service_delsys(const t_pool_service *service,
+                                   uint32_t *frequency)
+{
+    *frequency = 0;
+
+    switch (service->type)
+    {
+    case FE_ATSC:
+        *frequency = service->u.atsc.frequency;
+
+        return (service->u.atsc.modulation == VSB_8 ||
+                service->u.atsc.modulation == VSB_16) ?
+               SYS_ATSC : SYS_DVBC_ANNEX_B;
+
+    case FE_QAM:
+        *frequency = service->u.dvbc.frequency;
+        return SYS_DVBC_ANNEX_A;
+
+    case FE_OFDM:
+        *frequency = service->u.dvbt.frequency;
+        return SYS_DVBT;
+
+    default:
+        return service->s2 ? SYS_DVBS2 : SYS_DVBS;
+    }
+}
+
+static int tune(t_pool_tuner *tuner, int dvr, int rec_psi)
+{
+    t_pool_service *mux = &tuner->mux;
+
+    switch (mux->type)
+    {
+    case FE_ATSC:
+        return azap_tune(&tuner->session, mux->u.atsc, dvr, rec_psi,
+                         no_status);
+
+    case FE_QAM:
+        return czap_tune(&tuner->session, mux->u.dvbc, dvr, rec_psi,
+                         no_status);
+
+    case FE_OFDM:
+        return tzap_tune(&tuner->session, mux->u.dvbt, dvr, rec_psi,
+                         no_status);
+
+    default:
+        if (mux->s2)
+            return szap_tune_s2(&tuner->session, mux->u.dvbs2, dvr, rec_psi,
+                                no_status, mux->audio_bypass, mux->lnb_raw);
+
+        return szap_tune(&tuner->session, mux->u.dvbs, dvr, rec_psi,
+                         no_status, mux->audio_bypass, mux->lnb_raw);
+    }
+}
+
+// Let go of a subscription, and of its tuner if it was the last one.
+// Called with the pool locked, which is let go of while the tuner's monitor
+// stops.
+static void release(t_tuner_pool *pool, t_pool_subscription *subscription)
+{
+    t_pool_tuner *tuner = subscription->tuner;
+    int i;
+
+    for (i = 0; i < subscription->pid_count; i++)
+        drop_ref(tuner, subscription->pids[i]);
+
+    subscription->tuner = NULL;
+    subscription->pid_count = 0;
+
+    if (tuner->psi_subscription == subscription - pool->subscriptions)
+        tuner->psi_subscription = -1;
+
+    if (--tuner->subscriptions > 0)
+        return;
+
+    // A monitored tuner is closed by its monitor once it has stopped, 
+    // which may need the pool meanwhile.
+    if (tuner->monitoring)
+    {
+        tuner->state = POOL_TUNER_CLOSING;
+        zap_session_cancel(&tuner->session);
+
+        while (tuner->state == POOL_TUNER_CLOSING)
+            pthread_cond_wait(&pool->changed, &pool->lock);
+
+        return;
+    }
+
+    close_tuner(pool, tuner);
+}
+
+// Claim a tuner for the service's multiplex and tune it, passing the
+// service as the tune calls do. Called with the pool locked, which is let
+// go of for the tune.
+static int open_tuner(t_tuner_pool *pool, const t_pool_service *service,
+                      int rec_psi, t_pool_subscription *subscription)
+{
+    t_tuner_descriptor descriptor;
+    t_pool_tuner *tuner = NULL;
+    t_pid_filter *filter;
+    uint32_t frequency;
+    unsigned int delsys;
+    int i, retval;
+
+    for (i = 0; i < POOL_MAX_TUNERS; i++)
+    {
+        if (pool->tuners[i].state == POOL_TUNER_FREE)
+        {
+            tuner = &pool->tuners[i];
+            break;
+        }
+    }
+
+    delsys = service_delsys(service, &frequency);
+
+    if (tuner == NULL || caps_claim(delsys, frequency, &descriptor) < 0)
+        return -1;
+
+    if (zap_session_init(&tuner->session, descriptor, &pool->options) < 0)
+    {
+        caps_release(descriptor.adapter, descriptor.frontend);
+        return -1;
+    }
+
+    tuner->session.options.status_receiver_ex = lock_status;
+    tuner->session.options.status_context = tuner;
+
+    tuner->state = POOL_TUNER_TUNING;
+    tuner->pool = pool;
+    tuner->mux = *service;
+    tuner->subscriptions = 1;
+    tuner->pid_count = 0;
+    tuner->locked = 0;
+    tuner->monitoring = 0;
+    tuner->psi_subscription = -1;
+    tuner->lock_deadline_us = monotonic_us() +
+                              (int64_t)pool->lock_timeout_ms * 1000;
+
+    subscription->tuner = tuner;
+    subscription->pid_count = 0;
+
+    pthread_mutex_unlock(&pool->lock);
+    retval = tune(tuner, pool->dvr, rec_psi);
+    pthread_mutex_lock(&pool->lock);
+
+    if (retval < 0 || tuner->locked == 0)
+    {
+        release(pool, subscription);
+        return -2;
+    }
+
+    if (start_monitor(tuner) < 0)
+    {
+        release(pool, subscription);
+        return -1;
+    }
+
+    // What the tune passed is the first subscription's.
+    filter = &tuner->session.pid_filter;
+
+    for (i = 0; i < filter->count && i < SERVICE_MAX_PIDS; i++)
+    {
+        tuner->pids[i].pid = filter->pids[i];
+        tuner->pids[i].refs = 1;
+
+        subscription->pids[i] = filter->pids[i];
+    }
+
+    tuner->pid_count = subscription->pid_count = i;
+    tuner->psi_subscription = subscription - pool->subscriptions;
+    tuner->state = POOL_TUNER_LOCKED;
+
+    pthread_cond_broadcast(&pool->changed);
+    return 0;
+}
+
+// Pass the service's PIDs on a tuner that has its multiplex. Called with
+// the pool locked, which is let go of while the PSI is read.
+static int attach(t_tuner_pool *pool, t_pool_tuner *tuner,
+                  const t_pool_service *service, int rec_psi,
+                  t_pool_subscription *subscription)
+{
+    int found[SERVICE_MAX_PIDS], found_types[SERVICE_MAX_PIDS];
+    int pids[SERVICE_MAX_PIDS], pes_types[SERVICE_MAX_PIDS];
+    int vpid, apid, sid, found_count = 0, count = 0, i;
+
+    tuner->subscriptions++;
+
+    subscription->tuner = tuner;
+    subscription->pid_count = 0;
+
+    service_ids(service, &vpid, &apid, &sid);
+
+    // The tables are read without holding up the rest of the pool. The
+    // tuner stays, since the subscription holds it.
+    if ((vpid == 0 && apid == 0) || rec_psi)
+    {
+        pthread_mutex_unlock(&pool->lock);
+        found_count = zap_session_service_pids(&tuner->session, sid, rec_psi,
+                                               found, found_types);
+        pthread_mutex_lock(&pool->lock);
+
+        if (found_count < 0)
+        {
+            release(pool, subscription);
+            return -3;
+        }
+    }
+
+    // Given PIDs take the place of the service's streams, but not of its
+    // PAT and PMT (the last two found).
+    if (vpid != 0 || apid != 0)
+    {
+        if (vpid != 0)
+        {
+            pids[count] = vpid;
+            pes_types[count++] = DMX_PES_VIDEO;
+        }
+
+        if (apid != 0)
+        {
+            pids[count] = apid;
+            pes_types[count++] = DMX_PES_AUDIO;
+        }
+
+        for (i = rec_psi ? found_count - 2 : found_count; 
+             i < found_count; i++)
+        {
+            pids[count] = found[i];
+            pes_types[count++] = found_types[i];
+        }
+    }
+    else
+    {
+        for (i = 0; i < found_count; i++)
+        {
+            pids[count] = found[i];
+            pes_types[count++] = found_types[i];
+        }
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (add_ref(tuner, pids[i], pes_types[i]) < 0)
+        {
+            release(pool, subscription);
+            return -3;
+        }
+
+        subscription->pids[subscription->pid_count++] = pids[i];
+    }
+
+    return 0;
+}
+
+int pool_init(t_tuner_pool *pool, const t_tune_options *options, int dvr,
+              unsigned int lock_timeout_ms)
+{
+    memset(pool, 0, sizeof(t_tuner_pool));
+
+    if (options != NULL)
+        pool->options = *options;
+
+    pool->options.persistent = 1;
+    pool->dvr = dvr;
+    pool->lock_timeout_ms = lock_timeout_ms;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->changed, NULL);
+
+    return 0;
+}
+
+int pool_subscribe(t_tuner_pool *pool, const t_pool_service *service,
+                   int rec_psi)
+{
+    t_pool_subscription *subscription = NULL;
+    t_pool_tuner *tuner;
+    int i, retval;
+
+    pthread_mutex_lock(&pool->lock);
+
+    while (1)
+    {
+        tuner = NULL;
+
+        for (i = 0; i < POOL_MAX_TUNERS; i++)
+        {
+            // Failed tuners (and those closing) aren't shared any more.
+            if ((pool->tuners[i].state == POOL_TUNER_TUNING ||
+                 pool->tuners[i].state == POOL_TUNER_LOCKED) &&
+                same_mux(&pool->tuners[i].mux, service))
+            {
+                tuner = &pool->tuners[i];
+                break;
+            }
+        }
+
+        // Wait for a tune of the multiplex to lock (or fail).
+        if (tuner == NULL || tuner->state == POOL_TUNER_LOCKED)
+            break;
+
+        pthread_cond_wait(&pool->changed, &pool->lock);
+    }
+
+    for (i = 0; i < POOL_MAX_SUBSCRIPTIONS; i++)
+    {
+        if (pool->subscriptions[i].tuner == NULL)
+        {
+            subscription = &pool->subscriptions[i];
+            break;
+        }
+    }
+
+    if (subscription == NULL)
+        retval = -1;
+    else
+    {
+        subscription->pending = 1;
+
+        if (tuner != NULL)
+            retval = attach(pool, tuner, service, rec_psi, subscription);
+        else
+            retval = open_tuner(pool, service, rec_psi, subscription);
+
+        subscription->pending = 0;
+        pthread_cond_broadcast(&pool->changed);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return (retval < 0) ? retval : (int)(subscription - pool->subscriptions);
+}
+
+static t_pool_subscription *find_subscription(t_tuner_pool *pool,
+                                              int subscription)
+{
+    if (subscription < 0 || subscription >= POOL_MAX_SUBSCRIPTIONS ||
+        pool->subscriptions[subscription].tuner == NULL ||
+        pool->subscriptions[subscription].pending)
+        return NULL;
+
+    return &pool->subscriptions[subscription];
+}
+
+void pool_unsubscribe(t_tuner_pool *pool, int subscription)
+{
+    t_pool_subscription *found;
+
+    pthread_mutex_lock(&pool->lock);
+
+    if ((found = find_subscription(pool, subscription)) != NULL)
+        release(pool, found);
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+t_zap_session *pool_session(t_tuner_pool *pool, int subscription)
+{
+    t_pool_subscription *found;
+    t_zap_session *session = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+
+    if ((found = find_subscription(pool, subscription)) != NULL)
+        session = &found->tuner->session;
+
+    pthread_mutex_unlock(&pool->lock);
+    return session;
+}
+
+int pool_pids(t_tuner_pool *pool, int subscription, int *pids, int max)
+{
+    t_pool_subscription *found;
+    int count = -1;
+
+    pthread_mutex_lock(&pool->lock);
+
+    if ((found = find_subscription(pool, subscription)) != NULL)
+    {
+        for (count = 0; count < found->pid_count && count < max; count++)
+            pids[count] = found->pids[count];
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    return count;
+}
+
+int pool_state(t_tuner_pool *pool, int subscription)
+{
+    t_pool_subscription *found;
+    int state = -1;
+
+    pthread_mutex_lock(&pool->lock);
+
+    if ((found = find_subscription(pool, subscription)) != NULL)
+        state = found->tuner->state;
+
+    pthread_mutex_unlock(&pool->lock);
+    return state;
+}
+
+// Whether subscriptions are being made.
+static int pending(t_tuner_pool *pool)
+{
+    int i;
+
+    for (i = 0; i < POOL_MAX_SUBSCRIPTIONS; i++)
+        if (pool->subscriptions[i].pending)
+            return 1;
+
+    return 0;
+}
+
+void pool_destroy(t_tuner_pool *pool)
+{
+    int i;
+
+    pthread_mutex_lock(&pool->lock);
+
+    while (pending(pool))
+        pthread_cond_wait(&pool->changed, &pool->lock);
+
+    for (i = 0; i < POOL_MAX_SUBSCRIPTIONS; i++)
+        if (pool->subscriptions[i].tuner != NULL)
+            release(pool, &pool->subscriptions[i]);
+
+    pthread_mutex_unlock(&pool->lock);
+
+    pthread_cond_destroy(&pool->changed);
+    pthread_mutex_destroy(&pool->lock);
+}
@@ -0,0 +1,158 @@
+#ifndef __POOL__H
+#define __POOL__H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include <linux/dvb/frontend.h>
+
+#include "zaptypes.h"
+#include "session.h"
+#include "pidfilter.h"
+#include "azaplib.h"
+#include "czaplib.h"
+#include "szaplib.h"
+#include "tzaplib.h"
+
+// Tuners a pool can hold at once, and the subscriptions across them.
+#define POOL_MAX_TUNERS 32
+#define POOL_MAX_SUBSCRIPTIONS 128
+
+// A service to subscribe to: the type of frontend (FE_ATSC, FE_QAM, FE_OFDM
+// or FE_QPSK) and the matching tune info, whose vpid, apid and sid select
+// the service as they do for the tune calls. Everything else selects the
+// multiplex.
+typedef struct
+{
+    fe_type_t type;
+
+    union
+    {
+        t_atsc_tune_info atsc;
+        t_dvbc_tune_info dvbc;
+        t_dvbt_tune_info dvbt;
+        t_dvbs_tune_info dvbs;
+        t_dvbs2_tune_info dvbs2;
+    } u;
+
+    // For FE_QPSK: whether the service is given in u.dvbs2 (a DVB-S2
+    // transponder) rather than u.dvbs, and the rest as given to szap_tune().
+    int s2;
+    int audio_bypass;
+    char *lnb_raw;
+} t_pool_service;
+
+// A PID passed on a tuner, and the subscriptions that asked for it.
+typedef struct
+{
+    int pid;
+    int refs;
+} t_pool_pid;
+
+// States of a pool tuner. A tuner that loses its lock is failed: it's no
+// longer given new subscriptions. One being closed is released once its
+// monitor has stopped.
+#define POOL_TUNER_FREE 0
+#define POOL_TUNER_TUNING 1
+#define POOL_TUNER_LOCKED 2
+#define POOL_TUNER_FAILED 3
+#define POOL_TUNER_CLOSING 4
+
+struct t_tuner_pool;
+
+typedef struct
+{
+    int state;
+    struct t_tuner_pool *pool;
+
+    // The multiplex (the first subscription's service), and the session
+    // holding the tuner.
+    t_pool_service mux;
+    t_zap_session session;
+
+    int subscriptions;
+    t_pool_pid pids[PID_FILTER_MAX_PIDS];
+    int pid_count;
+
+    // For the tune: when to give up on the lock, and whether it was seen.
+    int64_t lock_deadline_us;
+    int locked;
+
+    // Whether the thread sampling the tuner once it has locked (and reading
+    // the PSI changes meanwhile) is running, and the subscription whose
+    // service's PSI it follows (the first), -1 once that one is dropped.
+    // The PIDs the PSI moves are counted as that subscription's.
+    int monitoring;
+    int psi_subscription;
+} t_pool_tuner;
+
+typedef struct
+{
+    // The tuner it's on, NULL if the subscription is free.
+    t_pool_tuner *tuner;
+
+    // Set while the subscription is being made (its tuner tuned, or its 
+    // PSI read), when it can't be used or dropped yet.
+    int pending;
+
+    int pids[SERVICE_MAX_PIDS];
+    int pid_count;
+} t_pool_subscription;
+
+// Tuners shared between the subscribers to the services on their
+// multiplexes: a subscription to a service on a multiplex that's already
+// tuned only adds the service's PIDs to that tuner's demux, and a tuner is
+// only claimed (see caps_claim()) for a multiplex that isn't. Each tuner is
+// released (and its devices closed) when its last subscription is.
+typedef struct t_tuner_pool
+{
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+
+    t_tune_options options;
+    int dvr;
+    unsigned int lock_timeout_ms;
+
+    t_pool_tuner tuners[POOL_MAX_TUNERS];
+    t_pool_subscription subscriptions[POOL_MAX_SUBSCRIPTIONS];
+} t_tuner_pool;
+
+// Prepare a pool whose tuners are tuned with the given options (NULL for the
+// defaults; the sessions are made persistent, and the status receiver is
+// the pool's) and dvr output, and given lock_timeout_ms to lock (as seen by
+// the status samples, options.status_interval_us apart). Once locked, each
+// tuner is sampled by a thread of its own for as long as it's held, which
+// also follows changes to the PSI. The tuners come from those found by 
+// caps_discover().
+int pool_init(t_tuner_pool *pool, const t_tune_options *options, int dvr,
+              unsigned int lock_timeout_ms);
+
+// Subscribe to a service, with its PAT and PMT if rec_psi, tuning a free
+// tuner if no tuner has its multiplex. Safe to use from any thread; a
+// subscription to a multiplex being tuned waits for that tune. Returns the
+// subscription (0 or more), -1 if there's no tuner (or subscription) to be
+// had, -2 if the tune failed or didn't lock in time, or -3 if the service's
+// PIDs couldn't be found or passed.
+int pool_subscribe(t_tuner_pool *pool, const t_pool_service *service,
+                   int rec_psi);
+
+// Drop a subscription, and the PIDs no other subscription on its tuner
+// needs. The tuner is released along with its last subscription.
+void pool_unsubscribe(t_tuner_pool *pool, int subscription);
+
+// The session carrying a subscription, and the PIDs passed for it. The
+// subscriptions on a tuner share its stream (see zap_session_open_dvr()),
+// which is read once and split by PID.
+t_zap_session *pool_session(t_tuner_pool *pool, int subscription);
+int pool_pids(t_tuner_pool *pool, int subscription, int *pids, int max);
+
+// The state of a subscription's tuner: POOL_TUNER_LOCKED, or 
+// POOL_TUNER_FAILED once it has lost the lock (the subscription should then
+// be dropped). -1 if there's no such subscription.
+int pool_state(t_tuner_pool *pool, int subscription);
+
+// Drop every subscription and release the pool, once the subscriptions
+// being made are.
+void pool_destroy(t_tuner_pool *pool);
+
+#endif
@@ -0,0 +1,680 @@
+// PSI tables and the process-wide cache of them (see psi.h).
+
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <linux/dvb/dmx.h>
+
+#include "backend.h"
+#include "psi.h"
+
+typedef struct
+{
+    int used;
+    uint64_t last_used;
+
+    t_mux_key key;
+    t_pat pat;
+} t_psi_cache_entry;
+
+typedef struct
+{
+    int used;
+    uint64_t last_used;
+
+    t_mux_key key;
+    t_pmt pmt;
+} t_psi_cache_pmt_entry;
+
+static t_psi_cache_entry psi_cache[PSI_CACHE_ENTRIES];
+static t_psi_cache_pmt_entry psi_cache_pmts[PSI_CACHE_PMT_ENTRIES];
+static uint64_t psi_cache_clock = 0;
+static pthread_mutex_t psi_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int psi_open_filter(const char *demux_dev, int pid, int table_id, 
+                    int table_mask, int extension)
+{
+    struct dmx_sct_filter_params f;
+    int fd;
+
+    // The filter skips the section length, so the table_id_extension comes
+    // right after the table_id.
+    memset(&f, 0, sizeof(f));
+    f.pid = pid;
+    f.filter.filter[0] = table_id;
+    f.filter.mask[0] = table_mask;
+    f.flags = DMX_IMMEDIATE_START | DMX_CHECK_CRC;
+
+    if (extension >= 0)
+    {
+        f.filter.filter[1] = extension >> 8;
+        f.filter.mask[1] = 0xff;
+        f.filter.filter[2] = extension & 0xff;
+        f.filter.mask[2] = 0xff;
+    }
+
+    if ((fd = zap_open(demux_dev, O_RDWR | O_NONBLOCK)) < 0)
+        return -1;
+
+    if (zap_ioctl(fd, DMX_SET_FILTER, &f) == -1)
+    {
+        zap_close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int psi_open_pat(const char *demux_dev)
+{
+    return psi_open_filter(demux_dev, PID_PAT, TABLE_PAT, 0xff, -1);
+}
+
+// Read one whole section. Returns its length, 0 if none was ready (or it was
+// cut short), or -1 on error.
+static int read_section(int fd, unsigned char *buf, int size)
+{
+    int count, section_length;
+
+    if ((count = zap_read(fd, buf, size)) < 0)
+    {
+        // EOVERFLOW: sections were lost, but they'll come around again.
+        if (errno == EAGAIN || errno == EINTR || errno == EOVERFLOW)
+            return 0;
+
+        return -1;
+    }
+
+    // Long enough for the header and CRC of a table with a syntax section.
+    if (count < 12)
+        return 0;
+
+    section_length = ((buf[1] & 0x0f) << 8) | buf[2];
+    if (count != section_length + 3)
+        return 0;
+
+    return count;
+}
+
+#define SECTION_SKIP -1
+#define SECTION_NEW 0
+#define SECTION_RESTART 1
+
+// Take note of a section. Returns SECTION_SKIP for one that isn't in effect
+// yet or has been seen, and SECTION_RESTART when it's the first of a new 
+// version (whatever was collected before should be dropped).
+static int accept_section(t_sections *sections, const unsigned char *buf)
+{
+    int version = (buf[5] >> 1) & 0x1f;
+    int number = buf[6];
+    int retval = SECTION_NEW;
+
+    if ((buf[5] & 0x01) == 0)
+        return SECTION_SKIP;
+
+    if (sections->started == 0 || sections->version != version)
+    {
+        memset(sections, 0, sizeof(t_sections));
+
+        sections->started = 1;
+        sections->version = version;
+        sections->last_section = buf[7];
+
+        retval = SECTION_RESTART;
+    }
+    else if (sections->seen[number / 8] & (1 << (number % 8)))
+        return SECTION_SKIP;
+
+    sections->seen[number / 8] |= 1 << (number % 8);
+
+    return retval;
+}
+
+static int sections_complete(const t_sections *sections)
+{
+    int i;
+
+    if (sections->started == 0)
+        return 0;
+
+    for (i = 0; i <= sections->last_section; i++)
+        if ((sections->seen[i / 8] & (1 << (i % 8))) == 0)
+            return 0;
+
+    return 1;
+}
+
+int psi_read_pat(int fd, t_pat *pat)
+{
+    unsigned char buf[4096];
+    int count, i;
+
+    if ((count = read_section(fd, buf, sizeof(buf))) <= 0)
+        return count;
+
+    switch (accept_section(&pat->sections, buf))
+    {
+    case SECTION_SKIP:
+        return sections_complete(&pat->sections);
+
+    case SECTION_RESTART:
+        pat->count = 0;
+        break;
+    }
+
+    pat->tsid = (buf[3] << 8) | buf[4];
+    pat->version = pat->sections.version;
+
+    // Programs run from after the header to before the CRC.
+    for (i = 8; i + 4 <= count - 4 && pat->count < PAT_MAX_PROGRAMS; i += 4)
+    {
+        pat->sids[pat->count] = (buf[i] << 8) | buf[i + 1];
+        pat->pmt_pids[pat->count] = ((buf[i + 2] & 0x1f) << 8) | buf[i + 3];
+        pat->count++;
+    }
+
+    return sections_complete(&pat->sections);
+}
+
+int psi_open_pmt(const char *demux_dev, int pmt_pid, int sid)
+{
+    return psi_open_filter(demux_dev, pmt_pid, TABLE_PMT, 0xff, sid);
+}
+
+// What a stream carries, from its type and (for private data) descriptors.
+static int stream_kind(int stream_type, int descriptor_kind)
+{
+    switch (stream_type)
+    {
+    case 0x01:  // MPEG-1
+    case 0x02:  // MPEG-2
+    case 0x10:  // MPEG-4 part 2
+    case 0x1b:  // H.264
+    case 0x24:  // HEVC
+    case 0x42:  // AVS
+    case 0xea:  // VC-1
+        return ES_VIDEO;
+
+    case 0x03:  // MPEG-1
+    case 0x04:  // MPEG-2
+    case 0x0f:  // AAC (ADTS)
+    case 0x11:  // AAC (LATM)
+    case 0x81:  // AC-3 (ATSC)
+    case 0x87:  // E-AC-3 (ATSC)
+        return ES_AUDIO;
+
+    case 0x06:  // PES private data (DVB)
+        return descriptor_kind;
+
+    default:
+        return ES_OTHER;
+    }
+}
+
+// Fill in what the descriptors of a stream tell us.
+static void parse_es_descriptors(t_es_stream *stream, int *kind,
+                                 const unsigned char *buf, int length)
+{
+    int tag, size;
+
+    while (length >= 2)
+    {
+        tag = buf[0];
+        size = buf[1];
+
+        if (size + 2 > length)
+            break;
+
+        switch (tag)
+        {
+        case 0x0a:  // ISO 639 language
+        case 0x59:  // subtitling
+        case 0x56:  // teletext
+            if (size >= 3 && stream->language[0] == 0)
+                memcpy(stream->language, buf + 2, 3);
+
+            if (tag == 0x59)
+                *kind = ES_SUBTITLE;
+            else if (tag == 0x56)
+                *kind = ES_TELETEXT;
+
+            break;
+
+        case 0x6a:  // AC-3
+        case 0x7a:  // E-AC-3
+        case 0x7b:  // DTS
+        case 0x7c:  // AAC
+            *kind = ES_AUDIO;
+            break;
+        }
+
+        buf += size + 2;
+        length -= size + 2;
+    }
+}
+
+int psi_read_pmt(int fd, t_pmt *pmt)
+{
+    unsigned char buf[4096];
+    t_es_stream *stream;
+    int count, i, info_length, kind;
+
+    if ((count = read_section(fd, buf, sizeof(buf))) <= 0)
+        return count;
+
+    switch (accept_section(&pmt->sections, buf))
+    {
+    case SECTION_SKIP:
+        return sections_complete(&pmt->sections);
+
+    case SECTION_RESTART:
+        pmt->count = 0;
+        break;
+    }
+
+    pmt->sid = (buf[3] << 8) | buf[4];
+    pmt->version = pmt->sections.version;
+    pmt->pcr_pid = ((buf[8] & 0x1f) << 8) | buf[9];
+
+    // Skip the program's descriptors. Streams run from there to the CRC.
+    info_length = ((buf[10] & 0x0f) << 8) | buf[11];
+    i = 12 + info_length;
+
+    while (i + 5 <= count - 4 && pmt->count < PMT_MAX_STREAMS)
+    {
+        info_length = ((buf[i + 3] & 0x0f) << 8) | buf[i + 4];
+        if (i + 5 + info_length > count - 4)
+            break;
+
+        stream = &pmt->streams[pmt->count];
+        memset(stream, 0, sizeof(t_es_stream));
+
+        stream->stream_type = buf[i];
+        stream->pid = ((buf[i + 1] & 0x1f) << 8) | buf[i + 2];
+
+        kind = ES_OTHER;
+        parse_es_descriptors(stream, &kind, buf + i + 5, info_length);
+        stream->kind = stream_kind(stream->stream_type, kind);
+
+        pmt->count++;
+        i += 5 + info_length;
+    }
+
+    return sections_complete(&pmt->sections);
+}
+
+// Copy a DVB text field (EN 300 468 annex A) as plain ASCII. A leading
+// character table selector is skipped, and anything unprintable dropped.
+static void copy_text(char *dest, int size, const unsigned char *buf, 
+                      int length)
+{
+    int i, n = 0;
+
+    if (length > 0 && buf[0] < 0x20)
+    {
+        // 0x10 is followed by two more bytes of the table number.
+        i = (buf[0] == 0x10) ? 3 : 1;
+        buf += i;
+        length -= i;
+    }
+
+    for (i = 0; i < length && n < size - 1; i++)
+        if (buf[i] >= 0x20 && buf[i] < 0x7f)
+            dest[n++] = buf[i];
+
+    dest[n] = 0;
+}
+
+// Look through a descriptor loop for the first descriptor with a tag. 
+// Returns a pointer to its body (and sets *size), or NULL.
+static const unsigned char *find_descriptor(const unsigned char *buf, 
+                                            int length, int tag, int *size)
+{
+    while (length >= 2 && buf[1] + 2 <= length)
+    {
+        if (buf[0] == tag)
+        {
+            *size = buf[1];
+            return buf + 2;
+        }
+
+        length -= buf[1] + 2;
+        buf += buf[1] + 2;
+    }
+
+    return NULL;
+}
+
+int psi_open_sdt(const char *demux_dev)
+{
+    return psi_open_filter(demux_dev, PID_SDT, TABLE_SDT, 0xff, -1);
+}
+
+int psi_read_sdt(int fd, t_sdt *sdt)
+{
+    unsigned char buf[4096];
+    const unsigned char *desc;
+    t_sdt_service *service;
+    int count, i, loop_length, size;
+
+    if ((count = read_section(fd, buf, sizeof(buf))) <= 0)
+        return count;
+
+    switch (accept_section(&sdt->sections, buf))
+    {
+    case SECTION_SKIP:
+        return sections_complete(&sdt->sections);
+
+    case SECTION_RESTART:
+        sdt->count = 0;
+        break;
+    }
+
+    sdt->tsid = (buf[3] << 8) | buf[4];
+    sdt->version = sdt->sections.version;
+    sdt->onid = (buf[8] << 8) | buf[9];
+
+    // Services start after the reserved byte and run to the CRC.
+    for (i = 11; i + 5 <= count - 4 && sdt->count < SDT_MAX_SERVICES; 
+         i += 5 + loop_length)
+    {
+        loop_length = ((buf[i + 3] & 0x0f) << 8) | buf[i + 4];
+        if (i + 5 + loop_length > count - 4)
+            break;
+
+        service = &sdt->services[sdt->count++];
+        memset(service, 0, sizeof(t_sdt_service));
+
+        service->sid = (buf[i] << 8) | buf[i + 1];
+        service->running_status = buf[i + 3] >> 5;
+        service->scrambled = (buf[i + 3] >> 4) & 0x01;
+
+        // The service descriptor: type, then provider and service names.
+        desc = find_descriptor(buf + i + 5, loop_length, 0x48, &size);
+        if (desc == NULL || size < 3 || desc[1] + 3 > size)
+            continue;
+
+        service->service_type = desc[0];
+        copy_text(service->provider, sizeof(service->provider), desc + 2, 
+                  desc[1]);
+
+        if (desc[1] + 3 + desc[desc[1] + 2] <= size)
+            copy_text(service->name, sizeof(service->name), 
+                      desc + desc[1] + 3, desc[desc[1] + 2]);
+    }
+
+    return sections_complete(&sdt->sections);
+}
+
+int psi_open_nit(const char *demux_dev)
+{
+    return psi_open_filter(demux_dev, PID_NIT, TABLE_NIT, 0xff, -1);
+}
+
+int psi_read_nit(int fd, t_nit *nit)
+{
+    unsigned char buf[4096];
+    const unsigned char *desc;
+    int count, i, end, loop_length, size;
+
+    if ((count = read_section(fd, buf, sizeof(buf))) <= 0)
+        return count;
+
+    switch (accept_section(&nit->sections, buf))
+    {
+    case SECTION_SKIP:
+        return sections_complete(&nit->sections);
+
+    case SECTION_RESTART:
+        nit->count = 0;
+        nit->name[0] = 0;
+        break;
+    }
+
+    nit->network_id = (buf[3] << 8) | buf[4];
+    nit->version = nit->sections.version;
+
+    // The network descriptors, then the transport streams.
+    loop_length = ((buf[8] & 0x0f) << 8) | buf[9];
+    if (10 + loop_length + 2 > count - 4)
+        return sections_complete(&nit->sections);
+
+    desc = find_descriptor(buf + 10, loop_length, 0x40, &size);
+    if (desc != NULL && nit->name[0] == 0)
+        copy_text(nit->name, sizeof(nit->name), desc, size);
+
+    i = 10 + loop_length;
+    end = i + 2 + (((buf[i] & 0x0f) << 8) | buf[i + 1]);
+    if (end > count - 4)
+        end = count - 4;
+
+    for (i += 2; i + 6 <= end && nit->count < NIT_MAX_STREAMS; 
+         i += 6 + loop_length)
+    {
+        loop_length = ((buf[i + 4] & 0x0f) << 8) | buf[i + 5];
+
+        nit->streams[nit->count].tsid = (buf[i] << 8) | buf[i + 1];
+        nit->streams[nit->count].onid = (buf[i + 2] << 8) | buf[i + 3];
+        nit->count++;
+    }
+
+    return sections_complete(&nit->sections);
+}
+
+int psi_open_vct(const char *demux_dev)
+{
+    // Terrestrial (0xc8) and cable (0xc9) VCTs.
+    return psi_open_filter(demux_dev, PID_PSIP, TABLE_TVCT, 0xfe, -1);
+}
+
+int psi_read_vct(int fd, t_vct *vct)
+{
+    unsigned char buf[4096];
+    t_vct_channel *channel;
+    int count, i, n, channels, loop_length;
+
+    if ((count = read_section(fd, buf, sizeof(buf))) <= 0)
+        return count;
+
+    switch (accept_section(&vct->sections, buf))
+    {
+    case SECTION_SKIP:
+        return sections_complete(&vct->sections);
+
+    case SECTION_RESTART:
+        vct->count = 0;
+        break;
+    }
+
+    vct->tsid = (buf[3] << 8) | buf[4];
+    vct->version = vct->sections.version;
+    vct->cable = (buf[0] == TABLE_CVCT);
+
+    // Fixed 32-byte channel records, each followed by its descriptors.
+    channels = buf[9];
+    for (i = 10; channels > 0 && i + 32 <= count - 4 && 
+                 vct->count < VCT_MAX_CHANNELS; i += 32 + loop_length)
+    {
+        loop_length = ((buf[i + 30] & 0x03) << 8) | buf[i + 31];
+        channels--;
+
+        channel = &vct->channels[vct->count++];
+        memset(channel, 0, sizeof(t_vct_channel));
+
+        // The short name is seven UTF-16 characters.
+        for (n = 0; n < 7 && (buf[i + n * 2] || buf[i + n * 2 + 1]); n++)
+            channel->short_name[n] = (buf[i + n * 2] == 0 && 
+                                      buf[i + n * 2 + 1] >= 0x20 && 
+                                      buf[i + n * 2 + 1] < 0x7f) ? 
+                                     buf[i + n * 2 + 1] : '?';
+
+        channel->major = ((buf[i + 14] & 0x0f) << 6) | (buf[i + 15] >> 2);
+        channel->minor = ((buf[i + 15] & 0x03) << 8) | buf[i + 16];
+        channel->modulation = buf[i + 17];
+        channel->tsid = (buf[i + 22] << 8) | buf[i + 23];
+        channel->sid = (buf[i + 24] << 8) | buf[i + 25];
+        channel->hidden = (buf[i + 26] >> 4) & 0x01;
+        channel->service_type = buf[i + 27] & 0x3f;
+        channel->source_id = (buf[i + 28] << 8) | buf[i + 29];
+    }
+
+    return sections_complete(&vct->sections);
+}
+
+int pat_pmt_pid(const t_pat *pat, int sid)
+{
+    int i;
+
+    // Service 0 is the network PID, not a program.
+    if (sid == 0)
+        return 0;
+
+    for (i = 0; i < pat->count; i++)
+        if (pat->sids[i] == sid)
+            return pat->pmt_pids[i];
+
+    return 0;
+}
+
+static t_psi_cache_entry *find(const t_mux_key *key)
+{
+    int i;
+
+    for (i = 0; i < PSI_CACHE_ENTRIES; i++)
+        if (psi_cache[i].used &&
+            memcmp(&psi_cache[i].key, key, sizeof(t_mux_key)) == 0)
+            return &psi_cache[i];
+
+    return NULL;
+}
+
+int psi_cache_lookup(const t_mux_key *key, t_pat *pat)
+{
+    t_psi_cache_entry *entry;
+    int retval = -1;
+
+    pthread_mutex_lock(&psi_cache_lock);
+
+    if ((entry = find(key)) != NULL)
+    {
+        entry->last_used = ++psi_cache_clock;
+        *pat = entry->pat;
+        retval = 0;
+    }
+
+    pthread_mutex_unlock(&psi_cache_lock);
+
+    return retval;
+}
+
+void psi_cache_store(const t_mux_key *key, const t_pat *pat)
+{
+    t_psi_cache_entry *entry;
+    int i;
+
+    pthread_mutex_lock(&psi_cache_lock);
+
+    if ((entry = find(key)) == NULL)
+    {
+        entry = &psi_cache[0];
+
+        for (i = 0; i < PSI_CACHE_ENTRIES; i++)
+        {
+            if (psi_cache[i].used == 0)
+            {
+                entry = &psi_cache[i];
+                break;
+            }
+
+            if (psi_cache[i].last_used < entry->last_used)
+                entry = &psi_cache[i];
+        }
+
+        entry->used = 1;
+        entry->key = *key;
+    }
+
+    entry->last_used = ++psi_cache_clock;
+    entry->pat = *pat;
+
+    pthread_mutex_unlock(&psi_cache_lock);
+}
+
+static t_psi_cache_pmt_entry *find_pmt(const t_mux_key *key, int sid)
+{
+    int i;
+
+    for (i = 0; i < PSI_CACHE_PMT_ENTRIES; i++)
+        if (psi_cache_pmts[i].used && psi_cache_pmts[i].pmt.sid == sid &&
+            memcmp(&psi_cache_pmts[i].key, key, sizeof(t_mux_key)) == 0)
+            return &psi_cache_pmts[i];
+
+    return NULL;
+}
+
+int psi_cache_lookup_pmt(const t_mux_key *key, int sid, t_pmt *pmt)
+{
+    t_psi_cache_pmt_entry *entry;
+    int retval = -1;
+
+    pthread_mutex_lock(&psi_cache_lock);
+
+    if ((entry = find_pmt(key, sid)) != NULL)
+    {
+        entry->last_used = ++psi_cache_clock;
+        *pmt = entry->pmt;
+        retval = 0;
+    }
+
+    pthread_mutex_unlock(&psi_cache_lock);
+
+    return retval;
+}
+
+void psi_cache_store_pmt(const t_mux_key *key, const t_pmt *pmt)
+{
+    t_psi_cache_pmt_entry *entry;
+    int i;
+
+    pthread_mutex_lock(&psi_cache_lock);
+
+    if ((entry = find_pmt(key, pmt->sid)) == NULL)
+    {
+        entry = &psi_cache_pmts[0];
+
+        for (i = 0; i < PSI_CACHE_PMT_ENTRIES; i++)
+        {
+            if (psi_cache_pmts[i].used == 0)
+            {
+                entry = &psi_cache_pmts[i];
+                break;
+            }
+
+            if (psi_cache_pmts[i].last_used < entry->last_used)
+                entry = &psi_cache_pmts[i];
+        }
+
+        entry->used = 1;
+        entry->key = *key;
+    }
+
+    entry->last_used = ++psi_cache_clock;
+    entry->pmt = *pmt;
+
+    pthread_mutex_unlock(&psi_cache_lock);
+}
+
+void psi_cache_clear(void)
+{
+    pthread_mutex_lock(&psi_cache_lock);
+    memset(psi_cache, 0, sizeof(psi_cache));
+    memset(psi_cache_pmts, 0, sizeof(psi_cache_pmts));
+    pthread_mutex_unlock(&psi_cache_lock);
+}
+
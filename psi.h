@@ -0,0 +1,219 @@
+#ifndef __PSI__H
+#define __PSI__H
+
+#include <stdint.h>
+
+#include <linux/dvb/frontend.h>
+
+// Multiplexes remembered by the PSI cache (the least recently used is
+// replaced).
+#define PSI_CACHE_ENTRIES 32
+
+// PMTs remembered by the PSI cache.
+#define PSI_CACHE_PMT_ENTRIES 64
+
+#define PAT_MAX_PROGRAMS 128
+#define PMT_MAX_STREAMS 32
+#define SDT_MAX_SERVICES 64
+#define NIT_MAX_STREAMS 64
+#define VCT_MAX_CHANNELS 64
+
+// Where the tables are carried.
+#define PID_PAT 0x0000
+#define PID_NIT 0x0010
+#define PID_SDT 0x0011
+#define PID_PSIP 0x1ffb
+
+#define TABLE_PAT 0x00
+#define TABLE_PMT 0x02
+#define TABLE_NIT 0x40
+#define TABLE_SDT 0x42
+#define TABLE_TVCT 0xc8
+#define TABLE_CVCT 0xc9
+
+// What an elementary stream carries (t_es_stream.kind).
+#define ES_OTHER 0
+#define ES_VIDEO 1
+#define ES_AUDIO 2
+#define ES_SUBTITLE 3
+#define ES_TELETEXT 4
+
+// Identifies a multiplex by how it was tuned. Zero it before filling it in,
+// since keys are compared byte for byte.
+typedef struct
+{
+    fe_type_t fe_type;
+    struct dvb_frontend_parameters params;
+
+    // Anything else that selects the multiplex (DVB-S: the polarization and
+    // satellite).
+    uint32_t extra;
+} t_mux_key;
+
+// The sections of a table received so far. A table is complete once every
+// section of one version has arrived. Zero it to start over.
+typedef struct
+{
+    int started;
+    int version;
+    int last_section;
+    uint8_t seen[32];
+} t_sections;
+
+// A program association table: where to find each service's PMT. Zero it 
+// before reading into it.
+typedef struct
+{
+    t_sections sections;
+
+    int tsid;
+    int version;
+
+    int count;
+    uint16_t sids[PAT_MAX_PROGRAMS];
+    uint16_t pmt_pids[PAT_MAX_PROGRAMS];
+} t_pat;
+
+typedef struct
+{
+    uint8_t stream_type;
+    uint8_t kind;
+    uint16_t pid;
+
+    // ISO 639 code, or empty.
+    char language[4];
+} t_es_stream;
+
+// A program map table: a service's elementary streams. Zero it before 
+// reading into it.
+typedef struct
+{
+    t_sections sections;
+
+    int sid;
+    int version;
+    int pcr_pid;
+
+    int count;
+    t_es_stream streams[PMT_MAX_STREAMS];
+} t_pmt;
+
+typedef struct
+{
+    uint16_t sid;
+    uint8_t service_type;
+    uint8_t running_status;
+    uint8_t scrambled;
+
+    char provider[32];
+    char name[32];
+} t_sdt_service;
+
+// A service description table (for the tuned transport stream).
+typedef struct
+{
+    t_sections sections;
+
+    int tsid;
+    int onid;
+    int version;
+
+    int count;
+    t_sdt_service services[SDT_MAX_SERVICES];
+} t_sdt;
+
+typedef struct
+{
+    uint16_t tsid;
+    uint16_t onid;
+} t_nit_stream;
+
+// A network information table (for the tuned network): the transport 
+// streams it carries.
+typedef struct
+{
+    t_sections sections;
+
+    int network_id;
+    int version;
+    char name[32];
+
+    int count;
+    t_nit_stream streams[NIT_MAX_STREAMS];
+} t_nit;
+
+typedef struct
+{
+    char short_name[8];
+    uint16_t major;
+    uint16_t minor;
+    uint8_t modulation;
+    uint8_t service_type;
+    uint8_t hidden;
+
+    uint16_t tsid;
+    uint16_t sid;
+    uint16_t source_id;
+} t_vct_channel;
+
+// An ATSC virtual channel table (terrestrial or cable).
+typedef struct
+{
+    t_sections sections;
+
+    int tsid;
+    int version;
+    int cable;
+
+    int count;
+    t_vct_channel channels[VCT_MAX_CHANNELS];
+} t_vct;
+
+// Open a non-blocking section filter for table_id (under table_mask) on a 
+// PID, and for one table_id_extension unless that's -1. Returns -1 on 
+// failure.
+int psi_open_filter(const char *demux_dev, int pid, int table_id, 
+                    int table_mask, int extension);
+
+// Open a non-blocking section filter for the PAT, or -1.
+int psi_open_pat(const char *demux_dev);
+
+// Read a section from a PAT filter. Returns 1 once every section of the PAT
+// has been read, 0 if more are needed (or nothing was ready), or -1 on error.
+// A new version starts the table over.
+int psi_read_pat(int fd, t_pat *pat);
+
+// Open a non-blocking section filter for a service's PMT, or -1.
+int psi_open_pmt(const char *demux_dev, int pmt_pid, int sid);
+
+// As psi_read_pat(), for a PMT.
+int psi_read_pmt(int fd, t_pmt *pmt);
+
+// The same for the SDT and NIT of the tuned transport stream, and the ATSC
+// VCT.
+int psi_open_sdt(const char *demux_dev);
+int psi_read_sdt(int fd, t_sdt *sdt);
+
+int psi_open_nit(const char *demux_dev);
+int psi_read_nit(int fd, t_nit *nit);
+
+int psi_open_vct(const char *demux_dev);
+int psi_read_vct(int fd, t_vct *vct);
+
+// The PMT PID of a service, or 0 if the PAT doesn't have it.
+int pat_pmt_pid(const t_pat *pat, int sid);
+
+// The process-wide cache of PATs by multiplex, so that a retune to a known
+// multiplex needn't wait for the PAT. Safe to use from any thread.
+int psi_cache_lookup(const t_mux_key *key, t_pat *pat);
+void psi_cache_store(const t_mux_key *key, const t_pat *pat);
+
+// The same for the PMTs of services on a multiplex.
+int psi_cache_lookup_pmt(const t_mux_key *key, int sid, t_pmt *pmt);
+void psi_cache_store_pmt(const t_mux_key *key, const t_pmt *pmt);
+
+// Forget everything (e.g. after a rescan).
+void psi_cache_clear(void);
+
+#endif
+
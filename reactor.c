@@ -0,0 +1,598 @@
+// A single-threaded event loop for many sessions (see reactor.h).
+
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+
+#include <linux/dvb/frontend.h>
+
+#include "util.h"
+#include "backend.h"
+#include "zaptypes.h"
+#include "session.h"
+#include "frontend.h"
+#include "trace.h"
+#include "reactor.h"
+
+// The epoll data of the reactor's own descriptors. Those of sessions are
+// their slot << 8, plus the index of the descriptor (see
+// zap_session_watch()), or STREAM_INDEX for the stream.
+#define TAG_TIMER 0xffffffffULL
+#define TAG_STOP 0xfffffffeULL
+#define STREAM_INDEX MONITOR_FDS
+
+static void close_fd(int *fd)
+{
+    if (*fd >= 0)
+    {
+        close(*fd);
+        *fd = -1;
+    }
+}
+
+static void wheel_init(t_zap_reactor *reactor)
+{
+    int i;
+
+    for (i = 0; i < REACTOR_WHEEL_SLOTS; i++)
+        reactor->slots[i].next = reactor->slots[i].prev = &reactor->slots[i];
+
+    reactor->wheel_tick = monotonic_us() / REACTOR_TICK_US;
+    reactor->timer_tick = 0;
+    reactor->timers = 0;
+}
+
+static void wheel_cancel(t_zap_reactor *reactor, t_wheel_timer *timer)
+{
+    if (timer->armed == 0)
+        return;
+
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->armed = 0;
+
+    reactor->timers--;
+}
+
+// Have the timer expire at a monotonic_us() time (on the next tick at the
+// earliest).
+static void wheel_arm(t_zap_reactor *reactor, t_wheel_timer *timer,
+                      int64_t at_us)
+{
+    int64_t tick = (at_us + REACTOR_TICK_US - 1) / REACTOR_TICK_US;
+    t_wheel_timer *head;
+
+    if (tick <= reactor->wheel_tick)
+        tick = reactor->wheel_tick + 1;
+
+    if (timer->armed && timer->expires == tick)
+        return;
+
+    wheel_cancel(reactor, timer);
+
+    head = &reactor->slots[tick % REACTOR_WHEEL_SLOTS];
+
+    timer->expires = tick;
+    timer->next = head->next;
+    timer->prev = head;
+    head->next->prev = timer;
+    head->next = timer;
+    timer->armed = 1;
+
+    reactor->timers++;
+}
+
+// Set timer_fd for the first timer in the wheel (or disarm it).
+static void wheel_schedule(t_zap_reactor *reactor)
+{
+    struct itimerspec spec;
+    t_wheel_timer *head, *timer;
+    int64_t tick, next = 0;
+    int i;
+
+    // Every timer in a slot expires on its tick or a whole number of turns
+    // of the wheel later, so the first one expiring on its slot's tick is 
+    // the next. Failing that, it's the nearest of the later turns.
+    for (i = 1; i <= REACTOR_WHEEL_SLOTS && reactor->timers > 0; i++)
+    {
+        tick = reactor->wheel_tick + i;
+        head = &reactor->slots[tick % REACTOR_WHEEL_SLOTS];
+
+        for (timer = head->next; timer != head; timer = timer->next)
+            if (next == 0 || timer->expires < next)
+                next = timer->expires;
+
+        if (next == tick)
+            break;
+    }
+
+    if (next == reactor->timer_tick)
+        return;
+
+    memset(&spec, 0, sizeof(spec));
+
+    if (next != 0)
+    {
+        spec.it_value.tv_sec = next * REACTOR_TICK_US / 1000000;
+        spec.it_value.tv_nsec = (next * REACTOR_TICK_US % 1000000) * 1000;
+    }
+
+    timerfd_settime(reactor->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+    reactor->timer_tick = next;
+}
+
+static t_reactor_entry *find_entry(t_zap_reactor *reactor,
+                                   t_zap_session *session)
+{
+    if (session->reactor != reactor || session->reactor_slot < 0 ||
+        session->reactor_slot >= reactor->count)
+        return NULL;
+
+    return &reactor->entries[session->reactor_slot];
+}
+
+static void watch_stream(t_zap_reactor *reactor, t_reactor_entry *entry,
+                         int op)
+{
+    struct epoll_event event;
+    int slot = entry - reactor->entries;
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u64 = ((uint64_t)slot << 8) | STREAM_INDEX;
+
+    epoll_ctl(reactor->epoll_fd, op, entry->reader->fd, &event);
+}
+
+static void stop_stream(t_zap_reactor *reactor, t_reactor_entry *entry)
+{
+    if (entry->reader == NULL)
+        return;
+
+    watch_stream(reactor, entry, EPOLL_CTL_DEL);
+    entry->reader = NULL;
+}
+
+static void read_stream(t_zap_reactor *reactor, t_reactor_entry *entry)
+{
+    if (entry->reader == NULL ||
+        dvr_reader_process(entry->reader, entry->receiver,
+                           entry->receiver_context) > 0)
+        return;
+
+    stop_stream(reactor, entry);
+
+    if (entry->handler != NULL)
+        entry->handler(entry->session, REACTOR_STREAM_END, entry->context);
+}
+
+// Take the session's tune as far as it can go without waiting, given the
+// descriptors that are ready (pfd, or NULL for none), and then watch for
+// what it waits on next.
+static void step(t_zap_reactor *reactor, t_reactor_entry *entry,
+                 struct pollfd *pfd)
+{
+    t_zap_session *session = entry->session;
+    struct pollfd ready[MONITOR_FDS];
+    int64_t wake_us, tick_us;
+    int slot = entry - reactor->entries;
+    int pollable = zap_backend_pollable();
+    int i;
+
+    if (session->monitor.running == 0)
+        return;
+
+    // The kernel can't tell when other backends' descriptors are ready.
+    if (pfd == NULL && pollable == 0)
+    {
+        monitor_pollfds(session, ready, &wake_us);
+
+        if (zap_poll(ready, MONITOR_FDS, 0) >= 0)
+            pfd = ready;
+    }
+
+    if (monitor_process(session, pfd))
+    {
+        monitor_pollfds(session, ready, &wake_us);
+
+        if (pollable == 0)
+        {
+            for (i = 1; i < MONITOR_FDS; i++)
+                ready[i].fd = -1;
+
+            tick_us = monotonic_us() + ZAP_BACKEND_TICK_MS * 1000;
+            if (tick_us < wake_us)
+                wake_us = tick_us;
+        }
+
+        zap_session_watch(session, reactor->epoll_fd, ready, slot);
+        wheel_arm(reactor, &entry->timer, wake_us);
+
+        return;
+    }
+
+    for (i = 0; i < MONITOR_FDS; i++)
+        ready[i].fd = -1;
+
+    zap_session_watch(session, reactor->epoll_fd, ready, slot);
+
+    // A stream read from another backend still needs its ticks.
+    if (entry->reader == NULL || pollable)
+        wheel_cancel(reactor, &entry->timer);
+
+    ZAP_TRACE(TRACE_TUNE_END, session->tuner.adapter, 0,
+              session->stats.lock_latency_us);
+    zap_session_end_tune(session);
+
+    if (entry->handler != NULL)
+        entry->handler(session, REACTOR_TUNE_DONE, entry->context);
+}
+
+// A session's timer: whatever's due in its tune, and the stream when it
+// can't be watched.
+static void expire(t_zap_reactor *reactor, t_reactor_entry *entry)
+{
+    step(reactor, entry, NULL);
+
+    if (entry->session == NULL || entry->reader == NULL ||
+        zap_backend_pollable())
+        return;
+
+    read_stream(reactor, entry);
+
+    if (entry->reader != NULL && entry->timer.armed == 0)
+        wheel_arm(reactor, &entry->timer,
+                  monotonic_us() + ZAP_BACKEND_TICK_MS * 1000);
+}
+
+// Fire every timer due by now.
+static void wheel_advance(t_zap_reactor *reactor)
+{
+    t_wheel_timer *head, *timer, *next;
+    t_reactor_entry *entry;
+    int64_t now_tick = monotonic_us() / REACTOR_TICK_US, steps, i;
+    int due[REACTOR_MAX_SESSIONS], count = 0, j;
+
+    if (now_tick <= reactor->wheel_tick)
+        return;
+
+    steps = now_tick - reactor->wheel_tick;
+    if (steps > REACTOR_WHEEL_SLOTS)
+        steps = REACTOR_WHEEL_SLOTS;
+
+    // Take them out first, since handlers may rearm any of them (each 
+    // session has one).
+    for (i = 1; i <= steps; i++)
+    {
+        head = &reactor->slots[(reactor->wheel_tick + i) %
+                               REACTOR_WHEEL_SLOTS];
+
+        for (timer = head->next; timer != head; timer = next)
+        {
+            next = timer->next;
+
+            if (timer->expires > now_tick)
+                continue;
+
+            wheel_cancel(reactor, timer);
+
+            entry = (t_reactor_entry *)((char *)timer - 
+                                        offsetof(t_reactor_entry, timer));
+            due[count++] = entry - reactor->entries;
+        }
+    }
+
+    reactor->wheel_tick = now_tick;
+
+    // Sessions removed meanwhile are skipped.
+    for (j = 0; j < count; j++)
+        if (reactor->entries[due[j]].session != NULL)
+            expire(reactor, &reactor->entries[due[j]]);
+}
+
+int zap_reactor_init(t_zap_reactor *reactor)
+{
+    struct epoll_event event;
+
+    memset(reactor, 0, sizeof(t_zap_reactor));
+
+    reactor->timer_fd = -1;
+    reactor->stop_fd = -1;
+
+    wheel_init(reactor);
+
+    if ((reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        return -1;
+
+    if ((reactor->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+                                            TFD_NONBLOCK | TFD_CLOEXEC)) < 0 ||
+        (reactor->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        goto failed;
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+
+    event.data.u64 = TAG_TIMER;
+    if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, reactor->timer_fd,
+                  &event) < 0)
+        goto failed;
+
+    event.data.u64 = TAG_STOP;
+    if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, reactor->stop_fd,
+                  &event) < 0)
+        goto failed;
+
+    return 0;
+
+failed:
+    close_fd(&reactor->stop_fd);
+    close_fd(&reactor->timer_fd);
+    close_fd(&reactor->epoll_fd);
+
+    return -1;
+}
+
+int zap_reactor_add(t_zap_reactor *reactor, t_zap_session *session,
+                    ReactorHandler handler, void *context)
+{
+    t_reactor_entry *entry;
+    int slot, i;
+
+    for (slot = 0; slot < reactor->count; slot++)
+        if (reactor->entries[slot].session == NULL)
+            break;
+
+    if (slot == REACTOR_MAX_SESSIONS)
+        return -1;
+
+    if (slot == reactor->count)
+        reactor->count++;
+
+    entry = &reactor->entries[slot];
+    memset(entry, 0, sizeof(t_reactor_entry));
+
+    entry->session = session;
+    entry->handler = handler;
+    entry->context = context;
+
+    session->reactor = reactor;
+    session->reactor_slot = slot;
+
+    for (i = 0; i < MONITOR_FDS; i++)
+        session->watched_fds[i] = -1;
+
+    return 0;
+}
+
+void zap_reactor_remove(t_zap_reactor *reactor, t_zap_session *session)
+{
+    t_reactor_entry *entry;
+    struct pollfd pfd[MONITOR_FDS];
+    int i;
+
+    if ((entry = find_entry(reactor, session)) == NULL)
+        return;
+
+    for (i = 0; i < MONITOR_FDS; i++)
+        pfd[i].fd = -1;
+
+    zap_session_watch(session, reactor->epoll_fd, pfd, 0);
+    stop_stream(reactor, entry);
+    wheel_cancel(reactor, &entry->timer);
+
+    session->monitor.running = 0;
+    session->reactor = NULL;
+
+    if (entry->owned)
+    {
+        zap_session_destroy(session);
+        free(session);
+    }
+
+    entry->session = NULL;
+
+    while (reactor->count > 0 &&
+           reactor->entries[reactor->count - 1].session == NULL)
+        reactor->count--;
+}
+
+int zap_reactor_discover(t_zap_reactor *reactor,
+                         const t_tune_options *options,
+                         ReactorHandler handler, void *context)
+{
+    t_tuner_descriptor tuner;
+    t_zap_session *session;
+    char path[80];
+    int adapter, frontend, fd, found = 0;
+
+    for (adapter = 0; adapter < REACTOR_MAX_ADAPTERS; adapter++)
+    {
+        for (frontend = 0; frontend < REACTOR_MAX_FRONTENDS; frontend++)
+        {
+            // Frontends opened read-only aren't powered up.
+            snprintf(path, sizeof(path), "/dev/dvb/adapter%i/frontend%i",
+                     adapter, frontend);
+
+            if ((fd = zap_open(path, O_RDONLY | O_NONBLOCK)) < 0)
+                break;
+
+            zap_close(fd);
+
+            if ((session = malloc(sizeof(t_zap_session))) == NULL)
+                return -1;
+
+            tuner.adapter = adapter;
+            tuner.frontend = frontend;
+            tuner.demux = frontend;
+
+            if (zap_session_init(session, tuner, options) < 0)
+            {
+                free(session);
+                return -1;
+            }
+
+            if (zap_reactor_add(reactor, session, handler, context) < 0)
+            {
+                zap_session_destroy(session);
+                free(session);
+                return found;
+            }
+
+            reactor->entries[session->reactor_slot].owned = 1;
+            found++;
+        }
+    }
+
+    return found;
+}
+
+int zap_reactor_count(t_zap_reactor *reactor)
+{
+    return reactor->count;
+}
+
+t_zap_session *zap_reactor_session(t_zap_reactor *reactor, int index)
+{
+    if (index < 0 || index >= reactor->count)
+        return NULL;
+
+    return reactor->entries[index].session;
+}
+
+int zap_reactor_read(t_zap_reactor *reactor, t_zap_session *session,
+                     t_dvr_reader *reader, PacketReceiver receiver,
+                     void *context)
+{
+    t_reactor_entry *entry;
+
+    if ((entry = find_entry(reactor, session)) == NULL)
+        return -1;
+
+    stop_stream(reactor, entry);
+
+    if (reader == NULL)
+        return 0;
+
+    entry->reader = reader;
+    entry->receiver = receiver;
+    entry->receiver_context = context;
+
+    if (zap_backend_pollable())
+        watch_stream(reactor, entry, EPOLL_CTL_ADD);
+    else
+        wheel_arm(reactor, &entry->timer, monotonic_us());
+
+    wheel_schedule(reactor);
+    return 0;
+}
+
+void zap_reactor_kick(t_zap_reactor *reactor, t_zap_session *session)
+{
+    t_reactor_entry *entry;
+
+    if ((entry = find_entry(reactor, session)) == NULL)
+        return;
+
+    step(reactor, entry, NULL);
+    wheel_schedule(reactor);
+}
+
+int zap_reactor_fd(t_zap_reactor *reactor)
+{
+    return reactor->epoll_fd;
+}
+
+int zap_reactor_dispatch(t_zap_reactor *reactor, int timeout_ms)
+{
+    struct epoll_event events[REACTOR_EVENTS];
+    struct pollfd pfd[MONITOR_FDS];
+    t_reactor_entry *entry;
+    uint64_t tag, count;
+    int64_t wake_us;
+    int i, n, slot, index;
+
+    if ((n = epoll_wait(reactor->epoll_fd, events, REACTOR_EVENTS,
+                        timeout_ms)) < 0)
+        return (errno == EINTR) ? 0 : -1;
+
+    for (i = 0; i < n; i++)
+    {
+        tag = events[i].data.u64;
+
+        if (tag == TAG_TIMER || tag == TAG_STOP)
+        {
+            if (read(tag == TAG_TIMER ? reactor->timer_fd : reactor->stop_fd,
+                     &count, sizeof(count)) > 0 && tag == TAG_STOP)
+                reactor->stopped = 1;
+
+            continue;
+        }
+
+        slot = tag >> 8;
+        index = tag & 0xff;
+
+        // Removed by an earlier handler.
+        if (slot >= reactor->count ||
+            (entry = &reactor->entries[slot])->session == NULL)
+            continue;
+
+        if (index == STREAM_INDEX)
+        {
+            read_stream(reactor, entry);
+            continue;
+        }
+
+        monitor_pollfds(entry->session, pfd, &wake_us);
+
+        pfd[index].revents =
+            ((events[i].events & EPOLLIN) ? POLLIN : 0) |
+            ((events[i].events & EPOLLPRI) ? POLLPRI : 0) |
+            ((events[i].events & (EPOLLERR | EPOLLHUP)) ? POLLERR : 0);
+
+        step(reactor, entry, pfd);
+    }
+
+    wheel_advance(reactor);
+    wheel_schedule(reactor);
+
+    return n;
+}
+
+int zap_reactor_run(t_zap_reactor *reactor)
+{
+    reactor->stopped = 0;
+
+    while (reactor->stopped == 0)
+        if (zap_reactor_dispatch(reactor, -1) < 0)
+            return -1;
+
+    return 0;
+}
+
+void zap_reactor_stop(t_zap_reactor *reactor)
+{
+    eventfd_write(reactor->stop_fd, 1);
+}
+
+void zap_reactor_destroy(t_zap_reactor *reactor)
+{
+    int slot;
+
+    for (slot = reactor->count - 1; slot >= 0; slot--)
+        if (reactor->entries[slot].session != NULL)
+            zap_reactor_remove(reactor, reactor->entries[slot].session);
+
+    close_fd(&reactor->stop_fd);
+    close_fd(&reactor->timer_fd);
+    close_fd(&reactor->epoll_fd);
+}
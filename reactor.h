@@ -0,0 +1,136 @@
+#ifndef __REACTOR__H
+#define __REACTOR__H
+
+#include <stdint.h>
+
+#include "zaptypes.h"
+#include "session.h"
+#include "dvr.h"
+
+// Sessions a reactor can drive, and adapters (frontends within each)
+// zap_reactor_discover() looks for.
+#define REACTOR_MAX_SESSIONS 128
+#define REACTOR_MAX_ADAPTERS 32
+#define REACTOR_MAX_FRONTENDS 4
+
+// The timer wheel: one slot per tick, so timers more than
+// REACTOR_WHEEL_SLOTS ticks away go around more than once.
+#define REACTOR_TICK_US 1000
+#define REACTOR_WHEEL_SLOTS 1024
+
+// Epoll events handled per zap_reactor_dispatch().
+#define REACTOR_EVENTS 64
+
+// What a session's handler is told.
+#define REACTOR_TUNE_DONE 1
+#define REACTOR_STREAM_END 2
+
+// Called from zap_reactor_dispatch() when a tune started by a *_tune_start()
+// call is over (REACTOR_TUNE_DONE: the receiver returned 0 and the PSI was
+// found or given up on, or the session was cancelled), or when the stream
+// given to zap_reactor_read() has ended (REACTOR_STREAM_END). The handler
+// may start another tune.
+typedef void (*ReactorHandler)(t_zap_session *session, int event,
+                               void *context);
+
+typedef struct t_wheel_timer
+{
+    struct t_wheel_timer *next;
+    struct t_wheel_timer *prev;
+
+    // The tick it expires on, and whether it's in the wheel.
+    int64_t expires;
+    int armed;
+} t_wheel_timer;
+
+typedef struct
+{
+    t_zap_session *session;
+    ReactorHandler handler;
+    void *context;
+
+    // Whether the session was created (and is freed) by the reactor.
+    int owned;
+
+    // The stream being read (see zap_reactor_read()), NULL if none.
+    t_dvr_reader *reader;
+    PacketReceiver receiver;
+    void *receiver_context;
+
+    // When the session next has something to do.
+    t_wheel_timer timer;
+} t_reactor_entry;
+
+// Drives the tunes and streams of any number of sessions from one thread:
+// every frontend, section filter and stream descriptor is in a single epoll
+// set, and status samples and PSI deadlines are timers on a wheel behind a
+// single timerfd.
+typedef struct zap_reactor
+{
+    int epoll_fd;
+    int timer_fd;
+    int stop_fd;
+    int stopped;
+
+    t_reactor_entry entries[REACTOR_MAX_SESSIONS];
+    int count;
+
+    // The wheel, as of wheel_tick (monotonic_us() / REACTOR_TICK_US), with
+    // a list head per slot, and the tick timer_fd is set for (0 if none).
+    t_wheel_timer slots[REACTOR_WHEEL_SLOTS];
+    int64_t wheel_tick;
+    int64_t timer_tick;
+    int timers;
+} t_zap_reactor;
+
+int zap_reactor_init(t_zap_reactor *reactor);
+
+// Have the reactor drive a session's tunes (those started by the
+// *_tune_start() calls) and streams, reporting to the handler. Returns -1 if
+// there's no room. Remove a session before destroying it.
+int zap_reactor_add(t_zap_reactor *reactor, t_zap_session *session,
+                    ReactorHandler handler, void *context);
+
+void zap_reactor_remove(t_zap_reactor *reactor, t_zap_session *session);
+
+// Add a session (with the given options, which may be NULL) for each
+// frontend found on adapters 0 to REACTOR_MAX_ADAPTERS - 1, through the
+// current backend. The frontends are only opened read-only to be found,
+// so they aren't powered up. Returns how many were added, or -1.
+int zap_reactor_discover(t_zap_reactor *reactor,
+                         const t_tune_options *options,
+                         ReactorHandler handler, void *context);
+
+// The sessions in the reactor by their place in it (session->reactor_slot),
+// NULL where one was removed.
+int zap_reactor_count(t_zap_reactor *reactor);
+t_zap_session *zap_reactor_session(t_zap_reactor *reactor, int index);
+
+// Hand the session's stream (see zap_session_open_dvr()) to the receiver
+// as it arrives, until the receiver returns 0 or reading fails. A NULL
+// reader stops reading.
+int zap_reactor_read(t_zap_reactor *reactor, t_zap_session *session,
+                     t_dvr_reader *reader, PacketReceiver receiver,
+                     void *context);
+
+// Called by the tune calls once a session's tune is being monitored.
+void zap_reactor_kick(t_zap_reactor *reactor, t_zap_session *session);
+
+// A descriptor that's readable whenever zap_reactor_dispatch() has
+// something to do, for running the reactor from another event loop.
+int zap_reactor_fd(t_zap_reactor *reactor);
+
+// Wait up to timeout_ms (-1 for no limit) and handle what's ready. Returns
+// the number of events handled, or -1 on failure.
+int zap_reactor_dispatch(t_zap_reactor *reactor, int timeout_ms);
+
+// Dispatch until zap_reactor_stop() is called, from any thread or a signal
+// handler.
+int zap_reactor_run(t_zap_reactor *reactor);
+void zap_reactor_stop(t_zap_reactor *reactor);
+
+// Remove every session (destroying those it discovered) and release the
+// reactor.
+void zap_reactor_destroy(t_zap_reactor *reactor);
+
+#endif
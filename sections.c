@@ -0,0 +1,227 @@
+// Deadline-bounded acquisition of several PSI tables at once (see sections.h).
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+
+#include "util.h"
+#include "backend.h"
+#include "psi.h"
+#include "sections.h"
+
+static unsigned int default_timeout_ms(int table)
+{
+    return (table == PSI_NIT) ? PSI_NIT_TIMEOUT_MS : PSI_DEFAULT_TIMEOUT_MS;
+}
+
+static int open_request(const char *demux_dev, t_psi_request *request)
+{
+    switch (request->table)
+    {
+    case PSI_PAT:  return psi_open_pat(demux_dev);
+    case PSI_PMT:  return psi_open_pmt(demux_dev, request->pid, request->sid);
+    case PSI_SDT:  return psi_open_sdt(demux_dev);
+    case PSI_NIT:  return psi_open_nit(demux_dev);
+    case PSI_VCT:  return psi_open_vct(demux_dev);
+    default:       return -1;
+    }
+}
+
+static int read_request(int fd, t_psi_request *request)
+{
+    switch (request->table)
+    {
+    case PSI_PAT:  return psi_read_pat(fd, &request->u.pat);
+    case PSI_PMT:  return psi_read_pmt(fd, &request->u.pmt);
+    case PSI_SDT:  return psi_read_sdt(fd, &request->u.sdt);
+    case PSI_NIT:  return psi_read_nit(fd, &request->u.nit);
+    case PSI_VCT:  return psi_read_vct(fd, &request->u.vct);
+    default:       return -1;
+    }
+}
+
+static void finish(t_psi_request *request, int *fd, int status,
+                   int64_t elapsed_us)
+{
+    if (*fd >= 0)
+    {
+        zap_close(*fd);
+        *fd = -1;
+    }
+
+    request->status = status;
+    request->elapsed_us = elapsed_us;
+}
+
+static int pat_pending(const t_psi_request *requests, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+        if (requests[i].table == PSI_PAT && requests[i].status == PSI_PENDING)
+            return 1;
+
+    return 0;
+}
+
+// A PAT has arrived: start the PMTs that were waiting for it.
+static void start_pmts(const char *demux_dev, t_psi_request *requests,
+                       int *fds, int count, const t_pat *pat,
+                       int64_t elapsed_us)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        if (requests[i].table != PSI_PMT || requests[i].status != PSI_PENDING
+            || requests[i].pid != 0 || fds[i] >= 0)
+            continue;
+
+        if ((requests[i].pid = pat_pmt_pid(pat, requests[i].sid)) == 0)
+            finish(&requests[i], &fds[i], PSI_NOT_FOUND, elapsed_us);
+        else if ((fds[i] = open_request(demux_dev, &requests[i])) < 0)
+            finish(&requests[i], &fds[i], PSI_FAILED, elapsed_us);
+    }
+}
+
+int psi_acquire(const char *demux_dev, t_psi_request *requests, int count,
+                int cancel_fd)
+{
+    struct pollfd pfd[PSI_MAX_REQUESTS + 1];
+    int fds[PSI_MAX_REQUESTS], map[PSI_MAX_REQUESTS];
+    int64_t start_us = monotonic_us(), now_us, deadline_us, next_us;
+    int i, n, pending, completed = 0, retval;
+
+    if (count > PSI_MAX_REQUESTS)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        fds[i] = -1;
+
+        requests[i].status = PSI_PENDING;
+        requests[i].elapsed_us = 0;
+        memset(&requests[i].u, 0, sizeof(requests[i].u));
+
+        if (requests[i].timeout_ms == 0)
+            requests[i].timeout_ms = default_timeout_ms(requests[i].table);
+
+        // A PMT without a PID waits for the PAT.
+        if (requests[i].table == PSI_PMT && requests[i].pid == 0)
+            continue;
+
+        if ((fds[i] = open_request(demux_dev, &requests[i])) < 0)
+            finish(&requests[i], &fds[i], PSI_FAILED, 0);
+    }
+
+    while (1)
+    {
+        now_us = monotonic_us();
+        next_us = -1;
+        pending = 0;
+        n = 0;
+
+        for (i = 0; i < count; i++)
+        {
+            if (requests[i].status != PSI_PENDING)
+                continue;
+
+            deadline_us = start_us + requests[i].timeout_ms * 1000LL;
+
+            if (now_us >= deadline_us)
+            {
+                finish(&requests[i], &fds[i], PSI_TIMED_OUT,
+                       now_us - start_us);
+                continue;
+            }
+
+            if (next_us < 0 || deadline_us < next_us)
+                next_us = deadline_us;
+
+            // PMTs still waiting for the PAT have no filter yet, and give up
+            // with it.
+            if (fds[i] < 0)
+            {
+                if (pat_pending(requests, count) == 0)
+                    finish(&requests[i], &fds[i], PSI_FAILED, 
+                           now_us - start_us);
+                else
+                    pending++;
+
+                continue;
+            }
+
+            pending++;
+
+            pfd[n].fd = fds[i];
+            pfd[n].events = POLLIN;
+            pfd[n].revents = 0;
+            map[n++] = i;
+        }
+
+        if (pending == 0)
+            break;
+
+        pfd[n].fd = cancel_fd;
+        pfd[n].events = POLLIN;
+        pfd[n].revents = 0;
+
+        if (zap_poll(pfd, n + 1, (next_us - now_us + 999) / 1000) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            for (i = 0; i < count; i++)
+                if (requests[i].status == PSI_PENDING)
+                    finish(&requests[i], &fds[i], PSI_FAILED,
+                           now_us - start_us);
+
+            break;
+        }
+
+        if (pfd[n].revents != 0)
+        {
+            for (i = 0; i < count; i++)
+                if (requests[i].status == PSI_PENDING)
+                    finish(&requests[i], &fds[i], PSI_CANCELLED,
+                           now_us - start_us);
+
+            return -1;
+        }
+
+        for (n = n - 1; n >= 0; n--)
+        {
+            if (pfd[n].revents == 0)
+                continue;
+
+            i = map[n];
+
+            if ((retval = read_request(fds[i], &requests[i])) == 0)
+                continue;
+
+            now_us = monotonic_us();
+
+            if (retval < 0)
+            {
+                finish(&requests[i], &fds[i], PSI_FAILED, now_us - start_us);
+                continue;
+            }
+
+            finish(&requests[i], &fds[i], PSI_COMPLETE, now_us - start_us);
+            completed++;
+
+            if (requests[i].table == PSI_PAT)
+                start_pmts(demux_dev, requests, fds, count,
+                           &requests[i].u.pat, now_us - start_us);
+        }
+    }
+
+    return completed;
+}
+
@@ -0,0 +1,69 @@
+#ifndef __SECTIONS__H
+#define __SECTIONS__H
+
+#include <stdint.h>
+
+#include "psi.h"
+
+#define PSI_MAX_REQUESTS 16
+
+// Tables for t_psi_request.table.
+#define PSI_PAT 0
+#define PSI_PMT 1
+#define PSI_SDT 2
+#define PSI_NIT 3
+#define PSI_VCT 4
+
+// Default deadlines: a little over the longest repetition interval allowed
+// for each table (EN 300 468, A/65), plus time for the frontend to lock.
+#define PSI_DEFAULT_TIMEOUT_MS 5000
+#define PSI_NIT_TIMEOUT_MS 15000
+
+// Values of t_psi_request.status.
+#define PSI_PENDING 0
+#define PSI_COMPLETE 1
+#define PSI_TIMED_OUT -1
+#define PSI_NOT_FOUND -2
+#define PSI_FAILED -3
+#define PSI_CANCELLED -4
+
+typedef struct
+{
+    // PSI_PAT, PSI_PMT, PSI_SDT, PSI_NIT or PSI_VCT.
+    int table;
+
+    // For PSI_PMT: the service, and the PID carrying its PMT. A pid of 0
+    // takes it from a PAT requested in the same call (the PMT is then
+    // PSI_NOT_FOUND if the PAT doesn't list the service).
+    int sid;
+    int pid;
+
+    // Milliseconds from the start of the call. Zero selects the default.
+    unsigned int timeout_ms;
+
+    // Filled in by psi_acquire(): a PSI_* status, and the microseconds from
+    // the start of the call until the table was complete (or given up on).
+    int status;
+    int64_t elapsed_us;
+
+    union
+    {
+        t_pat pat;
+        t_pmt pmt;
+        t_sdt sdt;
+        t_nit nit;
+        t_vct vct;
+    } u;
+} t_psi_request;
+
+// Read several tables at once, each with its own section filter and
+// deadline, under a single poll(). Returns once every request is complete or
+// past its deadline (so never later than the longest timeout), or when
+// cancel_fd (may be -1) becomes readable. Returns the number of tables
+// completed, or -1 if cancelled (or, with errno set to EINVAL, if there are
+// more than PSI_MAX_REQUESTS requests).
+int psi_acquire(const char *demux_dev, t_psi_request *requests, int count,
+                int cancel_fd);
+
+#endif
+
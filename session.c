@@ -0,0 +1,1175 @@
+// Per-tuner session state shared by the ?zap implementations.
+
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <poll.h>
+
+#include <linux/dvb/frontend.h>
+#include <linux/dvb/dmx.h>
+
+#include "util.h"
+#include "backend.h"
+#include "zaptypes.h"
+#include "pidfilter.h"
+#include "dvr.h"
+#include "sections.h"
+#include "unicable.h"
+#include "timing.h"
+#include "trace.h"
+#include "frontend.h"
+#include "session.h"
+#include "reactor.h"
+#include "caps.h"
+
+static unsigned int max_buffer_size(t_zap_session *session)
+{
+    if (session->options.max_buffer_size > 0)
+        return session->options.max_buffer_size;
+
+    return DEMUX_BUFFER_MAX;
+}
+
+// The demux buffer for the whole multiplex, within the session's cap.
+static unsigned int mux_buffer_size(t_zap_session *session)
+{
+    unsigned int size = demux_buffer_size(session->mux_bitrate_bps);
+
+    // Unknown: as much as the kernel gives the dvr device.
+    if (session->mux_bitrate_bps == 0)
+        size = PID_FILTER_TSDEMUX_BUFFER_SIZE;
+
+    if (size > max_buffer_size(session))
+        size = max_buffer_size(session);
+
+    return size;
+}
+
+static void close_fd(int *fd)
+{
+    if (*fd >= 0)
+    {
+        zap_close(*fd);
+        *fd = -1;
+    }
+}
+
+int zap_session_init(t_zap_session *session, t_tuner_descriptor tuner,
+                     const t_tune_options *options)
+{
+    int i;
+
+    memset(session, 0, sizeof(t_zap_session));
+
+    session->tuner = tuner;
+
+    if (options != NULL)
+        session->options = *options;
+
+    pthread_mutex_init(&session->trace_lock, NULL);
+    zap_session_begin_tune(session);
+
+    snprintf(session->frontend_dev, sizeof(session->frontend_dev),
+             "/dev/dvb/adapter%i/frontend%i", tuner.adapter, tuner.frontend);
+
+    snprintf(session->demux_dev, sizeof(session->demux_dev),
+             "/dev/dvb/adapter%i/demux%i", tuner.adapter, tuner.demux);
+
+    snprintf(session->audio_dev, sizeof(session->audio_dev),
+             "/dev/dvb/adapter%i/audio%i", tuner.adapter, tuner.demux);
+
+    snprintf(session->dvr_dev, sizeof(session->dvr_dev),
+             "/dev/dvb/adapter%i/dvr%i", tuner.adapter, tuner.demux);
+
+    session->frontend_fd = -1;
+    session->audio_dev_fd = -1;
+    session->user_band = -1;
+    session->pat_fd = -1;
+    session->pmt_fd = -1;
+    session->event_fd = -1;
+    session->timer_fd = -1;
+
+    for (i = 0; i < MONITOR_FDS; i++)
+        session->watched_fds[i] = -1;
+
+    pid_filter_init(&session->pid_filter, session->demux_dev, ZAP_OUT_DVR);
+    pthread_mutex_init(&session->pid_lock, NULL);
+
+    if ((session->cancel_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+    {
+        pthread_mutex_destroy(&session->pid_lock);
+        pthread_mutex_destroy(&session->trace_lock);
+        return -1;
+    }
+
+    return 0;
+}
+
+void zap_session_cancel(t_zap_session *session)
+{
+    eventfd_write(session->cancel_fd, 1);
+}
+
+void zap_session_reset_cancel(t_zap_session *session)
+{
+    eventfd_t count;
+
+    // Fails with EAGAIN when not cancelled.
+    eventfd_read(session->cancel_fd, &count);
+}
+
+int zap_session_cancelled(t_zap_session *session)
+{
+    struct pollfd pfd;
+
+    if (session->break_tune != NULL && *session->break_tune != 0)
+        return 1;
+
+    pfd.fd = session->cancel_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    return zap_poll(&pfd, 1, 0) > 0;
+}
+
+// Add a PID to the filter, timing it if a filter was set. Called with 
+// pid_lock held.
+static int add_pid(t_zap_session *session, int pid, int pes_type)
+{
+    t_pid_filter *filter = &session->pid_filter;
+    int64_t start_us = monotonic_us();
+    int count = filter->count, retval;
+
+    if ((retval = pid_filter_add(filter, pid, pes_type)) == 0 && 
+        filter->count > count)
+    {
+        zap_session_step(session, TUNE_STAGE_FILTER, pid, start_us);
+        ZAP_TRACE(TRACE_PID_ADD, session->tuner.adapter, pid, pes_type);
+    }
+
+    return retval;
+}
+
+int zap_session_add_pid(t_zap_session *session, int pid, int pes_type)
+{
+    int retval;
+
+    pthread_mutex_lock(&session->pid_lock);
+    retval = add_pid(session, pid, pes_type);
+    pthread_mutex_unlock(&session->pid_lock);
+
+    return retval;
+}
+
+int zap_session_remove_pid(t_zap_session *session, int pid)
+{
+    int retval;
+
+    ZAP_TRACE(TRACE_PID_REMOVE, session->tuner.adapter, pid, 0);
+
+    pthread_mutex_lock(&session->pid_lock);
+    retval = pid_filter_remove(&session->pid_filter, pid);
+    pthread_mutex_unlock(&session->pid_lock);
+
+    return retval;
+}
+
+// A PID change the PSI calls for (see t_zap_session.psi_pid_hook).
+static int psi_add_pid(t_zap_session *session, int pid, int pes_type)
+{
+    if (session->psi_pid_hook != NULL)
+        return session->psi_pid_hook(pid, pes_type, 1, 
+                                     session->psi_pid_context);
+
+    return zap_session_add_pid(session, pid, pes_type);
+}
+
+static void psi_remove_pid(t_zap_session *session, int pid)
+{
+    if (session->psi_pid_hook != NULL)
+        session->psi_pid_hook(pid, 0, 0, session->psi_pid_context);
+    else
+        zap_session_remove_pid(session, pid);
+}
+
+int zap_session_set_pids(t_zap_session *session, const int *pids, 
+                         const int *pes_types, int count)
+{
+    t_pid_filter *filter = &session->pid_filter;
+    int i, j, retval = 0;
+
+    pthread_mutex_lock(&session->pid_lock);
+
+    // Removals first, so that their filters can be reused.
+    for (i = filter->count - 1; i >= 0; i--)
+    {
+        for (j = 0; j < count; j++)
+            if (pids[j] == filter->pids[i])
+                break;
+
+        if (j < count)
+            continue;
+
+        ZAP_TRACE(TRACE_PID_REMOVE, session->tuner.adapter, filter->pids[i], 
+                  0);
+
+        if (pid_filter_remove(filter, filter->pids[i]) < 0)
+            retval = -1;
+    }
+
+    for (j = 0; j < count; j++)
+        if (add_pid(session, pids[j], 
+                    pes_types ? pes_types[j] : DMX_PES_OTHER) < 0)
+            retval = -1;
+
+    pthread_mutex_unlock(&session->pid_lock);
+
+    return retval;
+}
+
+int zap_session_stream_fd(t_zap_session *session)
+{
+    return session->pid_filter.fd;
+}
+
+int zap_session_open_dvr(t_zap_session *session, t_dvr_reader *reader,
+                         unsigned int buffer_size, unsigned int buffer_count)
+{
+    int fd, owns_fd = 0;
+
+    switch (session->pid_filter.output)
+    {
+    case ZAP_OUT_TSDEMUX:
+        fd = session->pid_filter.fd;
+        break;
+
+    case ZAP_OUT_DVR:
+        fd = zap_open(session->dvr_dev, O_RDONLY | O_NONBLOCK);
+        owns_fd = 1;
+        break;
+
+    default:
+        return -1;
+    }
+
+    if (fd < 0)
+        return -1;
+
+    if (dvr_reader_open(reader, fd, buffer_size, buffer_count) < 0)
+    {
+        if (owns_fd)
+            zap_close(fd);
+
+        return -1;
+    }
+
+    reader->owns_fd = owns_fd;
+
+    if (owns_fd)
+        dvr_reader_set_buffer(reader, mux_buffer_size(session), 
+                              max_buffer_size(session));
+    else
+    {
+        // The filter was started with its buffer already sized.
+        reader->is_filter = 1;
+        reader->buffer_stats.buffer_size = session->pid_filter.buffer_size;
+
+        dvr_reader_set_buffer(reader, 0, max_buffer_size(session));
+    }
+
+    return 0;
+}
+
+int zap_session_open_frontend(t_zap_session *session, fe_type_t fe_type)
+{
+    t_frontend_caps caps;
+    int64_t start_us;
+
+    // What was found by caps_discover() saves asking, and a frontend of the
+    // wrong type from being opened at all.
+    if (session->fe_info_valid == 0 && 
+        caps_find(session->tuner.adapter, session->tuner.frontend, 
+                  &caps) == 0)
+    {
+        session->fe_info = caps.info;
+        session->fe_info_valid = 1;
+    }
+
+    if (session->fe_info_valid && session->fe_info.type != fe_type)
+        return -3;
+
+    if (session->frontend_fd < 0)
+    {
+        start_us = monotonic_us();
+
+        if ((session->frontend_fd = zap_open(session->frontend_dev, 
+                                             O_RDWR | O_NONBLOCK)) < 0)
+            return -1;
+
+        zap_session_step(session, TUNE_STAGE_OPEN, -1, start_us);
+    }
+
+    if (session->fe_info_valid == 0)
+    {
+        start_us = monotonic_us();
+
+        if (zap_ioctl(session->frontend_fd, FE_GET_INFO, &session->fe_info) < 0)
+            return -2;
+
+        session->fe_info_valid = 1;
+        zap_session_step(session, TUNE_STAGE_INFO, -1, start_us);
+    }
+
+    if (session->fe_info.type != fe_type)
+        return -3;
+
+    return 0;
+}
+
+void zap_session_end_tune(t_zap_session *session)
+{
+    if (session->options.persistent == 0)
+        zap_session_close_devices(session);
+}
+
+void zap_session_set_mux(t_zap_session *session, fe_type_t fe_type,
+                         const struct dvb_frontend_parameters *params,
+                         uint32_t extra)
+{
+    memset(&session->mux_key, 0, sizeof(t_mux_key));
+
+    session->mux_key.fe_type = fe_type;
+    session->mux_key.params = *params;
+    session->mux_key.extra = extra;
+
+    session->mux_bitrate_bps = mux_bitrate(fe_type, params);
+}
+
+int64_t zap_session_begin_tune(t_zap_session *session)
+{
+    int i;
+
+    pthread_mutex_lock(&session->trace_lock);
+
+    memset(&session->stats, 0, sizeof(t_tune_stats));
+    session->stats.lock_latency_us = -1;
+
+    for (i = 0; i < TUNE_STAGES; i++)
+        session->stats.stage_us[i] = -1;
+
+    session->tune_start_us = monotonic_us();
+    session->sec_resend.resend_us = 0;
+
+    session->trace.start_us = session->tune_start_us;
+    session->trace.count = 0;
+    session->trace.dropped = 0;
+
+    pthread_mutex_unlock(&session->trace_lock);
+
+    return session->tune_start_us;
+}
+
+// Add to the trace and the stage's first time. Called with trace_lock held.
+static void trace(t_zap_session *session, int stage, int pid, 
+                  int64_t start_us, int64_t end_us)
+{
+    t_tune_event *event;
+
+    if (session->stats.stage_us[stage] < 0)
+        session->stats.stage_us[stage] = end_us - session->tune_start_us;
+
+    if (session->trace.count == TUNE_TRACE_MAX)
+    {
+        session->trace.dropped++;
+        return;
+    }
+
+    event = &session->trace.events[session->trace.count++];
+    event->stage = stage;
+    event->pid = pid;
+    event->start_us = start_us;
+    event->end_us = end_us;
+}
+
+void zap_session_mark(t_zap_session *session, int stage)
+{
+    int64_t now_us = monotonic_us();
+    int first;
+
+    pthread_mutex_lock(&session->trace_lock);
+
+    if ((first = (session->stats.stage_us[stage] < 0)))
+        trace(session, stage, -1, now_us, now_us);
+
+    pthread_mutex_unlock(&session->trace_lock);
+
+    if (first == 0)
+        return;
+
+    timing_record(session->tuner.adapter, stage, 
+                  now_us - session->tune_start_us);
+
+    if (stage == TUNE_STAGE_LOCK)
+        ZAP_TRACE(TRACE_LOCK, session->tuner.adapter, 
+                  now_us - session->tune_start_us, 0);
+    else if (stage == TUNE_STAGE_PAT || stage == TUNE_STAGE_PMT)
+        ZAP_TRACE(TRACE_PSI_FOUND, session->tuner.adapter, 
+                  stage == TUNE_STAGE_PAT ? PSI_PAT : PSI_PMT,
+                  now_us - session->tune_start_us);
+}
+
+void zap_session_step(t_zap_session *session, int stage, int pid,
+                      int64_t start_us)
+{
+    int64_t now_us = monotonic_us();
+
+    pthread_mutex_lock(&session->trace_lock);
+    trace(session, stage, pid, start_us, now_us);
+    pthread_mutex_unlock(&session->trace_lock);
+
+    timing_record(session->tuner.adapter, stage, now_us - start_us);
+}
+
+void zap_session_get_trace(t_zap_session *session, t_tune_trace *trace)
+{
+    pthread_mutex_lock(&session->trace_lock);
+    *trace = session->trace;
+    pthread_mutex_unlock(&session->trace_lock);
+}
+
+// Read tables with the session's deadline, and add the time taken to the 
+// stats. Fails unless every table was read.
+static int acquire(t_zap_session *session, t_psi_request *requests, 
+                   int count)
+{
+    int64_t start_us = monotonic_us();
+    int completed;
+
+    completed = psi_acquire(session->demux_dev, requests, count, 
+                            session->cancel_fd);
+
+    pthread_mutex_lock(&session->trace_lock);
+    session->stats.psi_acquire_us += monotonic_us() - start_us;
+    pthread_mutex_unlock(&session->trace_lock);
+
+    return completed == count ? 0 : -1;
+}
+
+int zap_session_find_pmt_pid(t_zap_session *session, int sid)
+{
+    t_psi_request requests[1];
+    t_pat pat;
+    int pmt_pid;
+
+    // Already found during this tune.
+    if (session->psi_sid == sid && session->psi_pmt_pid > 0)
+        return session->psi_pmt_pid;
+
+    close_fd(&session->pat_fd);
+
+    if (psi_cache_lookup(&session->mux_key, &pat) == 0 &&
+        (pmt_pid = pat_pmt_pid(&pat, sid)) > 0)
+    {
+        // If the check can't be set up, the PID is used unchecked.
+        memset(&session->pat_check, 0, sizeof(t_pat));
+        session->pat_fd = psi_open_pat(session->demux_dev);
+
+        session->stats.psi_cached = 1;
+    }
+    else
+    {
+        memset(requests, 0, sizeof(t_psi_request));
+        requests[0].table = PSI_PAT;
+        requests[0].timeout_ms = session->options.psi_timeout_ms;
+
+        if (acquire(session, requests, 1) < 0)
+            return -1;
+
+        psi_cache_store(&session->mux_key, &requests[0].u.pat);
+
+        pmt_pid = pat_pmt_pid(&requests[0].u.pat, sid);
+    }
+
+    zap_session_mark(session, TUNE_STAGE_PAT);
+
+    session->psi_sid = sid;
+    session->psi_pmt_pid = pmt_pid;
+
+    return pmt_pid;
+}
+
+// The PIDs to pass for a service, and the pes_type of each. The decoder only
+// takes one video and one audio stream (and the PCR).
+static int service_pids(t_zap_session *session, const t_pmt *pmt,
+                        int *pids, int *pes_types)
+{
+    int decoder = (session->pid_filter.output == ZAP_OUT_DECODER);
+    int have_video = 0, have_audio = 0, count = 0, i;
+
+    for (i = 0; i < pmt->count; i++)
+    {
+        pids[count] = pmt->streams[i].pid;
+
+        if (pmt->streams[i].kind == ES_VIDEO && have_video == 0)
+        {
+            pes_types[count] = DMX_PES_VIDEO;
+            have_video = 1;
+        }
+        else if (pmt->streams[i].kind == ES_AUDIO && have_audio == 0)
+        {
+            pes_types[count] = DMX_PES_AUDIO;
+            have_audio = 1;
+        }
+        else if (decoder)
+            continue;
+        else
+            pes_types[count] = DMX_PES_OTHER;
+
+        count++;
+    }
+
+    // The PCR usually rides on the video PID.
+    for (i = 0; i < count; i++)
+        if (pids[i] == pmt->pcr_pid)
+            break;
+
+    if (i == count && pmt->pcr_pid > 0 && pmt->pcr_pid < 0x1fff)
+    {
+        pids[count] = pmt->pcr_pid;
+        pes_types[count] = decoder ? DMX_PES_PCR : DMX_PES_OTHER;
+        count++;
+    }
+
+    return count;
+}
+
+// Pass the streams of pmt in place of those of session->pmt. Returns the 
+// number of PIDs added or removed, or -1.
+static int set_service(t_zap_session *session, const t_pmt *pmt)
+{
+    int old_pids[PMT_MAX_STREAMS + 1], new_pids[PMT_MAX_STREAMS + 1];
+    int old_types[PMT_MAX_STREAMS + 1], new_types[PMT_MAX_STREAMS + 1];
+    int old_count, new_count, i, j, changes = 0;
+
+    old_count = service_pids(session, &session->pmt, old_pids, old_types);
+    new_count = service_pids(session, pmt, new_pids, new_types);
+
+    for (i = 0; i < old_count; i++)
+    {
+        for (j = 0; j < new_count; j++)
+            if (new_pids[j] == old_pids[i])
+                break;
+
+        if (j == new_count)
+        {
+            psi_remove_pid(session, old_pids[i]);
+            changes++;
+        }
+    }
+
+    session->pmt = *pmt;
+
+    for (i = 0; i < new_count; i++)
+    {
+        for (j = 0; j < old_count; j++)
+            if (old_pids[j] == new_pids[i])
+                break;
+
+        if (j == old_count)
+        {
+            if (psi_add_pid(session, new_pids[i], new_types[i]) < 0)
+                return -1;
+
+            changes++;
+        }
+    }
+
+    return changes;
+}
+
+// Pass the service's PMT PID, if the tune asked for it and it's known.
+static int pass_pmt(t_zap_session *session)
+{
+    if (session->psi_pass_pmt == 0 || session->psi_pmt_pid <= 0)
+        return 0;
+
+    return psi_add_pid(session, session->psi_pmt_pid, DMX_PES_OTHER);
+}
+
+// Pass the streams of the service from its PMT (on psi_pmt_pid). A cached 
+// PMT is used straight away and checked while the tune is monitored. 
+// Otherwise the PMT is read here if may_wait, or left for check_frontend() 
+// to read (returning 1).
+static int find_streams(t_zap_session *session, int may_wait)
+{
+    t_psi_request request;
+    t_pmt pmt;
+
+    close_fd(&session->pmt_fd);
+    memset(&session->pmt_check, 0, sizeof(t_pmt));
+
+    if (psi_cache_lookup_pmt(&session->mux_key, session->psi_sid, &pmt) == 0)
+    {
+        // If the check can't be set up, the PMT is used unchecked.
+        session->pmt_fd = psi_open_pmt(session->demux_dev, 
+                                       session->psi_pmt_pid, 
+                                       session->psi_sid);
+
+        session->stats.psi_cached = 1;
+    }
+    else if (may_wait == 0)
+    {
+        session->pmt_fd = psi_open_pmt(session->demux_dev, 
+                                       session->psi_pmt_pid, 
+                                       session->psi_sid);
+
+        return session->pmt_fd < 0 ? -1 : 1;
+    }
+    else
+    {
+        memset(&request, 0, sizeof(t_psi_request));
+        request.table = PSI_PMT;
+        request.sid = session->psi_sid;
+        request.pid = session->psi_pmt_pid;
+        request.timeout_ms = session->options.psi_timeout_ms;
+
+        if (acquire(session, &request, 1) < 0)
+            return -1;
+
+        pmt = request.u.pmt;
+        psi_cache_store_pmt(&session->mux_key, &pmt);
+    }
+
+    zap_session_mark(session, TUNE_STAGE_PMT);
+
+    return set_service(session, &pmt) < 0 ? -1 : 0;
+}
+
+int zap_session_add_service(t_zap_session *session, int sid)
+{
+    t_psi_request requests[2];
+    t_pat pat;
+
+    session->psi_discover = 1;
+
+    // Nothing known about this multiplex: read both tables in one go, the 
+    // PMT as soon as the PAT says where it is.
+    if ((session->psi_sid != sid || session->psi_pmt_pid <= 0) &&
+        psi_cache_lookup(&session->mux_key, &pat) < 0)
+    {
+        memset(requests, 0, sizeof(requests));
+        requests[0].table = PSI_PAT;
+        requests[0].timeout_ms = session->options.psi_timeout_ms;
+        requests[1].table = PSI_PMT;
+        requests[1].sid = sid;
+        requests[1].timeout_ms = session->options.psi_timeout_ms;
+
+        if (acquire(session, requests, 2) < 0)
+            return -1;
+
+        psi_cache_store(&session->mux_key, &requests[0].u.pat);
+        psi_cache_store_pmt(&session->mux_key, &requests[1].u.pmt);
+
+        zap_session_mark(session, TUNE_STAGE_PAT);
+        zap_session_mark(session, TUNE_STAGE_PMT);
+
+        session->psi_sid = sid;
+        session->psi_pmt_pid = requests[1].pid;
+
+        return set_service(session, &requests[1].u.pmt) < 0 ? -1 : 0;
+    }
+
+    if (zap_session_find_pmt_pid(session, sid) <= 0)
+        return -1;
+
+    return find_streams(session, 1) < 0 ? -1 : 0;
+}
+
+int zap_session_service_pids(t_zap_session *session, int sid, int pass_psi,
+                             int *pids, int *pes_types)
+{
+    t_psi_request requests[2];
+    t_pat pat;
+    t_pmt pmt;
+    int pmt_pid, count;
+
+    memset(requests, 0, sizeof(requests));
+
+    if (psi_cache_lookup(&session->mux_key, &pat) == 0 &&
+        (pmt_pid = pat_pmt_pid(&pat, sid)) > 0)
+    {
+        if (psi_cache_lookup_pmt(&session->mux_key, sid, &pmt) < 0)
+        {
+            requests[0].table = PSI_PMT;
+            requests[0].sid = sid;
+            requests[0].pid = pmt_pid;
+            requests[0].timeout_ms = session->options.psi_timeout_ms;
+
+            if (acquire(session, requests, 1) < 0)
+                return -1;
+
+            pmt = requests[0].u.pmt;
+            psi_cache_store_pmt(&session->mux_key, &pmt);
+        }
+    }
+    else
+    {
+        requests[0].table = PSI_PAT;
+        requests[0].timeout_ms = session->options.psi_timeout_ms;
+        requests[1].table = PSI_PMT;
+        requests[1].sid = sid;
+        requests[1].timeout_ms = session->options.psi_timeout_ms;
+
+        if (acquire(session, requests, 2) < 0)
+            return -1;
+
+        psi_cache_store(&session->mux_key, &requests[0].u.pat);
+        psi_cache_store_pmt(&session->mux_key, &requests[1].u.pmt);
+
+        pmt_pid = requests[1].pid;
+        pmt = requests[1].u.pmt;
+    }
+
+    count = service_pids(session, &pmt, pids, pes_types);
+
+    if (pass_psi)
+    {
+        pids[count] = PID_PAT;
+        pes_types[count++] = DMX_PES_OTHER;
+        pids[count] = pmt_pid;
+        pes_types[count++] = DMX_PES_OTHER;
+    }
+
+    return count;
+}
+
+// Arm the PAT filter (and the PMT filter, once the PMT PID is known) 
+// without waiting for either.
+static int start_pipelined(t_zap_session *session, int sid)
+{
+    t_pat pat;
+    int retval = 1;
+
+    session->psi_sid = sid;
+    session->psi_pmt_pid = 0;
+
+    // The PAT is read, or checked if it's cached, while the tune is 
+    // monitored.
+    close_fd(&session->pat_fd);
+    memset(&session->pat_check, 0, sizeof(t_pat));
+
+    if ((session->pat_fd = psi_open_pat(session->demux_dev)) < 0)
+        return -1;
+
+    if (psi_cache_lookup(&session->mux_key, &pat) == 0 &&
+        (session->psi_pmt_pid = pat_pmt_pid(&pat, sid)) > 0)
+    {
+        session->stats.psi_cached = 1;
+        zap_session_mark(session, TUNE_STAGE_PAT);
+
+        retval = session->psi_discover ? find_streams(session, 0) : 0;
+    }
+
+    if (retval < 0)
+        return -1;
+
+    if (retval > 0)
+    {
+        session->psi_waiting = 1;
+        session->psi_deadline_us = monotonic_us() + 1000LL * 
+            (session->options.psi_timeout_ms > 0 ? 
+             session->options.psi_timeout_ms : PSI_DEFAULT_TIMEOUT_MS);
+    }
+
+    return 0;
+}
+
+int zap_session_start_psi(t_zap_session *session, int sid, int pass_psi,
+                          int discover)
+{
+    int retval = 0;
+
+    ZAP_TRACE(TRACE_PSI_START, session->tuner.adapter, sid, 
+              (pass_psi << 1) | (discover ? 1 : 0));
+
+    session->psi_pass_pmt = pass_psi;
+    session->psi_discover = discover;
+
+    if (pass_psi && zap_session_add_pid(session, PID_PAT, DMX_PES_OTHER) < 0)
+        return -1;
+
+    if (pass_psi || discover)
+    {
+        // A nonblocking tune never waits for tables.
+        if (session->options.pipelined || session->nonblocking)
+            retval = start_pipelined(session, sid);
+        else if (discover)
+            retval = zap_session_add_service(session, sid);
+        else if (zap_session_find_pmt_pid(session, sid) <= 0)
+            retval = -1;
+
+        if (retval == 0)
+            retval = pass_pmt(session);
+    }
+
+    session->stats.psi_status = (retval < 0) ? PSI_FAILED : 
+                                session->psi_waiting ? PSI_PENDING : 
+                                PSI_COMPLETE;
+
+    if (retval < 0)
+        return -1;
+
+    zap_session_mark(session, TUNE_STAGE_FILTERS);
+
+    if (session->psi_waiting == 0)
+        zap_session_mark(session, TUNE_STAGE_READY);
+
+    return 0;
+}
+
+int zap_session_psi_waiting(t_zap_session *session)
+{
+    return session->psi_waiting;
+}
+
+// Everything the tune asked for has been found, or never will be.
+static void psi_finished(t_zap_session *session, int status)
+{
+    session->psi_waiting = 0;
+    session->stats.psi_status = status;
+
+    if (status == PSI_COMPLETE)
+        zap_session_mark(session, TUNE_STAGE_READY);
+    else
+    {
+        close_fd(&session->pat_fd);
+        close_fd(&session->pmt_fd);
+    }
+}
+
+// The PAT has been read: update the cache and follow the PMT if it moved (or
+// wasn't known yet).
+static void pat_checked(t_zap_session *session)
+{
+    int pmt_pid, old_pid = session->psi_pmt_pid, retval = 0;
+
+    psi_cache_store(&session->mux_key, &session->pat_check);
+    zap_session_mark(session, TUNE_STAGE_PAT);
+
+    pmt_pid = pat_pmt_pid(&session->pat_check, session->psi_sid);
+
+    // The first PAT of the tune doesn't list the service.
+    if (pmt_pid == 0 && old_pid == 0)
+    {
+        if (session->psi_waiting)
+            psi_finished(session, PSI_NOT_FOUND);
+
+        return;
+    }
+
+    if (pmt_pid == old_pid)
+        return;
+
+    if (old_pid > 0)
+    {
+        session->stats.psi_stale = 1;
+
+        if (session->psi_pass_pmt)
+            psi_remove_pid(session, old_pid);
+    }
+
+    session->psi_pmt_pid = pmt_pid;
+
+    if (pmt_pid == 0)
+    {
+        if (session->psi_waiting)
+            psi_finished(session, PSI_NOT_FOUND);
+
+        return;
+    }
+
+    if (pass_pmt(session) < 0)
+        retval = -1;
+    else if (session->psi_discover)
+        retval = find_streams(session, 0);
+
+    // Still waiting for the PMT.
+    if (retval > 0)
+        return;
+
+    if (session->psi_waiting)
+        psi_finished(session, retval < 0 ? PSI_FAILED : PSI_COMPLETE);
+}
+
+void zap_session_revalidate_psi(t_zap_session *session)
+{
+    int retval, changes;
+
+    if (session->pat_fd >= 0 &&
+        (retval = psi_read_pat(session->pat_fd, &session->pat_check)) != 0)
+    {
+        close_fd(&session->pat_fd);
+
+        if (retval > 0)
+            pat_checked(session);
+    }
+
+    if (session->pmt_fd >= 0 &&
+        (retval = psi_read_pmt(session->pmt_fd, &session->pmt_check)) != 0)
+    {
+        close_fd(&session->pmt_fd);
+
+        if (retval > 0)
+        {
+            psi_cache_store_pmt(&session->mux_key, &session->pmt_check);
+            zap_session_mark(session, TUNE_STAGE_PMT);
+
+            changes = set_service(session, &session->pmt_check);
+
+            if (session->psi_waiting)
+                psi_finished(session, changes < 0 ? PSI_FAILED : 
+                                                    PSI_COMPLETE);
+            else if (changes != 0)
+                session->stats.psi_stale = 1;
+        }
+    }
+
+    if (session->psi_waiting && monotonic_us() >= session->psi_deadline_us)
+        psi_finished(session, PSI_TIMED_OUT);
+}
+
+void zap_session_reset_pids(t_zap_session *session, int dvr)
+{
+    if (dvr != ZAP_OUT_DECODER && dvr != ZAP_OUT_TSDEMUX)
+        dvr = ZAP_OUT_DVR;
+
+    pthread_mutex_lock(&session->pid_lock);
+
+    if (session->pid_filter.output == dvr)
+        pid_filter_clear(&session->pid_filter);
+    else
+    {
+        pid_filter_close(&session->pid_filter);
+        pid_filter_init(&session->pid_filter, session->demux_dev, dvr);
+    }
+
+    session->pid_filter.buffer_size = mux_buffer_size(session);
+    pthread_mutex_unlock(&session->pid_lock);
+
+    // Nothing found or passed for the new tune yet.
+    close_fd(&session->pat_fd);
+    close_fd(&session->pmt_fd);
+
+    session->psi_sid = 0;
+    session->psi_pmt_pid = 0;
+    memset(&session->pmt, 0, sizeof(t_pmt));
+
+    session->psi_pass_pmt = 0;
+    session->psi_discover = 0;
+    session->psi_waiting = 0;
+}
+
+int zap_session_monitor(t_zap_session *session, 
+                        StatusReceiver statusReceiver)
+{
+    if (session->nonblocking == 0)
+        return check_frontend(session, session->tune_start_us, 
+                              statusReceiver);
+
+    if (session->reactor != NULL)
+    {
+        monitor_begin(session, session->tune_start_us, statusReceiver);
+        zap_reactor_kick(session->reactor, session);
+        return 0;
+    }
+
+    if (zap_session_fd(session) < 0)
+        return -1;
+
+    monitor_begin(session, session->tune_start_us, statusReceiver);
+    zap_session_process(session);
+
+    return 0;
+}
+
+int zap_session_fd(t_zap_session *session)
+{
+    struct epoll_event event;
+
+    if (session->event_fd >= 0)
+        return session->event_fd;
+
+    if ((session->event_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        return -1;
+
+    if ((session->timer_fd = timerfd_create(CLOCK_MONOTONIC, 
+                                         TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+    {
+        close_fd(&session->event_fd);
+        return -1;
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = session->timer_fd;
+
+    if (epoll_ctl(session->event_fd, EPOLL_CTL_ADD, session->timer_fd, 
+                  &event) < 0)
+    {
+        close_fd(&session->timer_fd);
+        close_fd(&session->event_fd);
+        return -1;
+    }
+
+    return session->event_fd;
+}
+
+// Descriptors are re-added every time, since the kernel drops those that 
+// were closed even if another was opened with the same number since.
+void zap_session_watch(t_zap_session *session, int epoll_fd, 
+                       const struct pollfd *pfd, uint32_t tag)
+{
+    struct epoll_event event;
+    int i;
+
+    for (i = 0; i < MONITOR_FDS; i++)
+        if (session->watched_fds[i] >= 0 && 
+            session->watched_fds[i] != pfd[i].fd)
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, session->watched_fds[i], NULL);
+
+    for (i = 0; i < MONITOR_FDS; i++)
+    {
+        session->watched_fds[i] = pfd[i].fd;
+
+        if (pfd[i].fd < 0)
+            continue;
+
+        memset(&event, 0, sizeof(event));
+        event.events = ((pfd[i].events & POLLIN) ? EPOLLIN : 0) | 
+                       ((pfd[i].events & POLLPRI) ? EPOLLPRI : 0);
+        event.data.u64 = ((uint64_t)tag << 8) | i;
+
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, pfd[i].fd, &event) < 0 &&
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pfd[i].fd, &event) < 0)
+            session->watched_fds[i] = -1;
+    }
+}
+
+// Have the timer expire at a monotonic_us() time (never, for 0).
+static void arm_timer(t_zap_session *session, int64_t at_us)
+{
+    struct itimerspec spec;
+
+    memset(&spec, 0, sizeof(spec));
+
+    // An it_value of zero would disarm it.
+    if (at_us > 0)
+    {
+        spec.it_value.tv_sec = at_us / 1000000;
+        spec.it_value.tv_nsec = (at_us % 1000000) * 1000;
+    }
+
+    timerfd_settime(session->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+int zap_session_process(t_zap_session *session)
+{
+    struct pollfd pfd[MONITOR_FDS];
+    uint64_t expirations;
+    int64_t wake_us, tick_us;
+    int i, failed = 0;
+
+    if (session->monitor.running == 0)
+        return 0;
+
+    // Nothing would wake the caller again if the timer can't be read.
+    if (session->timer_fd >= 0 &&
+        read(session->timer_fd, &expirations, sizeof(expirations)) < 0 &&
+        errno != EAGAIN)
+    {
+        session->monitor.running = 0;
+        failed = 1;
+    }
+
+    if (failed == 0)
+    {
+        monitor_pollfds(session, pfd, &wake_us);
+
+        if (zap_poll(pfd, MONITOR_FDS, 0) < 0)
+            for (i = 0; i < MONITOR_FDS; i++)
+                pfd[i].revents = 0;
+    }
+
+    if (failed == 0 && monitor_process(session, pfd))
+    {
+        monitor_pollfds(session, pfd, &wake_us);
+
+        // The descriptors of other backends mean nothing to the kernel, so 
+        // they're checked on every tick instead.
+        if (zap_backend_pollable() == 0)
+        {
+            for (i = 1; i < MONITOR_FDS; i++)
+                pfd[i].fd = -1;
+
+            tick_us = monotonic_us() + ZAP_BACKEND_TICK_MS * 1000;
+            if (tick_us < wake_us)
+                wake_us = tick_us;
+        }
+
+        zap_session_watch(session, session->event_fd, pfd, 0);
+        arm_timer(session, wake_us > 0 ? wake_us : 1);
+
+        return 1;
+    }
+
+    for (i = 0; i < MONITOR_FDS; i++)
+        pfd[i].fd = -1;
+
+    zap_session_watch(session, session->event_fd, pfd, 0);
+    arm_timer(session, 0);
+
+    ZAP_TRACE(TRACE_TUNE_END, session->tuner.adapter, 0, 0);
+    zap_session_end_tune(session);
+
+    return failed ? -1 : 0;
+}
+
+void zap_session_close_devices(t_zap_session *session)
+{
+    pthread_mutex_lock(&session->pid_lock);
+    pid_filter_close(&session->pid_filter);
+    pthread_mutex_unlock(&session->pid_lock);
+
+    close_fd(&session->pat_fd);
+    close_fd(&session->pmt_fd);
+    close_fd(&session->audio_dev_fd);
+    close_fd(&session->frontend_fd);
+
+    session->fe_applied.count = 0;
+    session->sec.valid = 0;
+
+    if (session->user_band >= 0)
+    {
+        unicable_release(&session->user_band_lnb, session->user_band);
+        session->user_band = -1;
+    }
+}
+
+void zap_session_destroy(t_zap_session *session)
+{
+    zap_session_close_devices(session);
+    close_fd(&session->cancel_fd);
+    close_fd(&session->timer_fd);
+    close_fd(&session->event_fd);
+    pthread_mutex_destroy(&session->pid_lock);
+    pthread_mutex_destroy(&session->trace_lock);
+}
+
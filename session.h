@@ -0,0 +1,344 @@
+#ifndef __SESSION__H
+#define __SESSION__H
+
+#include <pthread.h>
+#include <poll.h>
+
+#include "zaptypes.h"
+#include "pidfilter.h"
+#include "dvr.h"
+#include "psi.h"
+#include "lnb.h"
+
+// The DVBv5 properties (DTV_*) of a tune, without DTV_TUNE.
+#define FE_MAX_PROPS 16
+
+typedef struct
+{
+    unsigned int count;
+    struct dtv_property props[FE_MAX_PROPS];
+} t_fe_props;
+
+// What the LNB and switches were last set to (DVB-S), so that retunes only 
+// send it again when it changes. valid is 0 when unknown.
+typedef struct
+{
+    int valid;
+
+    // The data byte of the last committed DiSEqC command: the switch port 
+    // (the satellite number), polarisation and band.
+    int committed;
+} t_sec_state;
+
+// A single cable router's channel change command (DVB-S) and the frontend
+// tune that follows it, both sent again if the tune hasn't locked by 
+// resend_us (0 once there's nothing to resend), up to resends more times. 
+// has_params is 0 for tunes that can only be made with properties.
+typedef struct
+{
+    struct dvb_diseqc_master_cmd cmd;
+    t_fe_props props;
+    struct dvb_frontend_parameters params;
+    int has_params;
+
+    int resends;
+    int attempts;
+    int64_t resend_us;
+    unsigned int seed;
+} t_sec_resend;
+
+// The descriptors watched while monitoring a tune (see monitor_pollfds()):
+// cancel_fd, the frontend, pat_fd and pmt_fd.
+#define MONITOR_FDS 4
+
+// The most PIDs zap_session_service_pids() gives: every stream, the PCR, the
+// PAT and the PMT.
+#define SERVICE_MAX_PIDS (PMT_MAX_STREAMS + 3)
+
+// Where the monitoring of a tune has got to (see check_frontend()).
+typedef struct
+{
+    int running;
+    StatusReceiver receiver;
+    int sampling;
+    int was_locked;
+    int legacy;
+    unsigned int interval_us;
+    int64_t tune_start_us;
+    int64_t next_sample_us;
+
+    // What the receiver was last given (see t_tune_options.status_mode).
+    int delivered;
+    int delivered_locked;
+    int64_t delivered_cnr;
+    int64_t delivered_ber;
+} t_fe_monitor;
+
+// The state of one tuner: its device paths, open descriptors and
+// cancellation token. Sessions share nothing, so any number of them may tune
+// concurrently from separate threads.
+typedef struct
+{
+    t_tuner_descriptor tuner;
+    t_tune_options options;
+    t_tune_stats stats;
+
+    char frontend_dev[80];
+    char demux_dev[80];
+    char audio_dev[80];
+    char dvr_dev[80];
+
+    // Descriptors are -1 when not open.
+    int frontend_fd;
+
+    // The properties the frontend was last tuned with through frontend_fd 
+    // (none once it's closed), so that a retune need only send what 
+    // changed, and whether the driver only takes FE_SET_FRONTEND.
+    t_fe_props fe_applied;
+    int fe_legacy;
+
+    // The equipment control state behind frontend_fd (forgotten once it's 
+    // closed, since the driver may then power the LNB down).
+    t_sec_state sec;
+
+    // The user band claimed on a single cable router (DVB-S), -1 if none, 
+    // and the LNB it was claimed for. It's released with the devices. The
+    // router's command is resent by the monitor (see check_frontend()).
+    int user_band;
+    struct lnb_types_st user_band_lnb;
+    t_sec_resend sec_resend;
+
+    // What FE_GET_INFO said about the frontend, once asked.
+    struct dvb_frontend_info fe_info;
+    int fe_info_valid;
+
+    // The PIDs passed by the demux. Guarded by pid_lock, so that the set can
+    // be changed from another thread while a tune is running.
+    t_pid_filter pid_filter;
+    pthread_mutex_t pid_lock;
+
+    // The tuned multiplex (see zap_session_set_mux()), and its estimated 
+    // bitrate (bits per second, 0 if unknown). Demux buffers are sized from 
+    // the bitrate.
+    t_mux_key mux_key;
+    uint64_t mux_bitrate_bps;
+
+    // When the current tune started (see zap_session_begin_tune()), and the 
+    // stages it has been through. The trace, stats.stage_us and 
+    // stats.psi_acquire_us are guarded by trace_lock, since PIDs can be set 
+    // (and a service's PSI read) from other threads.
+    int64_t tune_start_us;
+    t_tune_trace trace;
+    pthread_mutex_t trace_lock;
+
+    // The service whose PMT PID was found for this tune (0 if none).
+    int psi_sid;
+    int psi_pmt_pid;
+
+    // What zap_session_start_psi() was asked for, and whether a pipelined 
+    // tune is still waiting for it (until psi_deadline_us).
+    int psi_pass_pmt;
+    int psi_discover;
+    int psi_waiting;
+    int64_t psi_deadline_us;
+
+    // The streams of the service passed by zap_session_add_service() (none
+    // otherwise).
+    t_pmt pmt;
+
+    // Where the PID changes the PSI calls for go, if set, in place of 
+    // zap_session_add_pid() (add is 1) and zap_session_remove_pid() (0): 
+    // for owners that count who needs each PID on the session (see pool.h).
+    int (*psi_pid_hook)(int pid, int pes_type, int add, void *context);
+    void *psi_pid_context;
+
+    // PAT and PMT filters checking what was taken from the PSI cache, -1 
+    // when there's nothing to check (see zap_session_revalidate_psi()), and 
+    // the tables as read so far.
+    int pat_fd;
+    int pmt_fd;
+    t_pat pat_check;
+    t_pmt pmt_check;
+
+    // The audio decoder (DVB-S, decoder output only).
+    int audio_dev_fd;
+
+    // An eventfd that becomes readable once the session is cancelled.
+    int cancel_fd;
+
+    // Set for a tune started by a *_tune_start() call, which the caller 
+    // then drives with zap_session_process(). monitor is the state kept 
+    // between calls.
+    int nonblocking;
+    t_fe_monitor monitor;
+
+    // The descriptor given by zap_session_fd() (an epoll instance, -1 until
+    // asked for), the timerfd in it that wakes the next step, and what's 
+    // otherwise in it (-1 for nothing).
+    int event_fd;
+    int timer_fd;
+    int watched_fds[MONITOR_FDS];
+
+    // The reactor driving the session's tunes in place of its own descriptor
+    // (see reactor.h), NULL if none, and its place there.
+    struct zap_reactor *reactor;
+    int reactor_slot;
+
+    // The process-wide *_break_tune flag honored by the *_tune_silent()
+    // calls. NULL for sessions created by the caller.
+    volatile int *break_tune;
+} t_zap_session;
+
+// Prepare a session for the given tuner. options may be NULL.
+extern int zap_session_init(t_zap_session *session, t_tuner_descriptor tuner,
+                            const t_tune_options *options);
+
+// Stop a tune in progress (or the next one) on this session. This may be
+// called from any thread, or from a signal handler.
+extern void zap_session_cancel(t_zap_session *session);
+
+// Clear a previous cancellation so that the session can tune again.
+extern void zap_session_reset_cancel(t_zap_session *session);
+
+extern int zap_session_cancelled(t_zap_session *session);
+
+// Pass (or stop passing) a PID during the tune, in addition to those the 
+// tune call set up. The pes_type (DMX_PES_*) only matters for the decoder 
+// output. These may be called from any thread.
+extern int zap_session_add_pid(t_zap_session *session, int pid, int pes_type);
+extern int zap_session_remove_pid(t_zap_session *session, int pid);
+
+// Pass exactly the given PIDs (with their DMX_PES_* types, or NULL for 
+// DMX_PES_OTHER), adding and removing only what differs from the PIDs being 
+// passed. Filters that are no longer needed are kept for the ones added.
+extern int zap_session_set_pids(t_zap_session *session, const int *pids, 
+                                const int *pes_types, int count);
+
+// The descriptor to read the transport stream from when tuned with 
+// ZAP_OUT_TSDEMUX, or -1 (read the dvr device for ZAP_OUT_DVR).
+extern int zap_session_stream_fd(t_zap_session *session);
+
+// Prepare a reader for the stream of the current tune: the dvr device for 
+// ZAP_OUT_DVR, or the stream descriptor for ZAP_OUT_TSDEMUX (call this once 
+// the tune has added its PIDs). Zero sizes select the defaults. The kernel's
+// buffer is sized for the multiplex, and grows on repeated overflows up to
+// options.max_buffer_size (see reader->buffer_stats).
+extern int zap_session_open_dvr(t_zap_session *session, t_dvr_reader *reader, 
+                                unsigned int buffer_size, 
+                                unsigned int buffer_count);
+
+// Start measuring a tune: clear session->stats and return the time it 
+// started (see monotonic_us()).
+extern int64_t zap_session_begin_tune(t_zap_session *session);
+
+// Record that the tune has reached a TUNE_STAGE_* (only the first time), in
+// stats.stage_us, the trace and the adapter's histogram (see timing.h).
+extern void zap_session_mark(t_zap_session *session, int stage);
+
+// Record a step of the tune, a TUNE_STAGE_* that ran from start_us (see 
+// monotonic_us()) until now, for the PID given with TUNE_STAGE_FILTER (-1 
+// otherwise). Every step is traced and counted; stats.stage_us has the 
+// first.
+extern void zap_session_step(t_zap_session *session, int stage, int pid,
+                             int64_t start_us);
+
+// Copy out the trace of the current (or last) tune.
+extern void zap_session_get_trace(t_zap_session *session, 
+                                  t_tune_trace *trace);
+
+// Open the frontend, unless it's still open from the last tune, and check 
+// that it's of the given type. Returns -1 if it can't be opened, -2 if it 
+// can't be queried, or -3 if it's of another type.
+extern int zap_session_open_frontend(t_zap_session *session, 
+                                     fe_type_t fe_type);
+
+// Called by the tune calls as they return: close the devices, unless the 
+// session is persistent.
+extern void zap_session_end_tune(t_zap_session *session);
+
+// Record the multiplex being tuned. extra is anything besides the parameters
+// that selects it (see t_mux_key).
+extern void zap_session_set_mux(t_zap_session *session, fe_type_t fe_type,
+                                const struct dvb_frontend_parameters *params,
+                                uint32_t extra);
+
+// The PMT PID of a service on the tuned multiplex (0 if it isn't there, -1 
+// if cancelled). A multiplex tuned before is answered from the PSI cache 
+// straight away, and the PAT is then checked while the tune is monitored. 
+// Otherwise the PAT is read (and cached).
+extern int zap_session_find_pmt_pid(t_zap_session *session, int sid);
+
+// Pass every elementary stream of a service (video, all audio languages, 
+// subtitles, teletext and the PCR), as found in its PMT. The streams are in
+// session->pmt. A service seen before is answered from the PSI cache, and 
+// its PMT is then checked while the tune is monitored.
+extern int zap_session_add_service(t_zap_session *session, int sid);
+
+// The PIDs of another service on the tuned multiplex (with the PAT and its 
+// PMT if pass_psi), as zap_session_add_service() would pass them, and the 
+// pes_type of each, without changing what the session passes. The tables 
+// come from the PSI cache, or are read here. Safe to call while another 
+// thread monitors the session's tune. Returns how many there are, or -1.
+extern int zap_session_service_pids(t_zap_session *session, int sid, 
+                                    int pass_psi, int *pids, int *pes_types);
+
+// Set up the PSI for a tune, once the frontend has been given its 
+// parameters: pass the PAT and the service's PMT if pass_psi, and all of 
+// the service's streams if discover. Unless options.pipelined, the tables 
+// are read before this returns. Otherwise only the filters are armed, and 
+// the tables are read while the tune is monitored (see 
+// zap_session_psi_waiting()).
+extern int zap_session_start_psi(t_zap_session *session, int sid, 
+                                 int pass_psi, int discover);
+
+// Whether a pipelined tune is still waiting for the PSI it asked for.
+extern int zap_session_psi_waiting(t_zap_session *session);
+
+// Read from pat_fd and pmt_fd once they're readable. When a table is 
+// complete, update the cache and, if the service's PMT or streams have moved,
+// the PIDs being passed. Also gives up on the PSI of a pipelined tune once 
+// its deadline has passed.
+extern void zap_session_revalidate_psi(t_zap_session *session);
+
+// Drop all PIDs and select where they'll be sent (the dvr argument of the 
+// tune calls) for the next ones added. Call zap_session_set_mux() first. The
+// demux descriptors are kept for reuse when the output doesn't change.
+extern void zap_session_reset_pids(t_zap_session *session, int dvr);
+
+// Called by the tune calls once the frontend has its parameters and the PSI
+// has been started: monitor the tune with the receiver. A blocking tune 
+// returns once it's over, and a *_tune_start() one after its first step 
+// (see zap_session_process()). Returns -1 on failure.
+extern int zap_session_monitor(t_zap_session *session, 
+                               StatusReceiver statusReceiver);
+
+// A descriptor that becomes readable whenever zap_session_process() has 
+// something to do for a tune started by a *_tune_start() call, to be added 
+// to the caller's epoll set or poll() list. It lasts as long as the session.
+// Returns -1 on failure. Not used for sessions added to a reactor, which 
+// drives their tunes itself.
+extern int zap_session_fd(t_zap_session *session);
+
+// Advance a tune started by a *_tune_start() call: read the frontend status
+// and PSI that are due, and call the receiver. Never blocks. Returns 1 while
+// the tune is running, or 0 once it's over (the receiver returned 0 and the
+// PSI was found or given up on, or the session was cancelled), at which 
+// point the devices are closed unless the session is persistent. Returns -1,
+// having ended the tune in the same way, if the session's timer couldn't be 
+// read.
+extern int zap_session_process(t_zap_session *session);
+
+// Have an epoll set watch the descriptors given by monitor_pollfds() (-1 
+// for none) in place of those it was last given, each with 
+// ((uint64_t)tag << 8) | its index as its data.
+extern void zap_session_watch(t_zap_session *session, int epoll_fd, 
+                              const struct pollfd *pfd, uint32_t tag);
+
+// Close all device descriptors (the session can still be reused).
+extern void zap_session_close_devices(t_zap_session *session);
+
+// Release everything held by the session.
+extern void zap_session_destroy(t_zap_session *session);
+
+#endif
+
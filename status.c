@@ -0,0 +1,247 @@
+// Rings of status samples (see status.h).
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <linux/dvb/frontend.h>
+
+#include "zaptypes.h"
+#include "status.h"
+
+int status_ring_init(t_status_ring *ring, unsigned int size)
+{
+    unsigned int rounded = 1;
+
+    memset(ring, 0, sizeof(t_status_ring));
+
+    while (rounded < size)
+        rounded <<= 1;
+
+    if ((ring->records = calloc(rounded, sizeof(t_status_record))) == NULL)
+        return -1;
+
+    ring->size = rounded;
+    return 0;
+}
+
+void status_ring_free(t_status_ring *ring)
+{
+    free(ring->records);
+    ring->records = NULL;
+    ring->size = 0;
+}
+
+void status_ring_push(t_status_ring *ring, const t_status_record *record)
+{
+    uint64_t head = ring->head;
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    if (head - tail == ring->size)
+    {
+        __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    ring->records[head & (ring->size - 1)] = *record;
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+unsigned int status_ring_drain(t_status_ring *ring, t_status_record *records,
+                               unsigned int max)
+{
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = ring->tail;
+    unsigned int count = 0, start, run;
+
+    // In (at most) two contiguous runs.
+    while (tail != head && count < max)
+    {
+        start = tail & (ring->size - 1);
+        run = ring->size - start;
+
+        if (run > head - tail)
+            run = head - tail;
+        if (run > max - count)
+            run = max - count;
+
+        memcpy(&records[count], &ring->records[start], 
+               run * sizeof(t_status_record));
+
+        count += run;
+        tail += run;
+    }
+
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    return count;
+}
+
+uint64_t status_ring_dropped(t_status_ring *ring)
+{
+    return __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+}
+
+int status_board_open(t_status_board *board, const char *name, int writable)
+{
+    struct t_status_segment *segment;
+    struct stat st;
+    int fd;
+
+    memset(board, 0, sizeof(t_status_board));
+
+    if ((fd = shm_open(name, writable ? O_RDWR | O_CREAT : O_RDONLY, 
+                       0644)) == -1)
+        return -1;
+
+    if (fstat(fd, &st) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    if (writable && st.st_size == 0)
+    {
+        if (ftruncate(fd, sizeof(struct t_status_segment)) == -1)
+        {
+            close(fd);
+            return -1;
+        }
+
+        st.st_size = sizeof(struct t_status_segment);
+    }
+
+    if (st.st_size < sizeof(struct t_status_segment))
+    {
+        close(fd);
+        return -2;
+    }
+
+    segment = mmap(NULL, sizeof(struct t_status_segment), 
+                   writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, 
+                   fd, 0);
+
+    // The mapping outlives the descriptor.
+    close(fd);
+
+    if (segment == MAP_FAILED)
+        return -1;
+
+    // A new segment is zeroed. The magic number goes in last, so readers 
+    // don't take it for a board before it is one.
+    if (writable && __atomic_load_n(&segment->magic, __ATOMIC_ACQUIRE) == 0)
+    {
+        segment->version = STATUS_BOARD_VERSION;
+        segment->adapters = STATUS_BOARD_ADAPTERS;
+        segment->frontends = STATUS_BOARD_FRONTENDS;
+
+        __atomic_store_n(&segment->magic, STATUS_BOARD_MAGIC, 
+                         __ATOMIC_RELEASE);
+    }
+
+    if (__atomic_load_n(&segment->magic, __ATOMIC_ACQUIRE) != 
+            STATUS_BOARD_MAGIC || 
+        segment->version != STATUS_BOARD_VERSION)
+    {
+        munmap(segment, sizeof(struct t_status_segment));
+        return -2;
+    }
+
+    board->segment = segment;
+    board->size = sizeof(struct t_status_segment);
+    board->writable = writable;
+
+    return 0;
+}
+
+void status_board_close(t_status_board *board)
+{
+    if (board->segment != NULL)
+        munmap(board->segment, board->size);
+
+    board->segment = NULL;
+    board->size = 0;
+}
+
+int status_board_unlink(const char *name)
+{
+    return shm_unlink(name);
+}
+
+static t_status_slot *board_slot(const t_status_board *board, 
+                                 unsigned int adapter, unsigned int frontend)
+{
+    struct t_status_segment *segment = board->segment;
+
+    if (segment == NULL || adapter >= segment->adapters || 
+        frontend >= segment->frontends)
+        return NULL;
+
+    return &segment->slots[adapter * segment->frontends + frontend];
+}
+
+// A seqlock: the sequence is made odd, the sample written and the sequence 
+// made even again, so that a reader that saw the same even sequence before 
+// and after its copy knows the copy is whole.
+void status_board_publish(t_status_board *board, 
+                          const t_status_record *record)
+{
+    t_status_slot *slot;
+    uint32_t sequence;
+
+    if (board->writable == 0 || 
+        (slot = board_slot(board, record->adapter, record->frontend)) == NULL)
+        return;
+
+    sequence = __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED);
+
+    // Odd already if a writer died halfway, which this write then finishes.
+    sequence |= 1;
+
+    __atomic_store_n(&slot->sequence, sequence, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->record = *record;
+
+    // 0 means nothing was published.
+    if (++sequence == 0)
+        sequence = 2;
+
+    __atomic_store_n(&slot->sequence, sequence, __ATOMIC_RELEASE);
+}
+
+int status_board_read(const t_status_board *board, unsigned int adapter,
+                      unsigned int frontend, t_status_record *record)
+{
+    t_status_slot *slot;
+    uint32_t before, after;
+    int tries;
+
+    if ((slot = board_slot(board, adapter, frontend)) == NULL)
+        return -2;
+
+    for (tries = 0; tries < STATUS_BOARD_TRIES; tries++)
+    {
+        before = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+
+        if (before == 0)
+            return -1;
+
+        if (before & 1)
+            continue;
+
+        *record = slot->record;
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED);
+
+        if (before == after)
+            return 0;
+    }
+
+    return -3;
+}
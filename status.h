@@ -0,0 +1,80 @@
+#ifndef __STATUS__H
+#define __STATUS__H
+
+#include <stdint.h>
+
+#include <linux/dvb/frontend.h>
+
+#include "zaptypes.h"
+
+// Prepare a ring for at least size records (rounded up to a power of two).
+int status_ring_init(t_status_ring *ring, unsigned int size);
+
+void status_ring_free(t_status_ring *ring);
+
+// Add a record, without locking or system calls. Called by the thread 
+// monitoring the tune.
+void status_ring_push(t_status_ring *ring, const t_status_record *record);
+
+// Copy out up to max of the oldest records, and return how many. Safe 
+// against a concurrent push, but not another drain.
+unsigned int status_ring_drain(t_status_ring *ring, t_status_record *records,
+                               unsigned int max);
+
+// The records dropped from the ring while full so far.
+uint64_t status_ring_dropped(t_status_ring *ring);
+
+// The tuners a status board has a slot for, and the name it's usually given.
+#define STATUS_BOARD_ADAPTERS 32
+#define STATUS_BOARD_FRONTENDS 4
+#define STATUS_BOARD_NAME "/zaplib-status"
+
+// Attempts status_board_read() makes to copy a slot that isn't being 
+// written.
+#define STATUS_BOARD_TRIES 10000
+
+#define STATUS_BOARD_MAGIC 0x7a617062
+#define STATUS_BOARD_VERSION 1
+
+// A slot of the board, alone on its cache line(s). sequence is odd while the 
+// sample is being written, and 0 if there hasn't been one.
+typedef struct
+{
+    uint32_t sequence;
+    t_status_record record;
+} __attribute__((aligned(64))) t_status_slot;
+
+struct t_status_segment
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t adapters;
+    uint32_t frontends;
+
+    t_status_slot slots[STATUS_BOARD_ADAPTERS * STATUS_BOARD_FRONTENDS] 
+        __attribute__((aligned(64)));
+};
+
+// Map the POSIX shared memory segment with the given name (see shm_open()), 
+// creating it if writable is set, or only for reading. Returns -1 if it can't
+// be opened, or -2 if it isn't a status board of this version.
+int status_board_open(t_status_board *board, const char *name, int writable);
+
+void status_board_close(t_status_board *board);
+
+// Remove the segment's name (as shm_unlink()). Boards mapped stay usable.
+int status_board_unlink(const char *name);
+
+// Write a sample to its tuner's slot. Samples for a tuner must come from 
+// one thread at a time (that monitoring its tune).
+void status_board_publish(t_status_board *board, 
+                          const t_status_record *record);
+
+// Copy the last sample published for a tuner, without locks or system calls.
+// Returns 0, -1 if none has been, -2 if the board has no such tuner, or -3 
+// if the slot was being written for all of STATUS_BOARD_TRIES attempts. The 
+// sample's time_us (monotonic_us()) tells how current it is.
+int status_board_read(const t_status_board *board, unsigned int adapter,
+                      unsigned int frontend, t_status_record *record);
+
+#endif
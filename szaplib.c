@@ -49,8 +49,13 @@
 #include <linux/dvb/dmx.h>
 #include <linux/dvb/audio.h>
 #include "lnb.h"
+#include "unicable.h"
 #include "util.h"
+#include "backend.h"
 #include "zaptypes.h"
+#include "session.h"
+#include "frontend.h"
+#include "trace.h"
 #include "szaplib.h"
 
 #ifndef TRUE
@@ -60,270 +65,342 @@
 #define FALSE (1==0)
 #endif
 
-#define FRONTENDDEVICE "/dev/dvb/adapter%d/frontend%d"
-#define DEMUXDEVICE "/dev/dvb/adapter%d/demux%d"
-#define AUDIODEVICE "/dev/dvb/adapter%d/audio%d"
-
 int szap_break_tune = 0;
 
-static struct lnb_types_st lnb_type;
-
 struct diseqc_cmd {
    struct dvb_diseqc_master_cmd cmd;
    uint32_t wait;
 };
 
-void diseqc_send_msg(int fd, fe_sec_voltage_t v, struct diseqc_cmd *cmd,
-		     fe_sec_tone_mode_t t, fe_sec_mini_cmd_t b)
+/* milliseconds to wait after each step of diseqc_send_msg() */
+struct sec_timing {
+   unsigned int voltage;
+   unsigned int command;
+   unsigned int burst;
+};
+
+static const struct sec_timing default_timing =
+   { SEC_SETTLE_MS, SEC_SETTLE_MS, SEC_SETTLE_MS };
+
+static int send_sequence(int fd, fe_sec_voltage_t v, struct diseqc_cmd *cmd,
+			 fe_sec_tone_mode_t t, fe_sec_mini_cmd_t b,
+			 const struct sec_timing *timing)
 {
-    if (ioctl(fd, FE_SET_TONE, SEC_TONE_OFF) == -1)
+    int failed = 0;
+
+    if (zap_ioctl(fd, FE_SET_TONE, SEC_TONE_OFF) == -1)
     {
         //perror("FE_SET_TONE failed");
+        failed = 1;
     }
       
-    if (ioctl(fd, FE_SET_VOLTAGE, v) == -1)
+    if (zap_ioctl(fd, FE_SET_VOLTAGE, v) == -1)
     {
         //perror("FE_SET_VOLTAGE failed");
+        failed = 1;
     }
     
-    usleep(15 * 1000);
-    if (ioctl(fd, FE_DISEQC_SEND_MASTER_CMD, &cmd->cmd) == -1)
+    usleep(timing->voltage * 1000);
+    if (zap_ioctl(fd, FE_DISEQC_SEND_MASTER_CMD, &cmd->cmd) == -1)
     {
         //perror("FE_DISEQC_SEND_MASTER_CMD failed");
+        failed = 1;
     }
 
     usleep(cmd->wait * 1000);
-    usleep(15 * 1000);
-    if (ioctl(fd, FE_DISEQC_SEND_BURST, b) == -1)
+    usleep(timing->command * 1000);
+    if (zap_ioctl(fd, FE_DISEQC_SEND_BURST, b) == -1)
     {
         //perror("FE_DISEQC_SEND_BURST failed");
+        failed = 1;
     }
     
-    usleep(15 * 1000);
-    if (ioctl(fd, FE_SET_TONE, t) == -1)
+    usleep(timing->burst * 1000);
+    if (zap_ioctl(fd, FE_SET_TONE, t) == -1)
     {
         //perror("FE_SET_TONE failed");
+        failed = 1;
     }
-}
 
+    return failed ? -1 : 0;
+}
 
+void diseqc_send_msg(int fd, fe_sec_voltage_t v, struct diseqc_cmd *cmd,
+		     fe_sec_tone_mode_t t, fe_sec_mini_cmd_t b)
+{
+   send_sequence(fd, v, cmd, t, b, &default_timing);
+}
 
+static unsigned int settle_ms(unsigned int option_ms)
+{
+   return option_ms ? option_ms : SEC_SETTLE_MS;
+}
 
 /* digital satellite equipment control,
  * specification is available from http://www.eutelsat.com/
+ *
+ * The sequence is only sent when the committed command's data byte (switch 
+ * port, polarization and band) is unknown or changes, since a switch may 
+ * route by the polarization and band bits as well as by the voltage and 
+ * tone.
  */
-static int diseqc(int secfd, int sat_no, int pol_vert, int hi_band)
+static int diseqc(t_zap_session *session, int sat_no, int pol_vert, 
+		  int hi_band)
 {
    struct diseqc_cmd cmd =
        { {{0xe0, 0x10, 0x38, 0xf0, 0x00, 0x00}, 4}, 0 };
+   struct sec_timing timing;
+   t_sec_state *sec = &session->sec;
+   int fd = session->frontend_fd;
+   int voltage = pol_vert ? SEC_VOLTAGE_13 : SEC_VOLTAGE_18;
+   int tone = hi_band ? SEC_TONE_ON : SEC_TONE_OFF;
+   int64_t start_us = monotonic_us();
+   int failed = 0, sent = 0;
+
+   timing.voltage = settle_ms(session->options.sec_voltage_settle_ms);
+   timing.command = settle_ms(session->options.sec_command_settle_ms);
+   timing.burst = settle_ms(session->options.sec_burst_settle_ms);
 
    /* param: high nibble: reset bits, low nibble set bits,
     * bits are: option, position, polarization, band
     */
    cmd.cmd.msg[3] =
-       0xf0 | (((sat_no * 4) & 0x0f) | (hi_band ? 1 : 0) | (pol_vert ? 0 : 2));
+       0xf0 | (((sat_no * 4) & 0x0f) | (hi_band ? 1 : 0) | 
+	       (pol_vert ? 0 : 2));
+
+   /* the voltage and tone follow from the same bits */
+   if (!sec->valid || sec->committed != cmd.cmd.msg[3]) {
+      failed = (send_sequence(fd, voltage, &cmd, tone,
+			      sat_no % 2 ? SEC_MINI_B : SEC_MINI_A, 
+			      &timing) < 0);
+      sent = 1;
+   }
 
-   diseqc_send_msg(secfd, pol_vert ? SEC_VOLTAGE_13 : SEC_VOLTAGE_18,
-		   &cmd, hi_band ? SEC_TONE_ON : SEC_TONE_OFF,
-		   sat_no % 2 ? SEC_MINI_B : SEC_MINI_A);
+   /* after a failure, start over on the next tune */
+   sec->valid = !failed;
+   sec->committed = cmd.cmd.msg[3];
+
+   session->stats.sec_us += monotonic_us() - start_us;
+
+   if (sent) {
+      zap_session_step(session, TUNE_STAGE_SEC, -1, start_us);
+      ZAP_TRACE(TRACE_SEC, session->tuner.adapter, sat_no, 
+		(pol_vert << 1) | (hi_band ? 1 : 0));
+   }
 
    return TRUE;
 }
 
-static int do_tune(int fefd, unsigned int ifreq, unsigned int sr)
+/* a DVB-S2 setting: 0 for the frontend to choose, otherwise as given */
+static unsigned int s2_value(unsigned int value, unsigned int auto_value)
+{
+   return value ? (value & ~SZAP_S2_SET) : auto_value;
+}
+
+/* the frontend settings for a tune, as properties and (unless it's DVB-S2, 
+   which can only be tuned with properties) legacy parameters */
+static int tune_props(unsigned int ifreq, unsigned int sr, 
+                      const t_dvbs2_tune_info *s2, t_fe_props *props, 
+                      struct dvb_frontend_parameters *params)
+{
+   memset(params, 0, sizeof(*params));
+   params->frequency = ifreq;
+   params->inversion = INVERSION_AUTO;
+   params->u.qpsk.symbol_rate = sr;
+   params->u.qpsk.fec_inner = FEC_AUTO;
+
+   if (s2 == NULL) {
+      fe_props_from_params(props, FE_QPSK, params);
+      return TRUE;
+   }
+
+   props->count = 0;
+   fe_props_add(props, DTV_DELIVERY_SYSTEM, SYS_DVBS2);
+   fe_props_add(props, DTV_FREQUENCY, ifreq);
+   fe_props_add(props, DTV_INVERSION, INVERSION_AUTO);
+   fe_props_add(props, DTV_SYMBOL_RATE, sr);
+   fe_props_add(props, DTV_INNER_FEC, s2_value(s2->fec, FEC_AUTO));
+   fe_props_add(props, DTV_MODULATION, s2->modulation);
+   fe_props_add(props, DTV_ROLLOFF, s2_value(s2->rolloff, ROLLOFF_AUTO));
+   fe_props_add(props, DTV_PILOT, s2_value(s2->pilot, PILOT_AUTO));
+   fe_props_add(props, DTV_STREAM_ID, 
+		s2->multistream ? s2->stream_id : NO_STREAM_ID_FILTER);
+
+   return FALSE;
+}
+
+static int do_tune(t_zap_session *session, const t_fe_props *props, 
+                   const struct dvb_frontend_parameters *params)
 {
-   struct dvb_frontend_parameters tuneto;
    struct dvb_frontend_event ev;
 
    /* discard stale QPSK events */
    while (1) {
-      if (ioctl(fefd, FE_GET_EVENT, &ev) == -1)
+      if (zap_ioctl(session->frontend_fd, FE_GET_EVENT, &ev) == -1)
 	 break;
    }
 
-   tuneto.frequency = ifreq;
-   tuneto.inversion = INVERSION_AUTO;
-   tuneto.u.qpsk.symbol_rate = sr;
-   tuneto.u.qpsk.fec_inner = FEC_AUTO;
-
-   if (ioctl(fefd, FE_SET_FRONTEND, &tuneto) == -1) {
-//      perror("FE_SET_FRONTEND failed");
-      return FALSE;
-   }
+   return (set_frontend(session, props, params) == 0);
+}
 
-   return TRUE;
+static int same_router(const struct lnb_types_st *a, 
+		       const struct lnb_types_st *b)
+{
+   return a->scr == b->scr && a->user_band_count == b->user_band_count &&
+	  memcmp(a->user_bands, b->user_bands, 
+		 a->user_band_count * sizeof(unsigned int)) == 0;
 }
 
-static
-int check_frontend (int fe_fd, int dvr, const int interval_us, StatusReceiver statusReceiver)
+/* tune through a single cable router: claim a user band (keeping the one 
+ * from the last tune) and have the router move the transponder onto it. The 
+ * command is sent again if the frontend doesn't lock, in case it collided 
+ * with another tuner's on the cable, and the tune fails if the last attempt 
+ * doesn't lock either.
+ */
+static int unicable_tune(t_zap_session *session, 
+			 struct lnb_types_st *lnb_type, int sat_no, 
+			 unsigned int ifreq, int pol_vert, int hi_band,
+			 unsigned int sr, const t_dvbs2_tune_info *s2)
 {
-    (void)dvr;
-    fe_status_t status;
-    uint16_t snr, signal_strength;
-    uint32_t ber, uncorrected_blocks;
-    int is_locked;
-
-	while(szap_break_tune == 0) {
-        if (ioctl(fe_fd, FE_READ_STATUS, &status) == -1)
-        {
-            //perror("FE_READ_STATUS failed");
-        }
-        
-        /* some frontends might not support all these ioctls, thus we
-         * avoid printing errors */
-        if (ioctl(fe_fd, FE_READ_SIGNAL_STRENGTH, &signal_strength) == -1)
-            signal_strength = -2;
-        if (ioctl(fe_fd, FE_READ_SNR, &snr) == -1)
-            snr = -2;
-        if(ioctl(fe_fd, FE_READ_BER, &ber) == -1)
-            ber = -2;
-        if(ioctl(fe_fd, FE_READ_UNCORRECTED_BLOCKS, &uncorrected_blocks) == -1)
-            uncorrected_blocks = -2;
-
-        is_locked = (status & FE_HAS_LOCK) > 0;
-
-		if(statusReceiver(status, signal_strength, snr, ber, uncorrected_blocks, is_locked) == 0)
-            break;
-
-		usleep(interval_us);
+   t_sec_resend *resend = &session->sec_resend;
+   unsigned int tune_freq;
+   int band = session->user_band;
+   int64_t start_us;
+
+   if (band >= 0 && !same_router(&session->user_band_lnb, lnb_type)) {
+      unicable_release(&session->user_band_lnb, band);
+      band = session->user_band = -1;
    }
 
-   return 0;
-}
+   if (band < 0) {
+      if ((band = unicable_acquire(lnb_type, -1)) < 0)
+	 return FALSE;
 
+      session->user_band = band;
+      session->user_band_lnb = *lnb_type;
+   }
+
+   /* the router's commands leave the voltage and tone to it */
+   session->sec.valid = 0;
+
+   tune_freq = unicable_command(lnb_type, band, ifreq, sat_no, pol_vert, 
+				hi_band, &resend->cmd);
+   resend->has_params = tune_props(tune_freq, sr, s2, &resend->props, 
+				   &resend->params);
+
+   start_us = monotonic_us();
+   if (unicable_send(session->frontend_fd, &resend->cmd) < 0)
+      return FALSE;
+   session->stats.sec_us += monotonic_us() - start_us;
+   zap_session_step(session, TUNE_STAGE_SEC, -1, start_us);
+
+   if (!do_tune(session, &resend->props, 
+		resend->has_params ? &resend->params : NULL))
+      return FALSE;
+
+   monitor_resend_begin(session);
+
+   /* only a blocking tune waits here; the monitor resends for the others */
+   return session->nonblocking || monitor_resend_wait(session);
+}
 
 static
-int zap_to(t_tuner_descriptor tuner,
+int zap_to(t_zap_session *session, struct lnb_types_st *lnb_type,
       unsigned int sat_no, unsigned int freq, unsigned int pol,
       unsigned int sr, unsigned int vpid, unsigned int apid, int sid,
-      int dvr, int rec_psi, int bypass, int interval_us, StatusReceiver statusReceiver)
+      int dvr, int rec_psi, int bypass, const t_dvbs2_tune_info *s2, StatusReceiver statusReceiver)
 {
-   char fedev[128], dmxdev[128], auddev[128];
-   static int fefd, dmxfda, dmxfdv, audiofd = -1, patfd, pmtfd;
-   int pmtpid;
    uint32_t ifreq;
-   int hiband, result;
-   static struct dvb_frontend_info fe_info;
-
-   if (!fefd) {
-      snprintf(fedev, sizeof(fedev), FRONTENDDEVICE, tuner.adapter, tuner.frontend);
-      snprintf(dmxdev, sizeof(dmxdev), DEMUXDEVICE, tuner.adapter, tuner.demux);
-      snprintf(auddev, sizeof(auddev), AUDIODEVICE, tuner.adapter, tuner.demux);
-
-      if ((fefd = open(fedev, O_RDWR | O_NONBLOCK)) < 0) {
-	 return FALSE;
-      }
+   int hiband, result, discover, legacy;
+   struct dvb_frontend_parameters params, tuneto;
+   t_fe_props props;
 
-      result = ioctl(fefd, FE_GET_INFO, &fe_info);
+   /* still open from the last tune if the session is persistent */
+   if (zap_session_open_frontend(session, FE_QPSK) < 0)
+      return FALSE;
 
-      if (result < 0) {
-	 close(fefd);
-	 return FALSE;
-      }
+   if (s2 != NULL && !(session->fe_info.caps & FE_CAN_2G_MODULATION))
+      return FALSE;
 
-      if (fe_info.type != FE_QPSK) {
-	 close(fefd);
-	 return FALSE;
-      }
+   if (dvr == ZAP_OUT_DECODER && session->audio_dev_fd < 0)
+      session->audio_dev_fd = zap_open(session->audio_dev, O_RDWR);
 
-      if ((dmxfdv = open(dmxdev, O_RDWR)) < 0) {
-	 close(fefd);
-	 return FALSE;
-      }
+   /* the transponder, as do_tune() will set it up (leaving the code rate 
+      to the frontend) */
+   memset(&params, 0, sizeof(params));
+   params.frequency = freq;
+   params.inversion = INVERSION_AUTO;
+   params.u.qpsk.symbol_rate = sr;
+   params.u.qpsk.fec_inner = FEC_AUTO;
 
-      if ((dmxfda = open(dmxdev, O_RDWR)) < 0) {
-	 close(fefd);
-	 return FALSE;
-      }
-
-      if (dvr == 0)	/* DMX_OUT_DECODER */
-	 audiofd = open(auddev, O_RDWR);
-
-      if (rec_psi){
-         if ((patfd = open(dmxdev, O_RDWR)) < 0) {
-	    close(audiofd);
-	    close(dmxfda);
-	    close(dmxfdv);
-	    close(fefd);
-	    return FALSE;
-         }
-
-         if ((pmtfd = open(dmxdev, O_RDWR)) < 0) {
-	    close(patfd);
-	    close(audiofd);
-	    close(dmxfda);
-	    close(dmxfdv);
-	    close(fefd);
-	    return FALSE;
-         }
-      }
-   }
+   zap_session_set_mux(session, FE_QPSK, &params, 
+                       (sat_no << 8) | pol | 
+                       (s2 != NULL && s2->multistream ? 
+                          ((s2->stream_id & 0xff) + 1) << 16 : 0));
+   zap_session_reset_pids(session, dvr);
 
    hiband = 0;
-   if (lnb_type.switch_val && lnb_type.high_val &&
-	freq >= lnb_type.switch_val)
+   if (lnb_type->switch_val && lnb_type->high_val &&
+	freq >= lnb_type->switch_val)
 	hiband = 1;
 
    if (hiband)
-      ifreq = freq - lnb_type.high_val;
+      ifreq = freq - lnb_type->high_val;
    else {
-      if (freq < lnb_type.low_val)
-          ifreq = lnb_type.low_val - freq;
+      if (freq < lnb_type->low_val)
+          ifreq = lnb_type->low_val - freq;
       else
-          ifreq = freq - lnb_type.low_val;
+          ifreq = freq - lnb_type->low_val;
    }
-   result = FALSE;
-
-   if (diseqc(fefd, sat_no, pol, hiband))
-      if (do_tune(fefd, ifreq, sr))
-	 if (set_pesfilter(dmxfdv, vpid, DMX_PES_VIDEO, dvr))
-	    if (audiofd >= 0)
-	       (void)ioctl(audiofd, AUDIO_SET_BYPASS_MODE, bypass);
-	    if (set_pesfilter(dmxfda, apid, DMX_PES_AUDIO, dvr)) {
-	       if (rec_psi) {
-	          pmtpid = get_pmt_pid(dmxdev, sid);
-		  if (pmtpid < 0) {
-		     result = FALSE;
-		  }
-		  if (pmtpid == 0) {
-		     //fprintf(stderr,"couldn't find pmt-pid for sid %04x\n",sid);
-		     result = FALSE;
-		  }
-		  if (set_pesfilter(patfd, 0, DMX_PES_OTHER, dvr))
-	             if (set_pesfilter(pmtfd, pmtpid, DMX_PES_OTHER, dvr))
-	                result = TRUE;
-	          } else {
-		    result = TRUE;
-		  }
-	       }
-
-    check_frontend (fefd, dvr, interval_us, statusReceiver);
-
-    close(patfd);
-    close(pmtfd);
-
-    if (audiofd >= 0)
-	    close(audiofd);
-
-    close(dmxfda);
-    close(dmxfdv);
-    close(fefd);
+
+   if (lnb_type->scr != LNB_SCR_NONE)
+      result = unicable_tune(session, lnb_type, sat_no, ifreq, pol, hiband, 
+			     sr, s2);
+   else {
+      legacy = tune_props(ifreq, sr, s2, &props, &tuneto);
+      result = (diseqc(session, sat_no, pol, hiband) &&
+		do_tune(session, &props, legacy ? &tuneto : NULL));
+   }
+
+   if (result) {
+      if (session->audio_dev_fd >= 0)
+	 (void)zap_ioctl(session->audio_dev_fd, AUDIO_SET_BYPASS_MODE, bypass);
+
+      /* neither PID given, but a service: find the service's streams from
+         its PMT */
+      discover = (vpid == 0x1fff && apid == 0x1fff && sid != 0);
+      result = (discover ||
+		(zap_session_add_pid(session, vpid, DMX_PES_VIDEO) == 0 &&
+		 zap_session_add_pid(session, apid, DMX_PES_AUDIO) == 0));
+
+      if (result)
+	 result = (zap_session_start_psi(session, sid, rec_psi, 
+					 discover) == 0);
+   }
+
+   if (result)
+      result = (zap_session_monitor(session, statusReceiver) == 0);
 
    return result;
 }
 
-static int read_channels(t_tuner_descriptor tuner, t_dvbs_tune_info tune_info, 
-                         int dvr, int rec_psi, int bypass, int interval_us, 
+static int read_channels(t_zap_session *session, 
+                         const t_dvbs_tune_info *tune_info, 
+                         const t_dvbs2_tune_info *s2, int dvr, int rec_psi, 
+                         int bypass, struct lnb_types_st *lnb_type, 
                          StatusReceiver statusReceiver)
 {
     unsigned int vpid, apid;
 
-    vpid = (tune_info.vpid ? tune_info.vpid : 0x1fff);
-    apid = (tune_info.apid ? tune_info.apid : 0x1fff);
+    zap_session_begin_tune(session);
+
+    vpid = (tune_info->vpid ? tune_info->vpid : 0x1fff);
+    apid = (tune_info->apid ? tune_info->apid : 0x1fff);
 
-	return zap_to(tuner, tune_info.sat_no, tune_info.frequency * 1000, 
-	              tune_info.pol, tune_info.sr, vpid, apid, tune_info.sid, dvr, 
-	              rec_psi, bypass, interval_us, statusReceiver);
+	return zap_to(session, lnb_type, tune_info->sat_no, 
+	              tune_info->frequency * 1000, tune_info->pol, tune_info->sr, 
+	              vpid, apid, tune_info->sid, dvr, rec_psi, bypass, s2, 
+	              statusReceiver);
 }
 
 
@@ -332,35 +409,192 @@ static void handleSigalarm()
     szap_break_tune = 1;
 }
 
-// Tune a DVB-S device. The rec_psi argument indicates that PAT and PMT packets 
-// should come through (important if MPEGTS feed is to be readable by players).
-int szap_tune_silent(t_tuner_descriptor tuner, t_dvbs_tune_info tune_info, 
-                     int dvr, unsigned int rec_psi, 
-                     StatusReceiver statusReceiver, int audio_bypass, 
-                     char *lnb_raw)
+// The LNB described by lnb_raw (the default one for NULL), in kHz.
+static int decode_lnb(char *lnb_raw, struct lnb_types_st *lnb_type)
 {
-    // We use SIGALRM out of convenience, for whether we're testing tuning by 
-    // handle, or need to interrupt it from another thread.
-    signal(SIGALRM, handleSigalarm);
+    *lnb_type = *lnb_enum(0);
 
-	const int status_interval_us = 1000000;
+    if(lnb_raw != NULL && lnb_decode(lnb_raw, lnb_type) < 0) 
+        return -1;
 
-    lnb_type = *lnb_enum(0);
+    lnb_type->low_val *= 1000;	/* convert to kiloherz */
+    lnb_type->high_val *= 1000;	/* convert to kiloherz */
+    lnb_type->switch_val *= 1000;	/* convert to kiloherz */
 
-    if(lnb_raw != NULL && lnb_decode(lnb_raw, &lnb_type) < 0) 
+    return 0;
+}
+
+// Tune a DVB-S (or, given s2, DVB-S2) device on the given session.
+static int tune(t_zap_session *session, const t_dvbs_tune_info *tune_info, 
+                const t_dvbs2_tune_info *s2, int dvr, unsigned int rec_psi, 
+                StatusReceiver statusReceiver, int audio_bypass, 
+                char *lnb_raw)
+{
+    struct lnb_types_st lnb_type;
+    int result;
+
+    if (decode_lnb(lnb_raw, &lnb_type) < 0)
         return -1;
 
-    lnb_type.low_val *= 1000;	/* convert to kiloherz */
-    lnb_type.high_val *= 1000;	/* convert to kiloherz */
-    lnb_type.switch_val *= 1000;	/* convert to kiloherz */
+    if(rec_psi && dvr == ZAP_OUT_DECODER)
+        dvr = ZAP_OUT_DVR;
 
-    if(rec_psi)
-        dvr = 1;
+    ZAP_TRACE(TRACE_TUNE_BEGIN, session->tuner.adapter, FE_QPSK, 
+              tune_info->frequency);
 
-    if (!read_channels(tuner, tune_info, dvr, rec_psi, audio_bypass, 
-                       status_interval_us, statusReceiver))
+    session->nonblocking = 0;
+    result = read_channels(session, tune_info, s2, dvr, rec_psi, 
+                           audio_bypass, &lnb_type, statusReceiver);
+    zap_session_end_tune(session);
+
+    ZAP_TRACE(TRACE_TUNE_END, session->tuner.adapter, result ? 0 : -1, 
+              session->stats.lock_latency_us);
+
+    if (!result)
         return -1;
 
    return 0;
 }
 
+static int tune_start(t_zap_session *session, 
+                      const t_dvbs_tune_info *tune_info, 
+                      const t_dvbs2_tune_info *s2, int dvr, 
+                      unsigned int rec_psi, StatusReceiver statusReceiver, 
+                      int audio_bypass, char *lnb_raw)
+{
+    struct lnb_types_st lnb_type;
+
+    if (decode_lnb(lnb_raw, &lnb_type) < 0)
+        return -1;
+
+    if(rec_psi && dvr == ZAP_OUT_DECODER)
+        dvr = ZAP_OUT_DVR;
+
+    ZAP_TRACE(TRACE_TUNE_BEGIN, session->tuner.adapter, FE_QPSK, 
+              tune_info->frequency);
+
+    session->nonblocking = 1;
+
+    if (!read_channels(session, tune_info, s2, dvr, rec_psi, audio_bypass, 
+                       &lnb_type, statusReceiver))
+    {
+        zap_session_end_tune(session);
+
+        ZAP_TRACE(TRACE_TUNE_END, session->tuner.adapter, -1, 
+                  session->stats.lock_latency_us);
+
+        return -1;
+    }
+
+    return 0;
+}
+
+static int tune_silent(t_tuner_descriptor tuner, 
+                       const t_dvbs_tune_info *tune_info, 
+                       const t_dvbs2_tune_info *s2, int dvr, 
+                       unsigned int rec_psi, StatusReceiver statusReceiver, 
+                       int audio_bypass, char *lnb_raw, 
+                       const t_tune_options *options, t_tune_stats *stats)
+{
+    t_zap_session session;
+    int retval;
+
+    if (zap_session_init(&session, tuner, options) < 0)
+        return -1;
+
+    // We use SIGALRM out of convenience, for whether we're testing tuning by 
+    // handle, or need to interrupt it from another thread. Sessions created 
+    // by the caller are cancelled with zap_session_cancel() instead.
+    session.break_tune = &szap_break_tune;
+    signal(SIGALRM, handleSigalarm);
+
+    retval = tune(&session, tune_info, s2, dvr, rec_psi, statusReceiver, 
+                  audio_bypass, lnb_raw);
+    *stats = session.stats;
+
+    zap_session_destroy(&session);
+
+    return retval;
+}
+
+// Tune a DVB-S device on the given session, reporting status until the 
+// receiver returns 0 or the session is cancelled. The rec_psi argument 
+// indicates that PAT and PMT packets should come through (important if MPEGTS 
+// feed is to be readable by players).
+int szap_tune(t_zap_session *session, t_dvbs_tune_info tune_info, int dvr, 
+              unsigned int rec_psi, StatusReceiver statusReceiver, 
+              int audio_bypass, char *lnb_raw)
+{
+    return tune(session, &tune_info, NULL, dvr, rec_psi, statusReceiver, 
+                audio_bypass, lnb_raw);
+}
+
+// Start tuning a DVB-S device on the given session, returning once the 
+// frontend has its parameters and the filters are armed (the LNB and DiSEqC 
+// settle times are still waited for). The tune then runs as 
+// zap_session_process() is called, whenever zap_session_fd() is readable, 
+// and the PSI is always read as for options.pipelined.
+int szap_tune_start(t_zap_session *session, t_dvbs_tune_info tune_info, 
+                    int dvr, unsigned int rec_psi, 
+                    StatusReceiver statusReceiver, int audio_bypass, 
+                    char *lnb_raw)
+{
+    return tune_start(session, &tune_info, NULL, dvr, rec_psi, 
+                      statusReceiver, audio_bypass, lnb_raw);
+}
+
+// Tune a DVB-S device. The rec_psi argument indicates that PAT and PMT packets 
+// should come through (important if MPEGTS feed is to be readable by players).
+int szap_tune_silent(t_tuner_descriptor tuner, t_dvbs_tune_info tune_info, 
+                     int dvr, unsigned int rec_psi, 
+                     StatusReceiver statusReceiver, int audio_bypass, 
+                     char *lnb_raw)
+{
+    t_tune_stats stats;
+
+    return szap_tune_silent_ex(tuner, tune_info, dvr, rec_psi, statusReceiver, 
+                               audio_bypass, lnb_raw, NULL, &stats);
+}
+
+// As szap_tune_silent(), but with tuning options (may be NULL) and returning 
+// measurements in stats.
+int szap_tune_silent_ex(t_tuner_descriptor tuner, t_dvbs_tune_info tune_info, 
+                        int dvr, unsigned int rec_psi, 
+                        StatusReceiver statusReceiver, int audio_bypass, 
+                        char *lnb_raw, const t_tune_options *options, 
+                        t_tune_stats *stats)
+{
+    return tune_silent(tuner, &tune_info, NULL, dvr, rec_psi, statusReceiver, 
+                       audio_bypass, lnb_raw, options, stats);
+}
+
+// The DVB-S2 versions of szap_tune(), szap_tune_start() and 
+// szap_tune_silent_ex().
+int szap_tune_s2(t_zap_session *session, t_dvbs2_tune_info tune_info, 
+                 int dvr, unsigned int rec_psi, 
+                 StatusReceiver statusReceiver, int audio_bypass, 
+                 char *lnb_raw)
+{
+    return tune(session, &tune_info.dvbs, &tune_info, dvr, rec_psi, 
+                statusReceiver, audio_bypass, lnb_raw);
+}
+
+int szap_tune_s2_start(t_zap_session *session, t_dvbs2_tune_info tune_info, 
+                       int dvr, unsigned int rec_psi, 
+                       StatusReceiver statusReceiver, int audio_bypass, 
+                       char *lnb_raw)
+{
+    return tune_start(session, &tune_info.dvbs, &tune_info, dvr, rec_psi, 
+                      statusReceiver, audio_bypass, lnb_raw);
+}
+
+int szap_tune_s2_silent_ex(t_tuner_descriptor tuner, 
+                           t_dvbs2_tune_info tune_info, int dvr, 
+                           unsigned int rec_psi, 
+                           StatusReceiver statusReceiver, int audio_bypass, 
+                           char *lnb_raw, const t_tune_options *options, 
+                           t_tune_stats *stats)
+{
+    return tune_silent(tuner, &tune_info.dvbs, &tune_info, dvr, rec_psi, 
+                       statusReceiver, audio_bypass, lnb_raw, options, stats);
+}
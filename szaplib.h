@@ -2,6 +2,7 @@
 #define __SZAPLIB__H
 
 #include "zaptypes.h"
+#include "session.h"
 
 typedef struct
 {
@@ -14,10 +15,73 @@ typedef struct
    unsigned int sid;
 } t_dvbs_tune_info;
 
+/* marks a DVB-S2 setting given as it is (see t_dvbs2_tune_info) */
+#define SZAP_S2_SET 0x100
+
+/* a DVB-S2 transponder: the DVB-S tune info, and the modulation (as 
+   fe_modulation_t), code rate, roll-off and pilots. The last three are left 
+   to the frontend (FEC_AUTO, ROLLOFF_AUTO, PILOT_AUTO) when 0; any other 
+   value is an fe_code_rate_t, fe_rolloff_t or fe_pilot_t or'ed with 
+   SZAP_S2_SET, so that FEC_NONE, ROLLOFF_35 and PILOT_ON (which are 0) can 
+   be asked for. */
+typedef struct
+{
+   t_dvbs_tune_info dvbs;
+
+   unsigned int modulation;
+   unsigned int fec;
+   unsigned int rolloff;
+   unsigned int pilot;
+
+   /* the input stream of a multistream transponder (when multistream is 
+      set) */
+   unsigned int multistream;
+   unsigned int stream_id;
+} t_dvbs2_tune_info;
+
+extern int szap_tune(t_zap_session *session, t_dvbs_tune_info tune_info, 
+                     int dvr, unsigned int rec_psi, 
+                     StatusReceiver statusReceiver, int audio_bypass, 
+                     char *lnb_raw);
+
+extern int szap_tune_start(t_zap_session *session, 
+                           t_dvbs_tune_info tune_info, int dvr, 
+                           unsigned int rec_psi, 
+                           StatusReceiver statusReceiver, int audio_bypass, 
+                           char *lnb_raw);
+
 extern int szap_tune_silent(t_tuner_descriptor tuner, 
                             t_dvbs_tune_info tune_info, int dvr, 
                             unsigned int rec_psi, 
                             StatusReceiver statusReceiver, int audio_bypass, 
                             char *lnb_raw);
 
+extern int szap_tune_silent_ex(t_tuner_descriptor tuner, 
+                               t_dvbs_tune_info tune_info, int dvr, 
+                               unsigned int rec_psi, 
+                               StatusReceiver statusReceiver, int audio_bypass, 
+                               char *lnb_raw, const t_tune_options *options, 
+                               t_tune_stats *stats);
+
+/* as szap_tune(), szap_tune_start() and szap_tune_silent_ex(), for DVB-S2 
+   (which needs a DVBv5 driver) */
+extern int szap_tune_s2(t_zap_session *session, t_dvbs2_tune_info tune_info, 
+                        int dvr, unsigned int rec_psi, 
+                        StatusReceiver statusReceiver, int audio_bypass, 
+                        char *lnb_raw);
+
+extern int szap_tune_s2_start(t_zap_session *session, 
+                              t_dvbs2_tune_info tune_info, int dvr, 
+                              unsigned int rec_psi, 
+                              StatusReceiver statusReceiver, 
+                              int audio_bypass, char *lnb_raw);
+
+extern int szap_tune_s2_silent_ex(t_tuner_descriptor tuner, 
+                                  t_dvbs2_tune_info tune_info, int dvr, 
+                                  unsigned int rec_psi, 
+                                  StatusReceiver statusReceiver, 
+                                  int audio_bypass, char *lnb_raw, 
+                                  const t_tune_options *options, 
+                                  t_tune_stats *stats);
+
 #endif
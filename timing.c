@@ -0,0 +1,89 @@
+// Process-wide histograms of tune stage latencies (see timing.h).
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <linux/dvb/frontend.h>
+
+#include "zaptypes.h"
+#include "timing.h"
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static t_timing_histogram histograms[TIMING_MAX_ADAPTERS][TUNE_STAGES];
+
+static int bucket(int64_t latency_us)
+{
+    int n = 0;
+
+    while (n < TIMING_BUCKETS - 1 && latency_us >= (1LL << n))
+        n++;
+
+    return n;
+}
+
+void timing_record(unsigned int adapter, int stage, int64_t latency_us)
+{
+    t_timing_histogram *histogram;
+
+    if (adapter >= TIMING_MAX_ADAPTERS || stage < 0 || stage >= TUNE_STAGES)
+        return;
+
+    if (latency_us < 0)
+        latency_us = 0;
+
+    pthread_mutex_lock(&lock);
+
+    histogram = &histograms[adapter][stage];
+    histogram->count++;
+    histogram->total_us += latency_us;
+    histogram->buckets[bucket(latency_us)]++;
+
+    if (latency_us > histogram->max_us)
+        histogram->max_us = latency_us;
+
+    pthread_mutex_unlock(&lock);
+}
+
+int timing_histogram(unsigned int adapter, int stage, 
+                     t_timing_histogram *histogram)
+{
+    if (adapter >= TIMING_MAX_ADAPTERS || stage < 0 || stage >= TUNE_STAGES)
+        return -1;
+
+    pthread_mutex_lock(&lock);
+    *histogram = histograms[adapter][stage];
+    pthread_mutex_unlock(&lock);
+
+    return 0;
+}
+
+int64_t timing_percentile(const t_timing_histogram *histogram, int p)
+{
+    uint64_t rank, seen = 0;
+    int n;
+
+    if (histogram->count == 0)
+        return -1;
+
+    rank = (p * histogram->count + 99) / 100;
+
+    for (n = 0; n < TIMING_BUCKETS - 1; n++)
+    {
+        seen += histogram->buckets[n];
+
+        if (seen >= rank)
+            return (1LL << n) < histogram->max_us ? (1LL << n) 
+                                                  : histogram->max_us;
+    }
+
+    return histogram->max_us;
+}
+
+void timing_reset(void)
+{
+    pthread_mutex_lock(&lock);
+    memset(histograms, 0, sizeof(histograms));
+    pthread_mutex_unlock(&lock);
+}
+
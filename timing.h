@@ -0,0 +1,41 @@
+#ifndef __TIMING__H
+#define __TIMING__H
+
+#include <stdint.h>
+
+// Adapters whose tunes are timed (higher ones aren't counted).
+#define TIMING_MAX_ADAPTERS 32
+
+// Bucket n of a histogram counts latencies of under 2^n microseconds (and 
+// at least half that), except the last, which counts everything from 2^23 
+// (about 8 seconds) up.
+#define TIMING_BUCKETS 25
+
+// The latencies of one TUNE_STAGE_* on one adapter, over every tune in the 
+// process: how long each took for stages timed as a step (opening the 
+// frontend, FE_GET_INFO, DiSEqC, setting the parameters, each PID filter), 
+// and the time from the tune call for the rest.
+typedef struct
+{
+    uint64_t count;
+    uint64_t total_us;
+    int64_t max_us;
+    uint64_t buckets[TIMING_BUCKETS];
+} t_timing_histogram;
+
+// Count a latency. Safe to use from any thread.
+void timing_record(unsigned int adapter, int stage, int64_t latency_us);
+
+// Copy out a histogram. Returns -1 for an adapter or stage out of range.
+int timing_histogram(unsigned int adapter, int stage, 
+                     t_timing_histogram *histogram);
+
+// The latency that p percent of the samples are under, to the bucket (-1 
+// without samples).
+int64_t timing_percentile(const t_timing_histogram *histogram, int p);
+
+// Forget every histogram.
+void timing_reset(void);
+
+#endif
+
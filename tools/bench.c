@@ -0,0 +1,809 @@
+// Tuning and streaming benchmarks, run against simulated adapters (see
+// vadapter.h) so that releases can be compared without hardware. Results are
+// printed as JSON. Run with "make bench".
+//
+//     bench [-i iterations] [-s max_sessions] [-m megabytes] [-d seconds]
+//           [-f stream.ts]
+//
+// Without -f, a stream is generated: one service (sid 1, PMT on 0x100, video
+// and PCR on 0x101, audio on 0x102) at ATSC's 19.39 Mbit/s.
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include <linux/dvb/frontend.h>
+
+#include "zaptypes.h"
+#include "session.h"
+#include "azaplib.h"
+#include "dvr.h"
+#include "psi.h"
+#include "sections.h"
+#include "reactor.h"
+#include "util.h"
+#include "vadapter.h"
+
+#define BENCH_MAX_SESSIONS 32
+#define BENCH_MAX_SAMPLES 1024
+
+#define BENCH_BITRATE 19392658
+#define BENCH_PACKETS 50000
+#define BENCH_LOCK_DELAY_MS 30
+
+#define BENCH_SID 1
+#define BENCH_PMT_PID 0x100
+#define BENCH_VIDEO_PID 0x101
+#define BENCH_AUDIO_PID 0x102
+
+typedef struct
+{
+    int count;
+    int64_t values[BENCH_MAX_SAMPLES];
+} t_samples;
+
+typedef struct
+{
+    int iterations;
+    int max_sessions;
+    unsigned int megabytes;
+    unsigned int seconds;
+    const char *ts_path;
+} t_bench_config;
+
+typedef struct
+{
+    unsigned int adapter;
+    unsigned int seconds;
+
+    // Whether its thread was started, and what it came to.
+    int started;
+    int result;
+    int64_t zap_us;
+    uint64_t bytes;
+    uint32_t overflows;
+} t_session_run;
+
+static void add_sample(t_samples *samples, int64_t value)
+{
+    if (samples->count < BENCH_MAX_SAMPLES)
+        samples->values[samples->count++] = value;
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+// The nearest-rank percentile, in microseconds (-1 without samples).
+static int64_t percentile(t_samples *samples, int p)
+{
+    int rank;
+
+    if (samples->count == 0)
+        return -1;
+
+    qsort(samples->values, samples->count, sizeof(int64_t), compare_samples);
+
+    rank = (p * samples->count + 99) / 100;
+    return samples->values[(rank > 0) ? rank - 1 : 0];
+}
+
+static void print_samples(const char *name, t_samples *samples, int last)
+{
+    printf("\"%s\": {\"p50_us\": %lld, \"p99_us\": %lld, \"samples\": %d}%s",
+           name, (long long)percentile(samples, 50),
+           (long long)percentile(samples, 99), samples->count,
+           last ? "" : ", ");
+}
+
+static int64_t cpu_us(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000LL +
+           usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static uint32_t crc32_mpeg(const uint8_t *data, int length)
+{
+    uint32_t crc = 0xffffffff;
+    int i, j;
+
+    for (i = 0; i < length; i++)
+    {
+        crc ^= (uint32_t)data[i] << 24;
+
+        for (j = 0; j < 8; j++)
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+    }
+
+    return crc;
+}
+
+// A single-section table (section number 0 of 0) in a packet of its own.
+static void table_packet(uint8_t *p, int pid, int table_id, int extension,
+                         const uint8_t *body, int body_length, int cc)
+{
+    uint8_t *section = p + 5;
+    int length = 5 + body_length + 4;
+    uint32_t crc;
+
+    memset(p, 0xff, TS_PACKET_SIZE);
+    p[0] = 0x47;
+    p[1] = 0x40 | (pid >> 8);
+    p[2] = pid & 0xff;
+    p[3] = 0x10 | (cc & 0x0f);
+    p[4] = 0;
+
+    section[0] = table_id;
+    section[1] = 0xb0 | (length >> 8);
+    section[2] = length & 0xff;
+    section[3] = extension >> 8;
+    section[4] = extension & 0xff;
+    section[5] = 0xc1;
+    section[6] = 0;
+    section[7] = 0;
+    memcpy(section + 8, body, body_length);
+
+    crc = crc32_mpeg(section, 8 + body_length);
+    section[8 + body_length] = crc >> 24;
+    section[9 + body_length] = crc >> 16;
+    section[10 + body_length] = crc >> 8;
+    section[11 + body_length] = crc;
+}
+
+// Write the generated stream: a PAT and PMT every 40 packets (about every
+// 3ms), and a PCR every 10.
+static int generate_stream(const char *path)
+{
+    static const uint8_t pat[] = {
+        0x00, BENCH_SID, 0xe0 | (BENCH_PMT_PID >> 8), BENCH_PMT_PID & 0xff
+    };
+    static const uint8_t pmt[] = {
+        0xe0 | (BENCH_VIDEO_PID >> 8), BENCH_VIDEO_PID & 0xff, 0xf0, 0x00,
+        0x02, 0xe0 | (BENCH_VIDEO_PID >> 8), BENCH_VIDEO_PID & 0xff, 0xf0, 0,
+        0x81, 0xe0 | (BENCH_AUDIO_PID >> 8), BENCH_AUDIO_PID & 0xff, 0xf0, 0
+    };
+    uint8_t p[TS_PACKET_SIZE];
+    double pcr_per_packet = 27000000.0 * TS_PACKET_SIZE * 8 / BENCH_BITRATE;
+    uint64_t pcr, base;
+    int i, pid, cc[3] = { 0, 0, 0 }, ext;
+    FILE *f;
+
+    if ((f = fopen(path, "wb")) == NULL)
+        return -1;
+
+    for (i = 0; i < BENCH_PACKETS; i++)
+    {
+        if (i % 40 == 0)
+            table_packet(p, 0, TABLE_PAT, 1, pat, sizeof(pat), cc[0]++);
+        else if (i % 40 == 1)
+            table_packet(p, BENCH_PMT_PID, TABLE_PMT, BENCH_SID, pmt,
+                         sizeof(pmt), cc[1]++);
+        else
+        {
+            pid = (i % 5 == 0) ? BENCH_AUDIO_PID : BENCH_VIDEO_PID;
+
+            memset(p, 0xa5, TS_PACKET_SIZE);
+            p[0] = 0x47;
+            p[1] = pid >> 8;
+            p[2] = pid & 0xff;
+            p[3] = 0x10 | (cc[2]++ & 0x0f);
+
+            if (pid == BENCH_VIDEO_PID && i % 10 == 2)
+            {
+                pcr = (uint64_t)(i * pcr_per_packet);
+                base = pcr / 300;
+                ext = pcr % 300;
+
+                p[3] |= 0x20;
+                p[4] = 7;
+                p[5] = 0x10;
+                p[6] = base >> 25;
+                p[7] = base >> 17;
+                p[8] = base >> 9;
+                p[9] = base >> 1;
+                p[10] = ((base & 1) << 7) | 0x7e | (ext >> 8);
+                p[11] = ext & 0xff;
+            }
+        }
+
+        if (fwrite(p, TS_PACKET_SIZE, 1, f) != 1)
+        {
+            fclose(f);
+            return -1;
+        }
+    }
+
+    return fclose(f);
+}
+
+static int add_adapters(const t_bench_config *config, int count,
+                        int realtime)
+{
+    t_vadapter_config adapter;
+    int i;
+
+    memset(&adapter, 0, sizeof(adapter));
+    adapter.ts_path = config->ts_path;
+    adapter.realtime = realtime;
+    adapter.fe_type = FE_ATSC;
+    adapter.lock_delay_ms = BENCH_LOCK_DELAY_MS;
+    adapter.signal = -45000;
+    adapter.cnr_start = 25000;
+    adapter.cnr_end = 25000;
+
+    for (i = 0; i < count; i++)
+        if (vadapter_add(i, &adapter) != 0)
+            return -1;
+
+    return 0;
+}
+
+static void remove_adapters(int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+        vadapter_remove(i);
+}
+
+// Stop monitoring on lock.
+static int until_lock(fe_status_t status, uint16_t signal, uint16_t snr,
+                      uint32_t ber, uint32_t uncorrected_blocks,
+                      int is_locked)
+{
+    return is_locked == 0;
+}
+
+static t_atsc_tune_info tune_info(int frequency)
+{
+    t_atsc_tune_info info;
+
+    memset(&info, 0, sizeof(info));
+    info.frequency = frequency;
+    info.modulation = VSB_8;
+    info.sid = BENCH_SID;
+
+    return info;
+}
+
+static void init_session(t_zap_session *session, unsigned int adapter,
+                         int pipelined, int persistent)
+{
+    t_tuner_descriptor tuner = { adapter, 0, 0 };
+    t_tune_options options;
+
+    memset(&options, 0, sizeof(options));
+    options.status_interval_us = 5000;
+    options.pipelined = pipelined;
+    options.persistent = persistent;
+
+    zap_session_init(session, tuner, &options);
+}
+
+// Cold tunes (an empty PSI cache) on a fresh session: the time to lock, to
+// the PAT and PMT, and until every stream is passed.
+static int bench_tune(const t_bench_config *config, int pipelined, int last)
+{
+    t_zap_session session;
+    t_samples lock, pat, pmt, ready;
+    int i, failures = 0;
+
+    lock.count = pat.count = pmt.count = ready.count = 0;
+
+    for (i = 0; i < config->iterations; i++)
+    {
+        psi_cache_clear();
+        init_session(&session, 0, pipelined, 0);
+
+        if (azap_tune(&session, tune_info(500000000), ZAP_OUT_TSDEMUX, 1,
+                      until_lock) != 0)
+            failures++;
+        else
+        {
+            add_sample(&lock, session.stats.stage_us[TUNE_STAGE_LOCK]);
+            add_sample(&pat, session.stats.stage_us[TUNE_STAGE_PAT]);
+            add_sample(&pmt, session.stats.stage_us[TUNE_STAGE_PMT]);
+            add_sample(&ready, session.stats.stage_us[TUNE_STAGE_READY]);
+        }
+
+        zap_session_destroy(&session);
+    }
+
+    printf("\"%s\": {", pipelined ? "tune_pipelined" : "tune");
+    print_samples("lock", &lock, 0);
+    print_samples("pat", &pat, 0);
+    print_samples("pmt", &pmt, 0);
+    print_samples("ready", &ready, 0);
+    printf("\"failures\": %d}%s\n", failures, last ? "" : ",");
+
+    return failures;
+}
+
+// Retunes of a persistent session between two multiplexes it has seen
+// before: the whole tune call, as an application zapping would see it.
+static int bench_zap(const t_bench_config *config, int last)
+{
+    t_zap_session session;
+    t_samples zap;
+    int64_t start_us;
+    int i, failures = 0;
+
+    zap.count = 0;
+    init_session(&session, 0, 1, 1);
+
+    for (i = 0; i < config->iterations + 2; i++)
+    {
+        start_us = monotonic_us();
+
+        if (azap_tune(&session, tune_info(500000000 + (i % 2) * 6000000),
+                      ZAP_OUT_TSDEMUX, 1, until_lock) != 0)
+            failures++;
+        else if (i >= 2)
+            add_sample(&zap, monotonic_us() - start_us);
+    }
+
+    zap_session_destroy(&session);
+
+    printf("\"zap\": {");
+    print_samples("zap", &zap, 0);
+    printf("\"lock_delay_us\": %d, \"failures\": %d}%s\n",
+           BENCH_LOCK_DELAY_MS * 1000, failures, last ? "" : ",");
+
+    return failures;
+}
+
+typedef struct
+{
+    uint64_t bytes;
+    uint64_t limit;
+    int64_t deadline_us;
+} t_read_state;
+
+static int count_packets(const unsigned char *packets, unsigned int count,
+                         void *context)
+{
+    t_read_state *state = context;
+
+    state->bytes += (uint64_t)count * TS_PACKET_SIZE;
+
+    if (state->limit > 0 && state->bytes >= state->limit)
+        return 0;
+
+    return state->deadline_us == 0 || monotonic_us() < state->deadline_us;
+}
+
+// Reading the stream as fast as the simulated demux gives it: throughput and
+// the CPU it costs.
+static int bench_dvr(const t_bench_config *config, int last)
+{
+    t_zap_session session;
+    t_dvr_reader reader;
+    t_read_state state;
+    int64_t start_us, start_cpu_us, wall_us, used_us;
+    int failed;
+
+    memset(&state, 0, sizeof(state));
+    state.limit = (uint64_t)config->megabytes * 1024 * 1024;
+
+    init_session(&session, 0, 0, 1);
+
+    failed = azap_tune(&session, tune_info(500000000), ZAP_OUT_TSDEMUX, 1,
+                       until_lock) != 0 ||
+             zap_session_open_dvr(&session, &reader, 0, 0) != 0;
+
+    start_us = monotonic_us();
+    start_cpu_us = cpu_us();
+
+    if (failed == 0)
+    {
+        dvr_reader_run(&reader, -1, count_packets, &state);
+        dvr_reader_close(&reader);
+    }
+
+    wall_us = monotonic_us() - start_us;
+    used_us = cpu_us() - start_cpu_us;
+
+    zap_session_destroy(&session);
+
+    printf("\"dvr\": {\"bytes\": %llu, \"mb_per_s\": %.1f, "
+           "\"cpu_us_per_mbit\": %.2f, \"failures\": %d}%s\n",
+           (unsigned long long)state.bytes,
+           wall_us > 0 ? state.bytes / (double)wall_us : 0.0,
+           state.bytes > 0 ? used_us / (state.bytes * 8 / 1000000.0) : 0.0,
+           failed, last ? "" : ",");
+
+    return failed;
+}
+
+// One of several concurrent sessions: tune its own adapter, then read the
+// stream in realtime.
+static void *run_session(void *context)
+{
+    t_session_run *run = context;
+    t_zap_session session;
+    t_dvr_reader reader;
+    t_read_state state;
+    int64_t start_us = monotonic_us();
+
+    memset(&state, 0, sizeof(state));
+    init_session(&session, run->adapter, 1, 1);
+
+    run->result = azap_tune(&session, tune_info(500000000), ZAP_OUT_TSDEMUX,
+                            1, until_lock);
+    run->zap_us = monotonic_us() - start_us;
+
+    if (run->result == 0 &&
+        (run->result = zap_session_open_dvr(&session, &reader, 0, 0)) == 0)
+    {
+        state.deadline_us = monotonic_us() + run->seconds * 1000000LL;
+        dvr_reader_run(&reader, -1, count_packets, &state);
+
+        run->overflows = reader.buffer_stats.overflows;
+        dvr_reader_close(&reader);
+    }
+
+    run->bytes = state.bytes;
+
+    zap_session_destroy(&session);
+    return NULL;
+}
+
+// 1, 2, 4... sessions at once, each on its own adapter and thread.
+static int bench_scaling(const t_bench_config *config)
+{
+    static t_session_run runs[BENCH_MAX_SESSIONS];
+    pthread_t threads[BENCH_MAX_SESSIONS];
+    t_samples zap;
+    uint64_t bytes;
+    uint32_t overflows;
+    int64_t start_us, start_cpu_us, wall_us, used_us;
+    int sessions, i, failures, total_failures = 0;
+
+    printf("\"scaling\": [\n");
+
+    for (sessions = 1; sessions <= config->max_sessions; sessions *= 2)
+    {
+        if (add_adapters(config, sessions, 1) != 0)
+        {
+            remove_adapters(sessions);
+            return -1;
+        }
+
+        psi_cache_clear();
+
+        start_us = monotonic_us();
+        start_cpu_us = cpu_us();
+
+        for (i = 0; i < sessions; i++)
+        {
+            memset(&runs[i], 0, sizeof(runs[i]));
+            runs[i].adapter = i;
+            runs[i].seconds = config->seconds;
+
+            runs[i].started = (pthread_create(&threads[i], NULL, run_session,
+                                              &runs[i]) == 0);
+        }
+
+        zap.count = 0;
+        bytes = 0;
+        overflows = 0;
+        failures = 0;
+
+        for (i = 0; i < sessions; i++)
+        {
+            if (runs[i].started)
+                pthread_join(threads[i], NULL);
+
+            if (runs[i].started == 0 || runs[i].result != 0)
+                failures++;
+            else
+                add_sample(&zap, runs[i].zap_us);
+
+            bytes += runs[i].bytes;
+            overflows += runs[i].overflows;
+        }
+
+        wall_us = monotonic_us() - start_us;
+        used_us = cpu_us() - start_cpu_us;
+
+        remove_adapters(sessions);
+
+        printf("  {\"sessions\": %d, ", sessions);
+        print_samples("zap", &zap, 0);
+        printf("\"mb_per_s\": %.1f, \"cpu_us_per_mbit\": %.2f, "
+               "\"overflows\": %u, \"failures\": %d}%s\n",
+               wall_us > 0 ? bytes / (double)wall_us : 0.0,
+               bytes > 0 ? used_us / (bytes * 8 / 1000000.0) : 0.0,
+               overflows, failures,
+               sessions * 2 <= config->max_sessions ? "," : "");
+
+        total_failures += failures;
+    }
+
+    printf("],\n");
+    return total_failures;
+}
+
+// One of the sessions a reactor drives: tuned with azap_tune_start(), then
+// read in realtime through zap_reactor_read().
+typedef struct
+{
+    t_zap_reactor *reactor;
+    t_zap_session session;
+    t_dvr_reader reader;
+    t_read_state state;
+    unsigned int seconds;
+
+    // Whether it was added and tuned, and what it came to.
+    int started;
+    int done;
+    int failed;
+    int64_t start_us;
+    int64_t zap_us;
+    uint32_t overflows;
+} t_reactor_run;
+
+static void reactor_event(t_zap_session *session, int event, void *context)
+{
+    t_reactor_run *run = context;
+
+    if (event == REACTOR_TUNE_DONE)
+    {
+        run->zap_us = monotonic_us() - run->start_us;
+        run->state.deadline_us = monotonic_us() + run->seconds * 1000000LL;
+
+        if (session->stats.psi_status == PSI_COMPLETE &&
+            zap_session_open_dvr(session, &run->reader, 0, 0) == 0)
+        {
+            if (zap_reactor_read(run->reactor, session, &run->reader,
+                                 count_packets, &run->state) == 0)
+                return;
+
+            dvr_reader_close(&run->reader);
+        }
+
+        run->failed = 1;
+        run->done = 1;
+        return;
+    }
+
+    run->overflows = run->reader.buffer_stats.overflows;
+    dvr_reader_close(&run->reader);
+    run->done = 1;
+}
+
+// The same sessions, all driven by one reactor on this thread: the time
+// dispatch takes per event it handles, apart from the time spent waiting
+// for them.
+static int bench_reactor_scaling(const t_bench_config *config)
+{
+    static t_reactor_run runs[BENCH_MAX_SESSIONS];
+    t_zap_reactor reactor;
+    struct pollfd pfd;
+    t_samples zap;
+    uint64_t bytes, events;
+    uint32_t overflows;
+    int64_t start_us, start_cpu_us, wall_us, used_us, dispatch_us, now_us;
+    int64_t give_up_us;
+    int sessions, i, n, running, failures, total_failures = 0;
+
+    printf("\"reactor_scaling\": [\n");
+
+    for (sessions = 1; sessions <= config->max_sessions; sessions *= 2)
+    {
+        if (add_adapters(config, sessions, 1) != 0 ||
+            zap_reactor_init(&reactor) != 0)
+        {
+            remove_adapters(sessions);
+            return -1;
+        }
+
+        psi_cache_clear();
+
+        start_us = monotonic_us();
+        start_cpu_us = cpu_us();
+
+        for (i = 0; i < sessions; i++)
+        {
+            memset(&runs[i], 0, sizeof(runs[i]));
+            runs[i].reactor = &reactor;
+            runs[i].seconds = config->seconds;
+            runs[i].start_us = monotonic_us();
+
+            init_session(&runs[i].session, i, 1, 1);
+
+            runs[i].started =
+                zap_reactor_add(&reactor, &runs[i].session, reactor_event,
+                                &runs[i]) == 0 &&
+                azap_tune_start(&runs[i].session, tune_info(500000000),
+                                ZAP_OUT_TSDEMUX, 1, until_lock) == 0;
+        }
+
+        // Long enough for every tune and stream, whatever happens.
+        give_up_us = monotonic_us() + (config->seconds + 10) * 1000000LL;
+
+        pfd.fd = zap_reactor_fd(&reactor);
+        pfd.events = POLLIN;
+
+        events = 0;
+        dispatch_us = 0;
+
+        do
+        {
+            if (poll(&pfd, 1, 100) < 0)
+                break;
+
+            now_us = monotonic_us();
+            n = zap_reactor_dispatch(&reactor, 0);
+            dispatch_us += monotonic_us() - now_us;
+
+            if (n < 0)
+                break;
+
+            events += n;
+
+            for (i = 0, running = 0; i < sessions; i++)
+                if (runs[i].started && runs[i].done == 0)
+                    running++;
+        }
+        while (running > 0 && monotonic_us() < give_up_us);
+
+        wall_us = monotonic_us() - start_us;
+        used_us = cpu_us() - start_cpu_us;
+
+        zap.count = 0;
+        bytes = 0;
+        overflows = 0;
+        failures = 0;
+
+        for (i = 0; i < sessions; i++)
+        {
+            if (runs[i].started == 0 || runs[i].done == 0 || runs[i].failed)
+                failures++;
+            else
+                add_sample(&zap, runs[i].zap_us);
+
+            // Still reading if it never finished.
+            if (runs[i].started && runs[i].done == 0 &&
+                runs[i].state.deadline_us != 0)
+            {
+                zap_reactor_read(&reactor, &runs[i].session, NULL, NULL,
+                                 NULL);
+                dvr_reader_close(&runs[i].reader);
+            }
+
+            bytes += runs[i].state.bytes;
+            overflows += runs[i].overflows;
+
+            zap_reactor_remove(&reactor, &runs[i].session);
+            zap_session_destroy(&runs[i].session);
+        }
+
+        zap_reactor_destroy(&reactor);
+        remove_adapters(sessions);
+
+        printf("  {\"sessions\": %d, ", sessions);
+        print_samples("zap", &zap, 0);
+        printf("\"mb_per_s\": %.1f, \"cpu_us_per_mbit\": %.2f, "
+               "\"events\": %llu, \"dispatch_us_per_event\": %.2f, "
+               "\"overflows\": %u, \"failures\": %d}%s\n",
+               wall_us > 0 ? bytes / (double)wall_us : 0.0,
+               bytes > 0 ? used_us / (bytes * 8 / 1000000.0) : 0.0,
+               (unsigned long long)events,
+               events > 0 ? dispatch_us / (double)events : 0.0,
+               overflows, failures,
+               sessions * 2 <= config->max_sessions ? "," : "");
+
+        total_failures += failures;
+    }
+
+    printf("]\n");
+    return total_failures;
+}
+
+int main(int argc, char *argv[])
+{
+    t_bench_config config;
+    char generated[] = "/tmp/zaplib-bench-XXXXXX";
+    int opt, fd, failures = 0;
+
+    config.iterations = 50;
+    config.max_sessions = BENCH_MAX_SESSIONS;
+    config.megabytes = 512;
+    config.seconds = 2;
+    config.ts_path = NULL;
+
+    while ((opt = getopt(argc, argv, "i:s:m:d:f:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'i': config.iterations = atoi(optarg); break;
+        case 's': config.max_sessions = atoi(optarg); break;
+        case 'm': config.megabytes = atoi(optarg); break;
+        case 'd': config.seconds = atoi(optarg); break;
+        case 'f': config.ts_path = optarg; break;
+        default:
+            fprintf(stderr, "Usage: %s [-i iterations] [-s max_sessions] "
+                            "[-m megabytes] [-d seconds] [-f stream.ts]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+
+    if (config.iterations > BENCH_MAX_SAMPLES - 2)
+        config.iterations = BENCH_MAX_SAMPLES - 2;
+
+    if (config.max_sessions < 1 || config.max_sessions > BENCH_MAX_SESSIONS)
+        config.max_sessions = BENCH_MAX_SESSIONS;
+
+    if (config.ts_path == NULL)
+    {
+        if ((fd = mkstemp(generated)) < 0)
+        {
+            perror("mkstemp");
+            return 1;
+        }
+
+        close(fd);
+
+        if (generate_stream(generated) != 0)
+        {
+            perror(generated);
+            unlink(generated);
+            return 1;
+        }
+
+        config.ts_path = generated;
+    }
+
+    printf("{\n\"stream\": \"%s\", \"iterations\": %d,\n",
+           config.ts_path == generated ? "generated" : config.ts_path,
+           config.iterations);
+
+    if (add_adapters(&config, 1, 1) != 0)
+    {
+        fprintf(stderr, "Can't play %s.\n", config.ts_path);
+        failures++;
+    }
+    else
+    {
+        failures += bench_tune(&config, 0, 0);
+        failures += bench_tune(&config, 1, 0);
+        failures += bench_zap(&config, 0);
+        remove_adapters(1);
+    }
+
+    if (add_adapters(&config, 1, 0) == 0)
+    {
+        failures += bench_dvr(&config, 0);
+        remove_adapters(1);
+    }
+
+    if (bench_scaling(&config) != 0)
+        failures++;
+
+    if (bench_reactor_scaling(&config) != 0)
+        failures++;
+
+    printf("}\n");
+
+    if (config.ts_path == generated)
+        unlink(generated);
+
+    return failures == 0 ? 0 : 1;
+}
+
@@ -0,0 +1,1193 @@
+// Assertion tests, run against a simulated adapter (see vadapter.h) playing a
+// stream generated here, so that they need no hardware. Run with
+// "make check"; failed checks are printed, and the exit status is 1 if there
+// were any.
+//
+// The stream carries a PAT split over two sections (the second spanning two
+// packets), a PMT, an SDT, a NIT and a terrestrial VCT, and packets on
+// CHECK_VIDEO_PID, CHECK_AUDIO_PID and CHECK_DATA_PID.
+
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include <linux/dvb/frontend.h>
+#include <linux/dvb/dmx.h>
+
+#include "zaptypes.h"
+#include "backend.h"
+#include "session.h"
+#include "azaplib.h"
+#include "reactor.h"
+#include "dvr.h"
+#include "psi.h"
+#include "sections.h"
+#include "pidfilter.h"
+#include "lnb.h"
+#include "unicable.h"
+#include "caps.h"
+#include "pool.h"
+#include "status.h"
+#include "util.h"
+#include "vadapter.h"
+
+#define CHECK_DEMUX "/dev/dvb/adapter0/demux0"
+#define CHECK_FRONTEND "/dev/dvb/adapter0/frontend0"
+
+#define CHECK_TSID 0x0401
+#define CHECK_ONID 0x2000
+#define CHECK_NETWORK_ID 0x3001
+
+// Services 1 to CHECK_PROGRAMS are in the PAT, the first
+// CHECK_FIRST_SECTION_PROGRAMS of them in its first section. Service n's
+// PMT is on 0x1000 + n, except the one that's there.
+#define CHECK_PROGRAMS 100
+#define CHECK_FIRST_SECTION_PROGRAMS 40
+#define CHECK_PAT_VERSION 3
+
+#define CHECK_SID 1
+#define CHECK_PMT_PID 0x100
+#define CHECK_VIDEO_PID 0x101
+#define CHECK_AUDIO_PID 0x102
+#define CHECK_DATA_PID 0x103
+#define CHECK_SUBTITLE_PID 0x104
+
+#define CHECK_SECTION_MAX 1024
+#define CHECK_PACKETS 4000
+#define CHECK_BOARD_READS 200000
+
+// The adapter the non-blocking tunes and the reactor use, and the status it
+// reports: a lock after CHECK_LOCK_DELAY_MS, then a CNR ramp.
+#define CHECK_TUNE_ADAPTER 2
+#define CHECK_LOCK_DELAY_MS 100
+#define CHECK_CNR_START 10000
+#define CHECK_CNR_END 20000
+#define CHECK_CNR_RAMP_MS 200
+#define CHECK_CNR_DELTA 4000
+#define CHECK_STATUS_CALLS 256
+
+static int failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+static void check(int passed, const char *condition, const char *file,
+                  int line)
+{
+    if (passed)
+        return;
+
+    fprintf(stderr, "%s:%d: failed: %s\n", file, line, condition);
+    failures++;
+}
+
+static uint32_t crc32_mpeg(const uint8_t *data, int length)
+{
+    uint32_t crc = 0xffffffff;
+    int i, j;
+
+    for (i = 0; i < length; i++)
+    {
+        crc ^= (uint32_t)data[i] << 24;
+
+        for (j = 0; j < 8; j++)
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+    }
+
+    return crc;
+}
+
+// The stream being written, and the continuity counter of each PID.
+typedef struct
+{
+    FILE *f;
+    uint8_t cc[0x2000];
+} t_stream;
+
+// A section with a syntax section (and CRC) around body. Returns its length.
+static int make_section(uint8_t *section, int table_id, int extension,
+                        int version, int number, int last,
+                        const uint8_t *body, int body_length)
+{
+    int length = 5 + body_length + 4;
+    uint32_t crc;
+
+    section[0] = table_id;
+    section[1] = 0xb0 | (length >> 8);
+    section[2] = length & 0xff;
+    section[3] = extension >> 8;
+    section[4] = extension & 0xff;
+    section[5] = 0xc1 | ((version & 0x1f) << 1);
+    section[6] = number;
+    section[7] = last;
+    memcpy(section + 8, body, body_length);
+
+    crc = crc32_mpeg(section, 8 + body_length);
+    section[8 + body_length] = crc >> 24;
+    section[9 + body_length] = crc >> 16;
+    section[10 + body_length] = crc >> 8;
+    section[11 + body_length] = crc;
+
+    return 3 + length;
+}
+
+static int write_packet(t_stream *stream, int pid, int start,
+                        const uint8_t *payload, int length)
+{
+    uint8_t p[TS_PACKET_SIZE];
+
+    memset(p, 0xff, TS_PACKET_SIZE);
+    p[0] = 0x47;
+    p[1] = (start ? 0x40 : 0) | (pid >> 8);
+    p[2] = pid & 0xff;
+    p[3] = 0x10 | (stream->cc[pid]++ & 0x0f);
+    memcpy(p + 4, payload, length);
+
+    return fwrite(p, TS_PACKET_SIZE, 1, stream->f) == 1 ? 0 : -1;
+}
+
+// A section in packets of its own: the first starts it (after a pointer
+// field of 0), the rest carry on with it, and the last is stuffed.
+static int write_section(t_stream *stream, int pid, const uint8_t *section,
+                         int length)
+{
+    uint8_t payload[TS_PACKET_SIZE - 4];
+    int size, done = 0;
+
+    payload[0] = 0;
+    size = (length < (int)sizeof(payload) - 1) ? length :
+                                                  (int)sizeof(payload) - 1;
+    memcpy(payload + 1, section, size);
+
+    if (write_packet(stream, pid, 1, payload, 1 + size) != 0)
+        return -1;
+
+    for (done = size; done < length; done += size)
+    {
+        size = (length - done < (int)sizeof(payload)) ? length - done :
+                                                         (int)sizeof(payload);
+
+        if (write_packet(stream, pid, 0, section + done, size) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int pmt_pid_of(int sid)
+{
+    return (sid == CHECK_SID) ? CHECK_PMT_PID : 0x1000 + sid;
+}
+
+// PAT programs first to last.
+static int pat_body(uint8_t *body, int first, int last)
+{
+    int sid, n = 0;
+
+    for (sid = first; sid <= last; sid++)
+    {
+        body[n++] = sid >> 8;
+        body[n++] = sid & 0xff;
+        body[n++] = 0xe0 | (pmt_pid_of(sid) >> 8);
+        body[n++] = pmt_pid_of(sid) & 0xff;
+    }
+
+    return n;
+}
+
+// A DVB service descriptor. The provider name starts with a character table
+// selector, which isn't part of it.
+static int service_descriptor(uint8_t *d, int type, const char *provider,
+                              const char *name)
+{
+    int n = 0;
+
+    d[n++] = 0x48;
+    d[n++] = 3 + 1 + strlen(provider) + strlen(name);
+    d[n++] = type;
+    d[n++] = 1 + strlen(provider);
+    d[n++] = 0x05;
+    memcpy(d + n, provider, strlen(provider));
+    n += strlen(provider);
+    d[n++] = strlen(name);
+    memcpy(d + n, name, strlen(name));
+    n += strlen(name);
+
+    return n;
+}
+
+static int sdt_service(uint8_t *p, int sid, int running, int scrambled,
+                       int type, const char *provider, const char *name)
+{
+    int length = service_descriptor(p + 5, type, provider, name);
+
+    p[0] = sid >> 8;
+    p[1] = sid & 0xff;
+    p[2] = 0xfc;
+    p[3] = (running << 5) | (scrambled << 4) | (length >> 8);
+    p[4] = length & 0xff;
+
+    return 5 + length;
+}
+
+// A 32-byte VCT channel record, without descriptors.
+static int vct_channel(uint8_t *p, const char *name, int major, int minor,
+                       int sid, int hidden, int source_id)
+{
+    int i;
+
+    memset(p, 0, 32);
+
+    for (i = 0; i < 7 && name[i] != 0; i++)
+        p[i * 2 + 1] = name[i];
+
+    p[14] = 0xf0 | (major >> 6);
+    p[15] = ((major & 0x3f) << 2) | (minor >> 8);
+    p[16] = minor & 0xff;
+    p[17] = 0x04;
+    p[22] = CHECK_TSID >> 8;
+    p[23] = CHECK_TSID & 0xff;
+    p[24] = sid >> 8;
+    p[25] = sid & 0xff;
+    p[26] = 0x0d | (hidden ? 0x10 : 0);
+    p[27] = 0xc0 | 0x02;
+    p[28] = source_id >> 8;
+    p[29] = source_id & 0xff;
+    p[30] = 0xfc;
+    p[31] = 0;
+
+    return 32;
+}
+
+// Each table's sections, in the order they're played (looped).
+static int write_tables(t_stream *stream)
+{
+    static const uint8_t pmt[] = {
+        0xe0 | (CHECK_VIDEO_PID >> 8), CHECK_VIDEO_PID & 0xff, 0xf0, 0x00,
+        0x1b, 0xe0 | (CHECK_VIDEO_PID >> 8), CHECK_VIDEO_PID & 0xff, 0xf0, 0,
+        0x0f, 0xe0 | (CHECK_AUDIO_PID >> 8), CHECK_AUDIO_PID & 0xff, 0xf0, 6,
+        0x0a, 4, 'e', 'n', 'g', 0,
+        0x06, 0xe0 | (CHECK_SUBTITLE_PID >> 8), CHECK_SUBTITLE_PID & 0xff,
+        0xf0, 10, 0x59, 8, 'd', 'e', 'u', 0x10, 0, 1, 0, 1
+    };
+    uint8_t body[CHECK_SECTION_MAX], section[CHECK_SECTION_MAX];
+    int n, length, loop;
+
+    // An earlier version of the PAT (never complete), the new version's
+    // first section twice, and its second, which needs two packets.
+    n = pat_body(body, 500, 501);
+    length = make_section(section, TABLE_PAT, CHECK_TSID,
+                          CHECK_PAT_VERSION - 1, 0, 1, body, n);
+    if (write_section(stream, PID_PAT, section, length) != 0)
+        return -1;
+
+    n = pat_body(body, 1, CHECK_FIRST_SECTION_PROGRAMS);
+    length = make_section(section, TABLE_PAT, CHECK_TSID, CHECK_PAT_VERSION,
+                          0, 1, body, n);
+    if (write_section(stream, PID_PAT, section, length) != 0 ||
+        write_section(stream, PID_PAT, section, length) != 0)
+        return -1;
+
+    n = pat_body(body, CHECK_FIRST_SECTION_PROGRAMS + 1, CHECK_PROGRAMS);
+    length = make_section(section, TABLE_PAT, CHECK_TSID, CHECK_PAT_VERSION,
+                          1, 1, body, n);
+    if (write_section(stream, PID_PAT, section, length) != 0)
+        return -1;
+
+    length = make_section(section, TABLE_PMT, CHECK_SID, 0, 0, 0, pmt,
+                          sizeof(pmt));
+    if (write_section(stream, CHECK_PMT_PID, section, length) != 0)
+        return -1;
+
+    // SDT: the original network, then the services.
+    n = 0;
+    body[n++] = CHECK_ONID >> 8;
+    body[n++] = CHECK_ONID & 0xff;
+    body[n++] = 0xff;
+    n += sdt_service(body + n, 1, 4, 0, 0x01, "Check", "One");
+    n += sdt_service(body + n, 2, 1, 1, 0x02, "Check", "Two");
+    length = make_section(section, TABLE_SDT, CHECK_TSID, 0, 0, 0, body, n);
+    if (write_section(stream, PID_SDT, section, length) != 0)
+        return -1;
+
+    // NIT: the network name, then two transport streams.
+    n = 0;
+    body[n++] = 0xf0;
+    body[n++] = 2 + 3;
+    body[n++] = 0x40;
+    body[n++] = 3;
+    memcpy(body + n, "Net", 3);
+    n += 3;
+
+    loop = n;
+    n += 2;
+    body[n++] = CHECK_TSID >> 8;
+    body[n++] = CHECK_TSID & 0xff;
+    body[n++] = CHECK_ONID >> 8;
+    body[n++] = CHECK_ONID & 0xff;
+    body[n++] = 0xf0;
+    body[n++] = 0;
+    body[n++] = 0x04;
+    body[n++] = 0x02;
+    body[n++] = CHECK_ONID >> 8;
+    body[n++] = CHECK_ONID & 0xff;
+    body[n++] = 0xf0;
+    body[n++] = 0;
+    body[loop] = 0xf0 | ((n - loop - 2) >> 8);
+    body[loop + 1] = (n - loop - 2) & 0xff;
+
+    length = make_section(section, TABLE_NIT, CHECK_NETWORK_ID, 0, 0, 0, body,
+                          n);
+    if (write_section(stream, PID_NIT, section, length) != 0)
+        return -1;
+
+    // Terrestrial VCT: the protocol version, two channels, and no
+    // additional descriptors.
+    n = 0;
+    body[n++] = 0;
+    body[n++] = 2;
+    n += vct_channel(body + n, "KCHK", 7, 1, CHECK_SID, 0, 0x55);
+    n += vct_channel(body + n, "KCHK-HD", 7, 2, 2, 1, 0x56);
+    body[n++] = 0xfc;
+    body[n++] = 0;
+    length = make_section(section, TABLE_TVCT, CHECK_TSID, 0, 0, 0, body, n);
+    if (write_section(stream, PID_PSIP, section, length) != 0)
+        return -1;
+
+    return 0;
+}
+
+static int generate_stream(const char *path)
+{
+    static t_stream stream;
+    static const uint8_t payload[TS_PACKET_SIZE - 4];
+    static const int pids[] = {
+        CHECK_VIDEO_PID, CHECK_AUDIO_PID, CHECK_DATA_PID
+    };
+    int i;
+
+    memset(&stream, 0, sizeof(stream));
+
+    if ((stream.f = fopen(path, "wb")) == NULL)
+        return -1;
+
+    for (i = 0; i < CHECK_PACKETS; i++)
+    {
+        if ((i % 100 == 0 && write_tables(&stream) != 0) ||
+            write_packet(&stream, pids[i % 3], 0, payload,
+                         sizeof(payload)) != 0)
+        {
+            fclose(stream.f);
+            return -1;
+        }
+    }
+
+    return fclose(stream.f);
+}
+
+// Tune the simulated frontend, which then plays the stream.
+static int tune_frontend(void)
+{
+    struct dtv_property prop;
+    struct dtv_properties props;
+    int fd;
+
+    if ((fd = zap_open(CHECK_FRONTEND, O_RDWR | O_NONBLOCK)) < 0)
+        return -1;
+
+    memset(&prop, 0, sizeof(prop));
+    prop.cmd = DTV_TUNE;
+
+    props.num = 1;
+    props.props = &prop;
+
+    if (zap_ioctl(fd, FE_SET_PROPERTY, &props) < 0)
+    {
+        zap_close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// A PAT split over sections (one of which spans packets, one of which comes
+// twice, and an earlier version that's dropped), and the PMT it leads to.
+static void check_sections(void)
+{
+    t_psi_request requests[2], many[PSI_MAX_REQUESTS + 1];
+    const t_pmt *pmt = &requests[1].u.pmt;
+    const t_pat *pat = &requests[0].u.pat;
+    int i, sid, seen[CHECK_PROGRAMS + 1];
+
+    // Too many requests are refused rather than cut short.
+    memset(many, 0, sizeof(many));
+    for (i = 0; i <= PSI_MAX_REQUESTS; i++)
+        many[i].table = PSI_PAT;
+
+    errno = 0;
+    CHECK(psi_acquire(CHECK_DEMUX, many, PSI_MAX_REQUESTS + 1, -1) == -1);
+    CHECK(errno == EINVAL);
+
+    memset(requests, 0, sizeof(requests));
+    requests[0].table = PSI_PAT;
+    requests[1].table = PSI_PMT;
+    requests[1].sid = CHECK_SID;
+
+    CHECK(psi_acquire(CHECK_DEMUX, requests, 2, -1) == 2);
+    CHECK(requests[0].status == PSI_COMPLETE);
+    CHECK(requests[1].status == PSI_COMPLETE);
+
+    CHECK(pat->tsid == CHECK_TSID);
+    CHECK(pat->version == CHECK_PAT_VERSION);
+    CHECK(pat->count == CHECK_PROGRAMS);
+
+    memset(seen, 0, sizeof(seen));
+
+    for (i = 0; i < pat->count; i++)
+    {
+        sid = pat->sids[i];
+
+        CHECK(sid >= 1 && sid <= CHECK_PROGRAMS);
+        if (sid < 1 || sid > CHECK_PROGRAMS)
+            continue;
+
+        CHECK(seen[sid] == 0);
+        CHECK(pat->pmt_pids[i] == pmt_pid_of(sid));
+        seen[sid] = 1;
+    }
+
+    CHECK(pat_pmt_pid(pat, CHECK_SID) == CHECK_PMT_PID);
+    CHECK(pat_pmt_pid(pat, CHECK_PROGRAMS) == pmt_pid_of(CHECK_PROGRAMS));
+    CHECK(pat_pmt_pid(pat, 500) <= 0);
+
+    CHECK(pmt->sid == CHECK_SID);
+    CHECK(pmt->pcr_pid == CHECK_VIDEO_PID);
+    CHECK(pmt->count == 3);
+
+    if (pmt->count == 3)
+    {
+        CHECK(pmt->streams[0].pid == CHECK_VIDEO_PID);
+        CHECK(pmt->streams[0].kind == ES_VIDEO);
+        CHECK(pmt->streams[1].pid == CHECK_AUDIO_PID);
+        CHECK(pmt->streams[1].kind == ES_AUDIO);
+        CHECK(strcmp(pmt->streams[1].language, "eng") == 0);
+        CHECK(pmt->streams[2].pid == CHECK_SUBTITLE_PID);
+        CHECK(pmt->streams[2].kind == ES_SUBTITLE);
+        CHECK(strcmp(pmt->streams[2].language, "deu") == 0);
+    }
+}
+
+// The SDT, NIT and VCT, read at once.
+static void check_tables(void)
+{
+    t_psi_request requests[3];
+    const t_sdt *sdt = &requests[0].u.sdt;
+    const t_nit *nit = &requests[1].u.nit;
+    const t_vct *vct = &requests[2].u.vct;
+
+    memset(requests, 0, sizeof(requests));
+    requests[0].table = PSI_SDT;
+    requests[1].table = PSI_NIT;
+    requests[2].table = PSI_VCT;
+
+    CHECK(psi_acquire(CHECK_DEMUX, requests, 3, -1) == 3);
+
+    CHECK(requests[0].status == PSI_COMPLETE);
+    CHECK(sdt->tsid == CHECK_TSID);
+    CHECK(sdt->onid == CHECK_ONID);
+    CHECK(sdt->count == 2);
+
+    if (sdt->count == 2)
+    {
+        CHECK(sdt->services[0].sid == 1);
+        CHECK(sdt->services[0].service_type == 0x01);
+        CHECK(sdt->services[0].running_status == 4);
+        CHECK(sdt->services[0].scrambled == 0);
+        CHECK(strcmp(sdt->services[0].provider, "Check") == 0);
+        CHECK(strcmp(sdt->services[0].name, "One") == 0);
+
+        CHECK(sdt->services[1].sid == 2);
+        CHECK(sdt->services[1].service_type == 0x02);
+        CHECK(sdt->services[1].scrambled == 1);
+        CHECK(strcmp(sdt->services[1].name, "Two") == 0);
+    }
+
+    CHECK(requests[1].status == PSI_COMPLETE);
+    CHECK(nit->network_id == CHECK_NETWORK_ID);
+    CHECK(strcmp(nit->name, "Net") == 0);
+    CHECK(nit->count == 2);
+
+    if (nit->count == 2)
+    {
+        CHECK(nit->streams[0].tsid == CHECK_TSID);
+        CHECK(nit->streams[0].onid == CHECK_ONID);
+        CHECK(nit->streams[1].tsid == 0x0402);
+    }
+
+    CHECK(requests[2].status == PSI_COMPLETE);
+    CHECK(vct->tsid == CHECK_TSID);
+    CHECK(vct->cable == 0);
+    CHECK(vct->count == 2);
+
+    if (vct->count == 2)
+    {
+        CHECK(strcmp(vct->channels[0].short_name, "KCHK") == 0);
+        CHECK(vct->channels[0].major == 7);
+        CHECK(vct->channels[0].minor == 1);
+        CHECK(vct->channels[0].modulation == 0x04);
+        CHECK(vct->channels[0].tsid == CHECK_TSID);
+        CHECK(vct->channels[0].sid == CHECK_SID);
+        CHECK(vct->channels[0].hidden == 0);
+        CHECK(vct->channels[0].service_type == 0x02);
+        CHECK(vct->channels[0].source_id == 0x55);
+
+        CHECK(strcmp(vct->channels[1].short_name, "KCHK-HD") == 0);
+        CHECK(vct->channels[1].minor == 2);
+        CHECK(vct->channels[1].hidden == 1);
+    }
+}
+
+// Channel change commands, against values worked out from EN 50494 and
+// EN 50607 by hand.
+static void check_unicable(void)
+{
+    static const uint8_t unicable[] = { 0xe0, 0x10, 0x5a, 0x25, 0x2a };
+    static const uint8_t jess[] = { 0x70, 0x0c, 0x30, 0x16 };
+    struct lnb_types_st lnb;
+    struct dvb_diseqc_master_cmd cmd;
+    unsigned int freq;
+
+    // User band 1 (1420 MHz), the 1172 MHz IF in 4 MHz steps:
+    // (1172 + 1420) / 4 - 350 = 298, bank 1 (position A, vertical, high).
+    CHECK(lnb_decode("UNICABLE,1210,1420", &lnb) > 0);
+    CHECK(lnb.scr == LNB_SCR_UNICABLE);
+    CHECK(lnb.user_band_count == 2);
+
+    freq = unicable_command(&lnb, 1, 1172000, 0, 1, 1, &cmd);
+    CHECK(cmd.msg_len == sizeof(unicable));
+    CHECK(memcmp(cmd.msg, unicable, sizeof(unicable)) == 0);
+    CHECK(freq == 1420000);
+
+    // An IF between steps: (1173 + 1210) / 4 rounds to 596, which moves
+    // 1174 MHz onto the user band, so the frontend is tuned 1 MHz below it.
+    freq = unicable_command(&lnb, 0, 1173000, 0, 1, 1, &cmd);
+    CHECK(cmd.msg[3] == 0x04 && cmd.msg[4] == 0xf6);
+    CHECK(freq == 1209000);
+
+    // User band 1, the 1172 MHz IF in 1 MHz steps above 100 MHz (1072),
+    // position 5, horizontal, low band.
+    CHECK(lnb_decode("JESS,1210,1420", &lnb) > 0);
+    CHECK(lnb.scr == LNB_SCR_JESS);
+
+    freq = unicable_command(&lnb, 1, 1172300, 5, 0, 0, &cmd);
+    CHECK(cmd.msg_len == sizeof(jess));
+    CHECK(memcmp(cmd.msg, jess, sizeof(jess)) == 0);
+    CHECK(freq == 1420300);
+
+    CHECK(lnb_decode("UNICABLE", &lnb) < 0);
+    CHECK(lnb_decode("JESS,1210,x", &lnb) < 0);
+}
+
+// Read packets from the PID set's descriptor until max are in, noting the
+// PIDs. Returns the number read.
+static int read_pids(int fd, int *seen, int max)
+{
+    uint8_t packets[TS_PACKET_SIZE * 64];
+    struct pollfd pfd;
+    int count, i, total = 0;
+
+    while (total < max)
+    {
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        if (zap_poll(&pfd, 1, 1000) <= 0)
+            break;
+
+        if ((count = zap_read(fd, packets, sizeof(packets))) <= 0)
+            break;
+
+        for (i = 0; i + TS_PACKET_SIZE <= count; i += TS_PACKET_SIZE)
+            seen[((packets[i + 1] & 0x1f) << 8) | packets[i + 2]]++;
+
+        total += count / TS_PACKET_SIZE;
+    }
+
+    return total;
+}
+
+// PIDs added to and removed from one demux filter.
+static void check_pid_set(void)
+{
+    static int seen[0x2000];
+    t_pid_filter filter;
+
+    pid_filter_init(&filter, CHECK_DEMUX, ZAP_OUT_TSDEMUX);
+
+    CHECK(pid_filter_add(&filter, CHECK_VIDEO_PID, DMX_PES_OTHER) == 0);
+    CHECK(pid_filter_add(&filter, CHECK_AUDIO_PID, DMX_PES_OTHER) == 0);
+    CHECK(pid_filter_add(&filter, CHECK_AUDIO_PID, DMX_PES_OTHER) == 0);
+    CHECK(pid_filter_add(&filter, 0x1fff, DMX_PES_OTHER) == 0);
+    CHECK(filter.count == 2);
+    CHECK(filter.fd >= 0);
+    CHECK(pid_filter_contains(&filter, CHECK_VIDEO_PID));
+    CHECK(pid_filter_contains(&filter, CHECK_AUDIO_PID));
+    CHECK(pid_filter_contains(&filter, CHECK_DATA_PID) == 0);
+
+    memset(seen, 0, sizeof(seen));
+    CHECK(read_pids(filter.fd, seen, 600) >= 600);
+    CHECK(seen[CHECK_VIDEO_PID] > 0);
+    CHECK(seen[CHECK_AUDIO_PID] > 0);
+    CHECK(seen[CHECK_DATA_PID] == 0);
+    CHECK(seen[PID_PAT] == 0);
+
+    CHECK(pid_filter_remove(&filter, CHECK_AUDIO_PID) == 0);
+    CHECK(pid_filter_remove(&filter, CHECK_DATA_PID) == 0);
+    CHECK(pid_filter_add(&filter, CHECK_DATA_PID, DMX_PES_OTHER) == 0);
+    CHECK(filter.count == 2);
+    CHECK(pid_filter_contains(&filter, CHECK_AUDIO_PID) == 0);
+
+    memset(seen, 0, sizeof(seen));
+    CHECK(read_pids(filter.fd, seen, 600) >= 600);
+    CHECK(seen[CHECK_VIDEO_PID] > 0);
+    CHECK(seen[CHECK_AUDIO_PID] == 0);
+    CHECK(seen[CHECK_DATA_PID] > 0);
+
+    pid_filter_close(&filter);
+    CHECK(filter.count == 0);
+    CHECK(filter.fd < 0);
+}
+
+// A frontend claimed stays claimed when the adapters are discovered again,
+// and is dropped when it's gone.
+static void check_caps(void)
+{
+    t_tuner_descriptor tuner;
+    t_frontend_caps caps;
+
+    CHECK(caps_discover() == 1);
+    CHECK(caps_count() == 1);
+    CHECK(caps_get(0, &caps) == 0);
+    CHECK(caps.adapter == 0 && caps.frontend == 0);
+    CHECK(caps_get(1, &caps) < 0);
+    CHECK(caps_find(0, 0, &caps) == 0);
+    CHECK(caps.info.type == FE_ATSC);
+    CHECK(caps_find(1, 0, &caps) < 0);
+
+    CHECK(caps_claim(SYS_ATSC, 0, &tuner) == 0);
+    CHECK(tuner.adapter == 0 && tuner.frontend == 0);
+    CHECK(caps_claim(SYS_ATSC, 0, &tuner) < 0);
+
+    CHECK(caps_discover() == 1);
+    CHECK(caps_claim(SYS_ATSC, 0, &tuner) < 0);
+
+    caps_release(0, 0);
+    CHECK(caps_claim(SYS_ATSC, 0, &tuner) == 0);
+    CHECK(caps_claim(SYS_DVBS, 0, &tuner) < 0);
+}
+
+typedef struct
+{
+    t_tuner_pool *pool;
+    t_pool_service service;
+    int result;
+} t_pool_subscriber;
+
+static void *subscribe(void *context)
+{
+    t_pool_subscriber *subscriber = context;
+
+    subscriber->result = pool_subscribe(subscriber->pool,
+                                        &subscriber->service, 0);
+    return NULL;
+}
+
+// A second adapter whose signal comes and goes: a subscription can't be
+// used or dropped while its tuner is being tuned, and the tuner is failed
+// (and not shared any more) once it loses the lock.
+static void check_pool(const char *path)
+{
+    t_vadapter_config adapter;
+    t_pool_subscriber subscriber;
+    t_tuner_descriptor tuner;
+    t_tuner_pool pool;
+    pthread_t thread;
+    int64_t give_up_us;
+    int state;
+
+    memset(&adapter, 0, sizeof(adapter));
+    adapter.ts_path = path;
+    adapter.fe_type = FE_ATSC;
+    adapter.lock_delay_ms = 300;
+    adapter.loss_period_ms = 600;
+    adapter.loss_duration_ms = 300;
+
+    CHECK(vadapter_add(1, &adapter) == 0);
+    CHECK(caps_discover() == 2);
+
+    memset(&subscriber, 0, sizeof(subscriber));
+    subscriber.pool = &pool;
+    subscriber.service.type = FE_ATSC;
+    subscriber.service.u.atsc.frequency = 500000000;
+    subscriber.service.u.atsc.modulation = VSB_8;
+    subscriber.service.u.atsc.sid = CHECK_SID;
+    subscriber.service.u.atsc.vpid = CHECK_VIDEO_PID;
+    subscriber.service.u.atsc.apid = CHECK_AUDIO_PID;
+
+    pool_init(&pool, NULL, ZAP_OUT_TSDEMUX, 2000);
+
+    CHECK(pthread_create(&thread, NULL, subscribe, &subscriber) == 0);
+    usleep(100000);
+
+    CHECK(pool_session(&pool, 0) == NULL);
+    CHECK(pool_state(&pool, 0) < 0);
+    pool_unsubscribe(&pool, 0);
+
+    pthread_join(thread, NULL);
+    CHECK(subscriber.result == 0);
+    CHECK(pool_session(&pool, 0) != NULL);
+    CHECK(pool_state(&pool, 0) == POOL_TUNER_LOCKED);
+
+    give_up_us = monotonic_us() + 2000000;
+    while ((state = pool_state(&pool, 0)) == POOL_TUNER_LOCKED &&
+           monotonic_us() < give_up_us)
+        usleep(10000);
+
+    CHECK(state == POOL_TUNER_FAILED);
+
+    // Adapter 0's frontend is still claimed (see check_caps()).
+    CHECK(pool_subscribe(&pool, &subscriber.service, 0) < 0);
+
+    // Its frontend is given back with it.
+    pool_unsubscribe(&pool, 0);
+    CHECK(pool_session(&pool, 0) == NULL);
+    CHECK(caps_claim(SYS_ATSC, 0, &tuner) == 0);
+    CHECK(tuner.adapter == 1);
+    caps_release(1, 0);
+
+    pool_destroy(&pool);
+    vadapter_remove(1);
+}
+
+static void add_tune_adapter(const char *path)
+{
+    t_vadapter_config adapter;
+
+    memset(&adapter, 0, sizeof(adapter));
+    adapter.ts_path = path;
+    adapter.fe_type = FE_ATSC;
+    adapter.lock_delay_ms = CHECK_LOCK_DELAY_MS;
+    adapter.signal = -45000;
+    adapter.cnr_start = CHECK_CNR_START;
+    adapter.cnr_end = CHECK_CNR_END;
+    adapter.cnr_ramp_ms = CHECK_CNR_RAMP_MS;
+
+    CHECK(vadapter_add(CHECK_TUNE_ADAPTER, &adapter) == 0);
+}
+
+static void init_tune_session(t_zap_session *session, t_tune_options *options)
+{
+    t_tuner_descriptor tuner = { CHECK_TUNE_ADAPTER, 0, 0 };
+
+    options->status_interval_us = 10000;
+    options->pipelined = 1;
+
+    CHECK(zap_session_init(session, tuner, options) == 0);
+}
+
+static t_atsc_tune_info check_tune_info(void)
+{
+    t_atsc_tune_info info;
+
+    memset(&info, 0, sizeof(info));
+    info.frequency = 500000000;
+    info.modulation = VSB_8;
+    info.sid = CHECK_SID;
+
+    return info;
+}
+
+// The samples a status receiver was called with.
+typedef struct
+{
+    int count;
+    t_frontend_stats stats[CHECK_STATUS_CALLS];
+} t_status_calls;
+
+static int record_status(const t_frontend_stats *stats, void *context)
+{
+    t_status_calls *calls = context;
+
+    if (calls->count < CHECK_STATUS_CALLS)
+        calls->stats[calls->count++] = *stats;
+
+    return 1;
+}
+
+// Tune with azap_tune_start() and drive it with zap_session_process()
+// whenever zap_session_fd() is readable, cancelling once the CNR ramp is 
+// over (the receiver never ends it). The receiver is called as mode says, 
+// and every sample also goes to a ring.
+static void check_tune_start(int mode)
+{
+    t_zap_session session;
+    t_tune_options options;
+    t_status_ring ring;
+    t_status_calls calls;
+    static t_status_record records[CHECK_STATUS_CALLS];
+    struct pollfd pfd;
+    int64_t cancel_us, give_up_us;
+    unsigned int drained;
+    int i, result, running = 0;
+
+    CHECK(status_ring_init(&ring, CHECK_STATUS_CALLS) == 0);
+
+    memset(&calls, 0, sizeof(calls));
+    memset(&options, 0, sizeof(options));
+    options.status_receiver_ex = record_status;
+    options.status_context = &calls;
+    options.status_mode = mode;
+    options.status_snr_delta = CHECK_CNR_DELTA;
+    options.status_ring = &ring;
+
+    init_tune_session(&session, &options);
+
+    cancel_us = monotonic_us() +
+                (CHECK_LOCK_DELAY_MS + CHECK_CNR_RAMP_MS + 100) * 1000;
+    give_up_us = cancel_us + 2000000;
+
+    CHECK(azap_tune_start(&session, check_tune_info(), ZAP_OUT_TSDEMUX, 1,
+                          NULL) == 0);
+
+    pfd.fd = zap_session_fd(&session);
+    pfd.events = POLLIN;
+    CHECK(pfd.fd >= 0);
+
+    while ((result = zap_session_process(&session)) == 1 &&
+           monotonic_us() < give_up_us)
+    {
+        running++;
+
+        if (monotonic_us() >= cancel_us)
+            zap_session_cancel(&session);
+
+        poll(&pfd, 1, 10);
+    }
+
+    // Sampled on its own timer until cancelled, and over once it's been.
+    CHECK(result == 0);
+    CHECK(running > 1);
+    CHECK(zap_session_process(&session) == 0);
+    CHECK(session.stats.psi_status == PSI_COMPLETE);
+
+    drained = status_ring_drain(&ring, records, CHECK_STATUS_CALLS);
+    CHECK(status_ring_drain(&ring, records, CHECK_STATUS_CALLS) == 0);
+    CHECK(status_ring_dropped(&ring) == 0);
+    CHECK(drained > 2);
+    CHECK(records[0].adapter == CHECK_TUNE_ADAPTER);
+    CHECK(records[0].stats.is_locked == 0);
+    CHECK(records[drained - 1].stats.is_locked);
+    CHECK(records[drained - 1].stats.cnr == CHECK_CNR_END);
+
+    for (i = 1; i < (int)drained; i++)
+        CHECK(records[i].time_us >= records[i - 1].time_us);
+
+    if (mode == STATUS_EVERY_SAMPLE)
+        CHECK(calls.count == (int)drained);
+    else
+    {
+        // The first sample, the lock, and a CNR that's moved by the delta.
+        CHECK(calls.count >= 3);
+        CHECK(calls.count < (int)drained);
+        CHECK(calls.stats[0].is_locked == 0);
+
+        for (i = 1; i < calls.count; i++)
+            CHECK(calls.stats[i].is_locked != calls.stats[i - 1].is_locked ||
+                  llabs(calls.stats[i].cnr - calls.stats[i - 1].cnr) >=
+                      CHECK_CNR_DELTA);
+    }
+
+    zap_session_destroy(&session);
+    status_ring_free(&ring);
+}
+
+// Sample until the lock.
+static int until_locked(const t_frontend_stats *stats, void *context)
+{
+    return stats->is_locked == 0;
+}
+
+// What a session in the reactor has been told, and read.
+typedef struct
+{
+    t_zap_reactor *reactor;
+    t_dvr_reader reader;
+    int tune_done;
+    int stream_end;
+    int psi_status;
+    unsigned int packets;
+} t_reactor_check;
+
+static int count_reactor_packets(const unsigned char *packets,
+                                 unsigned int count, void *context)
+{
+    t_reactor_check *state = context;
+
+    state->packets += count;
+    return state->packets < CHECK_PACKETS;
+}
+
+static void reactor_event(t_zap_session *session, int event, void *context)
+{
+    t_reactor_check *state = context;
+
+    if (event == REACTOR_TUNE_DONE)
+    {
+        state->tune_done++;
+        state->psi_status = session->stats.psi_status;
+
+        if (zap_session_open_dvr(session, &state->reader, 0, 0) == 0 &&
+            zap_reactor_read(state->reactor, session, &state->reader,
+                             count_reactor_packets, state) == 0)
+            return;
+    }
+    else
+    {
+        state->stream_end++;
+        dvr_reader_close(&state->reader);
+    }
+
+    zap_reactor_stop(state->reactor);
+}
+
+// A tune and its stream driven by a reactor: the handler is told when the
+// tune is over, reads the stream until it has enough, and is told when
+// that's over.
+static void check_reactor(void)
+{
+    t_zap_reactor reactor;
+    t_zap_session session;
+    t_tune_options options;
+    t_reactor_check state;
+
+    memset(&state, 0, sizeof(state));
+    state.reactor = &reactor;
+
+    memset(&options, 0, sizeof(options));
+    options.status_receiver_ex = until_locked;
+    options.persistent = 1;
+
+    CHECK(zap_reactor_init(&reactor) == 0);
+    init_tune_session(&session, &options);
+
+    CHECK(zap_reactor_add(&reactor, &session, reactor_event, &state) == 0);
+    CHECK(zap_reactor_count(&reactor) == 1);
+    CHECK(zap_reactor_session(&reactor, 0) == &session);
+
+    CHECK(azap_tune_start(&session, check_tune_info(), ZAP_OUT_TSDEMUX, 1,
+                          NULL) == 0);
+    CHECK(zap_reactor_run(&reactor) == 0);
+
+    CHECK(state.tune_done == 1);
+    CHECK(state.psi_status == PSI_COMPLETE);
+    CHECK(state.stream_end == 1);
+    CHECK(state.packets >= CHECK_PACKETS);
+
+    zap_reactor_remove(&reactor, &session);
+    CHECK(zap_reactor_session(&reactor, 0) == NULL);
+
+    zap_session_destroy(&session);
+    zap_reactor_destroy(&reactor);
+}
+
+typedef struct
+{
+    t_status_board *board;
+    volatile int stop;
+    int64_t last;
+} t_board_writer;
+
+// Samples whose fields all follow from one number, so that a torn copy
+// shows, until the reader has seen enough.
+static void *write_samples(void *context)
+{
+    t_board_writer *writer = context;
+    t_status_record record;
+    int64_t n;
+
+    memset(&record, 0, sizeof(record));
+    record.adapter = 3;
+    record.frontend = 1;
+
+    for (n = 1; writer->stop == 0; n++)
+    {
+        record.time_us = n;
+        record.stats.signal = n;
+        record.stats.cnr = -n;
+        record.stats.post_error_bits = 2 * n;
+
+        status_board_publish(writer->board, &record);
+    }
+
+    writer->last = n - 1;
+    return NULL;
+}
+
+// A status board written by one thread and read by another, through
+// separate mappings.
+static void check_status_board(void)
+{
+    t_status_board board, reader;
+    t_board_writer writer;
+    t_status_record record;
+    pthread_t thread;
+    char name[64];
+    int64_t last = 0;
+    int opened, started, retval, torn = 0, reads = 0;
+
+    snprintf(name, sizeof(name), "/zaplib-check-%d", (int)getpid());
+
+    opened = (status_board_open(&board, name, 1) == 0);
+    CHECK(opened);
+    if (opened == 0)
+        return;
+
+    opened = (status_board_open(&reader, name, 0) == 0);
+    CHECK(opened);
+    if (opened == 0)
+    {
+        status_board_close(&board);
+        status_board_unlink(name);
+        return;
+    }
+
+    CHECK(status_board_read(&reader, 3, 1, &record) == -1);
+    CHECK(status_board_read(&reader, STATUS_BOARD_ADAPTERS, 0, &record) == -2);
+    CHECK(status_board_read(&reader, 0, STATUS_BOARD_FRONTENDS, &record) ==
+          -2);
+
+    writer.board = &board;
+    writer.stop = 0;
+    writer.last = 0;
+
+    started = (pthread_create(&thread, NULL, write_samples, &writer) == 0);
+    CHECK(started);
+
+    while (started && reads < CHECK_BOARD_READS)
+    {
+        // Nothing yet, or a slot being written every time it was tried.
+        retval = status_board_read(&reader, 3, 1, &record);
+        if (retval != 0)
+            continue;
+
+        reads++;
+
+        if (record.stats.signal != record.time_us ||
+            record.stats.cnr != -record.time_us ||
+            record.stats.post_error_bits != 2 * record.time_us ||
+            record.time_us < last)
+            torn++;
+
+        last = record.time_us;
+    }
+
+    if (started)
+    {
+        writer.stop = 1;
+        pthread_join(thread, NULL);
+
+        CHECK(torn == 0);
+
+        CHECK(status_board_read(&reader, 3, 1, &record) == 0);
+        CHECK(record.time_us == writer.last);
+        CHECK(record.adapter == 3 && record.frontend == 1);
+    }
+
+    CHECK(status_board_read(&reader, 3, 0, &record) == -1);
+
+    status_board_close(&reader);
+    status_board_close(&board);
+    CHECK(status_board_unlink(name) == 0);
+}
+
+int main(void)
+{
+    char path[] = "/tmp/zaplib-check-XXXXXX";
+    t_vadapter_config adapter;
+    int fd, fe_fd;
+
+    if ((fd = mkstemp(path)) < 0)
+    {
+        perror("mkstemp");
+        return 1;
+    }
+
+    close(fd);
+
+    if (generate_stream(path) != 0)
+    {
+        perror(path);
+        unlink(path);
+        return 1;
+    }
+
+    memset(&adapter, 0, sizeof(adapter));
+    adapter.ts_path = path;
+    adapter.fe_type = FE_ATSC;
+
+    if (vadapter_add(0, &adapter) != 0)
+    {
+        fprintf(stderr, "Can't play %s.\n", path);
+        unlink(path);
+        return 1;
+    }
+
+    fe_fd = tune_frontend();
+    CHECK(fe_fd >= 0);
+
+    if (fe_fd >= 0)
+    {
+        check_sections();
+        check_tables();
+        check_pid_set();
+        zap_close(fe_fd);
+    }
+
+    add_tune_adapter(path);
+    check_tune_start(STATUS_EVERY_SAMPLE);
+    check_tune_start(STATUS_ON_CHANGE);
+    check_reactor();
+    vadapter_remove(CHECK_TUNE_ADAPTER);
+
+    check_caps();
+    check_pool(path);
+
+    vadapter_remove(0);
+    unlink(path);
+
+    // The claim on the frontend removed goes with it.
+    CHECK(caps_discover() == 0);
+    caps_release(0, 0);
+    CHECK(caps_discover() == 0);
+    caps_clear();
+
+    check_unicable();
+    check_status_board();
+
+    if (failures > 0)
+    {
+        fprintf(stderr, "%d check(s) failed.\n", failures);
+        return 1;
+    }
+
+    printf("All checks passed.\n");
+    return 0;
+}
@@ -0,0 +1,322 @@
+// Assertion tests for zapcoro.hpp, built with -std=c++20 and run by
+// "make check" after tools/check.c, against a simulated adapter (see
+// vadapter.h) playing a stream generated here: one service (sid 1, PMT on
+// 0x100, video on 0x101, audio on 0x102).
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <unistd.h>
+#include <stdlib.h>
+
+#include "zapcoro.hpp"
+
+extern "C" {
+#include "vadapter.h"
+}
+
+#define CHECK_SID 1
+#define CHECK_PMT_PID 0x100
+#define CHECK_VIDEO_PID 0x101
+#define CHECK_AUDIO_PID 0x102
+
+#define CHECK_PACKETS 4000
+#define CHECK_LOCK_DELAY_MS 300
+
+static int failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+static void check(bool passed, const char *condition, const char *file,
+                  int line)
+{
+    if (passed)
+        return;
+
+    fprintf(stderr, "%s:%d: failed: %s\n", file, line, condition);
+    failures++;
+}
+
+static uint32_t crc32_mpeg(const uint8_t *data, int length)
+{
+    uint32_t crc = 0xffffffff;
+
+    for (int i = 0; i < length; i++)
+    {
+        crc ^= (uint32_t)data[i] << 24;
+
+        for (int j = 0; j < 8; j++)
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+    }
+
+    return crc;
+}
+
+// A single-section table (section number 0 of 0) in a packet of its own.
+static void table_packet(uint8_t *p, int pid, int table_id, int extension,
+                         const uint8_t *body, int body_length, int cc)
+{
+    uint8_t *section = p + 5;
+    int length = 5 + body_length + 4;
+    uint32_t crc;
+
+    memset(p, 0xff, TS_PACKET_SIZE);
+    p[0] = 0x47;
+    p[1] = 0x40 | (pid >> 8);
+    p[2] = pid & 0xff;
+    p[3] = 0x10 | (cc & 0x0f);
+    p[4] = 0;
+
+    section[0] = table_id;
+    section[1] = 0xb0 | (length >> 8);
+    section[2] = length & 0xff;
+    section[3] = extension >> 8;
+    section[4] = extension & 0xff;
+    section[5] = 0xc1;
+    section[6] = 0;
+    section[7] = 0;
+    memcpy(section + 8, body, body_length);
+
+    crc = crc32_mpeg(section, 8 + body_length);
+    section[8 + body_length] = crc >> 24;
+    section[9 + body_length] = crc >> 16;
+    section[10 + body_length] = crc >> 8;
+    section[11 + body_length] = crc;
+}
+
+// A PAT and PMT every 40 packets, and video and audio in between.
+static int generate_stream(const char *path)
+{
+    static const uint8_t pat[] = {
+        0x00, CHECK_SID, 0xe0 | (CHECK_PMT_PID >> 8), CHECK_PMT_PID & 0xff
+    };
+    static const uint8_t pmt[] = {
+        0xe0 | (CHECK_VIDEO_PID >> 8), CHECK_VIDEO_PID & 0xff, 0xf0, 0x00,
+        0x02, 0xe0 | (CHECK_VIDEO_PID >> 8), CHECK_VIDEO_PID & 0xff, 0xf0, 0,
+        0x81, 0xe0 | (CHECK_AUDIO_PID >> 8), CHECK_AUDIO_PID & 0xff, 0xf0, 0
+    };
+    uint8_t p[TS_PACKET_SIZE];
+    int cc[3] = { 0, 0, 0 }, pid;
+    FILE *f;
+
+    if ((f = fopen(path, "wb")) == NULL)
+        return -1;
+
+    for (int i = 0; i < CHECK_PACKETS; i++)
+    {
+        if (i % 40 == 0)
+            table_packet(p, 0, TABLE_PAT, 1, pat, sizeof(pat), cc[0]++);
+        else if (i % 40 == 1)
+            table_packet(p, CHECK_PMT_PID, TABLE_PMT, CHECK_SID, pmt,
+                         sizeof(pmt), cc[1]++);
+        else
+        {
+            pid = (i % 5 == 0) ? CHECK_AUDIO_PID : CHECK_VIDEO_PID;
+
+            memset(p, 0xa5, TS_PACKET_SIZE);
+            p[0] = 0x47;
+            p[1] = pid >> 8;
+            p[2] = pid & 0xff;
+            p[3] = 0x10 | (cc[2]++ & 0x0f);
+        }
+
+        if (fwrite(p, TS_PACKET_SIZE, 1, f) != 1)
+        {
+            fclose(f);
+            return -1;
+        }
+    }
+
+    return fclose(f);
+}
+
+static t_atsc_tune_info tune_info()
+{
+    t_atsc_tune_info info;
+
+    memset(&info, 0, sizeof(info));
+    info.frequency = 500000000;
+    info.modulation = VSB_8;
+    info.sid = CHECK_SID;
+
+    return info;
+}
+
+// What a coroutine saw, and how far it got.
+struct t_outcome
+{
+    int tries = 0;
+    bool locked = false;
+    int psi_status = -1;
+    bool has_video = false;
+    unsigned long packets = 0;
+    bool ended = false;
+    bool done = false;
+};
+
+// A tuner that didn't fit in the reactor: everything awaited fails at once,
+// without the reactor being run.
+static zap::task fail_at_once(zap::tuner &tuner, t_outcome &outcome)
+{
+    t_dvr_reader reader;
+
+    memset(&reader, 0, sizeof(reader));
+
+    outcome.tries++;
+    outcome.locked = co_await tuner.tune(tune_info(), ZAP_OUT_TSDEMUX, 1,
+                                         1000);
+    outcome.psi_status = co_await tuner.psi();
+    outcome.ended = (co_await tuner.packets(reader)).count == 0;
+    outcome.done = true;
+}
+
+// Tune with a timeout shorter than the lock delay, then retry with a longer
+// one, read the PSI and some packets, and delete the tuner from the
+// coroutine.
+static zap::task watch(zap::reactor &reactor, zap::tuner *tuner,
+                       t_outcome &outcome)
+{
+    t_dvr_reader reader;
+
+    outcome.tries++;
+    outcome.locked = co_await tuner->tune(tune_info(), ZAP_OUT_TSDEMUX, 1,
+                                          CHECK_LOCK_DELAY_MS / 3);
+
+    if (outcome.locked == false)
+    {
+        outcome.tries++;
+        outcome.locked = co_await tuner->tune(tune_info(), ZAP_OUT_TSDEMUX,
+                                              1, CHECK_LOCK_DELAY_MS * 10);
+    }
+
+    if (outcome.locked)
+    {
+        outcome.psi_status = co_await tuner->psi();
+
+        for (int i = 0; i < tuner->session()->pmt.count; i++)
+            if (tuner->session()->pmt.streams[i].pid == CHECK_VIDEO_PID)
+                outcome.has_video = true;
+
+        if (zap_session_open_dvr(tuner->session(), &reader, 0, 0) == 0)
+        {
+            while (outcome.packets < CHECK_PACKETS)
+            {
+                zap::batch batch = co_await tuner->packets(reader);
+
+                if (batch.count == 0)
+                {
+                    outcome.ended = true;
+                    break;
+                }
+
+                outcome.packets += batch.count;
+            }
+
+            dvr_reader_close(&reader);
+        }
+    }
+
+    delete tuner;
+    outcome.done = true;
+    reactor.stop();
+}
+
+static void check_invalid_tuner()
+{
+    t_tuner_descriptor descriptor = { 0, 0, 0 };
+    t_outcome outcome;
+    zap::reactor reactor;
+    std::vector<zap::tuner *> tuners;
+
+    for (int i = 0; i < REACTOR_MAX_SESSIONS; i++)
+        tuners.push_back(new zap::tuner(reactor, descriptor));
+
+    CHECK(tuners.back()->valid());
+
+    {
+        zap::tuner extra(reactor, descriptor);
+
+        CHECK(extra.valid() == false);
+
+        fail_at_once(extra, outcome);
+
+        CHECK(outcome.done);
+        CHECK(outcome.locked == false);
+        CHECK(outcome.ended);
+    }
+
+    for (zap::tuner *tuner : tuners)
+        delete tuner;
+}
+
+static void check_watch()
+{
+    t_tuner_descriptor descriptor = { 0, 0, 0 };
+    t_tune_options options;
+    t_outcome outcome;
+    zap::reactor reactor;
+
+    memset(&options, 0, sizeof(options));
+    options.status_interval_us = 20000;
+
+    watch(reactor, new zap::tuner(reactor, descriptor, &options), outcome);
+
+    CHECK(reactor.run() == 0);
+
+    CHECK(outcome.done);
+    CHECK(outcome.tries == 2);
+    CHECK(outcome.locked);
+    CHECK(outcome.psi_status == PSI_COMPLETE);
+    CHECK(outcome.has_video);
+    CHECK(outcome.packets >= CHECK_PACKETS);
+    CHECK(outcome.ended == false);
+}
+
+int main()
+{
+    char path[] = "/tmp/zaplib-checkcoro-XXXXXX";
+    t_vadapter_config adapter;
+    int fd;
+
+    if ((fd = mkstemp(path)) < 0)
+    {
+        perror("mkstemp");
+        return 1;
+    }
+
+    close(fd);
+
+    if (generate_stream(path) != 0)
+    {
+        perror(path);
+        unlink(path);
+        return 1;
+    }
+
+    memset(&adapter, 0, sizeof(adapter));
+    adapter.ts_path = path;
+    adapter.fe_type = FE_ATSC;
+    adapter.lock_delay_ms = CHECK_LOCK_DELAY_MS;
+
+    if (vadapter_add(0, &adapter) != 0)
+    {
+        fprintf(stderr, "Can't play %s.\n", path);
+        unlink(path);
+        return 1;
+    }
+
+    check_invalid_tuner();
+    check_watch();
+
+    vadapter_remove(0);
+    unlink(path);
+
+    if (failures > 0)
+    {
+        fprintf(stderr, "%d coroutine check(s) failed.\n", failures);
+        return 1;
+    }
+
+    printf("All coroutine checks passed.\n");
+    return 0;
+}
@@ -0,0 +1,324 @@
+// Per-thread trace rings (see trace.h).
+
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <syslog.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "util.h"
+#include "trace.h"
+
+#define TRACE_RING_MASK (TRACE_RING_RECORDS - 1)
+
+#if (TRACE_RING_RECORDS & TRACE_RING_MASK) != 0
+#error TRACE_RING_RECORDS must be a power of two.
+#endif
+
+// A ring has a single writer (its thread) and a single reader (whoever holds
+// drain_lock), so the two only share head and tail.
+typedef struct t_trace_ring
+{
+    struct t_trace_ring *next;
+
+    uint32_t thread;
+    int orphaned;
+
+    uint64_t head;
+    uint64_t tail;
+    uint64_t dropped;
+
+    t_trace_record records[TRACE_RING_RECORDS];
+} t_trace_ring;
+
+int zap_trace_enabled;
+
+static __thread t_trace_ring *thread_ring;
+
+// rings is only added to under ring_lock, and only removed from while 
+// draining (under both locks).
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static t_trace_ring *rings;
+static uint64_t orphans_dropped;
+
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ring_key;
+
+static pthread_mutex_t flusher_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flusher_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t flusher;
+static int flusher_running;
+static int flusher_stop;
+static unsigned int flusher_interval_ms;
+static TraceReceiver flusher_receiver;
+static void *flusher_context;
+
+static const char *point_names[TRACE_POINTS] = {
+    NULL, "tune begin", "tune end", "frontend set", "sec", "pid add", 
+    "pid remove", "psi start", "psi found", "lock"
+};
+
+// A thread that exits leaves its ring to be freed once drained.
+static void release_ring(void *ring)
+{
+    __atomic_store_n(&((t_trace_ring *)ring)->orphaned, 1, __ATOMIC_RELEASE);
+}
+
+static void create_key(void)
+{
+    pthread_key_create(&ring_key, release_ring);
+}
+
+static t_trace_ring *get_ring(void)
+{
+    t_trace_ring *ring;
+
+    if (thread_ring != NULL)
+        return thread_ring;
+
+    if ((ring = calloc(1, sizeof(t_trace_ring))) == NULL)
+        return NULL;
+
+    ring->thread = syscall(SYS_gettid);
+
+    pthread_once(&key_once, create_key);
+    pthread_setspecific(ring_key, ring);
+
+    pthread_mutex_lock(&ring_lock);
+    ring->next = rings;
+    rings = ring;
+    pthread_mutex_unlock(&ring_lock);
+
+    return (thread_ring = ring);
+}
+
+void zap_trace_enable(int enabled)
+{
+    __atomic_store_n(&zap_trace_enabled, enabled != 0, __ATOMIC_RELAXED);
+}
+
+void zap_trace_record(int point, unsigned int adapter, int64_t a, int64_t b)
+{
+    t_trace_ring *ring = get_ring();
+    t_trace_record *record;
+    uint64_t head, tail;
+
+    if (ring == NULL)
+        return;
+
+    head = ring->head;
+    tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    if (head - tail == TRACE_RING_RECORDS)
+    {
+        __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    record = &ring->records[head & TRACE_RING_MASK];
+    record->time_us = monotonic_us();
+    record->thread = ring->thread;
+    record->adapter = adapter;
+    record->point = point;
+    record->args[0] = a;
+    record->args[1] = b;
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Hand a ring's records over in (at most) two contiguous runs.
+static int drain_ring(t_trace_ring *ring, TraceReceiver receiver, 
+                      void *context)
+{
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = ring->tail;
+    unsigned int start, run;
+    int count = head - tail;
+
+    while (tail < head)
+    {
+        start = tail & TRACE_RING_MASK;
+        run = TRACE_RING_RECORDS - start;
+
+        if (run > head - tail)
+            run = head - tail;
+
+        receiver(&ring->records[start], run, context);
+        tail += run;
+    }
+
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    return count;
+}
+
+int zap_trace_drain(TraceReceiver receiver, void *context)
+{
+    t_trace_ring **link, *ring;
+    int count = 0;
+
+    pthread_mutex_lock(&drain_lock);
+
+    pthread_mutex_lock(&ring_lock);
+    ring = rings;
+    pthread_mutex_unlock(&ring_lock);
+
+    // Rings are only added at the head, so the rest of the list can be 
+    // walked without ring_lock.
+    for (; ring != NULL; ring = ring->next)
+        count += drain_ring(ring, receiver, context);
+
+    // Free the rings of threads that have exited. Nothing more can be 
+    // written to them, so they're empty now.
+    pthread_mutex_lock(&ring_lock);
+
+    for (link = &rings; (ring = *link) != NULL; )
+    {
+        if (__atomic_load_n(&ring->orphaned, __ATOMIC_ACQUIRE) &&
+            ring->head == ring->tail)
+        {
+            *link = ring->next;
+            orphans_dropped += ring->dropped;
+            free(ring);
+        }
+        else
+            link = &ring->next;
+    }
+
+    pthread_mutex_unlock(&ring_lock);
+    pthread_mutex_unlock(&drain_lock);
+
+    return count;
+}
+
+uint64_t zap_trace_dropped(void)
+{
+    t_trace_ring *ring;
+    uint64_t dropped;
+
+    pthread_mutex_lock(&ring_lock);
+
+    dropped = orphans_dropped;
+
+    for (ring = rings; ring != NULL; ring = ring->next)
+        dropped += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+
+    pthread_mutex_unlock(&ring_lock);
+
+    return dropped;
+}
+
+static void *run_flusher(void *unused)
+{
+    struct timespec deadline;
+
+    pthread_mutex_lock(&flusher_lock);
+
+    while (flusher_stop == 0)
+    {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += flusher_interval_ms / 1000;
+        deadline.tv_nsec += (flusher_interval_ms % 1000) * 1000000L;
+
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        pthread_cond_timedwait(&flusher_cond, &flusher_lock, &deadline);
+
+        pthread_mutex_unlock(&flusher_lock);
+        zap_trace_drain(flusher_receiver, flusher_context);
+        pthread_mutex_lock(&flusher_lock);
+    }
+
+    pthread_mutex_unlock(&flusher_lock);
+    return NULL;
+}
+
+int zap_trace_start_flusher(unsigned int interval_ms, TraceReceiver receiver,
+                            void *context)
+{
+    int retval = -1;
+
+    pthread_mutex_lock(&flusher_lock);
+
+    if (flusher_running == 0)
+    {
+        flusher_interval_ms = (interval_ms > 0) ? interval_ms : 1;
+        flusher_receiver = receiver;
+        flusher_context = context;
+        flusher_stop = 0;
+
+        if (pthread_create(&flusher, NULL, run_flusher, NULL) == 0)
+        {
+            flusher_running = 1;
+            retval = 0;
+        }
+    }
+
+    pthread_mutex_unlock(&flusher_lock);
+
+    return retval;
+}
+
+void zap_trace_stop_flusher(void)
+{
+    pthread_mutex_lock(&flusher_lock);
+
+    if (flusher_running == 0)
+    {
+        pthread_mutex_unlock(&flusher_lock);
+        return;
+    }
+
+    flusher_stop = 1;
+    pthread_cond_signal(&flusher_cond);
+    pthread_mutex_unlock(&flusher_lock);
+
+    // The flusher drains once more on its way out.
+    pthread_join(flusher, NULL);
+
+    pthread_mutex_lock(&flusher_lock);
+    flusher_running = 0;
+    pthread_mutex_unlock(&flusher_lock);
+}
+
+int zap_trace_format(const t_trace_record *record, char *buffer, 
+                     size_t size)
+{
+    const char *name = NULL;
+
+    if (record->point < TRACE_POINTS)
+        name = point_names[record->point];
+
+    if (name == NULL)
+        name = "unknown";
+
+    return snprintf(buffer, size, "%lld.%06lld [%u] adapter %u: %s (%lld, "
+                    "%lld)", (long long)(record->time_us / 1000000), 
+                    (long long)(record->time_us % 1000000), record->thread,
+                    record->adapter, name, (long long)record->args[0], 
+                    (long long)record->args[1]);
+}
+
+void zap_trace_syslog(const t_trace_record *records, int count, 
+                      void *context)
+{
+    char line[160];
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        zap_trace_format(&records[i], line, sizeof(line));
+        syslog(LOG_DEBUG, "%s", line);
+    }
+}
+
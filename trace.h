@@ -0,0 +1,88 @@
+#ifndef __TRACE__H
+#define __TRACE__H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Records each thread's ring holds. Records written to a full ring are 
+// dropped (and counted) until it's drained.
+#define TRACE_RING_RECORDS 1024
+
+// Trace points (t_trace_record.point), and what their arguments are.
+#define TRACE_TUNE_BEGIN 1      // fe_type, frequency
+#define TRACE_TUNE_END 2        // result, lock latency (us, -1 if none)
+#define TRACE_FRONTEND_SET 3    // properties sent (-1 for FE_SET_FRONTEND),
+                                // microseconds taken
+#define TRACE_SEC 4             // satellite, polarization << 1 | band
+#define TRACE_PID_ADD 5         // PID, DMX_PES_* type
+#define TRACE_PID_REMOVE 6      // PID
+#define TRACE_PSI_START 7       // sid, pass_psi << 1 | discover
+#define TRACE_PSI_FOUND 8       // table (PSI_PAT/PSI_PMT), microseconds 
+                                // from the tune call
+#define TRACE_LOCK 9            // microseconds from the tune call
+#define TRACE_POINTS 10
+
+typedef struct
+{
+    // monotonic_us(), and the thread (its kernel TID) and adapter.
+    int64_t time_us;
+    uint32_t thread;
+    uint16_t adapter;
+    uint16_t point;
+
+    int64_t args[2];
+} t_trace_record;
+
+// Receives drained records, oldest first for each thread.
+typedef void (*TraceReceiver)(const t_trace_record *records, int count, 
+                              void *context);
+
+// Trace points cost a single load and test while tracing is off (the 
+// default), and are compiled out altogether with -DZAP_NO_TRACE.
+#ifdef ZAP_NO_TRACE
+#define ZAP_TRACE(point, adapter, a, b) do { } while (0)
+#else
+#define ZAP_TRACE(point, adapter, a, b)                                     \
+    do                                                                      \
+    {                                                                       \
+        if (__atomic_load_n(&zap_trace_enabled, __ATOMIC_RELAXED))          \
+            zap_trace_record((point), (adapter), (a), (b));                 \
+    } while (0)
+#endif
+
+extern int zap_trace_enabled;
+
+// Turn tracing on or off for the process.
+void zap_trace_enable(int enabled);
+
+// Write a record to the calling thread's ring, without locking or system 
+// calls (beyond reading the clock). Used through ZAP_TRACE().
+void zap_trace_record(int point, unsigned int adapter, int64_t a, int64_t b);
+
+// Hand every record written so far to the receiver, thread by thread, from
+// the thread calling this (drains are serialized with each other and the 
+// background flusher). Returns the number of records.
+int zap_trace_drain(TraceReceiver receiver, void *context);
+
+// The records dropped from full rings so far.
+uint64_t zap_trace_dropped(void);
+
+// Drain the rings from a background thread every interval_ms. Returns -1 
+// if it's already running, or can't be started.
+int zap_trace_start_flusher(unsigned int interval_ms, TraceReceiver receiver,
+                            void *context);
+
+// Stop the background flusher, after a last drain.
+void zap_trace_stop_flusher(void);
+
+// Describe a record in text (as snprintf()).
+int zap_trace_format(const t_trace_record *record, char *buffer, 
+                     size_t size);
+
+// A TraceReceiver that logs each record with syslog(LOG_DEBUG) (the 
+// context is ignored). The caller opens the log, if it wants to.
+void zap_trace_syslog(const t_trace_record *records, int count, 
+                      void *context);
+
+#endif
+
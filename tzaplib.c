@@ -18,11 +18,11 @@
 #include <linux/dvb/dmx.h>
 
 #include "util.h"
+#include "session.h"
+#include "frontend.h"
+#include "trace.h"
 #include "tzaplib.h"
 
-static char FRONTEND_DEV [80];
-static char DEMUX_DEV [80];
-
 int tzap_break_tune = 0;
 
 static int check_fec(fe_code_rate_t *fec)
@@ -243,128 +243,151 @@ static int parse(t_dvbt_tune_info tune_info,
 
 
 static
-int setup_frontend (int fe_fd, struct dvb_frontend_parameters *frontend)
+int setup_frontend (t_zap_session *session, 
+                    struct dvb_frontend_parameters *frontend)
 {
-	struct dvb_frontend_info fe_info;
-
-	if (ioctl(fe_fd, FE_GET_INFO, &fe_info) < 0)
-		return -1;
+	t_fe_props props;
 
-	if (fe_info.type != FE_OFDM)
+	// Still open from the last tune if the session is persistent.
+	if (zap_session_open_frontend(session, FE_OFDM) < 0)
 		return -1;
 
-	if (ioctl(fe_fd, FE_SET_FRONTEND, frontend) < 0)
+	fe_props_from_params(&props, FE_OFDM, frontend);
+	if (set_frontend(session, &props, frontend) < 0)
 		return -1;
 
 	return 0;
 }
 
-static
-int check_frontend(int fe_fd, const int interval_us, 
-                   StatusReceiver statusReceiver)
-{
-	fe_status_t status;
-    uint16_t snr, signal_strength;
-    uint32_t ber, uncorrected_blocks;
-    int is_locked;
-
-	while(tzap_break_tune == 0) {
-	    ioctl(fe_fd, FE_READ_STATUS, &status);
-	    ioctl(fe_fd, FE_READ_SIGNAL_STRENGTH, &signal_strength);
-	    ioctl(fe_fd, FE_READ_SNR, &snr);
-	    ioctl(fe_fd, FE_READ_BER, &ber);
-	    ioctl(fe_fd, FE_READ_UNCORRECTED_BLOCKS, &uncorrected_blocks);
-
-        is_locked = (status & FE_HAS_LOCK) > 0;
-
-		if(statusReceiver(status, signal_strength, snr, ber, uncorrected_blocks, 
-		                  is_locked) == 0)
-            break;
-
-		usleep(interval_us);
-	}
-
-	return 0;
-}
-
 static void handleSigalarm()
 {
     tzap_break_tune = 1;
 }
 
-// Tune a DVB-T device. The rec_psi argument indicates that PAT and PMT packets 
-// should come through (important if MPEGTS feed is to be readable by players).
-int tzap_tune_silent(t_tuner_descriptor tuner, t_dvbt_tune_info tune_info, 
-                     int dvr, unsigned int rec_psi, 
-                     StatusReceiver statusReceiver)
+static int tune(t_zap_session *session, t_dvbt_tune_info *tune_info, int dvr, 
+                unsigned int rec_psi, StatusReceiver statusReceiver)
 {
-    // We use SIGALRM out of convenience, for whether we're testing tuning by 
-    // handle, or need to interrupt it from another thread.
-    signal(SIGALRM, handleSigalarm);
-
-	const int status_interval_us = 1000000;
+    zap_session_begin_tune(session);
 
 	struct dvb_frontend_parameters frontend_param;
+	int discover;
 
-	int pmtpid = 0;
-	int pat_fd, pmt_fd;
-	int frontend_fd, audio_fd = 0, video_fd = 0;
+	memset(&frontend_param, 0, sizeof(struct dvb_frontend_parameters));
 
-	snprintf (FRONTEND_DEV, sizeof(FRONTEND_DEV),
-		  "/dev/dvb/adapter%i/frontend%i", tuner.adapter, tuner.frontend);
+	if (parse (*tune_info, &frontend_param))
+		return -1;
 
-	snprintf (DEMUX_DEV, sizeof(DEMUX_DEV),
-		  "/dev/dvb/adapter%i/demux%i", tuner.adapter, tuner.demux);
+	if (setup_frontend (session, &frontend_param) < 0)
+		return -1;
 
-	memset(&frontend_param, 0, sizeof(struct dvb_frontend_parameters));
+	zap_session_set_mux(session, FE_OFDM, &frontend_param, 0);
+	zap_session_reset_pids(session, dvr);
 
-	if (parse (tune_info, &frontend_param))
-		return -1;
+	discover = (tune_info->vpid == 0 && tune_info->apid == 0 && 
+	            tune_info->sid != 0);
+	if (discover == 0)
+	{
+		if (zap_session_add_pid(session, tune_info->vpid, DMX_PES_VIDEO) < 0)
+			return -1;
 
-	if ((frontend_fd = open(FRONTEND_DEV, O_RDWR)) < 0)
+		if (zap_session_add_pid(session, tune_info->apid, DMX_PES_AUDIO) < 0)
+			return -1;
+	}
+
+	if (zap_session_start_psi(session, tune_info->sid, rec_psi, discover) < 0)
 		return -1;
 
-	if (setup_frontend (frontend_fd, &frontend_param) < 0)
+	if (zap_session_monitor(session, statusReceiver) < 0)
 		return -1;
 
-	if (rec_psi) {
-	    pmtpid = get_pmt_pid(DEMUX_DEV, tune_info.sid);
-	    if (pmtpid <= 0)
-    		return -1;
+	return 0;
+}
 
-	    if ((pat_fd = open(DEMUX_DEV, O_RDWR)) < 0)
-    		return -1;
+// Tune a DVB-T device on the given session, reporting status until the 
+// receiver returns 0 or the session is cancelled. The rec_psi argument 
+// indicates that PAT and PMT packets should come through (important if MPEGTS 
+// feed is to be readable by players).
+int tzap_tune(t_zap_session *session, t_dvbt_tune_info tune_info, int dvr, 
+              unsigned int rec_psi, StatusReceiver statusReceiver)
+{
+    int retval;
 
-	    if (set_pesfilter(pat_fd, 0, DMX_PES_OTHER, dvr) < 0)
-		    return -1;
+    ZAP_TRACE(TRACE_TUNE_BEGIN, session->tuner.adapter, FE_OFDM, 
+              tune_info.frequency);
 
-	    if ((pmt_fd = open(DEMUX_DEV, O_RDWR)) < 0)
-    		return -1;
+    session->nonblocking = 0;
+    retval = tune(session, &tune_info, dvr, rec_psi, statusReceiver);
+    zap_session_end_tune(session);
 
-	    if (set_pesfilter(pmt_fd, pmtpid, DMX_PES_OTHER, dvr) < 0)
-		    return -1;
-	}
+    ZAP_TRACE(TRACE_TUNE_END, session->tuner.adapter, retval, 
+              session->stats.lock_latency_us);
 
-    if ((video_fd = open(DEMUX_DEV, O_RDWR)) < 0)
-        return -1;
+    return retval;
+}
 
-	if (set_pesfilter (video_fd, tune_info.vpid, DMX_PES_VIDEO, dvr) < 0)
-		return -1;
+// Start tuning a DVB-T device on the given session, returning once the 
+// frontend has its parameters and the filters are armed. The tune then runs 
+// as zap_session_process() is called, whenever zap_session_fd() is readable,
+// and the PSI is always read as for options.pipelined.
+int tzap_tune_start(t_zap_session *session, t_dvbt_tune_info tune_info, 
+                    int dvr, unsigned int rec_psi, 
+                    StatusReceiver statusReceiver)
+{
+    int retval;
+
+    ZAP_TRACE(TRACE_TUNE_BEGIN, session->tuner.adapter, FE_OFDM, 
+              tune_info.frequency);
+
+    session->nonblocking = 1;
 
-	if ((audio_fd = open(DEMUX_DEV, O_RDWR)) < 0)
+    if ((retval = tune(session, &tune_info, dvr, rec_psi, 
+                       statusReceiver)) < 0)
+    {
+        zap_session_end_tune(session);
+
+        ZAP_TRACE(TRACE_TUNE_END, session->tuner.adapter, retval, 
+                  session->stats.lock_latency_us);
+    }
+
+    return retval;
+}
+
+// Tune a DVB-T device. The rec_psi argument indicates that PAT and PMT packets 
+// should come through (important if MPEGTS feed is to be readable by players).
+int tzap_tune_silent(t_tuner_descriptor tuner, t_dvbt_tune_info tune_info, 
+                     int dvr, unsigned int rec_psi, 
+                     StatusReceiver statusReceiver)
+{
+    t_tune_stats stats;
+
+    return tzap_tune_silent_ex(tuner, tune_info, dvr, rec_psi, statusReceiver, 
+                               NULL, &stats);
+}
+
+// As tzap_tune_silent(), but with tuning options (may be NULL) and returning 
+// measurements in stats.
+int tzap_tune_silent_ex(t_tuner_descriptor tuner, t_dvbt_tune_info tune_info, 
+                        int dvr, unsigned int rec_psi, 
+                        StatusReceiver statusReceiver, 
+                        const t_tune_options *options, t_tune_stats *stats)
+{
+    t_zap_session session;
+    int retval;
+
+    if (zap_session_init(&session, tuner, options) < 0)
         return -1;
 
-	if (set_pesfilter (audio_fd, tune_info.apid, DMX_PES_AUDIO, dvr) < 0)
-		return -1;
+    // We use SIGALRM out of convenience, for whether we're testing tuning by 
+    // handle, or need to interrupt it from another thread. Sessions created 
+    // by the caller are cancelled with zap_session_cancel() instead.
+    session.break_tune = &tzap_break_tune;
+    signal(SIGALRM, handleSigalarm);
 
-	check_frontend (frontend_fd, status_interval_us, statusReceiver);
+    retval = tzap_tune(&session, tune_info, dvr, rec_psi, statusReceiver);
+    *stats = session.stats;
 
-	close (pat_fd);
-	close (pmt_fd);
-	close (audio_fd);
-	close (video_fd);
-	close (frontend_fd);
+    zap_session_destroy(&session);
 
-	return 0;
+    return retval;
 }
 
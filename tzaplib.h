@@ -1,9 +1,10 @@
-#ifndef __SZAPLIB__H
-#define __SZAPLIB__H
+#ifndef __TZAPLIB__H
+#define __TZAPLIB__H
 
 #include <linux/dvb/frontend.h>
 
 #include "zaptypes.h"
+#include "session.h"
 
 typedef struct
 {
@@ -21,9 +22,24 @@ typedef struct
     int sid;
 } t_dvbt_tune_info;
 
+extern int tzap_tune(t_zap_session *session, t_dvbt_tune_info tune_info, 
+                     int dvr, unsigned int rec_psi, 
+                     StatusReceiver statusReceiver);
+
+extern int tzap_tune_start(t_zap_session *session, 
+                           t_dvbt_tune_info tune_info, int dvr, 
+                           unsigned int rec_psi, StatusReceiver statusReceiver);
+
 extern int tzap_tune_silent(t_tuner_descriptor tuner, 
                             t_dvbt_tune_info tune_info, 
                             int dvr, unsigned int rec_psi, 
                             StatusReceiver statusReceiver);
 
+extern int tzap_tune_silent_ex(t_tuner_descriptor tuner, 
+                               t_dvbt_tune_info tune_info, 
+                               int dvr, unsigned int rec_psi, 
+                               StatusReceiver statusReceiver, 
+                               const t_tune_options *options, 
+                               t_tune_stats *stats);
+
 #endif
@@ -0,0 +1,184 @@
+// Single cable routers: Unicable (EN 50494) and JESS (EN 50607). See 
+// unicable.h.
+
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <linux/dvb/frontend.h>
+
+#include "backend.h"
+#include "lnb.h"
+#include "unicable.h"
+
+typedef struct
+{
+    int scr;
+    unsigned int user_band_count;
+    unsigned int user_bands[LNB_MAX_USER_BANDS];
+
+    // The user bands in use (bit per band), and the tuners using any.
+    uint32_t in_use;
+    int users;
+} t_cable;
+
+static t_cable cables[UNICABLE_MAX_CABLES];
+static pthread_mutex_t cable_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Commands are serialized separately, so that claiming a band needn't wait 
+// for another tuner's command.
+static pthread_mutex_t send_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int same_cable(const t_cable *cable, const struct lnb_types_st *lnb)
+{
+    return cable->scr == lnb->scr &&
+           cable->user_band_count == lnb->user_band_count &&
+           memcmp(cable->user_bands, lnb->user_bands, 
+                  lnb->user_band_count * sizeof(unsigned int)) == 0;
+}
+
+// The cable's entry, added if it's new (NULL if there's no room).
+static t_cable *find_cable(const struct lnb_types_st *lnb, int add)
+{
+    t_cable *unused = NULL;
+    int i;
+
+    for (i = 0; i < UNICABLE_MAX_CABLES; i++)
+    {
+        if (cables[i].users > 0 && same_cable(&cables[i], lnb))
+            return &cables[i];
+
+        if (cables[i].users == 0 && unused == NULL)
+            unused = &cables[i];
+    }
+
+    if (add == 0 || unused == NULL)
+        return NULL;
+
+    memset(unused, 0, sizeof(t_cable));
+    unused->scr = lnb->scr;
+    unused->user_band_count = lnb->user_band_count;
+    memcpy(unused->user_bands, lnb->user_bands, 
+           lnb->user_band_count * sizeof(unsigned int));
+
+    return unused;
+}
+
+int unicable_acquire(const struct lnb_types_st *lnb, int preferred)
+{
+    t_cable *cable;
+    int band = -1, i;
+
+    pthread_mutex_lock(&cable_lock);
+
+    if ((cable = find_cable(lnb, 1)) != NULL)
+    {
+        if (preferred >= 0 && preferred < (int)cable->user_band_count &&
+            (cable->in_use & (1u << preferred)) == 0)
+            band = preferred;
+
+        for (i = 0; band < 0 && i < (int)cable->user_band_count; i++)
+            if ((cable->in_use & (1u << i)) == 0)
+                band = i;
+
+        if (band >= 0)
+        {
+            cable->in_use |= 1u << band;
+            cable->users++;
+        }
+    }
+
+    pthread_mutex_unlock(&cable_lock);
+
+    return band;
+}
+
+void unicable_release(const struct lnb_types_st *lnb, int band)
+{
+    t_cable *cable;
+
+    pthread_mutex_lock(&cable_lock);
+
+    if ((cable = find_cable(lnb, 0)) != NULL &&
+        (cable->in_use & (1u << band)) != 0)
+    {
+        cable->in_use &= ~(1u << band);
+        cable->users--;
+    }
+
+    pthread_mutex_unlock(&cable_lock);
+}
+
+unsigned int unicable_command(const struct lnb_types_st *lnb, int band, 
+                              unsigned int ifreq, int sat_no, int pol_vert, 
+                              int hi_band, 
+                              struct dvb_diseqc_master_cmd *cmd)
+{
+    unsigned int ub = lnb->user_bands[band] * 1000, t, requested;
+    int bank = ((sat_no & 1) << 2) | (pol_vert ? 0 : 2) | (hi_band ? 1 : 0);
+
+    memset(cmd, 0, sizeof(struct dvb_diseqc_master_cmd));
+
+    if (lnb->scr == LNB_SCR_JESS)
+    {
+        // ODU_Channel_change: 1 MHz steps above 100 MHz, and any of 64 
+        // satellite positions.
+        t = (ifreq + 500) / 1000 - 100;
+        requested = (t + 100) * 1000;
+
+        cmd->msg[0] = 0x70;
+        cmd->msg[1] = (band << 3) | ((t >> 8) & 0x07);
+        cmd->msg[2] = t & 0xff;
+        cmd->msg[3] = ((sat_no & 0x3f) << 2) | (bank & 0x03);
+        cmd->msg_len = 4;
+    }
+    else
+    {
+        // ODU_ChannelChange: 4 MHz steps of the IF plus the user band, and 
+        // two satellite positions.
+        t = (ifreq + ub + 2000) / 4000 - 350;
+        requested = (t + 350) * 4000 - ub;
+
+        cmd->msg[0] = 0xe0;
+        cmd->msg[1] = 0x10;
+        cmd->msg[2] = 0x5a;
+        cmd->msg[3] = (band << 5) | (bank << 2) | ((t >> 8) & 0x03);
+        cmd->msg[4] = t & 0xff;
+        cmd->msg_len = 5;
+    }
+
+    // What the rounding left over stays as an offset from the user band.
+    return ub + ifreq - requested;
+}
+
+int unicable_send(int fe_fd, const struct dvb_diseqc_master_cmd *cmd)
+{
+    int retval = 0;
+
+    pthread_mutex_lock(&send_lock);
+
+    // The router only listens while the voltage is raised, and the tone 
+    // must be off.
+    if (zap_ioctl(fe_fd, FE_SET_TONE, SEC_TONE_OFF) == -1 ||
+        zap_ioctl(fe_fd, FE_SET_VOLTAGE, SEC_VOLTAGE_18) == -1)
+        retval = -1;
+    else
+    {
+        usleep(UNICABLE_SETTLE_MS * 1000);
+
+        if (zap_ioctl(fe_fd, FE_DISEQC_SEND_MASTER_CMD, cmd) == -1)
+            retval = -1;
+
+        usleep(UNICABLE_SETTLE_MS * 1000);
+    }
+
+    if (zap_ioctl(fe_fd, FE_SET_VOLTAGE, SEC_VOLTAGE_13) == -1)
+        retval = -1;
+
+    pthread_mutex_unlock(&send_lock);
+
+    return retval;
+}
+
@@ -0,0 +1,45 @@
+#ifndef __UNICABLE__H
+#define __UNICABLE__H
+
+#include <linux/dvb/frontend.h>
+
+#include "lnb.h"
+
+// Cables (distinct routers and user band plans) tracked by the user band 
+// allocator.
+#define UNICABLE_MAX_CABLES 16
+
+// After a channel change, how long to wait for the frontend to lock before 
+// taking the command to have been lost (another tuner on the cable talking 
+// at the same time), and how often to try. Retries are spread over a random
+// delay of up to UNICABLE_BACKOFF_MS per attempt.
+#define UNICABLE_LOCK_WAIT_MS 800
+#define UNICABLE_RETRIES 3
+#define UNICABLE_BACKOFF_MS 50
+
+// Milliseconds to wait after raising the voltage for a command, and after 
+// the command.
+#define UNICABLE_SETTLE_MS 15
+
+// Claim a user band on the router described by lnb, for one tuner. Tuners 
+// given the same router type and user bands are taken to share a cable. 
+// preferred (or -1) is taken if it's free. Returns the band's index, or -1 
+// if every band is in use. Safe to use from any thread.
+int unicable_acquire(const struct lnb_types_st *lnb, int preferred);
+
+void unicable_release(const struct lnb_types_st *lnb, int band);
+
+// Build the channel change command that moves the transponder at ifreq (the 
+// LNB's output, in kHz) onto a user band, and return the frequency (kHz) to 
+// tune the frontend to.
+unsigned int unicable_command(const struct lnb_types_st *lnb, int band, 
+                              unsigned int ifreq, int sat_no, int pol_vert, 
+                              int hi_band, 
+                              struct dvb_diseqc_master_cmd *cmd);
+
+// Send a command to the router. Commands from tuners in this process are 
+// sent one at a time. Returns -1 on failure.
+int unicable_send(int fe_fd, const struct dvb_diseqc_master_cmd *cmd);
+
+#endif
+
@@ -23,6 +23,8 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <errno.h>
+#include <time.h>
+#include <poll.h>
 
 #include <sys/ioctl.h>
 #include <sys/types.h>
@@ -32,9 +34,20 @@
 #include <linux/dvb/frontend.h>
 #include <linux/dvb/dmx.h>
 
+#include "util.h"
+#include "backend.h"
+#include "sections.h"
+
 
 // Allow traffic for a certain PID to come through.
 int set_pesfilter(int dmxfd, int pid, int pes_type, int dvr)
+{
+    return set_pesfilter_buffer(dmxfd, pid, pes_type, dvr, 
+                                dvr ? DEMUX_BUFFER_MIN : 0);
+}
+
+int set_pesfilter_buffer(int dmxfd, int pid, int pes_type, int dvr,
+                         unsigned int buffer_size)
 {
     struct dmx_pes_filter_params pesfilter;
 
@@ -44,11 +57,9 @@ int set_pesfilter(int dmxfd, int pid, int pes_type, int dvr)
 	(pid == 0 && pes_type != DMX_PES_OTHER))
 	return 0;
 
-    if (dvr) {
-	int buffersize = 64 * 1024;
-	if (ioctl(dmxfd, DMX_SET_BUFFER_SIZE, buffersize) == -1)
-	    perror("DMX_SET_BUFFER_SIZE failed");
-    }
+    if (buffer_size > 0 &&
+	zap_ioctl(dmxfd, DMX_SET_BUFFER_SIZE, buffer_size) == -1)
+	perror("DMX_SET_BUFFER_SIZE failed");
 
     pesfilter.pid = pid;
     pesfilter.input = DMX_IN_FRONTEND;
@@ -56,7 +67,7 @@ int set_pesfilter(int dmxfd, int pid, int pes_type, int dvr)
     pesfilter.pes_type = pes_type;
     pesfilter.flags = DMX_IMMEDIATE_START;
 
-    if (ioctl(dmxfd, DMX_SET_PES_FILTER, &pesfilter) == -1) {
+    if (zap_ioctl(dmxfd, DMX_SET_PES_FILTER, &pesfilter) == -1) {
 	fprintf(stderr, "DMX_SET_PES_FILTER failed "
 	"(PID = 0x%04x): %d %m\n", pid, errno);
 	return -1;
@@ -66,62 +77,129 @@ int set_pesfilter(int dmxfd, int pid, int pes_type, int dvr)
 }
 
 
-int get_pmt_pid(char *dmxdev, int sid)
+int get_pmt_pid(char *dmxdev, int sid, int cancel_fd)
 {
-    int patfd, count;
-    int pmt_pid = 0;
-    int patread = 0;
-    int section_length;
-    unsigned char buft[4096];
-    unsigned char *buf = buft;
-    struct dmx_sct_filter_params f;
-
-    memset(&f, 0, sizeof(f));
-    f.pid = 0;
-    f.filter.filter[0] = 0x00;
-    f.filter.mask[0] = 0xff;
-    f.timeout = 0;
-    f.flags = DMX_IMMEDIATE_START | DMX_CHECK_CRC;
-
-    if ((patfd = open(dmxdev, O_RDWR)) < 0) {
-	perror("openening pat demux failed");
+    t_psi_request request;
+
+    memset(&request, 0, sizeof(request));
+    request.table = PSI_PAT;
+
+    if (psi_acquire(dmxdev, &request, 1, cancel_fd) <= 0)
 	return -1;
+
+    return pat_pmt_pid(&request.u.pat, sid);
+}
+
+unsigned int demux_buffer_size(uint64_t bitrate_bps)
+{
+    uint64_t size = bitrate_bps / 8 * DEMUX_BUFFER_MS / 1000;
+
+    // Whole packets.
+    size -= size % 188;
+
+    if (size < DEMUX_BUFFER_MIN)
+	return DEMUX_BUFFER_MIN;
+
+    if (size > DEMUX_BUFFER_MAX)
+	return DEMUX_BUFFER_MAX;
+
+    return size;
+}
+
+// Bits per symbol (per carrier for OFDM).
+static unsigned int modulation_bits(fe_modulation_t modulation)
+{
+    switch (modulation)
+    {
+    case QPSK:     return 2;
+    case QAM_16:   return 4;
+    case QAM_32:   return 5;
+    case QAM_64:   return 6;
+    case QAM_128:  return 7;
+    default:       return 8;
     }
+}
 
-    if (ioctl(patfd, DMX_SET_FILTER, &f) == -1) {
-	perror("ioctl DMX_SET_FILTER failed");
-	close(patfd);
-	return -1;
+// The inner code rate as a fraction of 1000.
+static unsigned int code_rate_permille(fe_code_rate_t fec)
+{
+    switch (fec)
+    {
+    case FEC_1_2:  return 500;
+    case FEC_2_3:  return 667;
+    case FEC_3_4:  return 750;
+    case FEC_4_5:  return 800;
+    case FEC_5_6:  return 833;
+    case FEC_6_7:  return 857;
+    case FEC_8_9:  return 889;
+    case FEC_NONE: return 1000;
+    default:       return 875;
     }
+}
 
-    while (!patread){
-	if (((count = read(patfd, buf, sizeof(buft))) < 0) && errno == EOVERFLOW)
-	    count = read(patfd, buf, sizeof(buft));
-	if (count < 0) {
-	    perror("read_sections: read error");
-	    close(patfd);
-	    return -1;
-	}
-	
-	section_length = ((buf[1] & 0x0f) << 8) | buf[2];
-	if (count != section_length + 3)
-	    continue;
-	
-	buf += 8;
-	section_length -= 8;
-	
-	patread = 1; /* assumes one section contains the whole pat */
-	while (section_length > 0) {
-	    int service_id = (buf[0] << 8) | buf[1];
-	    if (service_id == sid) {
-		pmt_pid = ((buf[2] & 0x1f) << 8) | buf[3];
-		section_length = 0;
-	    }
-	    buf += 4;
-	    section_length -= 4;
-	}
+uint64_t mux_bitrate(fe_type_t type, const struct dvb_frontend_parameters *p)
+{
+    uint64_t rate;
+    unsigned int bandwidth, guard;
+
+    switch (type)
+    {
+    case FE_ATSC:
+        switch (p->u.vsb.modulation)
+        {
+        case VSB_8:    return 19392658;
+        case VSB_16:   return 38785317;
+        case QAM_64:   return 26970350;
+        default:       return 38810700;
+        }
+
+    case FE_QAM:
+        // Reed-Solomon (204,188) on the symbol rate.
+        rate = (uint64_t)p->u.qam.symbol_rate * 
+               modulation_bits(p->u.qam.modulation);
+
+        return rate * 188 / 204;
+
+    case FE_QPSK:
+        rate = (uint64_t)p->u.qpsk.symbol_rate * 2 * 
+               code_rate_permille(p->u.qpsk.fec_inner) / 1000;
+
+        return rate * 188 / 204;
+
+    case FE_OFDM:
+        switch (p->u.ofdm.bandwidth)
+        {
+        case BANDWIDTH_6_MHZ:  bandwidth = 6000000; break;
+        case BANDWIDTH_7_MHZ:  bandwidth = 7000000; break;
+        default:               bandwidth = 8000000; break;
+        }
+
+        // The guard interval as a divisor of the useful symbol time.
+        switch (p->u.ofdm.guard_interval)
+        {
+        case GUARD_INTERVAL_1_4:   guard = 4;  break;
+        case GUARD_INTERVAL_1_8:   guard = 8;  break;
+        case GUARD_INTERVAL_1_16:  guard = 16; break;
+        default:                   guard = 32; break;
+        }
+
+        // EN 300 744: 423/544 of the bandwidth carries data, after the 
+        // pilots and the Reed-Solomon code.
+        rate = (uint64_t)bandwidth * 423 / 544 * 
+               modulation_bits(p->u.ofdm.constellation) * 
+               code_rate_permille(p->u.ofdm.code_rate_HP) / 1000;
+
+        return rate * guard / (guard + 1);
+
+    default:
+        return 0;
     }
+}
+
+int64_t monotonic_us(void)
+{
+    struct timespec ts;
 
-    close(patfd);
-    return pmt_pid;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
@@ -19,6 +19,37 @@
  * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
+#include <stdint.h>
+
+#include <linux/dvb/frontend.h>
+
+#include "psi.h"
+
+// Demux buffers hold DEMUX_BUFFER_MS of the expected bitrate, between
+// DEMUX_BUFFER_MIN and (unless the caller says otherwise) DEMUX_BUFFER_MAX.
+#define DEMUX_BUFFER_MS 500
+#define DEMUX_BUFFER_MIN (64 * 1024)
+#define DEMUX_BUFFER_MAX (32 * 1024 * 1024)
+
 int set_pesfilter(int dmxfd, int pid, int pes_type, int dvr);
 
-int get_pmt_pid(char *dmxdev, int sid);
+// As set_pesfilter(), but with the filter's buffer size (0 leaves the kernel
+// default).
+int set_pesfilter_buffer(int dmxfd, int pid, int pes_type, int dvr,
+                         unsigned int buffer_size);
+
+// The buffer size for a filter carrying bitrate_bps (the minimum if 0).
+unsigned int demux_buffer_size(uint64_t bitrate_bps);
+
+// The payload bitrate (bits per second) of a multiplex tuned with these
+// parameters. AUTO settings are taken at their highest rate, so this is an
+// upper bound. Zero if it can't be worked out.
+uint64_t mux_bitrate(fe_type_t type, const struct dvb_frontend_parameters *p);
+
+// Read the PAT and return the PMT PID for the service (0 if it's not there).
+// Gives up (-1) after PSI_DEFAULT_TIMEOUT_MS, or when cancel_fd becomes 
+// readable (may be -1).
+int get_pmt_pid(char *dmxdev, int sid, int cancel_fd);
+
+// Microseconds on CLOCK_MONOTONIC (for latency measurements).
+int64_t monotonic_us(void);
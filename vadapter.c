@@ -0,0 +1,1176 @@
+// Simulated adapters playing recorded transport streams (see vadapter.h).
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include <linux/dvb/frontend.h>
+#include <linux/dvb/dmx.h>
+#include <linux/dvb/version.h>
+
+#include "util.h"
+#include "backend.h"
+#include "vadapter.h"
+
+#define TS_PACKET 188
+#define TS_SYNC 0x47
+
+// Descriptors are looked up by number, so they have to be below this.
+#define VFD_TABLE 4096
+
+#define VFD_FRONTEND 1
+#define VFD_DEMUX 2
+#define VFD_DVR 3
+
+#define VFD_MAX_PIDS 32
+
+// Filter types of a demux descriptor.
+#define VFILTER_NONE 0
+#define VFILTER_PES 1
+#define VFILTER_SECTION 2
+
+// Default buffer sizes (as the kernel's).
+#define VDEMUX_BUFFER (8 * 1024)
+#define VDVR_BUFFER (10 * TS_PACKET * 1024)
+
+// Assembled sections waiting to be read from a section filter.
+#define VSECTION_QUEUE (16 * 1024)
+#define VSECTION_MAX 4096
+
+// The most descriptors a single poll() can have, and how often it checks on
+// the simulated ones while waiting.
+#define VPOLL_MAX 256
+#define VPOLL_INTERVAL_MS 1
+
+typedef struct
+{
+    int used;
+    unsigned int number;
+    t_vadapter_config config;
+
+    void *map;
+    size_t map_size;
+    const uint8_t *ts;
+    int64_t packets;
+    double packets_per_us;
+
+    // When the frontend was last tuned and locks (-1 before any tune), and
+    // the number of tunes so far (the stream starts over with each).
+    int64_t tune_us;
+    int64_t lock_us;
+    unsigned int epoch;
+
+    fe_delivery_system_t system;
+    uint32_t frequency;
+} t_adapter;
+
+typedef struct
+{
+    t_adapter *adapter;
+    int kind;
+
+    // The frontend status last reported by FE_GET_EVENT.
+    fe_status_t event_status;
+
+    // The demux filter.
+    int filter_type;
+    dmx_output_t output;
+    int started;
+    int oneshot;
+    int pid_count;
+    uint16_t pids[VFD_MAX_PIDS];
+    struct dmx_filter filter;
+    unsigned int buffer_size;
+
+    // The next packet of the stream, as of which tune.
+    int64_t cursor;
+    unsigned int epoch;
+
+    // The section being assembled, and those ready to be read.
+    uint8_t section[VSECTION_MAX];
+    int section_len;
+    uint8_t queue[VSECTION_QUEUE];
+    int queue_len;
+} t_vfd;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static t_adapter adapters[VADAPTER_MAX];
+static int adapter_count;
+static t_vfd *vfds[VFD_TABLE];
+
+static const t_zap_backend vadapter_backend;
+
+static t_vfd *lookup(int fd)
+{
+    return (fd >= 0 && fd < VFD_TABLE) ? vfds[fd] : NULL;
+}
+
+static t_adapter *find_adapter(unsigned int number)
+{
+    int i;
+
+    for (i = 0; i < VADAPTER_MAX; i++)
+        if (adapters[i].used && adapters[i].number == number)
+            return &adapters[i];
+
+    return NULL;
+}
+
+static const uint8_t *packet(const t_adapter *adapter, int64_t index)
+{
+    return adapter->ts + (index % adapter->packets) * TS_PACKET;
+}
+
+static int packet_pid(const uint8_t *p)
+{
+    return ((p[1] & 0x1f) << 8) | p[2];
+}
+
+// Whether the signal is out this far (microseconds) past lock.
+static int in_loss(const t_adapter *adapter, int64_t since_lock_us)
+{
+    int64_t period_us = adapter->config.loss_period_ms * 1000LL;
+    int64_t duration_us = adapter->config.loss_duration_ms * 1000LL;
+
+    if (period_us == 0 || duration_us == 0)
+        return 0;
+
+    return (since_lock_us % period_us) >= period_us - duration_us;
+}
+
+static fe_status_t status_at(const t_adapter *adapter, int64_t now_us)
+{
+    if (adapter->tune_us < 0)
+        return 0;
+
+    if (now_us < adapter->lock_us)
+        return FE_HAS_SIGNAL;
+
+    if (in_loss(adapter, now_us - adapter->lock_us))
+        return 0;
+
+    return FE_HAS_SIGNAL | FE_HAS_CARRIER | FE_HAS_VITERBI | FE_HAS_SYNC |
+           FE_HAS_LOCK;
+}
+
+static int locked_at(const t_adapter *adapter, int64_t now_us)
+{
+    return (status_at(adapter, now_us) & FE_HAS_LOCK) != 0;
+}
+
+static int64_t cnr_at(const t_adapter *adapter, int64_t now_us)
+{
+    const t_vadapter_config *config = &adapter->config;
+    int64_t since_us = now_us - adapter->lock_us;
+    int64_t ramp_us = config->cnr_ramp_ms * 1000LL;
+
+    if (ramp_us == 0 || since_us >= ramp_us)
+        return config->cnr_end;
+
+    return config->cnr_start +
+           (config->cnr_end - config->cnr_start) * since_us / ramp_us;
+}
+
+// Packets played since lock (at the stream's rate, even if read faster).
+static int64_t packets_since_lock(const t_adapter *adapter, int64_t now_us)
+{
+    if (adapter->tune_us < 0 || now_us < adapter->lock_us)
+        return 0;
+
+    return (int64_t)((now_us - adapter->lock_us) * adapter->packets_per_us);
+}
+
+// The packets of the stream a reader can have by now, in realtime.
+static int64_t due_packets(const t_adapter *adapter, int64_t now_us)
+{
+    return packets_since_lock(adapter, now_us);
+}
+
+static int packet_lost(const t_adapter *adapter, int64_t index)
+{
+    if (adapter->config.realtime == 0)
+        return 0;
+
+    return in_loss(adapter, (int64_t)(index / adapter->packets_per_us));
+}
+
+// Where a filter started now begins reading: the live position in realtime,
+// or the start of the stream otherwise.
+static void start_cursor(t_vfd *vfd, int64_t now_us)
+{
+    t_adapter *adapter = vfd->adapter;
+
+    vfd->cursor = adapter->config.realtime ? due_packets(adapter, now_us) : 0;
+    vfd->epoch = adapter->epoch;
+    vfd->section_len = 0;
+    vfd->queue_len = 0;
+}
+
+// The packets available to a descriptor, from its cursor up to the
+// returned end.
+static int64_t stream_end(t_vfd *vfd, int64_t now_us)
+{
+    t_adapter *adapter = vfd->adapter;
+
+    if (vfd->epoch != adapter->epoch)
+        start_cursor(vfd, now_us);
+
+    if (adapter->config.realtime)
+        return due_packets(adapter, now_us);
+
+    // As fast as they're read, while locked, and no more than once around
+    // the file per call.
+    return locked_at(adapter, now_us) ? vfd->cursor + adapter->packets
+                                      : vfd->cursor;
+}
+
+static int has_pid(const t_vfd *vfd, int pid)
+{
+    int i;
+
+    for (i = 0; i < vfd->pid_count; i++)
+        if (vfd->pids[i] == pid || vfd->pids[i] == 0x2000)
+            return 1;
+
+    return 0;
+}
+
+// The PIDs read through a descriptor passing transport stream packets: its
+// own for a TSDEMUX_TAP filter, or those of every started TS_TAP filter on
+// the adapter for the dvr.
+static void pid_map(const t_vfd *vfd, uint8_t *map)
+{
+    const t_vfd *other;
+    int fd, i;
+
+    memset(map, 0, 8192);
+
+    for (fd = 0; fd < VFD_TABLE; fd++)
+    {
+        if ((other = vfds[fd]) == NULL || other->adapter != vfd->adapter ||
+            other->kind != VFD_DEMUX || other->started == 0 ||
+            other->filter_type != VFILTER_PES)
+            continue;
+
+        if (vfd->kind == VFD_DVR ? other->output != DMX_OUT_TS_TAP
+                                 : other != vfd)
+            continue;
+
+        for (i = 0; i < other->pid_count; i++)
+        {
+            if (other->pids[i] == 0x2000)
+                memset(map, 1, 8192);
+            else
+                map[other->pids[i] & 0x1fff] = 1;
+        }
+    }
+}
+
+static int carries_ts(const t_vfd *vfd)
+{
+    return vfd->kind == VFD_DVR ||
+           (vfd->kind == VFD_DEMUX && vfd->started &&
+            vfd->filter_type == VFILTER_PES &&
+            vfd->output == DMX_OUT_TSDEMUX_TAP);
+}
+
+// Move the cursor past packets that won't be read. Returns whether one
+// that will is waiting.
+static int ts_ready(t_vfd *vfd, const uint8_t *map, int64_t now_us)
+{
+    t_adapter *adapter = vfd->adapter;
+    int64_t end = stream_end(vfd, now_us);
+
+    for (; vfd->cursor < end; vfd->cursor++)
+        if (map[packet_pid(packet(adapter, vfd->cursor))] &&
+            packet_lost(adapter, vfd->cursor) == 0)
+            return 1;
+
+    return 0;
+}
+
+static ssize_t read_ts(t_vfd *vfd, uint8_t *buf, size_t count,
+                       int64_t now_us)
+{
+    t_adapter *adapter = vfd->adapter;
+    uint8_t map[8192];
+    const uint8_t *p;
+    int64_t end, index, waiting = 0;
+    size_t n = 0;
+
+    pid_map(vfd, map);
+
+    if (ts_ready(vfd, map, now_us) == 0)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    end = stream_end(vfd, now_us);
+
+    // In realtime, a reader that has fallen further behind than the buffer
+    // loses what was in it.
+    if (adapter->config.realtime)
+    {
+        for (index = vfd->cursor; index < end; index++)
+            if (map[packet_pid(packet(adapter, index))])
+                waiting += TS_PACKET;
+
+        if (waiting > vfd->buffer_size)
+        {
+            vfd->cursor = end;
+            errno = EOVERFLOW;
+            return -1;
+        }
+    }
+
+    for (; vfd->cursor < end && n + TS_PACKET <= count; vfd->cursor++)
+    {
+        p = packet(adapter, vfd->cursor);
+
+        if (map[packet_pid(p)] == 0 || packet_lost(adapter, vfd->cursor))
+            continue;
+
+        memcpy(buf + n, p, TS_PACKET);
+        n += TS_PACKET;
+    }
+
+    if (n == 0)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    return n;
+}
+
+// Queue an assembled section if it passes the filter. Filters don't cover
+// the section_length bytes, as in the kernel.
+static void queue_section(t_vfd *vfd, const uint8_t *section, int length)
+{
+    const struct dmx_filter *filter = &vfd->filter;
+    int i, j;
+
+    for (i = 0; i < DMX_FILTER_SIZE; i++)
+    {
+        j = (i == 0) ? 0 : i + 2;
+
+        if (j >= length)
+            break;
+
+        if ((section[j] & filter->mask[i]) !=
+            (filter->filter[i] & filter->mask[i]))
+            return;
+    }
+
+    if (vfd->queue_len + length > VSECTION_QUEUE)
+        return;
+
+    memcpy(vfd->queue + vfd->queue_len, section, length);
+    vfd->queue_len += length;
+}
+
+// Take sections out of as many of the filter's packets as it takes to have
+// one ready.
+static int section_ready(t_vfd *vfd, int64_t now_us)
+{
+    t_adapter *adapter = vfd->adapter;
+    int64_t end = stream_end(vfd, now_us);
+    const uint8_t *p, *payload;
+    int offset, size, pointer, length, take;
+
+    for (; vfd->queue_len == 0 && vfd->cursor < end; vfd->cursor++)
+    {
+        p = packet(adapter, vfd->cursor);
+
+        if (packet_pid(p) != vfd->pids[0] || packet_lost(adapter, vfd->cursor)
+            || (p[3] & 0x10) == 0)
+            continue;
+
+        offset = 4;
+
+        if (p[3] & 0x20)
+            offset += 1 + p[4];
+
+        if (offset >= TS_PACKET)
+            continue;
+
+        payload = p + offset;
+        size = TS_PACKET - offset;
+
+        if (p[1] & 0x40)
+        {
+            // The tail of the previous section comes before the pointer.
+            pointer = payload[0];
+
+            if (pointer + 1 > size)
+                continue;
+
+            if (vfd->section_len > 0)
+            {
+                length = 3 + (((vfd->section[1] & 0x0f) << 8) | 
+                              vfd->section[2]);
+
+                if (vfd->section_len + pointer >= length)
+                {
+                    memcpy(vfd->section + vfd->section_len, payload + 1, 
+                           length - vfd->section_len);
+                    queue_section(vfd, vfd->section, length);
+                }
+            }
+
+            payload += 1 + pointer;
+            size -= 1 + pointer;
+
+            vfd->section_len = 0;
+
+            // A new section (and maybe more) starts here.
+            while (size >= 3 && payload[0] != 0xff)
+            {
+                length = 3 + (((payload[1] & 0x0f) << 8) | payload[2]);
+
+                if (length > VSECTION_MAX)
+                    break;
+
+                if (length > size)
+                {
+                    memcpy(vfd->section, payload, size);
+                    vfd->section_len = size;
+                    break;
+                }
+
+                queue_section(vfd, payload, length);
+                payload += length;
+                size -= length;
+            }
+        }
+        else if (vfd->section_len > 0)
+        {
+            length = 3 + (((vfd->section[1] & 0x0f) << 8) | vfd->section[2]);
+            take = length - vfd->section_len;
+
+            if (take > size)
+                take = size;
+
+            memcpy(vfd->section + vfd->section_len, payload, take);
+            vfd->section_len += take;
+
+            if (vfd->section_len == length)
+            {
+                queue_section(vfd, vfd->section, length);
+                vfd->section_len = 0;
+            }
+        }
+    }
+
+    return vfd->queue_len > 0;
+}
+
+static ssize_t read_section(t_vfd *vfd, uint8_t *buf, size_t count,
+                            int64_t now_us)
+{
+    int length;
+
+    if (section_ready(vfd, now_us) == 0)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    length = 3 + (((vfd->queue[1] & 0x0f) << 8) | vfd->queue[2]);
+
+    if (count > length)
+        count = length;
+
+    memcpy(buf, vfd->queue, count);
+    memmove(vfd->queue, vfd->queue + length, vfd->queue_len - length);
+    vfd->queue_len -= length;
+
+    if (vfd->oneshot)
+        vfd->started = 0;
+
+    return count;
+}
+
+// The events a descriptor has ready.
+static short readiness(t_vfd *vfd, short events, int64_t now_us)
+{
+    uint8_t map[8192];
+    short revents = 0;
+
+    if (vfd->kind == VFD_FRONTEND)
+    {
+        if ((events & POLLPRI) &&
+            status_at(vfd->adapter, now_us) != vfd->event_status)
+            revents |= POLLPRI;
+    }
+    else if ((events & POLLIN) && carries_ts(vfd))
+    {
+        pid_map(vfd, map);
+
+        if (ts_ready(vfd, map, now_us))
+            revents |= POLLIN;
+    }
+    else if ((events & POLLIN) && vfd->kind == VFD_DEMUX && vfd->started &&
+             vfd->filter_type == VFILTER_SECTION)
+    {
+        if (section_ready(vfd, now_us))
+            revents |= POLLIN;
+    }
+
+    return revents;
+}
+
+static void tune(t_adapter *adapter, int64_t now_us)
+{
+    adapter->tune_us = now_us;
+    adapter->lock_us = now_us + adapter->config.lock_delay_ms * 1000LL;
+    adapter->epoch++;
+}
+
+static void set_stat(struct dtv_property *prop, uint8_t scale,
+                     int64_t value)
+{
+    prop->u.st.len = 1;
+    prop->u.st.stat[0].scale = scale;
+
+    if (scale == FE_SCALE_DECIBEL)
+        prop->u.st.stat[0].svalue = value;
+    else
+        prop->u.st.stat[0].uvalue = value;
+}
+
+static int get_properties(t_adapter *adapter, struct dtv_properties *props,
+                          int64_t now_us)
+{
+    struct dtv_property *prop;
+    int locked = locked_at(adapter, now_us);
+    int64_t packets = packets_since_lock(adapter, now_us);
+    unsigned int i;
+
+    for (i = 0; i < props->num; i++)
+    {
+        prop = &props->props[i];
+
+        switch (prop->cmd)
+        {
+        case DTV_STAT_SIGNAL_STRENGTH:
+            if (status_at(adapter, now_us) & FE_HAS_SIGNAL)
+                set_stat(prop, FE_SCALE_DECIBEL, adapter->config.signal);
+            else
+                set_stat(prop, FE_SCALE_NOT_AVAILABLE, 0);
+            break;
+
+        case DTV_STAT_CNR:
+            if (locked)
+                set_stat(prop, FE_SCALE_DECIBEL, cnr_at(adapter, now_us));
+            else
+                set_stat(prop, FE_SCALE_NOT_AVAILABLE, 0);
+            break;
+
+        case DTV_STAT_PRE_ERROR_BIT_COUNT:
+        case DTV_STAT_POST_ERROR_BIT_COUNT:
+        case DTV_STAT_ERROR_BLOCK_COUNT:
+            set_stat(prop, FE_SCALE_COUNTER, 0);
+            break;
+
+        case DTV_STAT_PRE_TOTAL_BIT_COUNT:
+        case DTV_STAT_POST_TOTAL_BIT_COUNT:
+            set_stat(prop, FE_SCALE_COUNTER, packets * TS_PACKET * 8);
+            break;
+
+        case DTV_STAT_TOTAL_BLOCK_COUNT:
+            set_stat(prop, FE_SCALE_COUNTER, packets);
+            break;
+
+        case DTV_API_VERSION:
+            prop->u.data = (DVB_API_VERSION << 8) | DVB_API_VERSION_MINOR;
+            break;
+
+        case DTV_DELIVERY_SYSTEM:
+            prop->u.data = adapter->system;
+            break;
+
+        case DTV_FREQUENCY:
+            prop->u.data = adapter->frequency;
+            break;
+
+        default:
+            prop->u.data = 0;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+static int set_properties(t_adapter *adapter,
+                          const struct dtv_properties *props, int64_t now_us)
+{
+    const struct dtv_property *prop;
+    unsigned int i;
+
+    for (i = 0; i < props->num; i++)
+    {
+        prop = &props->props[i];
+
+        if (prop->cmd == DTV_DELIVERY_SYSTEM)
+            adapter->system = prop->u.data;
+        else if (prop->cmd == DTV_FREQUENCY)
+            adapter->frequency = prop->u.data;
+        else if (prop->cmd == DTV_TUNE)
+            tune(adapter, now_us);
+    }
+
+    return 0;
+}
+
+static int frontend_ioctl(t_vfd *vfd, unsigned long request, void *arg,
+                          int64_t now_us)
+{
+    t_adapter *adapter = vfd->adapter;
+    struct dvb_frontend_info *info;
+    struct dvb_frontend_event *event;
+    fe_status_t status = status_at(adapter, now_us);
+    int locked = (status & FE_HAS_LOCK) != 0;
+    int64_t snr;
+
+    switch (request)
+    {
+    case FE_GET_INFO:
+        info = arg;
+        memset(info, 0, sizeof(*info));
+        snprintf(info->name, sizeof(info->name), "Virtual adapter %u",
+                 adapter->number);
+        info->type = adapter->config.fe_type;
+        info->frequency_min = 0;
+        info->frequency_max = 0xffffffff;
+        info->caps = FE_CAN_INVERSION_AUTO | FE_CAN_FEC_AUTO |
+                     FE_CAN_QAM_AUTO | FE_CAN_TRANSMISSION_MODE_AUTO |
+                     FE_CAN_GUARD_INTERVAL_AUTO | FE_CAN_HIERARCHY_AUTO |
+                     FE_CAN_2G_MODULATION | FE_CAN_MULTISTREAM;
+        return 0;
+
+    case FE_SET_FRONTEND:
+        adapter->frequency = ((struct dvb_frontend_parameters *)arg)->frequency;
+        tune(adapter, now_us);
+        return 0;
+
+    case FE_SET_PROPERTY:
+        return set_properties(adapter, arg, now_us);
+
+    case FE_GET_PROPERTY:
+        return get_properties(adapter, arg, now_us);
+
+    case FE_READ_STATUS:
+        *(fe_status_t *)arg = status;
+        return 0;
+
+    case FE_GET_EVENT:
+        if (status == vfd->event_status)
+        {
+            errno = EWOULDBLOCK;
+            return -1;
+        }
+
+        event = arg;
+        memset(event, 0, sizeof(*event));
+        event->status = vfd->event_status = status;
+        event->parameters.frequency = adapter->frequency;
+        return 0;
+
+    case FE_READ_SIGNAL_STRENGTH:
+        *(uint16_t *)arg = (status & FE_HAS_SIGNAL) ? 0xc000 : 0;
+        return 0;
+
+    case FE_READ_SNR:
+        // Hundredths of a dB.
+        snr = locked ? cnr_at(adapter, now_us) / 10 : 0;
+        *(uint16_t *)arg = (snr < 0) ? 0 : (snr > 0xffff) ? 0xffff : snr;
+        return 0;
+
+    case FE_READ_BER:
+    case FE_READ_UNCORRECTED_BLOCKS:
+        *(uint32_t *)arg = 0;
+        return 0;
+
+    // The SEC has nothing on the other end.
+    case FE_SET_TONE:
+    case FE_SET_VOLTAGE:
+    case FE_ENABLE_HIGH_LNB_VOLTAGE:
+    case FE_DISEQC_SEND_MASTER_CMD:
+    case FE_DISEQC_SEND_BURST:
+    case FE_DISEQC_RESET_OVERLOAD:
+        return 0;
+
+    default:
+        errno = ENOTTY;
+        return -1;
+    }
+}
+
+static int demux_ioctl(t_vfd *vfd, unsigned long request, void *arg,
+                       int64_t now_us)
+{
+    const struct dmx_pes_filter_params *pes;
+    const struct dmx_sct_filter_params *sct;
+    uint16_t pid;
+    int i;
+
+    switch (request)
+    {
+    case DMX_SET_PES_FILTER:
+        pes = arg;
+        vfd->filter_type = VFILTER_PES;
+        vfd->output = pes->output;
+        vfd->oneshot = 0;
+        vfd->pid_count = 1;
+        vfd->pids[0] = pes->pid;
+        vfd->started = (pes->flags & DMX_IMMEDIATE_START) != 0;
+        start_cursor(vfd, now_us);
+        return 0;
+
+    case DMX_SET_FILTER:
+        sct = arg;
+        vfd->filter_type = VFILTER_SECTION;
+        vfd->output = DMX_OUT_TAP;
+        vfd->oneshot = (sct->flags & DMX_ONESHOT) != 0;
+        vfd->pid_count = 1;
+        vfd->pids[0] = sct->pid;
+        vfd->filter = sct->filter;
+        vfd->started = (sct->flags & DMX_IMMEDIATE_START) != 0;
+        start_cursor(vfd, now_us);
+        return 0;
+
+    case DMX_ADD_PID:
+        pid = *(uint16_t *)arg;
+
+        if (vfd->filter_type != VFILTER_PES ||
+            vfd->output != DMX_OUT_TSDEMUX_TAP)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        if (has_pid(vfd, pid) == 0)
+        {
+            if (vfd->pid_count == VFD_MAX_PIDS)
+            {
+                errno = ENOMEM;
+                return -1;
+            }
+
+            vfd->pids[vfd->pid_count++] = pid;
+        }
+
+        return 0;
+
+    case DMX_REMOVE_PID:
+        pid = *(uint16_t *)arg;
+
+        for (i = 0; i < vfd->pid_count; i++)
+            if (vfd->pids[i] == pid)
+                vfd->pids[i--] = vfd->pids[--vfd->pid_count];
+
+        return 0;
+
+    case DMX_START:
+        if (vfd->filter_type == VFILTER_NONE)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        if (vfd->started == 0)
+        {
+            vfd->started = 1;
+            start_cursor(vfd, now_us);
+        }
+
+        return 0;
+
+    case DMX_STOP:
+        vfd->started = 0;
+        return 0;
+
+    case DMX_SET_BUFFER_SIZE:
+        if (vfd->started)
+        {
+            errno = EBUSY;
+            return -1;
+        }
+
+        vfd->buffer_size = (unsigned int)(uintptr_t)arg;
+        return 0;
+
+    default:
+        errno = ENOTTY;
+        return -1;
+    }
+}
+
+static int v_open(void *context, const char *path, int flags)
+{
+    t_adapter *adapter;
+    t_vfd *vfd;
+    unsigned int number, device;
+    char name[16];
+    int fd, kind;
+
+    if (sscanf(path, "/dev/dvb/adapter%u/%15[a-z]%u", &number, name,
+               &device) != 3)
+        return zap_system_backend.open(NULL, path, flags);
+
+    pthread_mutex_lock(&lock);
+
+    if ((adapter = find_adapter(number)) == NULL)
+    {
+        pthread_mutex_unlock(&lock);
+        return zap_system_backend.open(NULL, path, flags);
+    }
+
+    if (device != 0)
+        kind = -1;
+    else if (strcmp(name, "frontend") == 0)
+        kind = VFD_FRONTEND;
+    else if (strcmp(name, "demux") == 0)
+        kind = VFD_DEMUX;
+    else if (strcmp(name, "dvr") == 0)
+        kind = VFD_DVR;
+    else
+        kind = -1;
+
+    if (kind < 0)
+    {
+        pthread_mutex_unlock(&lock);
+        errno = ENOENT;
+        return -1;
+    }
+
+    // A real descriptor keeps the number from being handed out elsewhere.
+    if ((fd = open("/dev/null", O_RDONLY | O_CLOEXEC)) < 0)
+        goto failed;
+
+    if (fd >= VFD_TABLE)
+    {
+        close(fd);
+        errno = EMFILE;
+        goto failed;
+    }
+
+    if ((vfd = calloc(1, sizeof(t_vfd))) == NULL)
+    {
+        close(fd);
+        errno = ENOMEM;
+        goto failed;
+    }
+
+    vfd->adapter = adapter;
+    vfd->kind = kind;
+    vfd->buffer_size = (kind == VFD_DVR) ? VDVR_BUFFER : VDEMUX_BUFFER;
+    vfd->epoch = adapter->epoch;
+
+    // Nothing is started on the dvr, so it follows the stream from the
+    // start.
+    if (kind == VFD_DVR)
+        start_cursor(vfd, monotonic_us());
+
+    vfds[fd] = vfd;
+
+    pthread_mutex_unlock(&lock);
+    return fd;
+
+failed:
+    pthread_mutex_unlock(&lock);
+    return -1;
+}
+
+static int v_close(void *context, int fd)
+{
+    t_vfd *vfd;
+
+    pthread_mutex_lock(&lock);
+
+    if ((vfd = lookup(fd)) != NULL)
+    {
+        vfds[fd] = NULL;
+        free(vfd);
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    return close(fd);
+}
+
+static int v_ioctl(void *context, int fd, unsigned long request, void *arg)
+{
+    t_vfd *vfd;
+    int64_t now_us = monotonic_us();
+    int retval;
+
+    pthread_mutex_lock(&lock);
+
+    if ((vfd = lookup(fd)) == NULL)
+    {
+        pthread_mutex_unlock(&lock);
+        return zap_system_backend.ioctl(NULL, fd, request, arg);
+    }
+
+    if (vfd->kind == VFD_FRONTEND)
+        retval = frontend_ioctl(vfd, request, arg, now_us);
+    else if (vfd->kind == VFD_DEMUX)
+        retval = demux_ioctl(vfd, request, arg, now_us);
+    else if (request == DMX_SET_BUFFER_SIZE)
+    {
+        vfd->buffer_size = (unsigned int)(uintptr_t)arg;
+        retval = 0;
+    }
+    else
+    {
+        errno = ENOTTY;
+        retval = -1;
+    }
+
+    pthread_mutex_unlock(&lock);
+    return retval;
+}
+
+static ssize_t v_read(void *context, int fd, void *buf, size_t count)
+{
+    t_vfd *vfd;
+    int64_t now_us = monotonic_us();
+    ssize_t retval;
+
+    pthread_mutex_lock(&lock);
+
+    if ((vfd = lookup(fd)) == NULL)
+    {
+        pthread_mutex_unlock(&lock);
+        return zap_system_backend.read(NULL, fd, buf, count);
+    }
+
+    if (carries_ts(vfd))
+        retval = read_ts(vfd, buf, count, now_us);
+    else if (vfd->kind == VFD_DEMUX && vfd->started &&
+             vfd->filter_type == VFILTER_SECTION)
+        retval = read_section(vfd, buf, count, now_us);
+    else
+    {
+        errno = (vfd->kind == VFD_FRONTEND) ? EINVAL : EAGAIN;
+        retval = -1;
+    }
+
+    pthread_mutex_unlock(&lock);
+    return retval;
+}
+
+// Simulated descriptors are checked every VPOLL_INTERVAL_MS, while the real
+// ones are polled in between.
+static int v_poll(void *context, struct pollfd *fds, nfds_t nfds,
+                  int timeout)
+{
+    struct pollfd real[VPOLL_MAX];
+    t_vfd *vfd;
+    int64_t now_us = monotonic_us(), deadline_us = -1, left_ms;
+    int ready, n, wait_ms;
+    nfds_t i;
+
+    if (nfds > VPOLL_MAX)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (timeout >= 0)
+        deadline_us = now_us + timeout * 1000LL;
+
+    while (1)
+    {
+        ready = 0;
+
+        pthread_mutex_lock(&lock);
+
+        for (i = 0; i < nfds; i++)
+        {
+            real[i] = fds[i];
+            fds[i].revents = 0;
+
+            if ((vfd = lookup(fds[i].fd)) == NULL)
+                continue;
+
+            real[i].fd = -1;
+
+            if ((fds[i].revents = readiness(vfd, fds[i].events, now_us)) != 0)
+                ready++;
+        }
+
+        pthread_mutex_unlock(&lock);
+
+        wait_ms = (ready > 0) ? 0 : VPOLL_INTERVAL_MS;
+
+        if (deadline_us >= 0)
+        {
+            left_ms = (deadline_us - now_us + 999) / 1000;
+
+            if (left_ms < wait_ms)
+                wait_ms = (left_ms < 0) ? 0 : left_ms;
+        }
+
+        if ((n = poll(real, nfds, wait_ms)) < 0)
+            return -1;
+
+        for (i = 0; i < nfds; i++)
+            if (real[i].fd >= 0)
+                fds[i].revents = real[i].revents;
+
+        now_us = monotonic_us();
+
+        if (ready + n > 0 || (deadline_us >= 0 && now_us >= deadline_us))
+            return ready + n;
+    }
+}
+
+static const t_zap_backend vadapter_backend = {
+    NULL, v_open, v_close, v_ioctl, v_read, v_poll, 0
+};
+
+// The rate of the stream in packets per microsecond, from the first and
+// last PCRs on the first PID carrying them.
+static double stream_rate(const uint8_t *ts, int64_t packets)
+{
+    const uint8_t *p;
+    int64_t i, first_index = -1, last_index = -1;
+    uint64_t pcr, first_pcr = 0, last_pcr = 0;
+    int pcr_pid = -1;
+
+    for (i = 0; i < packets; i++)
+    {
+        p = ts + i * TS_PACKET;
+
+        // An adaptation field with a PCR.
+        if ((p[3] & 0x20) == 0 || p[4] < 7 || (p[5] & 0x10) == 0)
+            continue;
+
+        if (pcr_pid < 0)
+            pcr_pid = packet_pid(p);
+        else if (packet_pid(p) != pcr_pid)
+            continue;
+
+        pcr = (((uint64_t)p[6] << 25) | (p[7] << 17) | (p[8] << 9) |
+               (p[9] << 1) | (p[10] >> 7)) * 300 +
+              (((p[10] & 1) << 8) | p[11]);
+
+        // Stop at a discontinuity or wrap.
+        if (first_index >= 0 && pcr <= last_pcr)
+            break;
+
+        if (first_index < 0)
+        {
+            first_index = i;
+            first_pcr = pcr;
+        }
+
+        last_index = i;
+        last_pcr = pcr;
+    }
+
+    if (first_index < 0 || last_index == first_index)
+        return VADAPTER_DEFAULT_BITRATE / (TS_PACKET * 8.0) / 1000000.0;
+
+    return (last_index - first_index) * 27.0 / (last_pcr - first_pcr);
+}
+
+int vadapter_add(unsigned int number, const t_vadapter_config *config)
+{
+    t_adapter *adapter = NULL;
+    struct stat st;
+    const uint8_t *ts;
+    void *map;
+    size_t offset = 0;
+    int fd, i;
+
+    if ((fd = open(config->ts_path, O_RDONLY | O_CLOEXEC)) < 0)
+        return -1;
+
+    if (fstat(fd, &st) == -1 || st.st_size < TS_PACKET * 2 ||
+        (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))
+            == MAP_FAILED)
+    {
+        close(fd);
+        return -1;
+    }
+
+    close(fd);
+    ts = map;
+
+    // Start at the first packet boundary.
+    while (offset + TS_PACKET < st.st_size &&
+           (ts[offset] != TS_SYNC || ts[offset + TS_PACKET] != TS_SYNC))
+        offset++;
+
+    if (offset + TS_PACKET >= st.st_size)
+    {
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    pthread_mutex_lock(&lock);
+
+    for (i = 0; i < VADAPTER_MAX && adapter == NULL; i++)
+        if (adapters[i].used == 0)
+            adapter = &adapters[i];
+
+    if (adapter == NULL || find_adapter(number) != NULL)
+    {
+        pthread_mutex_unlock(&lock);
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    memset(adapter, 0, sizeof(*adapter));
+    adapter->used = 1;
+    adapter->number = number;
+    adapter->config = *config;
+    adapter->config.ts_path = NULL;
+    adapter->map = map;
+    adapter->ts = ts + offset;
+    adapter->map_size = st.st_size;
+    adapter->packets = (st.st_size - offset) / TS_PACKET;
+    adapter->packets_per_us = stream_rate(adapter->ts, adapter->packets);
+    adapter->tune_us = -1;
+
+    if (adapter_count++ == 0)
+        zap_set_backend(&vadapter_backend);
+
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+void vadapter_remove(unsigned int number)
+{
+    t_adapter *adapter;
+
+    pthread_mutex_lock(&lock);
+
+    if ((adapter = find_adapter(number)) != NULL)
+    {
+        munmap(adapter->map, adapter->map_size);
+        adapter->used = 0;
+
+        if (--adapter_count == 0)
+            zap_set_backend(NULL);
+    }
+
+    pthread_mutex_unlock(&lock);
+}
+
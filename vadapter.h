@@ -0,0 +1,55 @@
+#ifndef __VADAPTER__H
+#define __VADAPTER__H
+
+#include <stdint.h>
+
+#include <linux/dvb/frontend.h>
+
+// Simulated adapters in the process.
+#define VADAPTER_MAX 64
+
+// The rate at which a stream without PCRs is played in realtime.
+#define VADAPTER_DEFAULT_BITRATE 19392658
+
+// A simulated adapter, for testing and benchmarking without hardware: a 
+// frontend that locks on any tune, and a demux playing a recorded transport
+// stream. It has a single frontend, demux and dvr device, each numbered 0.
+typedef struct
+{
+    // The transport stream played (looped) once the frontend has locked.
+    const char *ts_path;
+
+    // Play it at the rate given by its PCRs, or else as fast as it's read.
+    int realtime;
+
+    // What FE_GET_INFO reports.
+    fe_type_t fe_type;
+
+    // Milliseconds from a tune to lock.
+    unsigned int lock_delay_ms;
+
+    // Signal strength (0.001 dBm), and the CNR (0.001 dB) on lock, which 
+    // moves to cnr_end over cnr_ramp_ms.
+    int64_t signal;
+    int64_t cnr_start;
+    int64_t cnr_end;
+    unsigned int cnr_ramp_ms;
+
+    // The signal is lost for the last loss_duration_ms of every 
+    // loss_period_ms after lock (never if either is 0), and nothing is 
+    // played meanwhile.
+    unsigned int loss_period_ms;
+    unsigned int loss_duration_ms;
+} t_vadapter_config;
+
+// Simulate /dev/dvb/adapter<adapter>, switching the process to the virtual
+// backend (see backend.h) if it isn't already. Other adapters still go to 
+// the system. Returns -1 if the stream can't be read, or there's no room.
+int vadapter_add(unsigned int adapter, const t_vadapter_config *config);
+
+// Remove a simulated adapter, once its devices are closed. The system 
+// backend is restored with the last one.
+void vadapter_remove(unsigned int adapter);
+
+#endif
+
@@ -0,0 +1,522 @@
+#ifndef __ZAPCORO__H
+#define __ZAPCORO__H
+
+// C++20 coroutines over a reactor (see reactor.h): tunes, their PSI and the
+// stream are awaited rather than waited for, so any number of them share
+// the thread running the reactor. Give each executor thread its own
+// zap::reactor; coroutines resume on the thread that runs it.
+//
+//     zap::task watch(zap::tuner &tuner, t_atsc_tune_info info)
+//     {
+//         if (co_await tuner.tune(info, ZAP_OUT_TSDEMUX, 1, 2000) == false)
+//             co_return;
+//
+//         if (co_await tuner.psi() != PSI_COMPLETE)
+//             co_return;
+//
+//         t_dvr_reader reader;
+//         zap_session_open_dvr(tuner.session(), &reader, 0, 0);
+//
+//         while (true)
+//         {
+//             zap::batch batch = co_await tuner.packets(reader);
+//             if (batch.count == 0)
+//                 break;
+//             ...
+//         }
+//
+//         dvr_reader_close(&reader);
+//     }
+
+#include <coroutine>
+#include <exception>
+#include <algorithm>
+#include <vector>
+#include <cstdint>
+#include <time.h>
+
+#include <linux/dvb/frontend.h>
+
+extern "C" {
+#include "zaptypes.h"
+#include "session.h"
+#include "sections.h"
+#include "dvr.h"
+#include "reactor.h"
+#include "azaplib.h"
+#include "czaplib.h"
+#include "szaplib.h"
+#include "tzaplib.h"
+}
+
+namespace zap
+{
+
+// A coroutine that starts straight away and is not awaited: it runs until
+// its first co_await, and then on the reactor's thread.
+struct task
+{
+    struct promise_type
+    {
+        task get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+class tuner;
+
+// Coroutines aren't resumed from the reactor's callbacks, which are called
+// in the middle of a tune's monitoring or a stream's batch, but once
+// zap_reactor_dispatch() has returned: run() and dispatch() resume those
+// that became ready meanwhile.
+class reactor
+{
+public:
+    reactor() { zap_reactor_init(&reactor_); }
+    ~reactor() { zap_reactor_destroy(&reactor_); }
+
+    reactor(const reactor &) = delete;
+    reactor &operator=(const reactor &) = delete;
+
+    t_zap_reactor *get() noexcept { return &reactor_; }
+
+    // As zap_reactor_run().
+    int run() noexcept
+    {
+        reactor_.stopped = 0;
+
+        while (reactor_.stopped == 0)
+            if (dispatch(-1) < 0)
+                return -1;
+
+        return 0;
+    }
+
+    int dispatch(int timeout_ms) noexcept
+    {
+        int retval = zap_reactor_dispatch(&reactor_, timeout_ms);
+
+        resume_ready();
+        return retval;
+    }
+
+    void stop() noexcept { zap_reactor_stop(&reactor_); }
+
+private:
+    friend class tuner;
+
+    inline void resume_ready() noexcept;
+
+    t_zap_reactor reactor_;
+
+    // The tuners with coroutines to resume, in the order they became ready.
+    std::vector<tuner *> ready_;
+};
+
+// Packets from the stream: whole TS packets (copied from the reader, since
+// the coroutine runs once the reader has moved on), valid until the next
+// co_await. A count of 0 means the stream has ended.
+struct batch
+{
+    const unsigned char *packets;
+    unsigned int count;
+};
+
+// A session in a reactor, whose tunes are awaited. Status samples go to the
+// awaiting coroutine rather than to options.status_receiver_ex, and the 
+// session is persistent, so that its devices stay open for the stream once 
+// the tune is over (until the next tune, or the tuner is destroyed). Only 
+// one operation of each kind may be awaited at a time, and the tuner must 
+// outlive them. A tuner whose session couldn't be set up, or that didn't 
+// fit in the reactor (see valid()), fails whatever is awaited straight 
+// away.
+class tuner
+{
+public:
+    tuner(reactor &owner, t_tuner_descriptor descriptor,
+          const t_tune_options *options = nullptr) : reactor_(owner)
+    {
+        if (zap_session_init(&session_, descriptor, options) < 0)
+            return;
+
+        initialized_ = true;
+
+        session_.options.status_receiver_ex = &tuner::on_status;
+        session_.options.status_context = this;
+        session_.options.persistent = 1;
+
+        added_ = (zap_reactor_add(reactor_.get(), &session_, &tuner::on_event,
+                                  this) == 0);
+    }
+
+    ~tuner()
+    {
+        std::vector<tuner *> &ready = reactor_.ready_;
+
+        ready.erase(std::remove(ready.begin(), ready.end(), this),
+                    ready.end());
+
+        if (destroyed_ != nullptr)
+            *destroyed_ = true;
+
+        if (added_)
+            zap_reactor_remove(reactor_.get(), &session_);
+
+        if (initialized_)
+            zap_session_destroy(&session_);
+    }
+
+    tuner(const tuner &) = delete;
+    tuner &operator=(const tuner &) = delete;
+
+    bool valid() const noexcept { return added_; }
+
+    t_zap_session *session() noexcept { return &session_; }
+
+    void cancel() noexcept { zap_session_cancel(&session_); }
+
+    // Tune, and resume once the frontend has locked (true), or when it
+    // hasn't within timeout_ms, the tune fails or the session is cancelled
+    // (false). The PSI is then read in the background (see psi()).
+    class tune_awaitable
+    {
+    public:
+        // The first sample is taken as the tune starts, so the lock may
+        // already have been seen.
+        template <typename Start>
+        tune_awaitable(tuner &owner, unsigned int timeout_ms, Start start)
+            : owner_(owner)
+        {
+            owner_.tune_done_ = false;
+            owner_.lock_waiter_ = nullptr;
+            owner_.locked_ = false;
+            owner_.lock_deadline_us_ = now_us() + (int64_t)timeout_ms * 1000;
+
+            failed_ = (owner_.valid() == false || start() < 0);
+
+            // No REACTOR_TUNE_DONE follows a tune that didn't start.
+            if (failed_)
+                owner_.tune_done_ = true;
+        }
+
+        bool await_ready() const noexcept
+        {
+            return failed_ || owner_.locked_ || owner_.tune_done_;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle) noexcept
+        {
+            owner_.lock_waiter_ = handle;
+        }
+
+        bool await_resume() const noexcept
+        {
+            return failed_ == false && owner_.locked_;
+        }
+
+    private:
+        tuner &owner_;
+        bool failed_;
+    };
+
+    tune_awaitable tune(t_atsc_tune_info info, int dvr, int rec_psi,
+                        unsigned int timeout_ms)
+    {
+        return tune_awaitable(*this, timeout_ms, [&] {
+            return azap_tune_start(&session_, info, dvr, rec_psi,
+                                   &tuner::no_status);
+        });
+    }
+
+    tune_awaitable tune(t_dvbc_tune_info info, int dvr, int rec_psi,
+                        unsigned int timeout_ms)
+    {
+        return tune_awaitable(*this, timeout_ms, [&] {
+            return czap_tune_start(&session_, info, dvr, rec_psi,
+                                   &tuner::no_status);
+        });
+    }
+
+    tune_awaitable tune(t_dvbt_tune_info info, int dvr, int rec_psi,
+                        unsigned int timeout_ms)
+    {
+        return tune_awaitable(*this, timeout_ms, [&] {
+            return tzap_tune_start(&session_, info, dvr, rec_psi,
+                                   &tuner::no_status);
+        });
+    }
+
+    tune_awaitable tune(t_dvbs_tune_info info, int dvr, int rec_psi,
+                        int audio_bypass, char *lnb_raw,
+                        unsigned int timeout_ms)
+    {
+        return tune_awaitable(*this, timeout_ms, [&] {
+            return szap_tune_start(&session_, info, dvr, rec_psi,
+                                   &tuner::no_status, audio_bypass, lnb_raw);
+        });
+    }
+
+    tune_awaitable tune(t_dvbs2_tune_info info, int dvr, int rec_psi,
+                        int audio_bypass, char *lnb_raw,
+                        unsigned int timeout_ms)
+    {
+        return tune_awaitable(*this, timeout_ms, [&] {
+            return szap_tune_s2_start(&session_, info, dvr, rec_psi,
+                                      &tuner::no_status, audio_bypass,
+                                      lnb_raw);
+        });
+    }
+
+    // The PAT and the PMT of the service being tuned: resumes once they've
+    // been read (or given up on) with stats.psi_status (PSI_COMPLETE,
+    // PSI_TIMED_OUT...). The streams found are in session()->pmt.
+    class psi_awaitable
+    {
+    public:
+        explicit psi_awaitable(tuner &owner) : owner_(owner) {}
+
+        bool await_ready() const noexcept { return owner_.tune_done_; }
+
+        void await_suspend(std::coroutine_handle<> handle) noexcept
+        {
+            owner_.psi_waiter_ = handle;
+        }
+
+        int await_resume() const noexcept
+        {
+            return owner_.session_.stats.psi_status;
+        }
+
+    private:
+        tuner &owner_;
+    };
+
+    psi_awaitable psi() { return psi_awaitable(*this); }
+
+    // The next packets from the reader (see zap_session_open_dvr()). The
+    // reactor reads it while it's awaited, so the coroutine may close it 
+    // once it has its batch.
+    class packets_awaitable
+    {
+    public:
+        packets_awaitable(tuner &owner, t_dvr_reader &reader)
+            : owner_(owner), reader_(reader) {}
+
+        bool await_ready() const noexcept { return owner_.valid() == false; }
+
+        // Resumes straight away, with the stream ended, if it can't be 
+        // read.
+        bool await_suspend(std::coroutine_handle<> handle) noexcept
+        {
+            owner_.stream_waiter_ = handle;
+
+            if (owner_.reader_ == &reader_)
+                return true;
+
+            owner_.reader_ = &reader_;
+
+            if (zap_reactor_read(owner_.reactor_.get(), &owner_.session_,
+                                 &reader_, &tuner::on_packets, &owner_) == 0)
+                return true;
+
+            owner_.reader_ = nullptr;
+            owner_.stream_waiter_ = nullptr;
+            owner_.stream_ended_ = true;
+
+            return false;
+        }
+
+        batch await_resume() noexcept
+        {
+            owner_.stream_pending_ = false;
+
+            if (owner_.reader_ != nullptr)
+            {
+                owner_.reader_ = nullptr;
+                zap_reactor_read(owner_.reactor_.get(), &owner_.session_,
+                                 nullptr, nullptr, nullptr);
+            }
+
+            if (owner_.stream_ended_ || owner_.valid() == false)
+            {
+                owner_.stream_ended_ = false;
+                return batch{nullptr, 0};
+            }
+
+            return batch{owner_.packets_.data(),
+                         (unsigned int)(owner_.packets_.size() /
+                                        TS_PACKET_SIZE)};
+        }
+
+    private:
+        tuner &owner_;
+        t_dvr_reader &reader_;
+    };
+
+    packets_awaitable packets(t_dvr_reader &reader)
+    {
+        return packets_awaitable(*this, reader);
+    }
+
+private:
+    friend class reactor;
+
+    // As monotonic_us().
+    static int64_t now_us() noexcept
+    {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    }
+
+    static int no_status(fe_status_t, uint16_t, uint16_t, uint32_t, uint32_t,
+                         int)
+    {
+        return 0;
+    }
+
+    // Have the waiter resumed by the reactor (see reactor::resume_ready()).
+    void post(std::coroutine_handle<> &waiter)
+    {
+        if (!waiter)
+            return;
+
+        ready_.push_back(waiter);
+        waiter = nullptr;
+
+        if (queued_ == false)
+        {
+            queued_ = true;
+            reactor_.ready_.push_back(this);
+        }
+    }
+
+    // Resume the waiters posted, any of which may destroy the tuner.
+    void resume_ready()
+    {
+        std::coroutine_handle<> handle;
+        bool destroyed = false;
+
+        queued_ = false;
+        destroyed_ = &destroyed;
+
+        while (ready_.empty() == false)
+        {
+            handle = ready_.front();
+            ready_.erase(ready_.begin());
+
+            handle.resume();
+            if (destroyed)
+                return;
+        }
+
+        destroyed_ = nullptr;
+    }
+
+    // Sampling continues until the lock (or its deadline) has been seen.
+    static int on_status(const t_frontend_stats *stats, void *context)
+    {
+        tuner *self = static_cast<tuner *>(context);
+
+        if (stats->is_locked)
+            self->locked_ = true;
+        else if (now_us() < self->lock_deadline_us_)
+            return 1;
+
+        self->post(self->lock_waiter_);
+        return 0;
+    }
+
+    static void on_event(t_zap_session *, int event, void *context)
+    {
+        tuner *self = static_cast<tuner *>(context);
+
+        // Reading also stops when nothing awaits the next batch, and starts
+        // again with the next await.
+        if (event == REACTOR_STREAM_END)
+        {
+            self->reader_ = nullptr;
+
+            if (self->stream_waiter_)
+            {
+                self->stream_ended_ = true;
+                self->post(self->stream_waiter_);
+            }
+
+            return;
+        }
+
+        // Cancelled (or failed) before the lock was seen.
+        self->tune_done_ = true;
+        self->post(self->lock_waiter_);
+        self->post(self->psi_waiter_);
+    }
+
+    // The batch is copied for the coroutine, and what arrives before it has
+    // taken it is added on.
+    static int on_packets(const unsigned char *packets, unsigned int count,
+                          void *context)
+    {
+        tuner *self = static_cast<tuner *>(context);
+
+        if (self->stream_waiter_)
+        {
+            self->packets_.assign(packets, packets + count * TS_PACKET_SIZE);
+            self->stream_pending_ = true;
+            self->post(self->stream_waiter_);
+        }
+        else if (self->stream_pending_)
+            self->packets_.insert(self->packets_.end(), packets,
+                                  packets + count * TS_PACKET_SIZE);
+        else
+            return 0;
+
+        return 1;
+    }
+
+    reactor &reactor_;
+    t_zap_session session_;
+
+    // Whether the session was set up, and added to the reactor.
+    bool initialized_ = false;
+    bool added_ = false;
+
+    std::coroutine_handle<> lock_waiter_;
+    int64_t lock_deadline_us_ = 0;
+    bool locked_ = false;
+
+    std::coroutine_handle<> psi_waiter_;
+    bool tune_done_ = true;
+
+    std::coroutine_handle<> stream_waiter_;
+    t_dvr_reader *reader_ = nullptr;
+    std::vector<unsigned char> packets_;
+    bool stream_pending_ = false;
+    bool stream_ended_ = false;
+
+    // The waiters posted, whether the tuner is in reactor::ready_, and set
+    // by the destructor while they're being resumed.
+    std::vector<std::coroutine_handle<>> ready_;
+    bool queued_ = false;
+    bool *destroyed_ = nullptr;
+};
+
+void reactor::resume_ready() noexcept
+{
+    tuner *ready;
+
+    while (ready_.empty() == false)
+    {
+        ready = ready_.front();
+        ready_.erase(ready_.begin());
+        ready->resume_ready();
+    }
+}
+
+} // namespace zap
+
+#endif
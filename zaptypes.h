@@ -1,8 +1,100 @@
 #ifndef __ZAPTYPES__H
 #define __ZAPTYPES__H
 
+// Values for the dvr argument of the tune calls (where filtered packets go).
+// Any other nonzero value is taken as ZAP_OUT_DVR.
+
+// The hardware decoder.
+#define ZAP_OUT_DECODER 0
+
+// The dvr device, with one kernel filter (and demux descriptor) per PID.
+#define ZAP_OUT_DVR 1
+
+// The session's demux descriptor, with a single kernel filter carrying all of
+// the PIDs (see zap_session_stream_fd()).
+#define ZAP_OUT_TSDEMUX 2
+
 typedef int (*StatusReceiver)(fe_status_t status, uint16_t signal, uint16_t snr, uint32_t ber, uint32_t uncorrected_blocks, int is_locked);
 
+// A frontend status sample, as passed to a StatusReceiverEx. Each measure 
+// comes with its scale (FE_SCALE_*, see linux/dvb/frontend.h), which is 
+// FE_SCALE_NOT_AVAILABLE when the driver can't provide it (yet).
+typedef struct
+{
+    fe_status_t status;
+    int is_locked;
+
+    // Signal strength: in 0.001 dBm with FE_SCALE_DECIBEL, or 0 to 65535 with
+    // FE_SCALE_RELATIVE.
+    int signal_scale;
+    int64_t signal;
+
+    // Carrier to noise ratio: in 0.001 dB, or 0 to 65535.
+    int cnr_scale;
+    int64_t cnr;
+
+    // Counters since the frontend was tuned, or -1 if not available: bit 
+    // errors before and after the inner code and the bits counted, and 
+    // uncorrectable blocks and the blocks counted.
+    int64_t pre_error_bits;
+    int64_t pre_total_bits;
+    int64_t post_error_bits;
+    int64_t post_total_bits;
+    int64_t error_blocks;
+    int64_t total_blocks;
+
+    // The driver has no DVBv5 statistics, so the sample came from the legacy
+    // FE_READ_* ioctls: signal and CNR are FE_SCALE_RELATIVE but in the 
+    // driver's own units, and only error_blocks is counted.
+    int legacy;
+} t_frontend_stats;
+
+// Receives status samples in comparable units. context is 
+// t_tune_options.status_context. Return 0 to end the tune.
+typedef int (*StatusReceiverEx)(const t_frontend_stats *stats, void *context);
+
+// A status sample as kept in a t_status_ring: when it was taken 
+// (monotonic_us()), on which tuner, and what it was. Samples for the 
+// StatusReceiver are converted (legacy is set, and ber is in post_error_bits).
+typedef struct
+{
+    int64_t time_us;
+    uint16_t adapter;
+    uint16_t frontend;
+    t_frontend_stats stats;
+} t_status_record;
+
+// A preallocated ring of status records, written by the thread monitoring a
+// tune and drained in bulk by any one other thread (see status.h). Records 
+// written while it's full are dropped (and counted).
+typedef struct
+{
+    t_status_record *records;
+    unsigned int size;
+
+    uint64_t head;
+    uint64_t tail;
+    uint64_t dropped;
+} t_status_ring;
+
+struct t_status_segment;
+
+// A status board (see status.h) as mapped by this process: a shared memory 
+// segment with a slot per adapter and frontend, holding the last sample taken
+// on it.
+typedef struct
+{
+    struct t_status_segment *segment;
+    unsigned int size;
+    int writable;
+} t_status_board;
+
+// When the receiver is called (t_tune_options.status_mode): for every 
+// sample, or only for the first, when the lock changes, and when the SNR or
+// BER have moved by a threshold since the last call.
+#define STATUS_EVERY_SAMPLE 0
+#define STATUS_ON_CHANGE 1
+
 typedef struct
 {
     unsigned int adapter;
@@ -10,5 +102,151 @@ typedef struct
     unsigned int demux;
 } t_tuner_descriptor;
 
+// Optional tuning behavior. A zeroed struct (or a NULL pointer) gives the
+// defaults.
+typedef struct
+{
+    // Microseconds between status samples passed to the StatusReceiver. Zero
+    // selects the default of one second.
+    unsigned int status_interval_us;
+
+    // Only report status on the sampling interval instead of also waking on
+    // frontend events (the lock will then be reported up to one interval
+    // late).
+    int sample_only;
+
+    // The largest the demux buffer may grow to after repeated overflows. 
+    // Zero selects DEMUX_BUFFER_MAX (32 MiB).
+    unsigned int max_buffer_size;
+
+    // Milliseconds allowed for each PSI table read during a tune (the PAT 
+    // and PMT), after which the tune fails. Zero selects the default of 
+    // PSI_DEFAULT_TIMEOUT_MS (5 seconds).
+    unsigned int psi_timeout_ms;
+
+    // Arm the PSI filters along with the PES filters as soon as the frontend
+    // has been tuned, and finish finding the service's PMT (and streams) 
+    // while the tune is monitored, instead of reading the PAT and PMT one 
+    // after the other before the tune call returns.
+    int pipelined;
+
+    // Report status to this receiver, with statistics read in one 
+    // FE_GET_PROPERTY per sample, instead of the StatusReceiver given to 
+    // the tune call (which may then be NULL).
+    StatusReceiverEx status_receiver_ex;
+    void *status_context;
+
+    // STATUS_EVERY_SAMPLE (the default) or STATUS_ON_CHANGE. The thresholds
+    // for the latter are in the units of the sample: 0.001 dB of CNR and 
+    // post-FEC bit errors counted for status_receiver_ex (with DVBv5 
+    // statistics), or the driver's SNR and BER for the StatusReceiver. Zero 
+    // ignores that measure.
+    int status_mode;
+    unsigned int status_snr_delta;
+    unsigned int status_ber_delta;
+
+    // A ring that every sample is also written to, whether or not the 
+    // receiver is called for it. Several sessions may share one if they're 
+    // monitored by the same thread (a reactor).
+    t_status_ring *status_ring;
+
+    // A board that every sample is published to, for other processes to 
+    // read.
+    t_status_board *status_board;
+
+    // Keep the frontend and demux descriptors open when a tune call on the 
+    // session returns, so that the next tune (a retune) reuses them, only 
+    // sends the frontend what changed and doesn't power the tuner down in 
+    // between. They're closed by zap_session_close_devices().
+    int persistent;
+
+    // Milliseconds for the LNB and switches to settle after each step of 
+    // the DVB-S equipment control: a voltage change, a DiSEqC command (on 
+    // top of the wait the command asks for) and a tone burst. Zero selects 
+    // SEC_SETTLE_MS.
+    unsigned int sec_voltage_settle_ms;
+    unsigned int sec_command_settle_ms;
+    unsigned int sec_burst_settle_ms;
+} t_tune_options;
+
+#define SEC_SETTLE_MS 15
+
+// Stages of a tune (indexes of t_tune_stats.stage_us): the frontend has been
+// given the parameters, the demux filters are armed, the frontend has 
+// locked, the PAT and PMT have been found, and every PID asked for is being
+// passed. Then the steps along the way: the frontend has been opened and 
+// asked for its FE_GET_INFO, the LNB and switches have been set up (DVB-S),
+// the frontend has reported a signal, and a PID filter has been set.
+#define TUNE_STAGE_FRONTEND 0
+#define TUNE_STAGE_FILTERS 1
+#define TUNE_STAGE_LOCK 2
+#define TUNE_STAGE_PAT 3
+#define TUNE_STAGE_PMT 4
+#define TUNE_STAGE_READY 5
+#define TUNE_STAGE_OPEN 6
+#define TUNE_STAGE_INFO 7
+#define TUNE_STAGE_SEC 8
+#define TUNE_STAGE_SIGNAL 9
+#define TUNE_STAGE_FILTER 10
+#define TUNE_STAGES 11
+
+// Events kept in a t_tune_trace (later ones are dropped).
+#define TUNE_TRACE_MAX 64
+
+// A stage of a tune, as recorded in its trace. Steps (opening the frontend,
+// FE_GET_INFO, DiSEqC, setting the parameters, setting a PID filter) run 
+// from start_us to end_us. The rest happen at end_us (start_us is the same).
+typedef struct
+{
+    int stage;
+
+    // The PID, for TUNE_STAGE_FILTER (-1 otherwise).
+    int pid;
+
+    // monotonic_us() times.
+    int64_t start_us;
+    int64_t end_us;
+} t_tune_event;
+
+// Every stage reached by a tune, in order (see zap_session_get_trace()).
+typedef struct
+{
+    int64_t start_us;
+
+    int count;
+    int dropped;
+    t_tune_event events[TUNE_TRACE_MAX];
+} t_tune_trace;
+
+// Measurements taken during a tune.
+typedef struct
+{
+    // Microseconds from the tune call to the first is_locked callback, or -1
+    // if the frontend never locked.
+    int64_t lock_latency_us;
+
+    // The PMT PID came from the PSI cache, rather than from reading the PAT.
+    int psi_cached;
+
+    // The cached PMT PID was found to be out of date (and was replaced).
+    int psi_stale;
+
+    // Microseconds spent waiting for PSI tables.
+    int64_t psi_acquire_us;
+
+    // Microseconds from the tune call to each TUNE_STAGE_* (the end of the 
+    // first, for steps taken more than once), or -1 if the stage wasn't 
+    // reached (or wasn't needed).
+    int64_t stage_us[TUNE_STAGES];
+
+    // How finding the PSI asked for went: a PSI_* status (see sections.h), 
+    // PSI_PENDING while a pipelined tune is still waiting for it.
+    int psi_status;
+
+    // Microseconds spent switching the LNB and DiSEqC switches (DVB-S), 
+    // zero when they were already set up for the satellite and band.
+    int64_t sec_us;
+} t_tune_stats;
+
 #endif
 